@@ -0,0 +1,481 @@
+/********************************************************************************
+*	ABC_SMC.c																	*
+*	Approximate Bayesian computation by sequential Monte Carlo (population		*
+*		Monte Carlo, as in Beaumont et al. 2009). The first generation is		*
+*		drawn from the prior; each later one picks particles of the last by		*
+*		weight, perturbs them and keeps those whose simulation comes within		*
+*		the new tolerance of the reports.										*
+*	The distance is the sum over the reports of |simulated - reported| cases.	*
+*		It never falls as a simulation goes on, so a simulation is stopped as	*
+*		soon as it passes the tolerance - the decision is the same as if it		*
+*		had run to the end.														*
+*	Particles are tasks on the thread pool, claimed one at a time, so threads	*
+*		whose simulations end early pick up more. Each particle has its own		*
+*		random number stream, so the results don't depend on the threads.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation and qsort
+#include <string.h>						//For strcmp and memset
+#include <math.h>						//For log, exp and sqrt
+#include <time.h>						//For timing each generation
+#include "MTrandom.h"					//For random number generation (a stream for each particle)
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the prior
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the starting parameters
+#include "Thread_Pool.h"				//For simulating particles on every core
+#include "Outbreak_Simulator.h"			//For simulating outbreaks forward
+#include "ABC_SMC.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For progress
+
+/*-------------------------------
+| settings and set up			|
+-------------------------------*/
+
+void default_abc_settings(struct abc_settings *settings)
+{
+	settings->num_particles = DEFAULT_ABC_PARTICLES;
+	settings->num_generations = DEFAULT_ABC_GENERATIONS;
+	settings->num_threads = number_of_cores();
+	settings->seed = 5489UL;
+	settings->output_file[0] = 0;
+}
+
+struct report_bin
+{
+	int date;
+	int location;
+	int observed;
+};
+
+static int compare_bins(const void *a, const void *b)
+{
+	const struct report_bin *x = (const struct report_bin*)a, *y = (const struct report_bin*)b;
+
+	if (x->date != y->date) return x->date < y->date ? -1 : 1;
+	return x->location - y->location;
+}
+
+//Sorts the reports into bins by subregion and date. Reports of the same subregion and date are added up.
+static void build_abc_data(struct abc_data *data, struct current_case_report *reports, int num_reports)
+{
+	struct report_bin *bins;
+	int *previous_date;
+	int r, l, b, day, n;
+
+	memset(data, 0, sizeof(struct abc_data));
+	data->location_name = (char(*)[100])mem_malloc(MEM_SIMULATION, (num_reports > 0 ? num_reports : 1) * sizeof(*data->location_name));
+	data->location_weights = (double*)mem_calloc(MEM_SIMULATION, num_reports > 0 ? num_reports : 1, sizeof(double));
+	bins = (struct report_bin*)mem_malloc(MEM_SIMULATION, (num_reports > 0 ? num_reports : 1) * sizeof(struct report_bin));
+	if (!data->location_name || !data->location_weights || !bins) { printf("Could not allocate reports in build_abc_data.\n"); exit(1); }
+
+	for (r = 0; r < num_reports; r++) {
+		for (l = 0; l < data->num_locations; l++)
+			if (strcmp(data->location_name[l], reports[r].subregion) == 0) break;
+		if (l == data->num_locations) strcpy(data->location_name[data->num_locations++], reports[r].subregion);
+		bins[r].date = reports[r].date_ID;
+		bins[r].location = l;
+		bins[r].observed = reports[r].cases > 0 ? reports[r].cases : 0;
+		data->location_weights[l] += bins[r].observed;
+		data->total_reported += bins[r].observed;
+		if (reports[r].date_ID < 0 || reports[r].date_ID >= NUMDAYS) {
+			printf("Report %d is dated outside the %d days of the model.\n", r + 1, NUMDAYS);
+			exit(1);
+		}
+		if (reports[r].date_ID + 1 > data->num_days) data->num_days = reports[r].date_ID + 1;
+	}
+	if (data->num_locations == 0) { printf("There are no reports to fit.\n"); exit(1); }
+
+	qsort(bins, num_reports, sizeof(struct report_bin), compare_bins);
+	for (r = 1, n = 1; r < num_reports; r++) {
+		if (bins[r].date == bins[n - 1].date && bins[r].location == bins[n - 1].location) bins[n - 1].observed += bins[r].observed;
+		else bins[n++] = bins[r];
+	}
+	data->num_bins = n;
+
+	data->observed = (int*)mem_malloc(MEM_SIMULATION, n * sizeof(int));
+	data->bin = (int*)mem_malloc(MEM_SIMULATION, (long)data->num_days * data->num_locations * sizeof(int));
+	data->first_closing = (int*)mem_malloc(MEM_SIMULATION, (data->num_days + 1) * sizeof(int));
+	previous_date = (int*)mem_malloc(MEM_SIMULATION, data->num_locations * sizeof(int));
+	if (!data->observed || !data->bin || !data->first_closing || !previous_date) {
+		printf("Could not allocate bins in build_abc_data.\n");
+		exit(1);
+	}
+	for (l = 0; l < data->num_locations; l++) previous_date[l] = -1;
+	for (r = 0; r < data->num_days * data->num_locations; r++) data->bin[r] = -1;
+	for (b = 0, day = 0; b < n; b++) {
+		data->observed[b] = bins[b].observed;
+		l = bins[b].location;
+		for (r = previous_date[l] + 1; r <= bins[b].date; r++) data->bin[r * data->num_locations + l] = b;
+		previous_date[l] = bins[b].date;
+		while (day <= bins[b].date) data->first_closing[day++] = b;
+	}
+	while (day <= data->num_days) data->first_closing[day++] = n;
+
+	mem_free(previous_date);
+	mem_free(bins);
+}
+
+static void free_abc_data(struct abc_data *data)
+{
+	mem_free(data->location_name);
+	mem_free(data->location_weights);
+	mem_free(data->observed);
+	mem_free(data->bin);
+	mem_free(data->first_closing);
+}
+
+/*-------------------------------
+| parameters of a particle		|
+-------------------------------*/
+
+//Parameters from z: log rates, log duration means and sizes, logit probabilities
+static void particle_params(struct abc_run *run, double *z, struct parameter_list *p_params)
+{
+	int k;
+
+	*p_params = run->params;
+	for (k = 0; k < NUM_TRANS_TYPES; k++) p_params->beta[k] = exp(z[k]);
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		p_params->dur_mean[k] = exp(z[4 + k]);
+		p_params->dur_size[k] = exp(z[8 + k]);
+	}
+	p_params->p_diag = 1 / (1 + exp(-z[12]));
+	p_params->p_survive = 1 / (1 + exp(-z[13]));
+}
+
+//Log prior density of z (the prior of the parameters times the Jacobian of the change of scale)
+static double log_prior_z(struct abc_run *run, double *z)
+{
+	struct parameter_list params;
+	double value;
+	int k;
+
+	particle_params(run, z, &params);
+	value = log_prior(&params);
+	for (k = 0; k < 12; k++) value += z[k];
+	value += log(params.p_diag) + log(1 - params.p_diag) + log(params.p_survive) + log(1 - params.p_survive);
+	return value;
+}
+
+//Draws z from the prior (rgama_r and beta_r return logs)
+static void draw_from_prior(struct mt_state *rng, double *z)
+{
+	double log_p;
+	int k;
+
+	z[0] = rgama_r(rng, BETA0_PRIOR_SHAPE) - log(BETA0_PRIOR_RATE);
+	for (k = 1; k < NUM_TRANS_TYPES; k++) z[k] = rgama_r(rng, BETA_PRIOR_SHAPE) - log(BETA_PRIOR_RATE);
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		z[4 + k] = rgama_r(rng, DUR_MEAN_PRIOR_SHAPE) - log(DUR_MEAN_PRIOR_RATE);
+		z[8 + k] = rgama_r(rng, DUR_SIZE_PRIOR_SHAPE) - log(DUR_SIZE_PRIOR_RATE);
+	}
+	log_p = beta_r(rng, P_DIAG_PRIOR_A, P_DIAG_PRIOR_B);
+	z[12] = log_p - log1p(-exp(log_p));
+	log_p = beta_r(rng, P_SURVIVE_PRIOR_A, P_SURVIVE_PRIOR_B);
+	z[13] = log_p - log1p(-exp(log_p));
+}
+
+//Picks a particle of the last generation by weight and perturbs it
+static void draw_perturbed(struct abc_run *run, struct mt_state *rng, double *z)
+{
+	double u = uniform_r(rng) * run->cumulative_weight[run->settings.num_particles - 1];
+	int lo = 0, hi = run->settings.num_particles - 1, mid, k;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (run->cumulative_weight[mid] > u) hi = mid;
+		else lo = mid + 1;
+	}
+	for (k = 0; k < ABC_NUM_VALUES; k++) z[k] = run->previous[lo].z[k] + run->kernel_sd[k] * rand_Normal_r(rng);
+}
+
+//Weight of a new particle: its prior over the density of perturbing the last generation into it
+static double particle_weight(struct abc_run *run, double *z)
+{
+	double log_kernel, total = 0, largest = -HUGE_VAL, x;
+	double *log_terms = NULL;
+	struct abc_particle *previous;
+	int i, k, n = run->settings.num_particles;
+
+	if (run->generation == 0) return 1;
+	log_terms = (double*)mem_malloc(MEM_SIMULATION, n * sizeof(double));
+	if (!log_terms) { printf("Could not allocate terms in particle_weight.\n"); exit(1); }
+	for (i = 0; i < n; i++) {
+		previous = &run->previous[i];
+		log_terms[i] = -HUGE_VAL;
+		if (previous->weight <= 0) continue;
+		log_kernel = log(previous->weight);
+		for (k = 0; k < ABC_NUM_VALUES; k++) {
+			x = (z[k] - previous->z[k]) / run->kernel_sd[k];
+			log_kernel -= 0.5 * x * x;
+		}
+		log_terms[i] = log_kernel;
+		if (log_kernel > largest) largest = log_kernel;
+	}
+	for (i = 0; i < n; i++) if (log_terms[i] > -HUGE_VAL) total += exp(log_terms[i] - largest);
+	mem_free(log_terms);
+	return exp(log_prior_z(run, z) - largest - log(total));
+}
+
+/*-------------------------------
+| distance to the reports		|
+-------------------------------*/
+
+//Observer of a simulation: adds the day's diagnoses to their bins, closes the bins of the day's
+//reports, and stops the run once the distance passes the tolerance
+static int observe_day(struct simulation *sim, int day, void *arg)
+{
+	struct abc_worker *worker = (struct abc_worker*)arg;
+	struct abc_data *data = worker->data;
+	int l, b, *count = worker->count;
+	long k, *diagnoses = sim->diagnoses + (long)day * data->num_locations;
+	int *bin = data->bin + (long)day * data->num_locations;
+
+	if (sim->stopped) return 1;				//Too many cases - the counts are no longer complete (the run keeps
+											//SIM_STOPPED_MAX_CASES as the reason, so it isn't counted as early)
+	for (l = 0; l < data->num_locations; l++) {
+		if ((k = diagnoses[l]) == 0 || (b = bin[l]) < 0) continue;
+		if (count[b] + k > data->observed[b]) {
+			worker->excess += count[b] > data->observed[b] ? k : count[b] + k - data->observed[b];
+		}
+		count[b] += k;
+	}
+	for (b = data->first_closing[day]; b < data->first_closing[day + 1]; b++) {
+		if (count[b] > data->observed[b]) worker->excess -= count[b] - data->observed[b];
+		worker->closed += abs(count[b] - data->observed[b]);
+	}
+	return worker->closed + worker->excess > worker->tolerance;
+}
+
+//Simulates an outbreak from p_params and returns its distance to the reports - HUGE_VAL if it was
+//stopped by the tolerance or by making too many cases
+static double simulate_distance(struct abc_worker *worker, struct parameter_list *p_params, unsigned long seed,
+	struct abc_particle *particle)
+{
+	struct simulation *sim = &worker->sim;
+
+	memset(worker->count, 0, worker->data->num_bins * sizeof(int));
+	worker->closed = worker->excess = 0;
+	restart_simulation(sim, p_params, seed);
+	run_simulation(sim);
+	particle->attempts++;
+	particle->days_run += sim->last_day + 1;
+	if (sim->stopped) {
+		particle->stopped_early += sim->stopped == SIM_STOPPED_OBSERVER;
+		particle->stopped_max_cases += sim->stopped == SIM_STOPPED_MAX_CASES;
+		return HUGE_VAL;
+	}
+	return worker->closed + worker->excess;
+}
+
+//Pool task: draws and simulates parameters until a set comes within the tolerance
+static void make_particle(void *arg, int task, int thread)
+{
+	struct abc_run *run = (struct abc_run*)arg;
+	struct abc_worker *worker = &run->worker[thread];
+	struct abc_particle *particle = &run->particle[task];
+	struct parameter_list params;
+	struct mt_state rng;
+	unsigned long key[3];
+
+	key[0] = run->settings.seed;
+	key[1] = (unsigned long)run->generation;
+	key[2] = (unsigned long)task;
+	init_by_array_r(&rng, key, 3);
+	memset(particle, 0, sizeof(struct abc_particle));
+	worker->tolerance = run->tolerance;
+
+	while (particle->attempts < ABC_MAX_ATTEMPTS) {
+		if (run->generation == 0) draw_from_prior(&rng, particle->z);
+		else {
+			draw_perturbed(run, &rng, particle->z);
+			if (log_prior_z(run, particle->z) == -HUGE_VAL) {	//Outside the prior - no need to simulate
+				particle->attempts++;
+				continue;
+			}
+		}
+		particle_params(run, particle->z, &params);
+		particle->distance = simulate_distance(worker, &params, genrand_int32_r(&rng), particle);
+		if (particle->distance < HUGE_VAL && particle->distance <= run->tolerance) {
+			particle->accepted = 1;
+			particle->weight = particle_weight(run, particle->z);
+			return;
+		}
+	}
+	particle->weight = 0;
+}
+
+/*-------------------------------
+| generations					|
+-------------------------------*/
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+//Normalises the weights of the new population, and from it sets the next tolerance and the
+//perturbation (twice the weighted variance of each value). Returns the effective sample size.
+//Many simulations may tie at the same distance (e.g. every outbreak that is never diagnosed), so if
+//the quantile doesn't fall below the tolerance, the next tolerance is the largest distance that does.
+static double finish_generation(struct abc_run *run)
+{
+	int i, k, n = run->settings.num_particles, num_accepted = 0;
+	double total = 0, sum_squares = 0, mean, var;
+	double *distances = (double*)mem_malloc(MEM_SIMULATION, n * sizeof(double));
+	struct abc_particle *swap;
+
+	if (!distances) { printf("Could not allocate distances in finish_generation.\n"); exit(1); }
+	for (i = 0; i < n; i++) total += run->particle[i].weight;
+	if (total <= 0) { printf("No particle came within the tolerance %g.\n", run->tolerance); exit(1); }
+	for (i = 0; i < n; i++) {
+		run->particle[i].weight /= total;
+		sum_squares += run->particle[i].weight * run->particle[i].weight;
+		run->cumulative_weight[i] = (i > 0 ? run->cumulative_weight[i - 1] : 0) + run->particle[i].weight;
+		if (run->particle[i].accepted) distances[num_accepted++] = run->particle[i].distance;
+	}
+	for (k = 0; k < ABC_NUM_VALUES; k++) {
+		mean = var = 0;
+		for (i = 0; i < n; i++) mean += run->particle[i].weight * run->particle[i].z[k];
+		for (i = 0; i < n; i++) var += run->particle[i].weight * (run->particle[i].z[k] - mean) * (run->particle[i].z[k] - mean);
+		run->kernel_sd[k] = sqrt(2 * var);
+		if (run->kernel_sd[k] <= 0) run->kernel_sd[k] = 1e-6;
+	}
+	qsort(distances, num_accepted, sizeof(double), compare_doubles);
+	i = (int)(ABC_QUANTILE * (num_accepted - 1));
+	if (distances[i] >= run->tolerance)
+		while (i > 0 && distances[i] >= run->tolerance) i--;
+	if (distances[i] < run->tolerance || run->tolerance == HUGE_VAL) run->tolerance = distances[i];
+	mem_free(distances);
+
+	swap = run->previous;						//This generation is the one the next draws from
+	run->previous = run->particle;
+	run->particle = swap;
+	return 1 / sum_squares;
+}
+
+//Weighted means of the parameters of the last population
+static void print_generation(struct abc_run *run, double tolerance, double ess, double seconds)
+{
+	struct abc_particle *particle;
+	struct parameter_list params, mean;
+	long attempts = 0, stopped_early = 0, stopped_max_cases = 0, days_run = 0;
+	int i, k, accepted = 0;
+
+	memset(&mean, 0, sizeof(mean));
+	for (i = 0; i < run->settings.num_particles; i++) {
+		particle = &run->previous[i];
+		attempts += particle->attempts;
+		stopped_early += particle->stopped_early;
+		stopped_max_cases += particle->stopped_max_cases;
+		days_run += particle->days_run;
+		accepted += particle->accepted;
+		particle_params(run, particle->z, &params);
+		for (k = 0; k < NUM_TRANS_TYPES; k++) mean.beta[k] += particle->weight * params.beta[k];
+		for (k = 0; k < NUM_DURATIONS; k++) {
+			mean.dur_mean[k] += particle->weight * params.dur_mean[k];
+			mean.dur_size[k] += particle->weight * params.dur_size[k];
+		}
+		mean.p_diag += particle->weight * params.p_diag;
+		mean.p_survive += particle->weight * params.p_survive;
+	}
+	log_info(LOG_SIMULATION, "Generation %d: tolerance %g, %d particles from %ld simulations (%.2f%% accepted) in %.2f s, ESS %.1f",
+		run->generation, tolerance, accepted, attempts, attempts > 0 ? 100.0 * accepted / attempts : 0, seconds, ess);
+	log_info(LOG_SIMULATION, "\t%ld simulations stopped early by the tolerance and %ld at the largest number of cases; %.1f%% of the days simulated",
+		stopped_early, stopped_max_cases, attempts > 0 ? 100.0 * days_run / ((double)attempts * run->data.num_days) : 0);
+	log_info(LOG_SIMULATION, "\tMeans: beta %g %g %g %g, duration means %g %g %g %g, p_diag %g, p_survive %g",
+		mean.beta[0], mean.beta[1], mean.beta[2], mean.beta[3], mean.dur_mean[0], mean.dur_mean[1],
+		mean.dur_mean[2], mean.dur_mean[3], mean.p_diag, mean.p_survive);
+}
+
+//One line per particle of the last population: its weight, distance and parameters
+static void write_population(struct abc_run *run, const char *file_name)
+{
+	FILE *out = fopen(file_name, "w");
+	struct parameter_list params;
+	int i, k;
+
+	if (!out) { printf("Could not open %s to write the ABC population.\n", file_name); exit(1); }
+	fprintf(out, "weight,distance,beta0,beta1,beta2,beta3,dur_mean0,dur_mean1,dur_mean2,dur_mean3,"
+		"dur_size0,dur_size1,dur_size2,dur_size3,p_diag,p_survive\n");
+	for (i = 0; i < run->settings.num_particles; i++) {
+		if (!run->previous[i].accepted) continue;
+		particle_params(run, run->previous[i].z, &params);
+		fprintf(out, "%g,%g", run->previous[i].weight, run->previous[i].distance);
+		for (k = 0; k < NUM_TRANS_TYPES; k++) fprintf(out, ",%g", params.beta[k]);
+		for (k = 0; k < NUM_DURATIONS; k++) fprintf(out, ",%g", params.dur_mean[k]);
+		for (k = 0; k < NUM_DURATIONS; k++) fprintf(out, ",%g", params.dur_size[k]);
+		fprintf(out, ",%g,%g\n", params.p_diag, params.p_survive);
+	}
+	fclose(out);
+}
+
+void run_abc_smc(struct current_case_report *reports, struct parameter_list *p_params, struct abc_settings *settings)
+{
+	struct abc_run run;
+	struct simulation_settings sim_settings;
+	struct timespec start, end;
+	int t, num_threads, n;
+	double tolerance, ess;
+
+	memset(&run, 0, sizeof(run));
+	run.settings = *settings;
+	if (run.settings.num_particles < 2) run.settings.num_particles = 2;
+	n = run.settings.num_particles;
+	run.params = *p_params;
+	build_abc_data(&run.data, reports, p_params->total_reports);
+	log_info(LOG_SIMULATION, "ABC-SMC: %d particles, %d generations, %d reported cases in %d bins over %d subregions and %d days.",
+		n, run.settings.num_generations, run.data.total_reported, run.data.num_bins, run.data.num_locations, run.data.num_days);
+
+	run.particle = (struct abc_particle*)mem_calloc(MEM_SIMULATION, n, sizeof(struct abc_particle));
+	run.previous = (struct abc_particle*)mem_calloc(MEM_SIMULATION, n, sizeof(struct abc_particle));
+	run.cumulative_weight = (double*)mem_malloc(MEM_SIMULATION, n * sizeof(double));
+	if (!run.particle || !run.previous || !run.cumulative_weight) { printf("Could not allocate particles in run_abc_smc.\n"); exit(1); }
+
+	run.pool = create_thread_pool(run.settings.num_threads > 0 ? run.settings.num_threads : 1);
+	num_threads = pool_size(run.pool);
+	run.worker = (struct abc_worker*)mem_calloc(MEM_SIMULATION, num_threads, sizeof(struct abc_worker));
+	if (!run.worker) { printf("Could not allocate workers in run_abc_smc.\n"); exit(1); }
+	default_simulation_settings(&sim_settings);
+	sim_settings.num_days = run.data.num_days;
+	sim_settings.max_cases = (long)ABC_CASES_PER_REPORTED * run.data.total_reported;
+	if (sim_settings.max_cases < ABC_MIN_SIM_CASES) sim_settings.max_cases = ABC_MIN_SIM_CASES;
+	sim_settings.num_locations = run.data.num_locations;
+	sim_settings.location_weights = run.data.total_reported > 0 ? run.data.location_weights : NULL;
+	for (t = 0; t < num_threads; t++) {
+		init_simulation(&run.worker[t].sim, p_params, &sim_settings);
+		run.worker[t].sim.observer = observe_day;
+		run.worker[t].sim.observer_arg = &run.worker[t];
+		run.worker[t].data = &run.data;
+		run.worker[t].count = (int*)mem_malloc(MEM_SIMULATION, run.data.num_bins * sizeof(int));
+		if (!run.worker[t].count) { printf("Could not allocate counts in run_abc_smc.\n"); exit(1); }
+	}
+
+	run.tolerance = HUGE_VAL;					//The first generation only turns away runaway outbreaks
+	for (run.generation = 0; run.generation < run.settings.num_generations; run.generation++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		tolerance = run.tolerance;
+		run_pool_tasks(run.pool, make_particle, &run, n);
+		ess = finish_generation(&run);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		print_generation(&run, tolerance, ess, (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec));
+	}
+	if (run.settings.output_file[0]) write_population(&run, run.settings.output_file);
+
+	for (t = 0; t < num_threads; t++) {
+		free_simulation(&run.worker[t].sim);
+		mem_free(run.worker[t].count);
+	}
+	mem_free(run.worker);
+	destroy_thread_pool(run.pool);
+	mem_free(run.particle);
+	mem_free(run.previous);
+	mem_free(run.cumulative_weight);
+	free_abc_data(&run.data);
+}
@@ -0,0 +1,97 @@
+/********************************************************************************
+*	ABC_SMC.h																	*
+*	Contains:																	*
+*		- Settings and state of approximate Bayesian computation by sequential	*
+*			Monte Carlo: a population of parameter sets (particles), each		*
+*			kept only if an outbreak simulated from it comes within a			*
+*			tolerance of the reported counts, with the tolerance shrinking		*
+*			from one generation to the next										*
+*		- Functions defined in ABC_SMC.c										*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h, Thread_Pool.h and Outbreak_Simulator.h first.			*
+********************************************************************************/
+
+//Default settings (each can be changed on the command line)
+#define DEFAULT_ABC_PARTICLES 1000
+#define DEFAULT_ABC_GENERATIONS 8
+
+#define ABC_QUANTILE 0.5				//Each tolerance is this quantile of the last generation's distances
+#define ABC_MAX_ATTEMPTS 100000			//Simulations a particle may try before it is given up (weight 0)
+#define ABC_CASES_PER_REPORTED 20		//Simulations stop making cases beyond this many per reported case...
+#define ABC_MIN_SIM_CASES 1000			//...or this many, if more
+#define ABC_NUM_VALUES 14				//beta[4], dur_mean[4], dur_size[4], p_diag and p_survive
+
+/************************************************
+* Structures of an ABC-SMC run					*
+************************************************/
+
+struct abc_settings
+{
+	int num_particles;
+	int num_generations;
+	int num_threads;
+	unsigned long seed;
+	char output_file[200];			//Where the last population is written
+};
+
+//The reports as counts to match: one bin for each date a subregion reported on, holding the
+//diagnoses since that subregion's previous report
+struct abc_data
+{
+	int num_locations;				//Subregions, in order of first appearance in the reports
+	char (*location_name)[100];
+	double *location_weights;		//Reported cases in each subregion - where index cases are placed
+	int num_days;					//Up to and including the last report
+	int num_bins;					//In order of date
+	int *observed;					//observed[bin]: reported cases
+	int *bin;						//bin[day * num_locations + location]: bin counting a diagnosis then (-1 if none)
+	int *first_closing;				//Bins closing on day are first_closing[day] to first_closing[day + 1] - 1
+	int total_reported;
+};
+
+//A particle: its parameters, both as a parameter list and on the scale it is perturbed on
+//(log for rates and durations, logit for probabilities)
+struct abc_particle
+{
+	double z[ABC_NUM_VALUES];
+	double weight;
+	double distance;
+	int accepted;					//0 if the particle ran out of attempts
+	long attempts;					//Simulations run to find it
+	long stopped_early;				//Simulations ended early by the tolerance
+	long stopped_max_cases;			//Simulations ended at the simulation's largest number of cases
+	long days_run;					//Days simulated over all attempts
+};
+
+//Scratch space of one thread
+struct abc_worker
+{
+	struct simulation sim;
+	int *count;						//count[bin]: diagnoses so far
+	double closed;					//Distance of the bins already closed
+	double excess;					//Diagnoses beyond the reports in bins still open (a lower bound on their distance)
+	double tolerance;
+	struct abc_data *data;
+};
+
+struct abc_run
+{
+	struct abc_settings settings;
+	struct abc_data data;
+	struct parameter_list params;	//Copied into each particle's parameters (for the counts of reports and cases)
+	struct thread_pool *pool;
+	struct abc_worker *worker;		//One for each thread of the pool
+	struct abc_particle *particle;	//Population being made
+	struct abc_particle *previous;	//Last generation's population
+	double *cumulative_weight;		//Of the last generation, for picking particles
+	double kernel_sd[ABC_NUM_VALUES];	//Perturbation of each value
+	double tolerance;
+	int generation;
+};
+
+/****************************************
+* Functions defined in ABC_SMC.c		*
+****************************************/
+
+void default_abc_settings(struct abc_settings *settings);
+void run_abc_smc(struct current_case_report *reports, struct parameter_list *p_params, struct abc_settings *settings);
@@ -0,0 +1,154 @@
+/********************************************************************************
+*	Batch_Fits.c																*
+*	Fits many case files in one process. Each fit has a model context of its	*
+*		own (reports, cases, parameters and seed) and a sampler run on one		*
+*		thread, so the fits share nothing. The pool's threads take fits in		*
+*		turn until none are left, so a long fit holds up one thread rather		*
+*		than the batch, and a case file that cannot be read fails only its		*
+*		own fit.																*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strchr and strcpy
+#include <time.h>						//For timing each fit
+#include "MTrandom.h"					//Needed by Gibbs_Sampler.h
+#include "Date_And_Reading_Reports.h"	//For the model contexts
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For initialise_parameters
+#include "Posterior_Summary.h"			//Needed by Parallel_Tempering.h
+#include "Parallel_Tempering.h"			//For the sampler
+#include "Thread_Pool.h"				//For running fits side by side
+#include "Batch_Fits.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For progress
+
+//What every task of the pool needs
+struct batch_run
+{
+	struct batch_fit *fits;
+	struct sampler_settings *settings;
+};
+
+/*-------------------------------
+| the list						|
+-------------------------------*/
+
+//Reads up to max_fits lines of case_file[,summary_file], skipping blank lines. Returns the number read.
+int read_batch_list(const char *file_name, struct batch_fit *fits, int max_fits)
+{
+	FILE *list;
+	char line[500], *comma, *end;
+	int n = 0;
+
+	list = fopen(file_name, "r");
+	if (!list) { printf("Could not open the batch list %s.\n", file_name); exit(1); }
+	while (n < max_fits && fgets(line, sizeof(line), list)) {
+		end = line + strcspn(line, "\r\n");
+		*end = 0;
+		if (!line[0]) continue;
+		memset(&fits[n], 0, sizeof(struct batch_fit));
+		comma = strchr(line, ',');
+		if (comma) *comma = 0;
+		if (strlen(line) >= sizeof(fits[n].case_file) || (comma && strlen(comma + 1) >= sizeof(fits[n].summary_file))) {
+			printf("File name too long for fit %d of %s.\n", n + 1, file_name);
+			exit(1);
+		}
+		strcpy(fits[n].case_file, line);
+		if (comma) strcpy(fits[n].summary_file, comma + 1);
+		n++;
+	}
+	if (n == max_fits && fgets(line, sizeof(line), list)) log_warn(LOG_MAIN, "Only the first %d fits of %s are run.", max_fits, file_name);
+	fclose(list);
+	return n;
+}
+
+/*-------------------------------
+| running the fits				|
+-------------------------------*/
+
+//Fit number task, start to finish, on the calling thread
+static void run_batch_fit(void *arg, int task, int thread)
+{
+	struct batch_run *batch = (struct batch_run*)arg;
+	struct batch_fit *fit = &batch->fits[task];
+	struct sampler_settings settings = *batch->settings;
+	struct model_context model;
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	init_model_context(&model, fit->case_file, batch->settings->seed + task, 1);	//A stream of its own
+	if (!read_case_reports(&model)) {
+		log_error(LOG_MAIN, "Fit %d skipped: could not read %s.", task + 1, fit->case_file);
+		fit->failed = 1;
+		free_model_context(&model);
+		return;
+	}
+	generate_cases(&model);
+	initialise_parameters(&model.params);
+
+	//One thread and no files but its own summary - the fits share the output
+	settings.seed = model.seed;
+	settings.num_threads = 1;
+	settings.case_threads = 0;
+	settings.quiet = 1;
+	settings.checkpoint_file[0] = 0;
+	settings.restart_file[0] = 0;
+	settings.trace_file[0] = 0;
+	settings.spatial_file[0] = 0;
+	settings.renewal_file[0] = 0;
+	settings.live_name[0] = 0;
+	strcpy(settings.summary_file, fit->summary_file);
+	fit->log_lik = run_gibbs_sampler(&model, &settings);
+	fit->total_cases = model.params.total_cases;
+	fit->total_reports = model.params.total_reports;
+	free_model_context(&model);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fit->seconds = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+}
+
+//Runs every fit listed in file_name with settings (its threads are the fits run at once). Returns the number run.
+int run_batch_fits(const char *file_name, struct sampler_settings *settings)
+{
+	struct batch_run batch;
+	struct thread_pool *pool;
+	struct timespec start, end;
+	double seconds, fit_seconds = 0;
+	int num_fits, num_threads, num_failed = 0, i;
+
+	batch.fits = (struct batch_fit*)mem_malloc(MEM_SAMPLER, BATCH_MAX_FITS * sizeof(struct batch_fit));
+	if (!batch.fits) { printf("Could not allocate fits in run_batch_fits.\n"); exit(1); }
+	batch.settings = settings;
+	num_fits = read_batch_list(file_name, batch.fits, BATCH_MAX_FITS);
+	if (num_fits == 0) { log_error(LOG_MAIN, "No case files listed in %s.", file_name); mem_free(batch.fits); return 0; }
+
+	num_threads = settings->num_threads < num_fits ? settings->num_threads : num_fits;
+	log_info(LOG_MAIN, "Fitting %d case files of %s on %d threads, each with %d chains of %ld sweeps.", num_fits, file_name,
+		num_threads, settings->num_chains, settings->num_sweeps);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pool = create_thread_pool(num_threads);
+	run_pool_tasks(pool, run_batch_fit, &batch, num_fits);
+	destroy_thread_pool(pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	seconds = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+
+	flush_log();								//The fits' own messages first
+	printf("%-40s %9s %9s %14s %9s\n", "case file", "reports", "cases", "log lik", "seconds");
+	for (i = 0; i < num_fits; i++) {
+		if (batch.fits[i].failed) {
+			printf("%-40s %9s %9s %14s %9s\n", batch.fits[i].case_file, "-", "-", "not read", "-");
+			num_failed++;
+			continue;
+		}
+		printf("%-40s %9d %9d %14.3f %9.2f\n", batch.fits[i].case_file, batch.fits[i].total_reports,
+			batch.fits[i].total_cases, batch.fits[i].log_lik, batch.fits[i].seconds);
+		fit_seconds += batch.fits[i].seconds;
+	}
+	if (num_failed) log_warn(LOG_MAIN, "%d of the %d case files could not be read.", num_failed, num_fits);
+	log_info(LOG_MAIN, "Batch finished: %d fits in %.2f s (%.2f s of fitting, %.1f times faster than one at a time).", num_fits,
+		seconds, fit_seconds, seconds > 0 ? fit_seconds / seconds : 0);
+	mem_free(batch.fits);
+	return num_fits;
+}
@@ -0,0 +1,31 @@
+/********************************************************************************
+*	Batch_Fits.h																*
+*	Contains:																	*
+*		- A batch of fits: one case file per line of a list, each read into		*
+*			its own model context and fitted by its own sampler run, with		*
+*			the fits shared out over a thread pool								*
+*		- Functions defined in Batch_Fits.c										*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h, Posterior_Summary.h and Parallel_Tempering.h first.	*
+********************************************************************************/
+
+#define BATCH_MAX_FITS 1000
+
+//One line of the list: case_file[,summary_file]
+struct batch_fit
+{
+	char case_file[200];
+	char summary_file[200];		//"" for none
+	int total_cases;
+	int total_reports;
+	double log_lik;				//Of the cold chain's last state
+	double seconds;
+	int failed;					//1 if its case file could not be read
+};
+
+/****************************************
+* Functions defined in Batch_Fits.c		*
+****************************************/
+
+int read_batch_list(const char *file_name, struct batch_fit *fits, int max_fits);
+int run_batch_fits(const char *file_name, struct sampler_settings *settings);
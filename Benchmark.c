@@ -0,0 +1,149 @@
+/********************************************************************************
+*	Benchmark.c																	*
+*	Runs the program end to end on synthetic case files of growing size, to		*
+*		give scaling curves of each stage. Sizes are run in the order given,	*
+*		so with growing sizes the peak resident memory (which never falls)		*
+*		is that of the largest size so far.										*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strtok
+#include <time.h>						//For timing the stages
+#include <sys/resource.h>				//For the peak resident memory
+#include "MTrandom.h"					//For the random number streams of the chains
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood cache of the chains
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Synthetic_Data.h"				//For writing the case files
+#include "Profile.h"					//For splitting reading from making cases
+#include "Benchmark.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For progress
+
+void default_benchmark_settings(struct benchmark_settings *settings)
+{
+	memset(settings, 0, sizeof(struct benchmark_settings));
+	settings->sizes[0] = 1000;
+	settings->sizes[1] = 10000;
+	settings->sizes[2] = 100000;
+	settings->sizes[3] = 1000000;
+	settings->num_sizes = 4;
+	settings->num_sweeps = DEFAULT_BENCHMARK_SWEEPS;
+	settings->max_sampler_cases = DEFAULT_BENCHMARK_MAX_CASES;
+	settings->mean_cases = DEFAULT_SYNTHETIC_CASES;
+	settings->seed = 1;
+	settings->num_threads = 1;
+}
+
+//Sizes as a comma-separated list (e.g. 1000,1e5,1e7). Returns 0 if it is not understood.
+int parse_benchmark_sizes(struct benchmark_settings *settings, const char *list)
+{
+	char copy[400], *part, *end;
+	double size;
+
+	strncpy(copy, list, sizeof(copy) - 1);
+	copy[sizeof(copy) - 1] = 0;
+	settings->num_sizes = 0;
+	for (part = strtok(copy, ","); part; part = strtok(NULL, ",")) {
+		size = strtod(part, &end);
+		if (*end || size < 1 || settings->num_sizes == BENCHMARK_MAX_SIZES) return 0;
+		settings->sizes[settings->num_sizes++] = (long)size;
+	}
+	return settings->num_sizes > 0;
+}
+
+static double seconds_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + 1e-9 * (now.tv_nsec - start->tv_nsec);
+}
+
+static double peak_rss_mb()
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;		//Kilobytes on Linux
+}
+
+void run_benchmark(struct benchmark_settings *settings)
+{
+	FILE *output;
+	struct synthetic_settings data;
+	struct chain_state chain;
+	struct timespec start;
+	char data_file[220];
+	struct model_context model;
+	struct parameter_list *p_params = &model.params;
+	double generate_s, read_s, ingest_s, cases_s, table_s, sampler_s, before_ingest, before_cases;
+	long rows;
+	int s, sweep, sampled;
+
+	output = fopen(settings->output_file, "w");
+	if (!output) { printf("Could not open %s to write the benchmark.\n", settings->output_file); exit(1); }
+	fprintf(output, "rows,locations,cases,generate_s,ingest_s,rows_per_s,cases_s,cases_per_s,table_s,"
+		"sweeps,sampler_s,sweeps_per_s,case_sweeps_per_s,peak_rss_mb\n");
+	snprintf(data_file, sizeof(data_file), "%s.data.csv", settings->output_file);
+	printf("%10s %9s %9s %9s %9s %12s %9s %12s %9s %9s %12s %10s\n", "rows", "locations", "cases", "write s", "read s",
+		"rows/s", "cases s", "cases/s", "table s", "sample s", "sweeps/s", "peak MB");
+
+	for (s = 0; s < settings->num_sizes; s++) {
+		default_synthetic_settings(&data);
+		data.num_rows = settings->sizes[s];
+		data.num_locations = (int)(data.num_rows / BENCHMARK_ROWS_PER_LOCATION);
+		if (data.num_locations < DEFAULT_SYNTHETIC_LOCATIONS) data.num_locations = DEFAULT_SYNTHETIC_LOCATIONS;
+		data.num_days = BENCHMARK_DAYS;
+		data.mean_cases = settings->mean_cases;
+		data.seed = settings->seed + data.num_rows;		//The same file for a size, whatever the other sizes
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rows = write_synthetic_reports(data_file, &data);
+		generate_s = seconds_since(&start);
+
+		//Reading and making cases, split by the profile's totals
+		before_ingest = profile_seconds(PROF_INGEST);
+		before_cases = profile_seconds(PROF_CASES);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		init_model_context(&model, data_file, settings->seed, settings->num_threads);
+		read_case_data(&model);
+		read_s = seconds_since(&start);
+		ingest_s = profile_seconds(PROF_INGEST) - before_ingest;
+		cases_s = profile_seconds(PROF_CASES) - before_cases;
+		if (ingest_s + cases_s == 0) ingest_s = read_s;		//Profiling compiled out
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		use_lfunc_table(&model);			//Built afresh: no other context holds it
+		table_s = seconds_since(&start);
+
+		sampled = model.cases && p_params->total_cases <= settings->max_sampler_cases;
+		sampler_s = 0;
+		if (sampled) {
+			initialise_parameters(p_params);
+			initialise_chain(&chain, model.cases, p_params, 0, 1.0, settings->seed);
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (sweep = 0; sweep < settings->num_sweeps; sweep++) gibbs_sweep(&chain);
+			sampler_s = seconds_since(&start);
+			free_chain(&chain);
+		}
+
+		printf("%10ld %9d %9d %9.3f %9.3f %12.0f %9.3f %12.0f %9.3f ", rows, data.num_locations, p_params->total_cases,
+			generate_s, ingest_s, rows / ingest_s, cases_s, p_params->total_cases / (cases_s > 0 ? cases_s : 1e-9), table_s);
+		if (sampled) printf("%9.3f %12.1f", sampler_s, settings->num_sweeps / sampler_s);
+		else printf("%9s %12s", "-", "-");
+		printf(" %10.1f\n", peak_rss_mb());
+		fprintf(output, "%ld,%d,%d,%.6f,%.6f,%.1f,%.6f,%.1f,%.6f,%d,%.6f,%.3f,%.1f,%.1f\n", rows, data.num_locations,
+			p_params->total_cases, generate_s, ingest_s, rows / ingest_s, cases_s,
+			p_params->total_cases / (cases_s > 0 ? cases_s : 1e-9), table_s, sampled ? settings->num_sweeps : 0, sampler_s,
+			sampled ? settings->num_sweeps / sampler_s : 0, sampled ? (double)p_params->total_cases * settings->num_sweeps / sampler_s : 0,
+			peak_rss_mb());
+		fflush(output);
+		free_model_context(&model);		//Its cases, reports and hold on the table
+	}
+	fclose(output);
+	remove(data_file);
+	log_info(LOG_MAIN, "Wrote the benchmark to %s.", settings->output_file);
+}
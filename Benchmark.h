@@ -0,0 +1,37 @@
+/********************************************************************************
+*	Benchmark.h																	*
+*	Contains:																	*
+*		- Settings of the scaling benchmark: for each size, a synthetic case	*
+*			file is written and then read, its cases are made, the lfunc2		*
+*			table is built and one chain makes a fixed number of sweeps, each	*
+*			stage timed, with its throughput and the peak memory so far			*
+*		- Functions defined in Benchmark.c										*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h and Synthetic_Data.h first.								*
+********************************************************************************/
+
+#define BENCHMARK_MAX_SIZES 16
+#define DEFAULT_BENCHMARK_SWEEPS 10
+#define DEFAULT_BENCHMARK_MAX_CASES 100000	//The sampler is skipped for sizes with more cases than this
+#define BENCHMARK_ROWS_PER_LOCATION 100		//Subregions grow with the rows (at least DEFAULT_SYNTHETIC_LOCATIONS)
+#define BENCHMARK_DAYS 370					//From 1/1/2014, so every report falls within NUMDAYS
+
+struct benchmark_settings
+{
+	char output_file[200];					//CSV of the results (the synthetic files are written beside it)
+	long sizes[BENCHMARK_MAX_SIZES];		//Rows of each case file
+	int num_sizes;
+	int num_sweeps;
+	long max_sampler_cases;
+	double mean_cases;						//Mean size of each subregion's outbreak
+	unsigned long seed;
+	int num_threads;						//Threads making the cases
+};
+
+/****************************************
+* Functions defined in Benchmark.c		*
+****************************************/
+
+void default_benchmark_settings(struct benchmark_settings *settings);
+int parse_benchmark_sizes(struct benchmark_settings *settings, const char *list);
+void run_benchmark(struct benchmark_settings *settings);
@@ -0,0 +1,509 @@
+/********************************************************************************
+*	Checkpoint.c																*
+*	Saves the full state of a tempered run (every chain's cases, parameters		*
+*		and random number stream, the ladder, the counters, the reports and		*
+*		MTrandom's default stream) so a lost run can carry on exactly where		*
+*		it left off.															*
+*	The run is packed into a buffer on the sampler's thread (a memory copy),	*
+*		and a background thread writes it to <file>.tmp, syncs it and renames	*
+*		it over <file>, so a crash never leaves a half-written checkpoint.		*
+*	File layout: header (magic, version, layout check, payload size and			*
+*		checksum), then the payload in the order of save_run. Values are		*
+*		stored in the machine's own byte order - restart on the same kind of	*
+*		machine.																*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcpy
+#include <unistd.h>						//For fsync
+#include <pthread.h>					//For the background writer thread
+#include "MTrandom.h"					//For the random number streams
+#include "Date_And_Reading_Reports.h"	//For the case, report and parameter structures
+#include "Likelihood.h"					//For the likelihood cache
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Posterior_Summary.h"			//For the summaries of the cold chain
+#include "Parallel_Tempering.h"			//For the run and its ladder
+#include "Checkpoint.h"					//For structures and declarations of functions needed in this file
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Placement.h"						//For the node of each chain's cases
+#include "Log.h"							//For progress
+
+#define LAYOUT_CHECK (0x01020304UL + 0x100 * sizeof(long) + 0x10000 * sizeof(struct patient))
+
+struct checkpoint_header
+{
+	char magic[8];
+	unsigned long version;
+	unsigned long layout;			//LAYOUT_CHECK of the machine that wrote it
+	unsigned long payload_size;
+	unsigned long checksum;			//FNV-1a hash of the payload
+};
+
+struct byte_buffer
+{
+	unsigned char *data;
+	size_t length;
+	size_t size;
+};
+
+struct byte_reader
+{
+	const unsigned char *data;
+	size_t length;
+	size_t position;
+	const char *file_name;			//For error messages
+};
+
+struct checkpoint_writer
+{
+	char file_name[200];
+	char temp_name[210];
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;			//Signalled when there is a checkpoint to write (or on shutdown)
+	pthread_cond_t idle;			//Signalled when a write has finished
+	struct byte_buffer pending;		//Belongs to the writer thread while busy is set
+	int busy;
+	int shutdown;
+	long written;
+	long skipped;					//Checkpoints dropped because the last one was still being written
+};
+
+/*-------------------------------
+| packing and unpacking			|
+-------------------------------*/
+
+static unsigned long fnv1a(const unsigned char *data, size_t length)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return (unsigned long)hash;
+}
+
+static void put(struct byte_buffer *buffer, const void *source, size_t size)
+{
+	if (buffer->length + size > buffer->size) {
+		buffer->size = 2 * (buffer->length + size);
+		buffer->data = (unsigned char*)mem_realloc(MEM_IO, buffer->data, buffer->size);
+		if (!buffer->data) { printf("Could not grow buffer in write_checkpoint.\n"); exit(1); }
+	}
+	memcpy(buffer->data + buffer->length, source, size);
+	buffer->length += size;
+}
+
+static void get(struct byte_reader *reader, void *destination, size_t size)
+{
+	if (reader->position + size > reader->length) {
+		printf("Checkpoint %s ends too soon.\n", reader->file_name);
+		exit(1);
+	}
+	memcpy(destination, reader->data + reader->position, size);
+	reader->position += size;
+}
+
+//Random number streams are saved without the padding at the end of struct mt_state, so that equal
+//states always give byte-identical checkpoints
+static void put_rng(struct byte_buffer *buffer, struct mt_state *rng)
+{
+	put(buffer, rng->mt, sizeof(rng->mt));
+	put(buffer, &rng->mti, sizeof(int));
+}
+
+static void get_rng(struct byte_reader *reader, struct mt_state *rng)
+{
+	get(reader, rng->mt, sizeof(rng->mt));
+	get(reader, &rng->mti, sizeof(int));
+}
+
+static int case_number(struct chain_state *chain, p_patient current)
+{
+	return current ? (int)(current - chain->cases) : NO_CASE;
+}
+
+static p_patient case_pointer(struct chain_state *chain, int number, const char *file_name)
+{
+	if (number == NO_CASE) return NULL;
+	if (number < 0 || number >= chain->num_cases) {
+		printf("Checkpoint %s refers to case %d of %d.\n", file_name, number, chain->num_cases);
+		exit(1);
+	}
+	return &chain->cases[number];
+}
+
+static void save_chain(struct byte_buffer *buffer, struct chain_state *chain)
+{
+	int i, first;
+	p_patient current;
+	struct checkpoint_case record;
+
+	put(buffer, &chain->chain_ID, sizeof(int));
+	put(buffer, &chain->rung, sizeof(int));
+	put(buffer, &chain->heat, sizeof(double));
+	put_rng(buffer, &chain->rng);
+	put(buffer, &chain->params, sizeof(struct parameter_list));
+	put(buffer, &chain->num_cases, sizeof(int));
+	put(buffer, &chain->num_observed, sizeof(int));
+	put(buffer, &chain->capacity, sizeof(int));
+	first = case_number(chain, chain->first_case);
+	put(buffer, &first, sizeof(int));
+	put(buffer, &chain->sweeps, sizeof(long));
+	put(buffer, chain->proposed, sizeof(chain->proposed));
+	put(buffer, chain->accepted, sizeof(chain->accepted));
+	put(buffer, chain->move_ns, sizeof(chain->move_ns));
+	put(buffer, &chain->adapt, sizeof(struct move_adaptation));
+	put(buffer, &chain->log_lik, sizeof(double));
+	put(buffer, &chain->log_prior, sizeof(double));
+	put(buffer, &chain->cache.log_lik, sizeof(double));		//Running total - recomputing it would not be bit-exact
+	put(buffer, &chain->cache.drift_checks, sizeof(long));
+	put(buffer, &chain->cache.max_drift, sizeof(double));
+
+	for (i = 0; i < chain->num_cases; i++) {
+		current = &chain->cases[i];
+		memset(&record, 0, sizeof(record));
+		record.index = current->index;
+		memcpy(record.country, current->country, sizeof(record.country));
+		memcpy(record.subregion, current->subregion, sizeof(record.subregion));
+		record.x = current->x;
+		record.y = current->y;
+		record.location = current->location;
+		memcpy(record.dates, current->dates, sizeof(record.dates));
+		record.parent_case = case_number(chain, current->parent_case);
+		record.first_2dary = case_number(chain, current->first_2dary);
+		record.left_sib = case_number(chain, current->left_sib);
+		record.right_sib = case_number(chain, current->right_sib);
+		record.next = case_number(chain, current->next);
+		record.prev = case_number(chain, current->prev);
+		record.transmission_type = current->transmission_type;
+		record.survive = current->survive;
+		record.est_case = current->est_case;
+		record.diag = current->diag;
+		record.diag_day = current->diag_day;
+		record.secondary_cases = current->secondary_cases;
+		record.pop_dens = current->pop_dens;
+		put(buffer, &record, sizeof(record));
+	}
+}
+
+static void save_run(struct byte_buffer *buffer, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report *reports)
+{
+	int c;
+	int K = run->ladder.num_rungs;
+	struct mt_state default_rng;
+
+	put(buffer, &run->settings, sizeof(struct sampler_settings));
+	put(buffer, &run->sweeps_done, sizeof(long));
+	put(buffer, &run->swap_rounds, sizeof(long));
+	put_rng(buffer, &run->rng);
+	get_genrand_state(&default_rng);
+	put_rng(buffer, &default_rng);
+
+	put(buffer, &K, sizeof(int));
+	put(buffer, run->ladder.heat, K * sizeof(double));
+	put(buffer, run->ladder.log_gap, K * sizeof(double));
+	put(buffer, run->ladder.chain_on_rung, K * sizeof(int));
+	put(buffer, run->ladder.swaps_proposed, K * sizeof(long));
+	put(buffer, run->ladder.swaps_accepted, K * sizeof(long));
+	put(buffer, run->ladder.swap_rate, K * sizeof(double));
+	put(buffer, &run->ladder.adaptations, sizeof(long));
+
+	put(buffer, p_params, sizeof(struct parameter_list));
+	if (p_params->total_reports > 0)
+		put(buffer, reports, p_params->total_reports * sizeof(struct current_case_report));
+
+	for (c = 0; c < K; c++) save_chain(buffer, &run->chains[c]);
+
+	put(buffer, &run->summary.num_quantities, sizeof(int));
+	put(buffer, run->summary.quantity, run->summary.num_quantities * sizeof(struct quantity_summary));
+}
+
+static void load_chain(struct byte_reader *reader, struct chain_state *chain)
+{
+	int i, first;
+	p_patient current;
+	struct checkpoint_case record;
+	double cache_log_lik, max_drift;
+	long drift_checks;
+
+	memset(chain, 0, sizeof(struct chain_state));
+	get(reader, &chain->chain_ID, sizeof(int));
+	get(reader, &chain->rung, sizeof(int));
+	get(reader, &chain->heat, sizeof(double));
+	get_rng(reader, &chain->rng);
+	get(reader, &chain->params, sizeof(struct parameter_list));
+	get(reader, &chain->num_cases, sizeof(int));
+	get(reader, &chain->num_observed, sizeof(int));
+	get(reader, &chain->capacity, sizeof(int));
+	get(reader, &first, sizeof(int));
+	get(reader, &chain->sweeps, sizeof(long));
+	get(reader, chain->proposed, sizeof(chain->proposed));
+	get(reader, chain->accepted, sizeof(chain->accepted));
+	get(reader, chain->move_ns, sizeof(chain->move_ns));
+	get(reader, &chain->adapt, sizeof(struct move_adaptation));
+	get(reader, &chain->log_lik, sizeof(double));
+	get(reader, &chain->log_prior, sizeof(double));
+	get(reader, &cache_log_lik, sizeof(double));
+	get(reader, &drift_checks, sizeof(long));
+	get(reader, &max_drift, sizeof(double));
+
+	if (chain->num_observed < 1 || chain->num_cases < chain->num_observed || chain->capacity < chain->num_cases) {
+		printf("Checkpoint %s has a chain with %d of %d cases observed (room for %d).\n", reader->file_name,
+			chain->num_observed, chain->num_cases, chain->capacity);
+		exit(1);
+	}
+	chain->max_unobserved = unobserved_limit(chain->num_observed);
+	chain->cases = (struct patient*)mem_large(MEM_CASES, (size_t)chain->capacity * sizeof(struct patient), node_for_index(chain->chain_ID));
+	if (!chain->cases) { printf("Could not allocate cases in read_checkpoint.\n"); exit(1); }
+	chain->first_case = case_pointer(chain, first, reader->file_name);
+
+	for (i = 0; i < chain->num_cases; i++) {
+		get(reader, &record, sizeof(record));
+		current = &chain->cases[i];
+		current->index = record.index;
+		memcpy(current->country, record.country, sizeof(record.country));
+		memcpy(current->subregion, record.subregion, sizeof(record.subregion));
+		current->x = record.x;
+		current->y = record.y;
+		current->location = record.location;
+		memcpy(current->dates, record.dates, sizeof(record.dates));
+		current->parent_case = case_pointer(chain, record.parent_case, reader->file_name);
+		current->first_2dary = case_pointer(chain, record.first_2dary, reader->file_name);
+		current->left_sib = case_pointer(chain, record.left_sib, reader->file_name);
+		current->right_sib = case_pointer(chain, record.right_sib, reader->file_name);
+		current->next = case_pointer(chain, record.next, reader->file_name);
+		current->prev = case_pointer(chain, record.prev, reader->file_name);
+		current->transmission_type = record.transmission_type;
+		current->survive = record.survive;
+		current->est_case = record.est_case;
+		current->diag = record.diag;
+		current->diag_day = record.diag_day;
+		current->secondary_cases = record.secondary_cases;
+		current->pop_dens = record.pop_dens;
+	}
+
+	//Exposures per day of each case, from its children
+	for (i = 0; i < chain->num_cases; i++) {
+		current = &chain->cases[i];
+		if (current->parent_case && current->dates[0] >= 0 && current->dates[0] < NUMDAYS)
+			current->parent_case->secondary_cases_gen[current->dates[0]]++;
+	}
+
+	init_likelihood_cache(&chain->cache, chain->first_case, chain->capacity, &chain->params);
+	chain->cache.log_lik = cache_log_lik;
+	chain->cache.drift_checks = drift_checks;
+	chain->cache.max_drift = max_drift;
+}
+
+static void load_run(struct byte_reader *reader, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report **p_report_list)
+{
+	int c, K;
+	struct mt_state default_rng;
+
+	get(reader, &run->settings, sizeof(struct sampler_settings));
+	get(reader, &run->sweeps_done, sizeof(long));
+	get(reader, &run->swap_rounds, sizeof(long));
+	get_rng(reader, &run->rng);
+	get_rng(reader, &default_rng);
+	set_genrand_state(&default_rng);
+
+	get(reader, &K, sizeof(int));
+	if (K < 1 || K != run->settings.num_chains) { printf("Checkpoint %s has a bad ladder.\n", reader->file_name); exit(1); }
+	allocate_ladder(&run->ladder, K);
+	get(reader, run->ladder.heat, K * sizeof(double));
+	get(reader, run->ladder.log_gap, K * sizeof(double));
+	get(reader, run->ladder.chain_on_rung, K * sizeof(int));
+	get(reader, run->ladder.swaps_proposed, K * sizeof(long));
+	get(reader, run->ladder.swaps_accepted, K * sizeof(long));
+	get(reader, run->ladder.swap_rate, K * sizeof(double));
+	get(reader, &run->ladder.adaptations, sizeof(long));
+
+	get(reader, p_params, sizeof(struct parameter_list));
+	*p_report_list = (struct current_case_report*)mem_malloc(MEM_REPORTS, (p_params->total_reports > 0 ? p_params->total_reports : 1)
+		* sizeof(struct current_case_report));
+	if (!*p_report_list) { printf("Could not allocate report_list in read_checkpoint.\n"); exit(1); }
+	if (p_params->total_reports > 0)
+		get(reader, *p_report_list, p_params->total_reports * sizeof(struct current_case_report));
+
+	run->chains = (struct chain_state*)mem_malloc(MEM_SAMPLER, K * sizeof(struct chain_state));
+	if (!run->chains) { printf("Could not allocate chains in read_checkpoint.\n"); exit(1); }
+	for (c = 0; c < K; c++) load_chain(reader, &run->chains[c]);
+	apply_ladder(run);
+
+	init_posterior_summary(&run->summary, &run->chains[0]);		//Subregions come from the cases
+	get(reader, &K, sizeof(int));
+	if (K != run->summary.num_quantities) { printf("Checkpoint %s has a bad summary.\n", reader->file_name); exit(1); }
+	get(reader, run->summary.quantity, K * sizeof(struct quantity_summary));
+}
+
+/*-------------------------------
+| writing in the background		|
+-------------------------------*/
+
+//Writes the pending buffer to the temporary file, then renames it over the checkpoint
+static void write_pending(struct checkpoint_writer *writer)
+{
+	FILE *output;
+	struct checkpoint_header header;
+	int ok;
+	unsigned long long ticks = profile_start();
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+	header.version = CHECKPOINT_VERSION;
+	header.layout = LAYOUT_CHECK;
+	header.payload_size = writer->pending.length;
+	header.checksum = fnv1a(writer->pending.data, writer->pending.length);
+
+	output = fopen(writer->temp_name, "wb");
+	if (output == NULL) {
+		printf("Could not open %s to write a checkpoint.\n", writer->temp_name);
+		return;
+	}
+	ok = fwrite(&header, sizeof(header), 1, output) == 1
+		&& fwrite(writer->pending.data, 1, writer->pending.length, output) == writer->pending.length
+		&& fflush(output) == 0 && fsync(fileno(output)) == 0;
+	ok = (fclose(output) == 0) && ok;
+	profile_stop(PROF_CHECKPOINT_IO, ticks);
+	profile_count(PROF_BYTES_WRITTEN, (long)(sizeof(header) + writer->pending.length));
+	if (!ok || rename(writer->temp_name, writer->file_name) != 0) {
+		printf("Could not write checkpoint %s - the previous one is kept.\n", writer->file_name);
+		return;
+	}
+	writer->written++;
+}
+
+static void *writer_main(void *arg)
+{
+	struct checkpoint_writer *writer = (struct checkpoint_writer*)arg;
+
+	pthread_mutex_lock(&writer->lock);
+	for (;;) {
+		while (!writer->busy && !writer->shutdown) pthread_cond_wait(&writer->wake, &writer->lock);
+		if (!writer->busy) break;		//Shut down with nothing left to write
+		pthread_mutex_unlock(&writer->lock);
+
+		write_pending(writer);
+
+		pthread_mutex_lock(&writer->lock);
+		writer->busy = 0;
+		pthread_cond_broadcast(&writer->idle);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return NULL;
+}
+
+struct checkpoint_writer *start_checkpoint_writer(const char *file_name)
+{
+	struct checkpoint_writer *writer;
+
+	writer = (struct checkpoint_writer*)mem_calloc(MEM_IO, 1, sizeof(struct checkpoint_writer));
+	if (!writer) { printf("Could not allocate writer in start_checkpoint_writer.\n"); exit(1); }
+	strncpy(writer->file_name, file_name, sizeof(writer->file_name) - 1);
+	snprintf(writer->temp_name, sizeof(writer->temp_name), "%s.tmp", writer->file_name);
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->wake, NULL);
+	pthread_cond_init(&writer->idle, NULL);
+	if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0) {
+		printf("Could not start the checkpoint writer thread.\n");
+		exit(1);
+	}
+	return writer;
+}
+
+//Packs the run and hands it to the writer thread. Returns 1 if the checkpoint was queued, or 0 if
+//it was skipped because the last one is still being written (the sampler never waits for the disk).
+int write_checkpoint(struct checkpoint_writer *writer, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report *reports)
+{
+	int busy;
+
+	pthread_mutex_lock(&writer->lock);
+	busy = writer->busy;
+	if (busy) writer->skipped++;
+	pthread_mutex_unlock(&writer->lock);
+	if (busy) return 0;
+
+	writer->pending.length = 0;				//The buffer is reused, so it only grows on the first checkpoint
+	save_run(&writer->pending, run, p_params, reports);
+
+	pthread_mutex_lock(&writer->lock);
+	writer->busy = 1;
+	pthread_cond_signal(&writer->wake);
+	pthread_mutex_unlock(&writer->lock);
+	return 1;
+}
+
+//Waits for any checkpoint still being written, then stops the writer thread
+void stop_checkpoint_writer(struct checkpoint_writer *writer)
+{
+	pthread_mutex_lock(&writer->lock);
+	while (writer->busy) pthread_cond_wait(&writer->idle, &writer->lock);
+	writer->shutdown = 1;
+	pthread_cond_signal(&writer->wake);
+	pthread_mutex_unlock(&writer->lock);
+	pthread_join(writer->thread, NULL);
+
+	log_info(LOG_SAMPLER, "Wrote %ld checkpoints to %s (%ld skipped while the disk was busy).",
+		writer->written, writer->file_name, writer->skipped);
+	pthread_cond_destroy(&writer->idle);
+	pthread_cond_destroy(&writer->wake);
+	pthread_mutex_destroy(&writer->lock);
+	mem_free(writer->pending.data);
+	mem_free(writer);
+}
+
+/*-------------------------------
+| restoring						|
+-------------------------------*/
+
+//Restores a run (and the parameters, reports and MTrandom's default stream) from a checkpoint,
+//reading the file in one go
+void read_checkpoint(const char *file_name, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report **p_report_list)
+{
+	FILE *input;
+	long size;
+	unsigned char *data;
+	struct checkpoint_header header;
+	struct byte_reader reader;
+
+	input = fopen(file_name, "rb");
+	if (input == NULL) { printf("Checkpoint %s could not be opened.\n", file_name); exit(1); }
+	fseek(input, 0, SEEK_END);
+	size = ftell(input);
+	fseek(input, 0, SEEK_SET);
+	if (size < (long)sizeof(header)) { printf("Checkpoint %s is too short.\n", file_name); exit(1); }
+	data = (unsigned char*)mem_malloc(MEM_IO, size);
+	if (!data) { printf("Could not allocate data in read_checkpoint.\n"); exit(1); }
+	if (fread(data, 1, size, input) != (size_t)size) { printf("Could not read checkpoint %s.\n", file_name); exit(1); }
+	fclose(input);
+
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, 8) != 0) { printf("%s is not a checkpoint.\n", file_name); exit(1); }
+	if (header.version != CHECKPOINT_VERSION || header.layout != LAYOUT_CHECK) {
+		printf("Checkpoint %s was written by a different version of the code or machine.\n", file_name);
+		exit(1);
+	}
+	if (header.payload_size != size - sizeof(header)
+		|| header.checksum != fnv1a(data + sizeof(header), header.payload_size)) {
+		printf("Checkpoint %s is damaged.\n", file_name);
+		exit(1);
+	}
+
+	reader.data = data + sizeof(header);
+	reader.length = header.payload_size;
+	reader.position = 0;
+	reader.file_name = file_name;
+	load_run(&reader, run, p_params, p_report_list);
+	mem_free(data);
+}
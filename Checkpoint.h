@@ -0,0 +1,51 @@
+/********************************************************************************
+*	Checkpoint.h																*
+*	Contains:																	*
+*		- The record each case is saved as (pointers become case indices)		*
+*		- Functions defined in Checkpoint.c										*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h, Posterior_Summary.h and Parallel_Tempering.h first.	*
+********************************************************************************/
+
+#define CHECKPOINT_MAGIC "EBOLACKP"	//First 8 bytes of every checkpoint file
+#define CHECKPOINT_VERSION 10		//Change whenever the layout below changes
+#define NO_CASE -1					//Index saved in place of a NULL pointer
+
+//A case as saved in a checkpoint. secondary_cases_gen is not saved - it is rebuilt from the
+//children's exposure dates, which keeps each record to about a seventh of a struct patient.
+struct checkpoint_case
+{
+	int index;
+	char country[50];
+	char subregion[100];
+	double x;
+	double y;
+	int location;
+	int dates[4];
+	int parent_case;		//Indices into the chain's block of cases (NO_CASE for NULL)
+	int first_2dary;
+	int left_sib;
+	int right_sib;
+	int next;
+	int prev;
+	int transmission_type;
+	int survive;
+	int est_case;
+	int diag;
+	int diag_day;
+	int secondary_cases;
+	int pop_dens;
+};
+
+struct checkpoint_writer;	//Defined in Checkpoint.c - only used through the functions below
+
+/****************************************
+* Functions defined in Checkpoint.c		*
+****************************************/
+
+struct checkpoint_writer *start_checkpoint_writer(const char *file_name);
+int write_checkpoint(struct checkpoint_writer *writer, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report *reports);
+void stop_checkpoint_writer(struct checkpoint_writer *writer);
+void read_checkpoint(const char *file_name, struct sampler_run *run, struct parameter_list *p_params,
+	struct current_case_report **p_report_list);
@@ -0,0 +1,236 @@
+/********************************************************************************
+*	Coloured_Sweep.c															*
+*	Date moves of one chain spread over a pool of threads. A date move of a	*
+*		case changes only its own term and those of its children, so cases	*
+*		that are not parent and child can be moved at the same time. Cases of	*
+*		even generation are moved first, then those of odd generation.			*
+*	Each block of a colour has its own random number stream and keeps its		*
+*		changes to the statistics to itself until the colour is finished.		*
+*		Siblings share a parent, whose count of exposures per day is the only	*
+*		thing two blocks may write at once - it is changed atomically.			*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcpy and memset
+#include <math.h>						//For log
+#include "MTrandom.h"					//For random number generation (a stream for each block)
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood cache
+#include "Incidence.h"					//For the event counts of the chains
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Thread_Pool.h"				//For running blocks on every core
+#include "Coloured_Sweep.h"				//For structures and declarations of functions needed in this file
+#include "Spatial_Kernel.h"				//Needed by Renewal.h
+#include "Renewal.h"					//For moving the onsets of the renewal engine
+#include "Memory.h"						//For memory accounting
+
+/*-------------------------------
+| setting up					|
+-------------------------------*/
+
+struct coloured_sweep *create_coloured_sweep(struct thread_pool *pool)
+{
+	struct coloured_sweep *sweep = (struct coloured_sweep*)mem_calloc(MEM_SAMPLER, 1, sizeof(struct coloured_sweep));
+
+	if (!sweep) { printf("Could not allocate sweep in create_coloured_sweep.\n"); exit(1); }
+	sweep->pool = pool;
+	return sweep;
+}
+
+void free_coloured_sweep(struct coloured_sweep *sweep)
+{
+	int b;
+
+	for (b = 0; b < COLOUR_BLOCKS; b++) {
+		mem_free(sweep->block[b].scratch);
+		mem_free(sweep->block[b].onset_moves);
+	}
+	mem_free(sweep->colour[0]);
+	mem_free(sweep->colour[1]);
+	mem_free(sweep);
+}
+
+//Sorts the cases of chain by the parity of their generation, walking each tree of the forest
+//through its child and sibling links
+static void colour_cases(struct coloured_sweep *sweep, struct chain_state *chain)
+{
+	int parity;
+	p_patient root, current;
+
+	if (sweep->capacity < chain->num_cases) {
+		sweep->capacity = 2 * chain->num_cases;
+		sweep->colour[0] = (p_patient*)mem_realloc(MEM_SAMPLER, sweep->colour[0], sweep->capacity * sizeof(p_patient));
+		sweep->colour[1] = (p_patient*)mem_realloc(MEM_SAMPLER, sweep->colour[1], sweep->capacity * sizeof(p_patient));
+		if (!sweep->colour[0] || !sweep->colour[1]) { printf("Could not allocate colours in colour_cases.\n"); exit(1); }
+	}
+
+	sweep->colour_size[0] = sweep->colour_size[1] = 0;
+	for (root = chain->first_case; root != NULL; root = root->next) {
+		if (root->parent_case) continue;
+		current = root;
+		parity = 0;
+		while (1) {
+			sweep->colour[parity][sweep->colour_size[parity]++] = current;
+			if (current->first_2dary) {				//Down to the first child
+				current = current->first_2dary;
+				parity ^= 1;
+				continue;
+			}
+			while (current != root && current->right_sib == NULL) {	//Up until there is a sibling to visit
+				current = current->parent_case;
+				parity ^= 1;
+			}
+			if (current == root) break;
+			current = current->right_sib;
+		}
+	}
+	if (sweep->colour_size[0] + sweep->colour_size[1] != chain->num_cases) {
+		printf("Only %d of %d cases are in the transmission forest.\n", sweep->colour_size[0] + sweep->colour_size[1], chain->num_cases);
+		exit(1);
+	}
+}
+
+/*-------------------------------
+| moves							|
+-------------------------------*/
+
+static void grow_scratch(struct colour_block *block)
+{
+	block->scratch_size = block->scratch_size ? 2 * block->scratch_size : 16;
+	block->scratch = (struct case_contribution*)mem_realloc(MEM_SAMPLER, block->scratch, block->scratch_size * sizeof(struct case_contribution));
+	if (!block->scratch) { printf("Could not allocate scratch in grow_scratch.\n"); exit(1); }
+}
+
+//Notes a moved onset, to go to the renewal engine once the blocks are done (it isn't thread safe)
+static void note_onset_move(struct colour_block *block, int location, int from, int to)
+{
+	if (block->num_onset_moves == block->onset_moves_size) {
+		block->onset_moves_size = block->onset_moves_size ? 2 * block->onset_moves_size : 64;
+		block->onset_moves = (int*)mem_realloc(MEM_SAMPLER, block->onset_moves, 3 * block->onset_moves_size * sizeof(int));
+		if (!block->onset_moves) { printf("Could not allocate onset moves in note_onset_move.\n"); exit(1); }
+	}
+	block->onset_moves[3 * block->num_onset_moves] = location;
+	block->onset_moves[3 * block->num_onset_moves + 1] = from;
+	block->onset_moves[3 * block->num_onset_moves + 2] = to;
+	block->num_onset_moves++;
+}
+
+//Moves one of parent's exposures from day from to day to
+static void move_exposure(p_patient parent, int from, int to)
+{
+	if (from >= 0 && from < NUMDAYS) __atomic_fetch_sub(&parent->secondary_cases_gen[from], 1, __ATOMIC_RELAXED);
+	if (to >= 0 && to < NUMDAYS) __atomic_fetch_add(&parent->secondary_cases_gen[to], 1, __ATOMIC_RELAXED);
+}
+
+//The date move of Gibbs_Sampler.c for a given case, working out the change in the likelihood
+//from the terms of the case and its children alone. The parent keeps its list of children as it
+//is, so siblings in other blocks are left alone.
+static void block_date_move(struct colour_block *block, struct chain_state *chain, p_patient current, int step)
+{
+	struct likelihood_cache *cache = &chain->cache;
+	struct case_contribution *cached = &cache->contrib[current->index];
+	struct case_contribution new_contrib;
+	p_patient child;
+	int slot = (int)(uniform_r(&block->rng) * 4);
+	int shift = 1 + (int)(uniform_r(&block->rng) * step);
+	int old_dates[4];
+	int n;
+	double delta, log_ratio;
+
+	if (uniform_r(&block->rng) < 0.5) shift = -shift;
+	block->proposed++;
+
+	memcpy(old_dates, current->dates, sizeof(old_dates));
+	if (current->survive && slot >= 2) current->dates[2] = current->dates[3] = old_dates[2] + shift;
+	else current->dates[slot] += shift;
+
+	if (case_is_valid(current)) {
+		case_contribution(current, &new_contrib);
+		delta = cache_shared_term(cache, &new_contrib) - cache_shared_term(cache, cached);
+		n = 0;
+		for (child = current->first_2dary; child != NULL; child = child->right_sib) {
+			if (n == block->scratch_size) grow_scratch(block);
+			case_contribution(child, &block->scratch[n]);
+			if (!block->scratch[n].valid) break;				//A child no longer fits in the windows
+			delta += cache_shared_term(cache, &block->scratch[n]) - cache_shared_term(cache, &cache->contrib[child->index]);
+			n++;
+		}
+		log_ratio = chain->heat * delta;
+		if (child == NULL && (log_ratio >= 0 || log(uniform_r(&block->rng)) < log_ratio)) {
+			apply_contribution(&block->delta, cached, -1);
+			*cached = new_contrib;
+			apply_contribution(&block->delta, cached, 1);
+			n = 0;
+			for (child = current->first_2dary; child != NULL; child = child->right_sib) {
+				cached = &cache->contrib[child->index];
+				apply_contribution(&block->delta, cached, -1);
+				*cached = block->scratch[n++];
+				apply_contribution(&block->delta, cached, 1);
+			}
+			block->delta_log_lik += delta;
+			block->accepted++;
+			if (current->parent_case && current->dates[0] != old_dates[0])
+				move_exposure(current->parent_case, old_dates[0], current->dates[0]);
+			if (chain->incidence.tree) incidence_move_dates(&chain->incidence, current, old_dates);
+			if (chain->renewal && current->dates[1] != old_dates[1]) note_onset_move(block, current->location, old_dates[1], current->dates[1]);
+			return;
+		}
+	}
+
+	memcpy(current->dates, old_dates, sizeof(old_dates));		//Rejected - put the dates back
+}
+
+//Pool task: every case of one block in turn
+static void sweep_block(void *arg, int task, int thread)
+{
+	struct coloured_sweep *sweep = (struct coloured_sweep*)arg;
+	struct colour_block *block = &sweep->block[task];
+	int i;
+
+	for (i = 0; i < block->num_cases; i++) block_date_move(block, sweep->chain, block->cases[i], sweep->step);
+}
+
+//One date move of every case of chain, each colour split into blocks that run side by side.
+//The chain's statistics must be valid (no invalid cases) - every move is judged on its own terms.
+void coloured_date_moves(struct coloured_sweep *sweep, struct chain_state *chain, int step)
+{
+	int c, b, num_blocks, size, *move;
+	struct colour_block *block;
+
+	sweep->chain = chain;
+	sweep->step = step;
+	colour_cases(sweep, chain);
+	cache_prepare_terms(&chain->cache, step);		//A shift of step days changes a duration by at most step
+
+	for (c = 0; c < 2; c++) {
+		size = sweep->colour_size[c];
+		if (size == 0) continue;
+		num_blocks = size / COLOUR_BLOCK_MIN_CASES;
+		if (num_blocks < 1) num_blocks = 1;
+		if (num_blocks > COLOUR_BLOCKS) num_blocks = COLOUR_BLOCKS;
+
+		for (b = 0; b < num_blocks; b++) {
+			block = &sweep->block[b];
+			init_genrand_r(&block->rng, genrand_int32_r(&chain->rng));
+			block->cases = sweep->colour[c] + (long)b * size / num_blocks;
+			block->num_cases = (int)((long)(b + 1) * size / num_blocks - (long)b * size / num_blocks);
+			clear_model_stats(&block->delta);
+			block->delta_log_lik = 0;
+			block->proposed = block->accepted = 0;
+			block->num_onset_moves = 0;
+		}
+		run_pool_tasks(sweep->pool, sweep_block, sweep, num_blocks);
+
+		for (b = 0; b < num_blocks; b++) {				//In order, so the totals don't depend on the threads
+			block = &sweep->block[b];
+			cache_merge(&chain->cache, &block->delta, block->delta_log_lik);
+			chain->proposed[MOVE_DATES] += block->proposed;
+			chain->accepted[MOVE_DATES] += block->accepted;
+			for (move = block->onset_moves; move < block->onset_moves + 3 * block->num_onset_moves; move += 3)
+				renewal_move_onset(chain->renewal, move[0], move[1], move[2]);
+		}
+	}
+	chain->log_lik = cache_log_lik(&chain->cache);
+}
@@ -0,0 +1,54 @@
+/********************************************************************************
+*	Coloured_Sweep.h															*
+*	Contains:																	*
+*		- State of parallel sweeps of the date moves of one chain. Cases are	*
+*			coloured by the parity of their generation in the transmission		*
+*			forest, so no two cases of a colour are parent and child, and each	*
+*			colour is split into blocks that are moved at once on a pool		*
+*		- Functions defined in Coloured_Sweep.c									*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h and Thread_Pool.h first.								*
+********************************************************************************/
+
+#define COLOUR_BLOCKS 32			//Most blocks per colour - fixed, so results don't depend on the number of threads
+#define COLOUR_BLOCK_MIN_CASES 64	//Fewest cases in a block (smaller blocks are not worth a task)
+
+/************************************************
+* Structures of a coloured sweep				*
+************************************************/
+
+//One block of cases of one colour, moved in order by whichever thread claims it
+struct colour_block
+{
+	struct mt_state rng;				//Seeded from the chain's stream before every colour
+	p_patient *cases;					//Part of the colour's list of cases
+	int num_cases;
+	struct model_stats delta;			//Change to the chain's statistics from the moves accepted
+	double delta_log_lik;
+	long proposed;
+	long accepted;
+	struct case_contribution *scratch;	//New contributions of the children of the case being moved
+	int scratch_size;
+	int *onset_moves;					//(location, from, to) of every onset moved, for the chain's renewal engine
+	int num_onset_moves;
+	int onset_moves_size;
+};
+
+struct coloured_sweep
+{
+	struct thread_pool *pool;
+	p_patient *colour[2];				//colour[c]: cases whose generation has parity c
+	int colour_size[2];
+	int capacity;						//Room in each colour's list
+	struct chain_state *chain;			//Chain being swept (one at a time)
+	int step;							//Largest date shift of this sweep
+	struct colour_block block[COLOUR_BLOCKS];
+};
+
+/****************************************
+* Functions defined in Coloured_Sweep.c	*
+****************************************/
+
+struct coloured_sweep *create_coloured_sweep(struct thread_pool *pool);
+void free_coloured_sweep(struct coloured_sweep *sweep);
+void coloured_date_moves(struct coloured_sweep *sweep, struct chain_state *chain, int step);
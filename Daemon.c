@@ -0,0 +1,583 @@
+/********************************************************************************
+*	Daemon.c																	*
+*	Serves fit and simulation jobs over a Unix domain socket (see Daemon.h).	*
+*	The lfunc2 table is built once, and each case file is read once (again		*
+*		if it changes on disk), so a job starts from parsed reports rather		*
+*		than from a new process. The daemon only parses the reports - the		*
+*		cases are made in the job's child, under its limits.					*
+*	Each job runs in a child forked for it, so its memory budget and CPU		*
+*		limit apply to it alone, and a job that goes over them, or fails,		*
+*		takes nothing else down. The child has its own copy of the warm			*
+*		tables and reports (shared with the daemon until either writes).		*
+*	A client connects, sends one request line and reads the replies, one		*
+*		JSON object a line, until the daemon closes the connection: accepted,	*
+*		running, then done (or error, at any point). Requests are read as		*
+*		they arrive, alongside the socket and the ending jobs, so a client		*
+*		that is slow to send holds up nobody but itself.						*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strstr and strcmp
+#include <stdarg.h>						//For the replies' formats
+#include <math.h>						//For ceil
+#include <time.h>						//For timing the jobs
+#include <signal.h>						//For ignoring broken connections
+#include <unistd.h>						//For fork, pipe and close
+#include <fcntl.h>						//For a pipe that never blocks
+#include <errno.h>						//For keeping errno across the signal handler
+#include <poll.h>						//For waiting on the socket
+#include <sys/socket.h>					//For the socket
+#include <sys/un.h>						//For Unix domain addresses
+#include <sys/stat.h>					//For the case files' modification times
+#include <sys/wait.h>					//For finished jobs
+#include <sys/resource.h>				//For the CPU limit
+#include "MTrandom.h"					//Needed by Gibbs_Sampler.h
+#include "Date_And_Reading_Reports.h"	//For the model contexts
+#include "lfunc.h"						//For the lfunc2 table
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For initialise_parameters
+#include "Posterior_Summary.h"			//Needed by Parallel_Tempering.h
+#include "Parallel_Tempering.h"			//For fit jobs
+#include "Outbreak_Simulator.h"			//For simulation jobs
+#include "Trace.h"						//For simulating from a trace sample
+#include "Log.h"						//For status lines, and closing the log's writer before forking
+#include "Daemon.h"						//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting and the jobs' budgets
+
+//A case file kept parsed
+struct daemon_dataset
+{
+	struct model_context model;
+	time_t modified;			//Of the case file when it was read
+	long last_use;				//Number of the last job to use it
+};
+
+//A job running in a child
+struct daemon_job
+{
+	pid_t pid;
+	int client;					//Connection its replies go to (kept open to report how it ended)
+	long number;
+};
+
+//A connection whose request is still being read, or is waiting for a job to end
+struct daemon_pending
+{
+	int client;
+	int complete;				//1 once the line is in (or the client stopped sending)
+	size_t used;
+	double received;			//When it was accepted
+	char line[DAEMON_REQUEST_SIZE];
+};
+
+struct daemon
+{
+	int listener;
+	struct sampler_settings *settings;
+	struct simulation_settings *sim_settings;
+	struct daemon_dataset datasets[DAEMON_MAX_DATASETS];
+	int num_datasets;
+	struct daemon_job jobs[DAEMON_MAX_JOBS];
+	int num_running;
+	int max_running;
+	struct daemon_pending pending[DAEMON_MAX_PENDING];	//In the order they were accepted
+	int num_pending;
+	long jobs_started;
+	long jobs_failed;
+	long dataset_loads;
+	long dataset_hits;
+	int stopping;				//1 once asked to shut down - no more jobs are taken
+	double started;
+};
+
+static int wake_pipe[2];		//A byte is written whenever a job ends, to wake the poll for the socket
+
+static void job_ended(int signal_number)
+{
+	int saved = errno;
+
+	if (write(wake_pipe[1], "", 1) < 0) {}			//Full already, which wakes it as well
+	errno = saved;
+}
+
+static double now_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+/*-------------------------------
+| requests and replies			|
+-------------------------------*/
+
+//Copies the value of "key" in a flat JSON object (a string without its quotes, or a bare number)
+//into value. Returns 0 if the key is not there.
+static int json_value(const char *line, const char *key, char *value, size_t size)
+{
+	char pattern[64];
+	const char *at, *p;
+	size_t n = 0;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+	for (at = strstr(line, pattern); at; at = strstr(at + 1, pattern)) {
+		p = at + strlen(pattern);
+		while (*p == ' ' || *p == '\t') p++;
+		if (*p != ':') continue;				//A string value that happens to match the key
+		for (p++; *p == ' ' || *p == '\t'; p++);
+		if (*p == '"') {
+			for (p++; *p && *p != '"'; p++) {
+				if (*p == '\\' && p[1]) p++;
+				if (n + 1 < size) value[n++] = *p;
+			}
+		}
+		else while (*p && *p != ',' && *p != '}' && *p != ' ' && n + 1 < size) value[n++] = *p++;
+		value[n] = 0;
+		return 1;
+	}
+	return 0;
+}
+
+//Reads "key" as a number into number, leaving it as it was if the key is not there. Returns 0 if it is not a number.
+static int json_number(const char *line, const char *key, double *number)
+{
+	char value[64], *end;
+	double read;
+
+	if (!json_value(line, key, value, sizeof(value))) return 1;
+	read = strtod(value, &end);
+	if (end == value || *end) return 0;
+	*number = read;
+	return 1;
+}
+
+//Fills request from a request line, starting from the daemon's own settings. Returns 0 if the line
+//is not understood (an unknown type, or a number that is not one).
+int parse_daemon_request(const char *line, struct daemon_request *request, struct sampler_settings *settings,
+	struct simulation_settings *sim_settings)
+{
+	double seed, chains, sweeps, burn_in, threads, days, max_cases, hybrid, sample = -1;
+	struct parameter_list check;
+
+	memset(request, 0, sizeof(struct daemon_request));
+	if (!json_value(line, "type", request->type, sizeof(request->type))) return 0;
+	if (strcmp(request->type, "fit") && strcmp(request->type, "simulate") && strcmp(request->type, "status")
+		&& strcmp(request->type, "shutdown")) return 0;
+	json_value(line, "data", request->data, sizeof(request->data));
+	json_value(line, "summary", request->summary, sizeof(request->summary));
+	json_value(line, "output", request->output, sizeof(request->output));
+	json_value(line, "trace", request->trace, sizeof(request->trace));
+	json_value(line, "params", request->params, sizeof(request->params));
+	memset(&check, 0, sizeof(struct parameter_list));
+	if (request->params[0] && !set_parameter_values(&check, request->params)) return 0;
+	seed = settings->seed;
+	chains = settings->num_chains;
+	sweeps = settings->num_sweeps;
+	burn_in = settings->burn_in;
+	threads = 1;
+	days = sim_settings->num_days;
+	max_cases = sim_settings->max_cases;
+	hybrid = sim_settings->hybrid_threshold;
+	if (!json_number(line, "seed", &seed) || !json_number(line, "chains", &chains) || !json_number(line, "sweeps", &sweeps)
+		|| !json_number(line, "burnin", &burn_in) || !json_number(line, "threads", &threads) || !json_number(line, "days", &days)
+		|| !json_number(line, "max_cases", &max_cases) || !json_number(line, "hybrid", &hybrid)
+		|| !json_number(line, "sample", &sample)
+		|| !json_number(line, "max_memory_mb", &request->max_memory_mb)
+		|| !json_number(line, "max_cpu_s", &request->max_cpu_seconds)) return 0;
+	if (chains < 1 || sweeps < 0 || burn_in < 0 || threads < 1 || days < 1 || max_cases < 1 || hybrid < 0) return 0;
+	request->seed = (unsigned long)seed;
+	request->num_chains = (int)chains;
+	request->num_sweeps = (long)sweeps;
+	request->burn_in = (long)burn_in;
+	request->num_threads = (int)threads;
+	request->num_days = (int)days;
+	request->max_cases = (long)max_cases;
+	request->hybrid_threshold = (long)hybrid;
+	request->sample = (long)sample;
+	return strcmp(request->type, "fit") || request->data[0];		//A fit needs a case file
+}
+
+//Sends one reply line. A client that has gone away is not an error - its job simply runs unheard.
+static void reply(int client, const char *format, ...)
+{
+	char line[1000];
+	va_list args;
+	int length, sent;
+
+	va_start(args, format);
+	length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (length > (int)sizeof(line) - 1) length = sizeof(line) - 1;
+	while (length > 0 && (sent = (int)write(client, line, length)) > 0) {
+		memmove(line, line + sent, length - sent);
+		length -= sent;
+	}
+}
+
+//Reads what has arrived of a request, without waiting. Marks it complete at a newline, the end of
+//the connection or a full line, and puts the connection back to blocking writes for the replies.
+static void read_request(struct daemon_pending *pending)
+{
+	ssize_t got = -1;
+
+	while (pending->used + 1 < sizeof(pending->line)
+		&& (got = read(pending->client, pending->line + pending->used, sizeof(pending->line) - 1 - pending->used)) > 0) {
+		pending->used += got;
+		pending->line[pending->used] = 0;
+		if (strchr(pending->line, '\n')) break;
+	}
+	pending->line[pending->used] = 0;
+	if (strchr(pending->line, '\n') || pending->used + 1 >= sizeof(pending->line) || got == 0
+		|| (errno != EAGAIN && errno != EWOULDBLOCK)) pending->complete = 1;
+	if (pending->complete) fcntl(pending->client, F_SETFL, 0);
+}
+
+/*-------------------------------
+| warm case files				|
+-------------------------------*/
+
+//The parsed case file, read now if it is new or has changed. Returns NULL if it cannot be read
+//(and forgets it), without making its cases.
+static struct daemon_dataset *find_dataset(struct daemon *daemon, const char *file_name, int *loaded)
+{
+	struct daemon_dataset *dataset = NULL;
+	struct stat status;
+	int d;
+
+	*loaded = 0;
+	if (stat(file_name, &status) != 0 || !S_ISREG(status.st_mode)) return NULL;
+	for (d = 0; d < daemon->num_datasets; d++)
+		if (strcmp(daemon->datasets[d].model.case_file_name, file_name) == 0) dataset = &daemon->datasets[d];
+	if (dataset && dataset->modified == status.st_mtime) {
+		daemon->dataset_hits++;
+		return dataset;
+	}
+	if (!dataset && daemon->num_datasets < DAEMON_MAX_DATASETS) dataset = &daemon->datasets[daemon->num_datasets++];
+	else if (!dataset) {							//Full - the one used longest ago makes way
+		dataset = &daemon->datasets[0];
+		for (d = 1; d < daemon->num_datasets; d++)
+			if (daemon->datasets[d].last_use < dataset->last_use) dataset = &daemon->datasets[d];
+	}
+	free_model_context(&dataset->model);			//Nothing, for a slot never used
+	init_model_context(&dataset->model, file_name, 0, 1);
+	if (!read_case_reports(&dataset->model)) {
+		*dataset = daemon->datasets[--daemon->num_datasets];	//Its slot goes to the last one
+		memset(&daemon->datasets[daemon->num_datasets], 0, sizeof(struct daemon_dataset));
+		return NULL;
+	}
+	dataset->modified = status.st_mtime;
+	daemon->dataset_loads++;
+	*loaded = 1;
+	return dataset;
+}
+
+/*-------------------------------
+| jobs							|
+-------------------------------*/
+
+static void run_fit_job(struct daemon *daemon, struct daemon_request *request, struct daemon_dataset *dataset, int client,
+	long number, double received)
+{
+	struct model_context model = dataset->model;	//The child's own copy of the parsed reports
+	struct sampler_settings settings = *daemon->settings;
+	double start, log_lik;
+
+	model.seed = request->seed;
+	model.num_threads = request->num_threads;
+	generate_cases(&model);
+	initialise_parameters(&model.params);
+	settings.seed = request->seed;
+	settings.num_chains = request->num_chains;
+	settings.num_sweeps = request->num_sweeps;
+	settings.burn_in = request->burn_in;
+	settings.num_threads = request->num_threads;
+	settings.case_threads = 0;
+	settings.quiet = 1;
+	settings.checkpoint_file[0] = 0;
+	settings.restart_file[0] = 0;
+	settings.trace_file[0] = 0;
+	settings.spatial_file[0] = 0;
+	settings.renewal_file[0] = 0;
+	settings.live_name[0] = 0;
+	strcpy(settings.summary_file, request->summary);
+
+	start = now_seconds();
+	reply(client, "{\"job\": %ld, \"status\": \"running\", \"setup_ms\": %.3f}\n", number, 1000 * (start - received));
+	log_lik = run_gibbs_sampler(&model, &settings);
+	reply(client, "{\"job\": %ld, \"status\": \"done\", \"log_lik\": %.6f, \"reports\": %d, \"cases\": %d, \"seconds\": %.3f}\n",
+		number, log_lik, model.params.total_reports, model.params.total_cases, now_seconds() - start);
+}
+
+static void run_simulation_job(struct daemon *daemon, struct daemon_request *request, int client, long number, double received)
+{
+	struct simulation_settings sim_settings = *daemon->sim_settings;
+	struct parameter_list params;
+	struct simulation sim;
+	double start;
+
+	memset(&params, 0, sizeof(struct parameter_list));
+	initialise_parameters(&params);
+	if (request->trace[0] && !read_trace_parameters(request->trace, request->sample, &params)) {
+		reply(client, "{\"job\": %ld, \"status\": \"error\", \"error\": \"the trace has no such sample\"}\n", number);
+		return;
+	}
+	if (request->params[0]) set_parameter_values(&params, request->params);	//Checked when the request was read
+	sim_settings.seed = request->seed;
+	sim_settings.num_days = request->num_days;
+	sim_settings.max_cases = request->max_cases;
+	sim_settings.hybrid_threshold = request->hybrid_threshold;
+
+	start = now_seconds();
+	reply(client, "{\"job\": %ld, \"status\": \"running\", \"setup_ms\": %.3f}\n", number, 1000 * (start - received));
+	init_simulation(&sim, &params, &sim_settings);
+	run_simulation(&sim);
+	if (request->output[0]) write_simulation(&sim, request->output);
+	reply(client, "{\"job\": %ld, \"status\": \"done\", \"cases\": %ld, \"last_day\": %d, \"stopped\": %d, \"seconds\": %.3f}\n",
+		number, sim.num_cases, sim.last_day, sim.stopped, now_seconds() - start);
+	free_simulation(&sim);
+}
+
+//In the child: sets the job's limits, runs it and leaves without the daemon's exit handlers
+static void run_job(struct daemon *daemon, struct daemon_request *request, struct daemon_dataset *dataset, int client,
+	long number, double received)
+{
+	struct memory_usage total;
+	struct rlimit limit;
+	char budget[64];
+	int j;
+
+	close(daemon->listener);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	for (j = 0; j < daemon->num_running; j++) close(daemon->jobs[j].client);	//Or they would stay open until this job ends
+	for (j = 0; j < daemon->num_pending; j++)
+		if (daemon->pending[j].client != client) close(daemon->pending[j].client);
+	signal(SIGCHLD, SIG_DFL);
+	if (request->max_cpu_seconds > 0) {
+		limit.rlim_cur = (rlim_t)ceil(request->max_cpu_seconds);
+		limit.rlim_max = limit.rlim_cur + 1;			//SIGXCPU at the first, SIGKILL at the second
+		setrlimit(RLIMIT_CPU, &limit);
+	}
+	if (request->max_memory_mb > 0) {					//On top of the warm tables and reports it starts with
+		memory_usage(MEM_TOTAL, &total);
+		snprintf(budget, sizeof(budget), "total=%lld", total.live + (long long)(request->max_memory_mb * 1024 * 1024));
+		set_memory_budgets(budget);
+	}
+	if (strcmp(request->type, "fit") == 0) run_fit_job(daemon, request, dataset, client, number, received);
+	else run_simulation_job(daemon, request, client, number, received);
+	fflush(stdout);
+	_exit(0);
+}
+
+//Collects finished jobs, waiting for one if wait is set, and tells the clients of any that failed
+static void reap_jobs(struct daemon *daemon, int wait)
+{
+	pid_t pid;
+	int status, j;
+
+	while ((pid = waitpid(-1, &status, wait ? 0 : WNOHANG)) > 0) {
+		wait = 0;
+		for (j = 0; j < daemon->num_running && daemon->jobs[j].pid != pid; j++);
+		if (j == daemon->num_running) continue;
+		if (WIFSIGNALED(status)) {
+			daemon->jobs_failed++;
+			if (WTERMSIG(status) == SIGXCPU || WTERMSIG(status) == SIGKILL)
+				reply(daemon->jobs[j].client, "{\"job\": %ld, \"status\": \"error\", \"error\": \"CPU limit reached\"}\n", daemon->jobs[j].number);
+			else reply(daemon->jobs[j].client, "{\"job\": %ld, \"status\": \"error\", \"error\": \"killed by signal %d\"}\n",
+				daemon->jobs[j].number, WTERMSIG(status));
+		}
+		else if (WEXITSTATUS(status) != 0) {
+			daemon->jobs_failed++;
+			reply(daemon->jobs[j].client, "{\"job\": %ld, \"status\": \"error\", \"error\": \"failed with status %d "
+				"(over its memory limit, or see the daemon's output)\"}\n", daemon->jobs[j].number, WEXITSTATUS(status));
+		}
+		close(daemon->jobs[j].client);
+		daemon->jobs[j] = daemon->jobs[--daemon->num_running];
+	}
+}
+
+//Answers a request read in full: status and shutdown at once, and a fit or simulation by starting a child for it.
+//Returns 0, leaving the connection open, if the job has to wait for one running to end.
+static int handle_request(struct daemon *daemon, struct daemon_pending *pending)
+{
+	struct daemon_request request;
+	struct daemon_dataset *dataset = NULL;
+	int client = pending->client, loaded = 0;
+	long number;
+	pid_t pid;
+
+	if (!pending->used) { close(client); return 1; }
+	if (!parse_daemon_request(pending->line, &request, daemon->settings, daemon->sim_settings)) {
+		reply(client, "{\"status\": \"error\", \"error\": \"request not understood\"}\n");
+		close(client);
+		return 1;
+	}
+	if (strcmp(request.type, "status") == 0) {
+		reply(client, "{\"status\": \"ok\", \"jobs\": %ld, \"failed\": %ld, \"running\": %d, \"datasets\": %d, "
+			"\"dataset_loads\": %ld, \"dataset_hits\": %ld, \"uptime_s\": %.1f}\n", daemon->jobs_started, daemon->jobs_failed,
+			daemon->num_running, daemon->num_datasets, daemon->dataset_loads, daemon->dataset_hits, now_seconds() - daemon->started);
+		close(client);
+		return 1;
+	}
+	if (strcmp(request.type, "shutdown") == 0) {
+		daemon->stopping = 1;
+		reply(client, "{\"status\": \"stopping\", \"running\": %d}\n", daemon->num_running);
+		close(client);
+		return 1;
+	}
+	if (daemon->stopping) {
+		reply(client, "{\"status\": \"error\", \"error\": \"the daemon is stopping\"}\n");
+		close(client);
+		return 1;
+	}
+	if (daemon->num_running >= daemon->max_running) return 0;
+	if (strcmp(request.type, "fit") == 0 && !(dataset = find_dataset(daemon, request.data, &loaded))) {
+		reply(client, "{\"status\": \"error\", \"error\": \"cannot read the case file\"}\n");
+		close(client);
+		return 1;
+	}
+
+	number = ++daemon->jobs_started;
+	if (dataset) dataset->last_use = number;
+	reply(client, "{\"job\": %ld, \"status\": \"accepted\"%s}\n", number,
+		!dataset ? "" : loaded ? ", \"dataset\": \"loaded\"" : ", \"dataset\": \"cached\"");
+	fflush(stdout);									//Or the child would write it out again
+	pid = fork();
+	if (pid == 0) run_job(daemon, &request, dataset, client, number, pending->received);
+	if (pid < 0) {
+		daemon->jobs_failed++;
+		reply(client, "{\"job\": %ld, \"status\": \"error\", \"error\": \"could not start the job\"}\n", number);
+		close(client);
+		return 1;
+	}
+	daemon->jobs[daemon->num_running].pid = pid;
+	daemon->jobs[daemon->num_running].client = client;
+	daemon->jobs[daemon->num_running].number = number;
+	daemon->num_running++;
+	return 1;
+}
+
+//Answers every request read in full, in the order they came, unless its job has to wait
+static void handle_pending(struct daemon *daemon)
+{
+	int p = 0;
+
+	while (p < daemon->num_pending) {
+		if (!daemon->pending[p].complete || !handle_request(daemon, &daemon->pending[p])) { p++; continue; }
+		daemon->num_pending--;
+		memmove(&daemon->pending[p], &daemon->pending[p + 1], (daemon->num_pending - p) * sizeof(struct daemon_pending));
+	}
+}
+
+/*-------------------------------
+| serving						|
+-------------------------------*/
+
+//Serves jobs on socket_path until a shutdown request, running up to settings->num_threads at once.
+//settings and sim_settings are the defaults of every request.
+void run_daemon(const char *socket_path, struct sampler_settings *settings, struct simulation_settings *sim_settings)
+{
+	struct daemon *daemon;
+	struct sockaddr_un address;
+	struct pollfd waiting[2 + DAEMON_MAX_PENDING];
+	int reading[2 + DAEMON_MAX_PENDING];			//The pending connection each of waiting is for (-1 for none)
+	struct sigaction action;
+	struct stat status;
+	struct daemon_pending *pending;
+	char drained[64];
+	double now, wait;
+	int client, accepting, num_waiting, timeout, d, p;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) { printf("Socket name %s is too long.\n", socket_path); exit(1); }
+	if (stat(socket_path, &status) == 0 && !S_ISSOCK(status.st_mode)) { printf("%s exists and is not a socket.\n", socket_path); exit(1); }
+	daemon = (struct daemon*)mem_calloc(MEM_OTHER, 1, sizeof(struct daemon));
+	if (!daemon) { printf("Could not allocate daemon in run_daemon.\n"); exit(1); }
+	daemon->settings = settings;
+	daemon->sim_settings = sim_settings;
+	daemon->max_running = settings->num_threads < DAEMON_MAX_JOBS ? settings->num_threads : DAEMON_MAX_JOBS;
+	daemon->started = now_seconds();
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+	unlink(socket_path);							//Left by a daemon before
+	daemon->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (daemon->listener < 0 || bind(daemon->listener, (struct sockaddr*)&address, sizeof(address)) != 0
+		|| listen(daemon->listener, 64) != 0) { printf("Could not listen on %s.\n", socket_path); exit(1); }
+	signal(SIGPIPE, SIG_IGN);
+	if (pipe(wake_pipe) != 0) { printf("Could not make a pipe in run_daemon.\n"); exit(1); }
+	fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = job_ended;
+	action.sa_flags = SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &action, NULL);
+	close_log();									//Messages go straight out - a forked child has no writer thread
+	initlfunc2();									//Once, for every job
+	log_info(LOG_MAIN, "Serving jobs on %s, up to %d at once.", socket_path, daemon->max_running);
+	fflush(stdout);
+
+	for (;;) {
+		reap_jobs(daemon, 0);
+		handle_pending(daemon);
+		if (daemon->stopping && daemon->num_running == 0) break;
+
+		//Wait for a job to end, a new connection, or more of a request still being read
+		waiting[0].fd = wake_pipe[0];
+		waiting[0].events = POLLIN;
+		reading[0] = -1;
+		num_waiting = 1;
+		accepting = !daemon->stopping && daemon->num_pending < DAEMON_MAX_PENDING;
+		if (accepting) {
+			waiting[num_waiting].fd = daemon->listener;
+			waiting[num_waiting].events = POLLIN;
+			reading[num_waiting++] = -1;
+		}
+		timeout = 1000;
+		now = now_seconds();
+		for (p = 0; p < daemon->num_pending; p++) {
+			if (daemon->pending[p].complete) continue;		//Waiting for a job to end, not for the client
+			waiting[num_waiting].fd = daemon->pending[p].client;
+			waiting[num_waiting].events = POLLIN;
+			reading[num_waiting++] = p;
+			wait = daemon->pending[p].received + DAEMON_READ_TIMEOUT - now;
+			if (wait * 1000 < timeout) timeout = wait > 0 ? (int)ceil(wait * 1000) : 0;
+		}
+		if (poll(waiting, num_waiting, timeout) < 0) continue;	//Interrupted by a job ending
+		while (read(wake_pipe[0], drained, sizeof(drained)) > 0);
+
+		for (d = 1; d < num_waiting; d++)
+			if (reading[d] >= 0 && waiting[d].revents) read_request(&daemon->pending[reading[d]]);
+		now = now_seconds();
+		for (p = 0; p < daemon->num_pending; p++) {			//Out of time: what was sent is the request
+			pending = &daemon->pending[p];
+			if (pending->complete || now < pending->received + DAEMON_READ_TIMEOUT) continue;
+			pending->complete = 1;
+			fcntl(pending->client, F_SETFL, 0);
+		}
+		if (accepting && (waiting[1].revents & POLLIN) && (client = accept(daemon->listener, NULL, NULL)) >= 0) {
+			fcntl(client, F_SETFL, O_NONBLOCK);			//Read as it arrives, never waited on
+			pending = &daemon->pending[daemon->num_pending++];
+			memset(pending, 0, sizeof(struct daemon_pending));
+			pending->client = client;
+			pending->received = now;
+			read_request(pending);
+		}
+	}
+
+	for (p = 0; p < daemon->num_pending; p++) close(daemon->pending[p].client);
+	close(daemon->listener);
+	unlink(socket_path);
+	signal(SIGCHLD, SIG_DFL);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	log_info(LOG_MAIN, "Daemon stopped after %ld jobs (%ld failed), %ld case files read and %ld reused.", daemon->jobs_started,
+		daemon->jobs_failed, daemon->dataset_loads, daemon->dataset_hits);
+	for (d = 0; d < daemon->num_datasets; d++) free_model_context(&daemon->datasets[d].model);
+	cleanuplfunc2();
+	mem_free(daemon);
+}
@@ -0,0 +1,55 @@
+/********************************************************************************
+*	Daemon.h																	*
+*	Contains:																	*
+*		- A server that keeps the lfunc2 table and parsed case files warm and	*
+*			runs fit and simulation jobs sent as one-line JSON requests over a	*
+*			Unix domain socket, each in a forked copy of itself with its own	*
+*			memory and CPU limits												*
+*		- Functions defined in Daemon.c											*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h, Posterior_Summary.h, Parallel_Tempering.h and			*
+*		Outbreak_Simulator.h first.												*
+********************************************************************************/
+
+#define DAEMON_MAX_DATASETS 64			//Case files kept parsed - the one used longest ago makes way
+#define DAEMON_MAX_JOBS 256				//Most jobs running at once, whatever the number of threads
+#define DAEMON_REQUEST_SIZE 4096		//Longest request line
+#define DAEMON_READ_TIMEOUT 5			//Seconds a client has to send its request
+#define DAEMON_MAX_PENDING 64			//Connections whose requests are being read or wait for a free job
+
+/************************************************
+* Structure of a request						*
+************************************************/
+
+//A request is one line holding a flat JSON object, e.g.
+//{"type": "fit", "data": "cases.csv", "seed": 3, "sweeps": 5000, "max_memory_mb": 512, "max_cpu_s": 60}
+//{"type": "simulate", "params": "beta1=0.3,beta3=0.5", "days": 428, "max_cases": 1000000}
+//Types are fit, simulate, status and shutdown. Fields left out keep the daemon's own settings.
+struct daemon_request
+{
+	char type[20];
+	char data[200];				//Case file of a fit
+	char summary[200];			//Where a fit writes its summary ("" for none)
+	char output[200];			//Where a simulation writes its cases ("" for none)
+	char trace[200];			//Simulations only: a trace to take the parameters from ("" for the starting ones)...
+	long sample;				//...its sample to take (-1 for the last)...
+	char params[200];			//...then parameters set as name=value,... (see set_parameter_values)
+	unsigned long seed;
+	int num_chains;
+	long num_sweeps;
+	long burn_in;
+	int num_threads;			//Threads of the job itself
+	int num_days;				//Simulations only
+	long max_cases;
+	long hybrid_threshold;
+	double max_memory_mb;		//0 for no limit
+	double max_cpu_seconds;		//0 for no limit
+};
+
+/****************************************
+* Functions defined in Daemon.c			*
+****************************************/
+
+int parse_daemon_request(const char *line, struct daemon_request *request, struct sampler_settings *settings,
+	struct simulation_settings *sim_settings);
+void run_daemon(const char *socket_path, struct sampler_settings *settings, struct simulation_settings *sim_settings);
@@ -11,10 +11,16 @@
 #include <stdio.h>						//For standard input/output functions
 #include <stdlib.h>						//For standard C library functions
 #include <string.h>						//For functions that manipulate strings
+#include <time.h>						//For timing the making of cases
 #include "Date_And_Reading_Reports.h"	//For structures and declarations of functions needed in this file
 											//To allow multiple source files to be used in one program
 #include "MTrandom.h"					//For random number generation (accept/reject situations)
 #include "lfunc.h"						//For MTrandom.cpp
+#include "Thread_Pool.h"				//For filling in the cases in parallel
+#include "Log.h"						//For levelled logging
+#include "Profile.h"					//For timing phases of the run
+#include "Memory.h"						//For memory accounting
+#include "Placement.h"					//For huge pages for the block of cases
 
 /*---------------------------------------------------------------
 | functions contained in this source code, for use in Ebola_x.c |
@@ -58,85 +64,308 @@ int generate_report_date_id(int day, int month, int year)
 
 int assign_x() //F:: NEEDS PROPER INPUT VARIABLES
 {
-	printf("Assigning x coordinate for case based on report location.\n");
+	log_trace(LOG_READING, "Assigning x coordinate for case based on report location.");
 		//This will be removed when proper function is written	
 	return 0;	//Temporary - until we can assign a proper value
 }
 
 int assign_y()	//F:: NEEDS PROPER INPUT VARIABLES
 {
-	printf("Assigning y coordinate for case based on report location.\n");
+	log_trace(LOG_READING, "Assigning y coordinate for case based on report location.");
 	//This will be removed when proper function is written	
 	return 0;	//Temporary - until we can assign a proper value
 }
 
-void generate_cases(struct current_case_report *current_report, p_patient *head, struct parameter_list *p_params)
-{	//I've passed the above to this function as it is outside the main source code and these parts are needed
-	int i;						//to count the number of cases created so far
-	int j;						//to count days when needed to initialise values
-	p_patient current;	//the current case we're working with
-	p_patient index_case;	//the first case of the outbreak
-
-	if (p_params->total_cases == 0){	//if it's the first case of all,
-		//creating index case
-		*head = index_case = (p_patient*)malloc(sizeof(p_patient));
-		if(!index_case){printf("Could not allocate index case in generate_cases.\n"); exit(1);}
-
-		//Initialising index case variables
-		strcpy(index_case->country, current_report->country);		//Country of case
-		strcpy(index_case->subregion, current_report->subregion);	//Subregion of case
-		//index_case->x = assign_x();
-		//index_case->x = (int)(uniform() * 100);		//Gives case an x-coord b/w 1 + 100 (0 and 99?)
-		//index_case->y = assign_y();
-		//index_case->y = (int)(uniform() * 100);		//Gives case an x-coord b/w 1 + 100 (0 and 99?)
-		index_case->diag = 1;		//This case is from a report, so diagnosis = 1
-		index_case->diag_day = 1;	//Index case is diagnosed on date_ID = 1
-		index_case->est_case = 1;	//Any reported case became established
-		index_case->parent_case = NULL;	//No parent case for index case
-		index_case->secondary_cases = 0;	//No secondary cases yet
-		for (j = 1; j <= NUMDAYS; j++) {
-			index_case->secondary_cases_gen[j] = 0;	//No secondary cases on any day
-		}
-		index_case->first_2dary = NULL;	//No cases founded
-		index_case->left_sib = NULL;		//No cases founded
-		index_case->right_sib = NULL;		//No cases founded
-		index_case->prev = NULL;			//No-one newer in the list
-		index_case->next = NULL;			//No-one older in the list
-		index_case->transmission_type = 0;//Zoonotic transmission for index case (0)
-		//index_case->pop_dens = population_density(x, y)	//Likely format for population density input
-			//VARIABLES NOT DEALT WITH: DATES[N], SURVIVAL
+/*---------------------------------------
+| making the reported cases				|
+---------------------------------------*/
+
+static unsigned long hash_subregion(struct current_case_report *report)
+{
+	unsigned long hash = 14695981039346656037UL;
+	const char *c;
+
+	for (c = report->country; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+	hash = (hash ^ ',') * 1099511628211UL;
+	for (c = report->subregion; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+	return hash;
+}
+
+//Fills in each report's previous_date_ID: the date of the last report before it for the same
+//subregion, or the day before its own date if it is the subregion's first (or out of order).
+//Also numbers the subregions, in order of their first reports (location). Subregions are found
+//in an open-addressed hash table of their latest reports. Returns the number of subregions.
+int assign_previous_dates(struct current_case_report *reports, int num_reports)
+{
+	int n, *last_report, *found, num_locations = 0;
+	unsigned long size = 16, slot;
+
+	while (size < 2UL * num_reports) size *= 2;
+	last_report = (int*)mem_malloc(MEM_REPORTS, size * sizeof(int));			//last_report[slot]: latest report of a subregion (-1 if empty)
+	if (!last_report) { printf("Could not allocate last_report in assign_previous_dates.\n"); exit(1); }
+	memset(last_report, 0xff, size * sizeof(int));
+	for (n = 0; n < num_reports; n++) {
+		for (slot = hash_subregion(&reports[n]) & (size - 1); *(found = &last_report[slot]) >= 0; slot = (slot + 1) & (size - 1))
+			if (strcmp(reports[*found].subregion, reports[n].subregion) == 0
+				&& strcmp(reports[*found].country, reports[n].country) == 0) break;
+		if (*found >= 0 && reports[*found].date_ID < reports[n].date_ID) reports[n].previous_date_ID = reports[*found].date_ID;
+		else reports[n].previous_date_ID = reports[n].date_ID - 1;
+		reports[n].location = *found >= 0 ? reports[*found].location : num_locations++;
+		*found = n;
 	}
-	else {	//creating non-index case
-		current = (struct patient*)malloc(sizeof(struct patient));
-		if (!current){printf("Could not allocate new case in generate_cases.\n"); exit(1);}
-		
-		//Initialising index case variables
-		strcpy(current->country, current_report->country);		//Country of case
-		strcpy(current->subregion, current_report->subregion);	//Subregion of case
-		//current->x = assign_x();
-		//current->x = (int)(uniform()*100);		//Gives case an x-coord b/w 1 + 100 (0 and 99?)
-		//current->y = assign_y();
-		//current->y = (int)(uniform()*100);		//Gives case an x-coord b/w 1 + 100 (0 and 99?)
-		current->diag = 1;		//This case is from a report, so diagnosis = 1
-		//current->diag_day = assign_diag_day();	//From date_ID and prev_date_ID (for country?)
-		current->est_case = 1;	//Any reported case became established
-		current->secondary_cases = 0;	//No secondary cases yet
-		for (j = 1; j <= NUMDAYS; j++) {
-			current->secondary_cases_gen[j] = 0;	//No secondary cases on any day
-		}
-		current->first_2dary = NULL;	//No cases founded
-		current->left_sib = NULL;		//No cases founded
-		current->right_sib = NULL;		//No cases founded
-		current->transmission_type = 0;//Zoonotic transmission for index case (0)
-		//current->pop_dens = population_density(x, y)	//Likely format for population density input
-			//VARIABLES NOT DEALT WITH: DATES[N], SURVIVAL, PARENT
-			
-			//Generate linked list
-		current->next = *head;		//next in the list is the most recently created case
-		current->prev = NULL;		//no previous case as this is the most recent
-		(*head)->prev = current;		//if head is next, current is head's previous
-		*head = current;				//switch head to most current (to become new case's next case) 
+	mem_free(last_report);
+	return num_locations;
+}
+
+struct materialize_job
+{
+	struct current_case_report *reports;
+	int num_reports;
+	int *first_case;		//first_case[n]: position of report n's first case (first_case[num_reports]: all cases)
+	struct patient *block;
+	unsigned long seed;
+};
+
+//Fills in cases [task * MATERIALIZE_CHUNK, (task + 1) * MATERIALIZE_CHUNK). Each chunk has its own
+//random numbers, so the cases do not depend on the number of threads.
+static void materialize_chunk(void *arg, int task, int thread)
+{
+	struct materialize_job *job = (struct materialize_job*)arg;
+	struct current_case_report *report;
+	struct mt_state rng;
+	unsigned long key[2];
+	p_patient current;
+	int i, end, n, lo, hi, days;
+	int total = job->first_case[job->num_reports];
+
+	key[0] = job->seed;
+	key[1] = (unsigned long)task;
+	init_by_array_r(&rng, key, 2);
+	i = task * MATERIALIZE_CHUNK;
+	end = i + MATERIALIZE_CHUNK < total ? i + MATERIALIZE_CHUNK : total;
+	for (lo = 0, hi = job->num_reports - 1; lo < hi; ) {			//Last report starting at or before case i
+		n = (lo + hi + 1) / 2;
+		if (job->first_case[n] <= i) lo = n;
+		else hi = n - 1;
 	}
-		(p_params->num_diagnosed)++;//New case - update diagnosed case count
-		(p_params->total_cases)++;	//New case - update total case count
-}
\ No newline at end of file
+	for (n = lo; i < end; i++) {
+		while (job->first_case[n + 1] <= i) n++;
+		report = &job->reports[n];
+		current = &job->block[i];
+		memcpy(current->country, report->country, sizeof(current->country));
+		memcpy(current->subregion, report->subregion, sizeof(current->subregion));
+		current->location = report->location;
+		current->index = i;
+		current->diag = 1;		//From a report, so diagnosed
+		days = report->date_ID - report->previous_date_ID;		//Diagnosed some day since the last report
+		current->diag_day = report->previous_date_ID + 1 + (int)(uniform_r(&rng) * days);
+		current->est_case = 1;
+		current->transmission_type = 0;
+		current->prev = i > 0 ? &job->block[i - 1] : NULL;
+		current->next = i < total - 1 ? &job->block[i + 1] : NULL;
+	}
+}
+
+//Makes every reported case at once, after the reports are read: one block, in report order, linked
+//as a list starting at its first element, and filled in parallel. Each case is diagnosed on a day
+//drawn uniformly from those since its subregion's previous report. Returns the first case (NULL if none).
+p_patient materialize_cases(struct current_case_report *reports, struct parameter_list *p_params, unsigned long seed,
+	int num_threads)
+{
+	struct materialize_job job;
+	struct thread_pool *pool;
+	struct timespec start, end;
+	int n, num_chunks;
+	unsigned long long ticks = profile_start();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assign_previous_dates(reports, p_params->total_reports);
+	job.reports = reports;
+	job.num_reports = p_params->total_reports;
+	job.seed = seed;
+	job.first_case = (int*)mem_malloc(MEM_CASES, (job.num_reports + 1) * sizeof(int));
+	if (!job.first_case) { printf("Could not allocate first_case in materialize_cases.\n"); exit(1); }
+	job.first_case[0] = 0;
+	for (n = 0; n < job.num_reports; n++) job.first_case[n + 1] = job.first_case[n] + (reports[n].cases > 0 ? reports[n].cases : 0);
+	p_params->num_diagnosed = p_params->total_cases = job.first_case[job.num_reports];
+	if (p_params->total_cases == 0) {
+		mem_free(job.first_case);
+		return NULL;
+	}
+
+	job.block = (struct patient*)mem_large(MEM_CASES, (size_t)p_params->total_cases * sizeof(struct patient), PLACE_ANY_NODE);	//Zero: no parents, children or dates yet
+	if (!job.block) { printf("Could not allocate %d cases in materialize_cases.\n", p_params->total_cases); exit(1); }
+	num_chunks = (p_params->total_cases + MATERIALIZE_CHUNK - 1) / MATERIALIZE_CHUNK;
+	if (num_threads > num_chunks) num_threads = num_chunks;
+	if (num_threads > 1) {
+		pool = create_thread_pool(num_threads);
+		run_pool_tasks(pool, materialize_chunk, &job, num_chunks);
+		destroy_thread_pool(pool);
+	}
+	else for (n = 0; n < num_chunks; n++) materialize_chunk(&job, n, 0);
+	mem_free(job.first_case);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	profile_stop(PROF_CASES, ticks);
+	log_info(LOG_READING, "Made %d cases from %d reports in %.2f ms.", p_params->total_cases, job.num_reports,
+		1e3 * (end.tv_sec - start.tv_sec) + 1e-6 * (end.tv_nsec - start.tv_nsec));
+	return job.block;
+}
+
+/*-------------------------------
+| model contexts				|
+-------------------------------*/
+
+//An empty context for the reports in case_file_name
+void init_model_context(struct model_context *model, const char *case_file_name, unsigned long seed, int num_threads)
+{
+	memset(model, 0, sizeof(struct model_context));
+	if (strlen(case_file_name) >= sizeof(model->case_file_name)) { printf("Case file name %s is too long.\n", case_file_name); exit(1); }
+	strcpy(model->case_file_name, case_file_name);
+	model->seed = seed;
+	model->num_threads = num_threads;
+}
+
+//3) Read case data into an array, so it can be used to generate a linked list of cases
+//Reads only the reports: returns 1, or 0 (with a message, and no reports) if they cannot be read
+int read_case_reports(struct model_context *model)
+{
+	//local variables
+	FILE *patient_data;		//For the input file
+	char line[1000];		//To read unnecessary entries to (e.g. column headings)
+	char ch;				//To read individual characters of names to temporarily
+	int i;					//To read country names into the report list
+	int j;					//To read subregion names into the report list
+	int n;					//For the line in the report list that we are up to
+	int capacity = MAX_REPORTS;	//Reports there is room for
+	struct current_case_report *report_list;
+	struct parameter_list *p_params = &model->params;
+	unsigned long long ticks = profile_start();
+//	int m;					//To count the number of cases that have been created
+	
+	log_debug(LOG_READING, "Opened read_case_data.");
+
+	//Allocate memory for the case reports (any from an earlier call are freed)
+	mem_free(model->reports);
+	mem_free(model->cases);
+	model->cases = NULL;
+	report_list = (struct current_case_report*)mem_malloc(MEM_REPORTS, capacity * sizeof(struct current_case_report));
+	model->reports = report_list;
+	if (!report_list){
+		printf("Could not allocate report_list.\n");
+		return 0;
+	}
+	else {
+		log_debug(LOG_READING, "Allocated report_list successfully.");
+	}
+
+	//Use data in file on command line and report_list to store patients
+	log_debug(LOG_READING, "Reading case data into array.");
+
+	patient_data = fopen(model->case_file_name, "r");
+	if (patient_data == NULL)
+	{
+		log_error(LOG_READING, "File %s containing patient data could not be opened.", model->case_file_name);
+		mem_free(model->reports);
+		model->reports = NULL;
+		return 0;
+	}
+	else log_debug(LOG_READING, "Patient data file is open.");
+	fgets(line, sizeof(line), patient_data);
+				//reads header. Ready to read first line of case data.
+	
+	//Setting up variables to read data
+	p_params->num_diagnosed = 0;			//Reported case count
+	p_params->total_cases = 0;				//Total cases
+	n = 0;									//First line of report list
+	
+	//Reading data into array
+	do
+	{
+		if (n == capacity) {				//Out of room - double it
+			capacity *= 2;
+			report_list = (struct current_case_report*)mem_realloc(MEM_REPORTS, report_list, capacity * sizeof(struct current_case_report));
+			if (!report_list) {
+				printf("Could not grow report_list to %d reports.\n", capacity);
+				fclose(patient_data);
+				mem_free(model->reports);
+				model->reports = NULL;
+				return 0;
+			}
+			model->reports = report_list;
+		}
+
+		//Read country into array
+		i = 0;
+		report_list[n].country[i] = 0;
+		while (fscanf(patient_data, "%c", &ch) == 1 && ch != ',' && i < 49)	//i<49 to match maximum length of country name
+			report_list[n].country[i++] = ch;								//Read up to and including first comma (country name)
+		report_list[n].country[i] = 0;										//Finish string for country name
+		//Read subregion into array
+		j = 0;
+		while (fscanf(patient_data, "%c", &ch) == 1 && ch != ',' && j < 99)	//j<99 for same reason as i<49 above
+			report_list[n].subregion[j++] = ch;								//Read up to and including second comma (subregion name)
+		report_list[n].subregion[j] = 0;									//Finish string for subregion name
+
+		//Read number of cases in report
+		fscanf(patient_data, "%d", &report_list[n].cases);
+		fscanf(patient_data, "%c", &ch);		//reads third comma
+
+		//Read date of report
+		fscanf(patient_data, "%d/%d/%d", &report_list[n].day, &report_list[n].month, &report_list[n].year);
+		report_list[n].date_ID = generate_report_date_id(report_list[n].day, report_list[n].month, report_list[n].year);
+
+		//Check reading of entry and determine end of reports
+		if (report_list[n].country[0] != 0) {	//If there is data in the country column (i.e. there is an entry)
+			log_trace(LOG_READING, "Report %d: %s, %s, %d cases on %d/%d/%d (date_ID %d)", n + 1, report_list[n].country,
+				report_list[n].subregion, report_list[n].cases, report_list[n].day, report_list[n].month, report_list[n].year,
+				report_list[n].date_ID);
+			n++;									//Ready to enter next report in next array 'row'
+			p_params->total_reports = n;		//Update number of reports
+		}
+		else {	//If there is no entry,
+			p_params->total_reports = n;
+			log_info(LOG_READING, "Reading of reports complete. Total number of reports = %d.", p_params->total_reports);
+		}
+	} while (fgets(line, sizeof(line), patient_data));			//Reads rest of line, while there are lines
+	fclose(patient_data);			//close file when data read from it
+
+	profile_stop(PROF_INGEST, ticks);
+	profile_count(PROF_REPORTS, p_params->total_reports);
+	return 1;
+}
+
+//Reads the reports, and makes the cases of every report at once
+int read_case_data(struct model_context *model)	//F::check naming convention for called/calling fns
+{
+	if (!read_case_reports(model)) exit(1);
+	generate_cases(model);
+	flush_log();					//Before the sampler's own output
+	return 0;
+}
+
+//Makes the context's cases from its reports (any made before are freed). Returns the first case.
+p_patient generate_cases(struct model_context *model)
+{
+	mem_free(model->cases);
+	model->cases = materialize_cases(model->reports, &model->params, model->seed, model->num_threads);
+	return model->cases;
+}
+
+//Takes a hold on the lfunc2 table: it is built by the first context to ask, and shared by the rest
+void use_lfunc_table(struct model_context *model)
+{
+	if (model->uses_lfunc) return;
+	initlfunc2();
+	model->uses_lfunc = 1;
+}
+
+void free_model_context(struct model_context *model)
+{
+	mem_free(model->cases);
+	mem_free(model->reports);
+	if (model->uses_lfunc) cleanuplfunc2();
+	model->cases = NULL;
+	model->reports = NULL;
+	model->uses_lfunc = 0;
+}
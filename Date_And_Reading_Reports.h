@@ -3,12 +3,24 @@
 *	Created by Neal Smith in March 2018											*
 *	Contains:																	*
 *		- Structures required for both Ebola_x.c and Date_And_Reading_Reports.c	*
+*		- The model context: the reports, cases and parameters of one data set,	*
+*			so a process can hold (and fit) many								*
 *		- Functions defined in Date_And_Reading_Reports.c						*
 ********************************************************************************/
 
 //Definitions of global variables
 #define NUMDAYS 428			//The number of days from the index case being infectious to the last report
 								//I need to verify this ASAP
+#define NUM_TRANS_TYPES 4	//Index, individual, hospital and burial transmission (see transmission_type)
+#define NUM_DURATIONS 4		//Key durations of a case, each given a negative binomial distribution:
+#define DUR_INCUBATION 0		//dates[1] - dates[0] - 1 (at least a day between exposure and symptoms)
+#define DUR_INFECTIOUS 1		//dates[2] - dates[1] - 1
+#define DUR_BURIAL 2			//dates[3] - dates[2] (fatal cases only - survivors have dates[3] = dates[2])
+#define DUR_DIAGNOSIS 3			//diag_day - dates[1] (diagnosed cases only)
+#define MATERIALIZE_CHUNK 4096	//Reported cases filled in by one task of materialize_cases
+#define MAX_REPORTS 120		//There are ~58000 entries in our dataset - only 111 in the Mali subset.
+								//Room for this many is made first; the list doubles whenever it fills
+#define NO_LOCATION -1			//Location of a case with no known place (e.g. an unobserved index case)
 
 /********************************************
 * Structures required for both source files *
@@ -23,6 +35,7 @@ struct patient
 	char subregion[100];	//Used to generate the specific location
 	double x;				//x co-ordinate - generated from the above
 	double y;				//y co-ordinate - generated from the above
+	int location;			//Number of the subregion (see current_case_report.location), or NO_LOCATION
 	int dates[4];		//key dates for a case:
 						//dates[0]: day of exposure(or ?seeding event?)
 						//dates[1]: day first infective(showing symptoms)
@@ -55,7 +68,7 @@ struct patient
 							//int num_unobs ;				//Number of unobserved 2dary cases - IF WE WANT TO STORE THIS
 	p_patient next;
 	p_patient prev;
-} *head;					//Create the first case in the linked list
+};
 
 	//parameters of model
 struct parameter_list
@@ -63,7 +76,13 @@ struct parameter_list
 	int total_reports;		//Total number of case reports - USED TO CHECK READING OF CASE DATA
 	int num_diagnosed;		//Should come from reading the case reports
 	int total_cases;		//Included num_diagnosed and undiagnosed
-} parameters;				//(pointer to?) parameter list used in model
+	double beta[NUM_TRANS_TYPES];		//Transmission rate per infectious day for each transmission_type
+											//beta[0] is the zoonotic rate per day over the whole period
+	double dur_mean[NUM_DURATIONS];		//Mean of each key duration, above its minimum (see DUR_ definitions)
+	double dur_size[NUM_DURATIONS];		//Negative binomial size (dispersion) of each key duration
+	double p_diag;						//Probability that a case is diagnosed (and so reported)
+	double p_survive;					//Probability that a case survives
+};
 
 	//Structure of the date from each case report
 struct current_case_report		//Because we don't have a line list, read each report's data here first
@@ -78,13 +97,34 @@ struct current_case_report		//Because we don't have a line list, read each repor
 	int year;				//Year in the date of report
 	int date_ID;			//The date of this report.
 	int previous_date_ID;	//The date of the previous report FOR THE SAME SUBREGION - used for temporal precision
-} *report_list;	 //F:: Figure out how to best access these reports when needed.
+	int location;			//Number of the subregion, from 0 in order of first report (see Spatial_Kernel.h)
+};
+
+	//Everything one data set owns - no state is global, so contexts can be read and fitted side by side
+struct model_context
+{
+	char case_file_name[200];				//Case data file
+	struct current_case_report *reports;	//Its reports (params.total_reports of them)
+	p_patient cases;						//The reported cases, one block starting with the first (NULL if none)
+	struct parameter_list params;			//Model parameters, and the counts of reports and cases
+	unsigned long seed;						//Seeds every random number stream of the context (each has its own state)
+	int num_threads;						//Threads for making cases
+	int uses_lfunc;							//1 while it holds the lfunc2 table, which every context shares
+};
 
 /****************************************
 * Functions defined in this source file *
 ****************************************/
 
 int generate_report_date_id(int day, int month, int year);
-void generate_cases(struct current_case_report *current_report, p_patient *head, struct parameter_list *p_params);
+int assign_previous_dates(struct current_case_report *reports, int num_reports);
+p_patient materialize_cases(struct current_case_report *reports, struct parameter_list *p_params, unsigned long seed,
+	int num_threads);
+void init_model_context(struct model_context *model, const char *case_file_name, unsigned long seed, int num_threads);
+int read_case_reports(struct model_context *model);
+int read_case_data(struct model_context *model);
+p_patient generate_cases(struct model_context *model);
+void use_lfunc_table(struct model_context *model);
+void free_model_context(struct model_context *model);
 int assign_x();
 int assign_y();
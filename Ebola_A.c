@@ -11,24 +11,62 @@
 #include <stdio.h>	//Standard C input/output functions
 #include <string.h>	//Library for functions on strings
 #include <stdlib.h>	//Standard C Library (for memory allocation in particular) 
+#include <unistd.h>	//For isatty (pausing only when run from a terminal)
 #include "Date_And_Reading_Reports.h"	//Header file for conversion of date to date_ID
 #include "MTrandom.h"					//For random number generation (accept/reject situations)
 #include "lfunc.h"						//For MTrandom.cpp
+#include "Likelihood.h"					//For the likelihood of the augmented data
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains and their moves
+#include "Posterior_Summary.h"			//For summaries of the posterior
+#include "Parallel_Tempering.h"			//For running tempered chains on every core
+#include "Checkpoint.h"					//For saving and restoring the run
+#include "Outbreak_Simulator.h"			//For simulating outbreaks forward
+#include "Thread_Pool.h"				//For the pool ABC-SMC runs on
+#include "ABC_SMC.h"					//For fitting by simulation (ABC-SMC)
+#include "Trace.h"						//For reading posterior draws
+#include "Posterior_Predictive.h"		//For posterior predictive checks
+#include "Log.h"						//For levelled logging
+#include "Profile.h"					//For timing phases of the run
+#include "Synthetic_Data.h"				//For writing synthetic case files
+#include "Benchmark.h"					//For the scaling benchmark
+#include "Batch_Fits.h"					//For fitting many case files in one process
+#include "Daemon.h"						//For serving jobs over a socket
+#include "Live_Ring.h"					//For following a run from another process
+#include "Placement.h"					//For huge pages, NUMA nodes and their counters
+#include "Memory.h"						//For memory accounting
+#include "Self_Test.h"					//For checking the fast paths from the build
 
 //definitions
-#define MAX_REPORTS 120		//There are ~58000 entries in our dataset - only 111 in the Mali subset.
-								//Likely value: 100000. Reduce this number if memory issues occur
 #define NUMDAYS 428
 
 
 //global constants, variables and structures
 	//Anything beginning with "p_" is a pointer.
 char code_name[100];
-char case_file_name[100];
+struct sampler_settings settings;	//Number of chains, sweeps etc. - defaults unless set on the command line
+struct simulation_settings sim_settings;	//Days, largest number of cases and seed of a forward simulation
+char simulation_file[200];			//If given, an outbreak is simulated from the starting parameters instead
+char simulation_trace[200];			//If given, the simulation's parameters are a sample of this trace...
+long simulation_sample = -1;		//...this one (-1 for the last)...
+char simulation_values[200];		//...then any set here, as name=value,...
+struct abc_settings abc;			//If an output file is given, the reports are fitted by ABC-SMC instead
+struct predictive_settings predict;	//If an output file is given, posterior predictive checks are run instead
+char log_file[200];					//If given, log messages go here instead of the console
+int pause_at_end;					//If set (and run from a terminal), wait for a key before exiting
+char profile_file[200];				//If given, timings of the phases of the run are written here as JSON...
+char prometheus_file[200];			//...and here in the Prometheus text format
+int profile_interval = DEFAULT_PROFILE_INTERVAL;	//Seconds between writes
+struct synthetic_settings synthetic;	//If a number of rows is given, a synthetic case file is written instead
+struct benchmark_settings benchmark;	//If an output file is given, the scaling benchmark is run instead
 
-struct parameter_list *p_parameters = &parameters;		//A pointer initialised to a parameter list
-struct current_case_report *p_reports = &report_list;	//A pointer initiliased to a case report list
-	//POTENTIAL ISSUE: REPORT LIST IS AN ARRAY OF STRUCTURES. I'M NOT SURE HOW BEST TO REFERENCE IT.
+struct model_context model;			//The case file's reports, cases and parameters - the only data set, unless -batch
+char batch_file[200];				//If given, every case file it lists is fitted side by side instead
+char socket_file[200];				//If given, fit and simulation jobs are served on this socket instead
+char tail_name[100];				//If given, the live ring of another run is followed instead
+int placement_report;				//1 to count dTLB misses and remote reads, and report them with the placement at exit
+char self_tests[50];				//If given (all, or a test's name), the self-tests are run instead
+int exit_status;					//1 if any self-test failed
 
 	//Structures defining the following located in "Date_And_Reading_Reports.h":
 		//An individual case
@@ -44,118 +82,140 @@ struct current_case_report *p_reports = &report_list;	//A pointer initiliased to
 void usage()
 {
 	printf("Command line should contain the following files, each with names < 100ch:\nCase data input file.\n");
+	printf("Optional settings may follow the file:\n\t-chains K -threads T -sweeps N -burnin N -swap N -maxtemp T -seed S\n");
+	printf("\t-checkpoint F -every N (save the run to F every N sweeps) -restart F (carry on from checkpoint F)\n");
+	printf("\t-trace F -thin N (record the cold chain to F every N sweeps) -summary F (write posterior summaries to F)\n");
+	printf("\t-spatial F -coords C -kernelscale S -kernelexp A (write the cold chain's infectious pressure on each\n");
+	printf("\t\tsubregion and day to F, spread by 1 / (1 + (d / S)^A) between subregions with coordinates in C)\n");
+	printf("\t-fieldtol E (take the spatial pressure from an FFT grid, to a relative error of about E, instead)\n");
+	printf("\t-renewal F (write each subregion's onsets and the onsets and diagnoses expected from them to F)\n");
+	printf("\t-incidence 1 (keep Fenwick trees of every chain's events per subregion and day, for code that queries them)\n");
+	printf("\t-casethreads T (spread the date moves of each chain over T threads, running the chains in turn)\n");
+	printf("\t-batch F (fit every case file listed in F, one per line with an optional summary file after a comma,\n");
+	printf("\t\tas -threads fits side by side, each with the settings given here)\n");
+	printf("\t-hugepages H (off, thp or explicit: huge pages for the chains' blocks of cases)\n");
+	printf("\t-numa 1 (spread the chains' cases over the NUMA nodes)\n");
+	printf("\t-live L (publish the run's progress to the shared-memory ring L, for -tail L or other monitors)\n");
+	printf("\t-tail L (follow the run publishing to L, printing its latest sample until it ends)\n");
+	printf("\t-serve S (serve fit and simulation jobs, sent as JSON lines, on the Unix socket S, as -threads at once)\n");
+	printf("\t-simulate F -simdays D -simcases N (simulate an outbreak from the starting parameters into F instead)\n");
+	printf("\t-simtrace T -simsample N (simulate from sample N of trace T, or its last) -simparams P (set parameters\n");
+	printf("\t\tof the simulation as name=value,..., e.g. beta1=0.3,p_diag=0.6, with the names of the trace)\n");
+	printf("\t-hybrid N (simulate a location by compartment counts while it has more than N exposures a day)\n");
+	printf("\t-abc F -particles N -generations G (fit the reports by ABC-SMC, writing the last population to F)\n");
+	printf("\t-predict F -replicates R -draws T -numdraws N (write predictive quantiles of the reports to F, from\n");
+	printf("\t\tR replicates of each of N draws from trace T, or of the starting parameters)\n");
+	printf("\t-log L (log level: error, warn, info, debug or trace, for every module or as module=level,...;\n");
+	printf("\t\tmodules main, reading, sampler, simulation) -logfile F (log to F) -pause 1 (wait for a key at the end)\n");
+	printf("\t-profile F -prom P -profileevery S (write timings of each phase to F as JSON and P for Prometheus every S s)\n");
+	printf("\t-membudget B (memory budgets as subsystem=size,..., e.g. cases=2G,total=6G; subsystems reports, cases,\n");
+	printf("\t\tlfunc, sampler, simulation, io, threads, spatial, other and total)\n");
+	printf("\t-generate N -locations L -gendays D -gencases C (write N synthetic rows to the case file instead, for L\n");
+	printf("\t\tsubregions over D days, with outbreaks of C cases on average)\n");
+	printf("\t-benchmark F -benchsizes N1,N2,... -benchsweeps S -benchcases C (time each stage on synthetic files of\n");
+	printf("\t\teach size, sampling S sweeps for sizes of up to C cases, and write the results to F)\n");
+	printf("\t-selftest T (check the fast paths against direct versions on random inputs from -seed, T being all\n");
+	printf("\t\tor one of trace, fft, field, incidence, renewal and live)\n");
 }
 
 //1) To ensure we have the files we need.
 void handleargs(int argc, char **argv)
 {
-	printf("Determining if all necessary files are present.\n");
-	if (argc != 2) usage();													//Number of files in command line, plus one(for the filename). We currently have one file - the case data.
-	else printf("Correct number of files provided as command arguments.\n");
-	if (strlen(argv[1])>100) usage();										//Making sure the title isn't too long - remnant of Jon's code. //Q:: needed?
-	strcpy(case_file_name, argv[1]);										//Copy the file name for a check, and to call file from.
-	printf("Case file name is %s.\n", case_file_name);							//To ensure correct files are in correct locations.
-}
-
-/*--------------------------------------------------
-| FUNCTIONS REGARDING READING OF DATA INTO PROGRAM |
---------------------------------------------------*/
+	int i;
 
-//3) Read case data into an array, so it can be used to generate a linked list of cases
-int read_case_data(struct parameter_list *p_params)	//F::check naming convention for called/calling fns
-{
-	//local variables
-	FILE *patient_data;		//For the input file
-	char line[100];			//To read unnecessary entries to (e.g. column headings)
-	char ch;				//To read individual characters of names to temporarily
-	int i;					//To read country names into the report list
-	int j;					//To read subregion names into the report list
-	int n;					//For the line in the report list that we are up to
-//	int m;					//To count the number of cases that have been created
-	
-	printf("Opened read_case_data.\n");
-
-	//Allocate sufficient memory to store the number of case reports
-	report_list = (struct current_case_report*)malloc(MAX_REPORTS * sizeof(struct current_case_report));
-	if (!report_list){
-		printf("Could not allocate report_list.\n");
+	log_debug(LOG_MAIN, "Determining if all necessary files are present.");
+	if (argc < 2) {															//Number of files in command line, plus one(for the filename). We currently have one file - the case data.
+		usage();
 		exit(1);
 	}
-	else {
-		printf("Allocated report_list successfully.\n");
-	}
-
-	//Use data in file on command line and report_list to store patients
-	printf("Reading case data into array.\n");
+	else log_debug(LOG_MAIN, "Correct number of files provided as command arguments.");
+	if (strlen(argv[1])>100) usage();										//Making sure the title isn't too long - remnant of Jon's code. //Q:: needed?
+	init_model_context(&model, argv[1], 0, 1);								//Copy the file name for a check, and to call file from.
+	log_info(LOG_MAIN, "Case file name is %s.", model.case_file_name);					//To ensure correct files are in correct locations.
 
-	patient_data = fopen(case_file_name, "r");
-	if (patient_data == NULL)
-	{
-		printf("\n File containing patient data could not be opened\n");
-		exit(1);
-	}
-	else printf("Patient data file is open.\n");
-	fgets(line, 1000, patient_data);
-				//reads header. Ready to read first line of case data.
-	
-	//Setting up variables to read data
-	p_params->num_diagnosed = 0;			//Reported case count
-	p_params->total_cases = 0;				//Total cases
-	n = 0;									//First line of report list
-	
-	//Reading data into array
-	do
-	{
-		//Read country into array
-		i = 0;
-		report_list[n].country[i] = 0;
-		while (fscanf(patient_data, "%c", &ch) == 1 && ch != ',' && i < 50)	//i<50 to match maximum length of country name
-			report_list[n].country[i++] = ch;								//Read up to and including first comma (country name)
-		report_list[n].country[i] = 0;										//Finish string for country name
-		//Read subregion into array
-		j = 0;
-		while (fscanf(patient_data, "%c", &ch) == 1 && ch != ',' && j < 100)//j<100 for same reason as i<50 above
-			report_list[n].subregion[j++] = ch;								//Read up to and including second comma (subregion name)
-		report_list[n].subregion[j] = 0;									//Finish string for subregion name
-
-		//Read number of cases in report
-		fscanf(patient_data, "%d", &report_list[n].cases);
-		fscanf(patient_data, "%c", &ch);		//reads third comma
-
-		//Read date of report
-		fscanf(patient_data, "%d/%d/%d", &report_list[n].day, &report_list[n].month, &report_list[n].year);
-		report_list[n].date_ID = generate_report_date_id(report_list[n].day, report_list[n].month, report_list[n].year);
-
-		//If there are cases on this date, generate the cases in a linked list
-			if (report_list[n].cases >= 1){
-			for(i = 1; i <= report_list[n].cases; i++){		//For all cases in this report,
-				generate_cases(p_reports, &head, p_params);	//Make a case
-			}	//Check to see if passing these are needed
-					//POTENTIAL ISSUE: MIXING UP OF USING p_reports AND report_list
-						//report_list is a pointer to the start of an array. Can I pass it to a fn?
-							//If not, should I pass p_reports to this (and all) fns instead?
-		printf("Generating case for next report.\nGenerated cases = %d.\n", p_params->num_diagnosed);	
+	//Settings for the sampler, each given as a flag followed by a value
+	default_sampler_settings(&settings);
+	default_simulation_settings(&sim_settings);
+	default_abc_settings(&abc);
+	default_predictive_settings(&predict);
+	default_synthetic_settings(&synthetic);
+	synthetic.num_rows = 0;
+	default_benchmark_settings(&benchmark);
+	for (i = 2; i < argc; i += 2) {
+		if (i + 1 >= argc) { printf("No value given for %s.\n", argv[i]); usage(); exit(1); }
+		if (strcmp(argv[i], "-chains") == 0) settings.num_chains = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-threads") == 0) settings.num_threads = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-casethreads") == 0) settings.case_threads = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-sweeps") == 0) settings.num_sweeps = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-burnin") == 0) settings.burn_in = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-swap") == 0) settings.swap_interval = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-maxtemp") == 0) settings.max_temperature = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-seed") == 0) settings.seed = strtoul(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "-checkpoint") == 0) strncpy(settings.checkpoint_file, argv[i + 1], sizeof(settings.checkpoint_file) - 1);
+		else if (strcmp(argv[i], "-every") == 0) settings.checkpoint_interval = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-restart") == 0) strncpy(settings.restart_file, argv[i + 1], sizeof(settings.restart_file) - 1);
+		else if (strcmp(argv[i], "-trace") == 0) strncpy(settings.trace_file, argv[i + 1], sizeof(settings.trace_file) - 1);
+		else if (strcmp(argv[i], "-thin") == 0) settings.trace_interval = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-simulate") == 0) strncpy(simulation_file, argv[i + 1], sizeof(simulation_file) - 1);
+		else if (strcmp(argv[i], "-simdays") == 0) sim_settings.num_days = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-simcases") == 0) sim_settings.max_cases = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-hybrid") == 0) sim_settings.hybrid_threshold = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-simtrace") == 0) strncpy(simulation_trace, argv[i + 1], sizeof(simulation_trace) - 1);
+		else if (strcmp(argv[i], "-simsample") == 0) simulation_sample = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-simparams") == 0) strncpy(simulation_values, argv[i + 1], sizeof(simulation_values) - 1);
+		else if (strcmp(argv[i], "-abc") == 0) strncpy(abc.output_file, argv[i + 1], sizeof(abc.output_file) - 1);
+		else if (strcmp(argv[i], "-particles") == 0) abc.num_particles = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-generations") == 0) abc.num_generations = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-predict") == 0) strncpy(predict.output_file, argv[i + 1], sizeof(predict.output_file) - 1);
+		else if (strcmp(argv[i], "-replicates") == 0) predict.num_replicates = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-draws") == 0) strncpy(predict.draws_file, argv[i + 1], sizeof(predict.draws_file) - 1);
+		else if (strcmp(argv[i], "-numdraws") == 0) predict.num_draws = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-summary") == 0) strncpy(settings.summary_file, argv[i + 1], sizeof(settings.summary_file) - 1);
+		else if (strcmp(argv[i], "-spatial") == 0) strncpy(settings.spatial_file, argv[i + 1], sizeof(settings.spatial_file) - 1);
+		else if (strcmp(argv[i], "-coords") == 0) strncpy(settings.coords_file, argv[i + 1], sizeof(settings.coords_file) - 1);
+		else if (strcmp(argv[i], "-kernelscale") == 0) settings.kernel_scale = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-kernelexp") == 0) settings.kernel_exponent = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-fieldtol") == 0) settings.field_tolerance = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-hugepages") == 0) {
+			if (!set_huge_pages(argv[i + 1])) { printf("Huge pages should be off, thp or explicit, not %s.\n", argv[i + 1]); usage(); exit(1); }
+			placement_report = 1;
 		}
-
-		//Check reading of entry and determine end of reports
-		if (report_list[n].country[0] != 0) {	//If there is data in the country column (i.e. there is an entry)
-			printf("Data for report %d:\n\tCountry: %s\n", n + 1, report_list[n].country);
-			printf("\tSubregion: %s\n", report_list[n].subregion);
-			printf("\tCases: %d\n", report_list[n].cases);
-			printf("\tReport_Date: %d/%d/%d\n", report_list[n].day, report_list[n].month, report_list[n].year);
-			printf("\tReport_Date_ID: %d\n", report_list[n].date_ID);
-			n++;									//Ready to enter next report in next array 'row'
-			p_params->total_reports = n;		//Update number of reports
+		else if (strcmp(argv[i], "-numa") == 0) {
+			set_numa_placement(atoi(argv[i + 1]));
+			placement_report = 1;
 		}
-		else {	//If there is no entry,
-			p_params->total_reports = n;
-			printf("Reading of reports complete.\nTotal number of reports = %d.", p_params->total_reports);
+		else if (strcmp(argv[i], "-live") == 0) strncpy(settings.live_name, argv[i + 1], sizeof(settings.live_name) - 1);
+		else if (strcmp(argv[i], "-tail") == 0) strncpy(tail_name, argv[i + 1], sizeof(tail_name) - 1);
+		else if (strcmp(argv[i], "-serve") == 0) strncpy(socket_file, argv[i + 1], sizeof(socket_file) - 1);
+		else if (strcmp(argv[i], "-batch") == 0) strncpy(batch_file, argv[i + 1], sizeof(batch_file) - 1);
+		else if (strcmp(argv[i], "-incidence") == 0) settings.incidence = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-renewal") == 0) strncpy(settings.renewal_file, argv[i + 1], sizeof(settings.renewal_file) - 1);
+		else if (strcmp(argv[i], "-log") == 0) {
+			if (!set_log_levels(argv[i + 1])) { printf("Could not understand log levels %s.\n", argv[i + 1]); usage(); exit(1); }
 		}
-	} while (fgets(line, 1000, patient_data));			//Reads rest of line, while there are lines
-	fclose(patient_data);			//close file when data read from it
-
-	return 0;
+		else if (strcmp(argv[i], "-logfile") == 0) strncpy(log_file, argv[i + 1], sizeof(log_file) - 1);
+		else if (strcmp(argv[i], "-pause") == 0) pause_at_end = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-profile") == 0) strncpy(profile_file, argv[i + 1], sizeof(profile_file) - 1);
+		else if (strcmp(argv[i], "-prom") == 0) strncpy(prometheus_file, argv[i + 1], sizeof(prometheus_file) - 1);
+		else if (strcmp(argv[i], "-profileevery") == 0) profile_interval = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-membudget") == 0) {
+			if (!set_memory_budgets(argv[i + 1])) { printf("Could not understand memory budgets %s.\n", argv[i + 1]); usage(); exit(1); }
+		}
+		else if (strcmp(argv[i], "-generate") == 0) synthetic.num_rows = (long)atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-locations") == 0) synthetic.num_locations = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-gendays") == 0) synthetic.num_days = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-gencases") == 0) synthetic.mean_cases = benchmark.mean_cases = atof(argv[i + 1]);
+		else if (strcmp(argv[i], "-benchmark") == 0) strncpy(benchmark.output_file, argv[i + 1], sizeof(benchmark.output_file) - 1);
+		else if (strcmp(argv[i], "-benchsizes") == 0) {
+			if (!parse_benchmark_sizes(&benchmark, argv[i + 1])) { printf("Could not understand sizes %s.\n", argv[i + 1]); usage(); exit(1); }
+		}
+		else if (strcmp(argv[i], "-benchsweeps") == 0) benchmark.num_sweeps = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-benchcases") == 0) benchmark.max_sampler_cases = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-selftest") == 0) strncpy(self_tests, argv[i + 1], sizeof(self_tests) - 1);
+		else { printf("Unknown setting %s.\n", argv[i]); usage(); exit(1); }
+	}
 }
+
 /*---------------
 | MAIN FUNCTION |
 ---------------*/
@@ -163,22 +223,106 @@ int read_case_data(struct parameter_list *p_params)	//F::check naming convention
 int main(int argc, char **argv)
 {
 	strcpy(code_name, argv[0]);
-	printf("Starting code for %s.", code_name);		//Baseline code - so something is happening!
+	log_info(LOG_MAIN, "Starting code for %s.", code_name);		//Baseline code - so something is happening!
 	
 	//Make sure the necessary input files are present
 	handleargs(argc, argv);
+	model.seed = settings.seed;							//The main context's cases come from the sampler's seed and threads
+	model.num_threads = settings.num_threads;
+	atexit(print_memory_report);		//Registered before the log's own, so it comes after the log is written out
+	if (placement_report) {
+		start_placement_counters();		//Before any thread starts, so every one is counted
+		atexit(print_placement_report);
+	}
+	open_log(log_file);
+	start_profile_export(profile_file, prometheus_file, profile_interval);
 
-	//Read case report data into an array
-		//Step two: convert data into cases. Not yet.
-	read_case_data(p_parameters);
+	//Carry on from a checkpoint - it holds the reports, cases and parameters, so the case file isn't read
+	if (settings.restart_file[0]) resume_gibbs_sampler(&model, &settings);
+	else if (batch_file[0]) {
+		//Fit every case file listed, side by side - the case file on the command line isn't read
+		run_batch_fits(batch_file, &settings);
+	}
+	else if (tail_name[0]) {
+		//Follow another run - the case file isn't read
+		tail_live_ring(tail_name);
+	}
+	else if (socket_file[0]) {
+		//Serve jobs until asked to stop - each request names its own case file
+		run_daemon(socket_file, &settings, &sim_settings);
+	}
+	else if (synthetic.num_rows > 0) {
+		//Write a synthetic case file in place of reading one
+		synthetic.seed = settings.seed;
+		log_info(LOG_MAIN, "Wrote %ld synthetic reports for %d subregions to %s.", write_synthetic_reports(model.case_file_name, &synthetic),
+			synthetic.num_locations, model.case_file_name);
+	}
+	else if (self_tests[0]) {
+		//Check the fast paths on random inputs - the case file isn't read
+		exit_status = run_self_tests(self_tests, settings.seed);
+		if (exit_status < 0) { usage(); exit(1); }
+		exit_status = exit_status > 0;
+	}
+	else if (benchmark.output_file[0]) {
+		//Scaling benchmark on synthetic case files - the case file isn't read
+		benchmark.seed = settings.seed;
+		benchmark.num_threads = settings.num_threads;
+		run_benchmark(&benchmark);
+	}
+	else if (simulation_file[0]) {
+		//Forward simulation from the starting parameters, a trace sample or those given - the case file isn't read
+		struct simulation sim;
 
-	//Initialise parameters
+		initialise_parameters(&model.params);
+		if (simulation_trace[0] && !read_trace_parameters(simulation_trace, simulation_sample, &model.params)) {
+			printf("Trace %s has no sample %ld.\n", simulation_trace, simulation_sample);
+			exit(1);
+		}
+		if (simulation_values[0] && !set_parameter_values(&model.params, simulation_values)) {
+			printf("Could not understand parameters %s.\n", simulation_values);
+			usage();
+			exit(1);
+		}
+		sim_settings.seed = settings.seed;
+		init_simulation(&sim, &model.params, &sim_settings);
+		run_simulation(&sim);
+		print_simulation(&sim);
+		write_simulation(&sim, simulation_file);
+		free_simulation(&sim);
+	}
+	else if (abc.output_file[0]) {
+		//Fit the reports by simulation - the threads and seed are those of the sampler
+		read_case_data(&model);
+		initialise_parameters(&model.params);
+		abc.num_threads = settings.num_threads;
+		abc.seed = settings.seed;
+		run_abc_smc(model.reports, &model.params, &abc);
+	}
+	else if (predict.output_file[0]) {
+		//Posterior predictive checks of the reports
+		read_case_data(&model);
+		initialise_parameters(&model.params);
+		predict.seed = settings.seed;
+		run_posterior_predictive(model.reports, &model.params, &predict);
+	}
+	else {
+		//Read case report data into an array
+			//Step two: convert data into cases. Not yet.
+		read_case_data(&model);
 
-	//Open output file and set up counters for MCMC
+		//Initialise parameters
+		initialise_parameters(&model.params);
 
-	//Initiate Gibbs sampler
+		//Output (the trace file, if one was given) is opened by the sampler
+
+		//Initiate Gibbs sampler
+		run_gibbs_sampler(&model, &settings);
+	}
+	free_model_context(&model);
 
-	getchar();					//So I can see what I've done - otherwise the code exits
+	stop_profile_export();
+	close_log();
+	if (pause_at_end && isatty(fileno(stdin))) getchar();	//So I can see what I've done - otherwise the code exits
 
-	return 0;					//Gives an integer to the computer so the function has returned a value, as indicated.
+	return exit_status;			//Gives an integer to the computer so the function has returned a value, as indicated.
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+/********************************************************************************
+*	FFT.c																		*
+*	Radix-2 FFT (see FFT.h): bit reversal, then butterflies of doubling			*
+*		length, with the twiddles worked out once for each length of transform.	*
+********************************************************************************/
+
+//preprocessor directives
+#include <math.h>						//For M_PI
+#include <complex.h>					//For complex doubles and cexp
+#include "FFT.h"						//For declarations of functions needed in this file
+
+//a * b, without the checks for infinities that make the * of complex.h a library call
+static inline double _Complex multiply(double _Complex a, double _Complex b)
+{
+	return (creal(a) * creal(b) - cimag(a) * cimag(b)) + I * (creal(a) * cimag(b) + cimag(a) * creal(b));
+}
+
+//Smallest power of two of at least n
+int fft_size(int n)
+{
+	int p = 1;
+
+	while (p < n) p *= 2;
+	return p;
+}
+
+//twiddle[k] = exp(-2 pi i k / n) for k below n / 2
+void fft_twiddles(double _Complex *twiddle, int n)
+{
+	int k;
+
+	for (k = 0; k < n / 2; k++) twiddle[k] = cexp(-2.0 * M_PI * I * k / n);
+}
+
+//result[k] = a[k] * b[k] for k below n (result may be a or b)
+void fft_multiply(double _Complex *result, const double _Complex *a, const double _Complex *b, long n)
+{
+	long k;
+
+	for (k = 0; k < n; k++) result[k] = multiply(a[k], b[k]);
+}
+
+//In place, of length n (a power of two), with the twiddles of n. The inverse is not scaled.
+void fft(double _Complex *a, int n, const double _Complex *twiddle, int inverse)
+{
+	int i, j, bit, length, half, step, k;
+	double _Complex t, w;
+
+	for (i = 1, j = 0; i < n; i++) {				//Bit reversal
+		for (bit = n >> 1; j & bit; bit >>= 1) j ^= bit;
+		j |= bit;
+		if (i < j) { t = a[i]; a[i] = a[j]; a[j] = t; }
+	}
+	for (length = 2; length <= n; length *= 2) {
+		half = length / 2;
+		step = n / length;
+		for (i = 0; i < n; i += length)
+			for (k = 0; k < half; k++) {
+				w = inverse ? conj(twiddle[k * step]) : twiddle[k * step];
+				t = multiply(w, a[i + k + half]);
+				a[i + k + half] = a[i + k] - t;
+				a[i + k] += t;
+			}
+	}
+}
@@ -0,0 +1,15 @@
+/********************************************************************************
+*	FFT.h																		*
+*	Contains:																	*
+*		- Functions defined in FFT.c: an in-place radix-2 FFT of complex		*
+*			doubles, shared by the pressure field and the renewal engine		*
+********************************************************************************/
+
+/****************************************
+* Functions defined in FFT.c			*
+****************************************/
+
+int fft_size(int n);
+void fft_twiddles(double _Complex *twiddle, int n);
+void fft_multiply(double _Complex *result, const double _Complex *a, const double _Complex *b, long n);
+void fft(double _Complex *a, int n, const double _Complex *twiddle, int inverse);
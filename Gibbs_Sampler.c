@@ -0,0 +1,779 @@
+/********************************************************************************
+*	Gibbs_Sampler.c																*
+*	Moves of the Metropolis-within-Gibbs sampler for one chain. Each sweep		*
+*		shifts dates and changes parents of randomly chosen cases, then			*
+*		updates the model parameters. The likelihood is raised to the chain's	*
+*		heat, so the same moves serve every rung of the tempering ladder.		*
+*	During burn-in the random-walk scales adapt towards their best				*
+*		acceptance rates, and the covariance of each duration's parameters		*
+*		is learned for block moves. Time spent in each type of move is kept,	*
+*		so moves can be judged by effective samples per second.					*
+*	Unobserved cases are added and removed by reversible-jump moves. They		*
+*		sit together at the end of the chain's block of cases, so one can be	*
+*		picked uniformly, added or removed in constant time.					*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcpy and strcpy
+#include <math.h>						//For log and exp
+#include <time.h>						//For timing the moves
+#include <limits.h>						//For INT_MAX
+#include "MTrandom.h"					//For random number generation (accept/reject situations)
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood and prior
+#include "Incidence.h"					//For counts of events per subregion and day
+#include "Gibbs_Sampler.h"				//For structures and declarations of functions needed in this file
+#include "Thread_Pool.h"				//For coloured sweeps
+#include "Coloured_Sweep.h"				//For date moves on several threads
+#include "Spatial_Kernel.h"				//Needed by Renewal.h
+#include "Renewal.h"					//For the expected onsets of each subregion
+#include "Log.h"						//For warnings
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Placement.h"						//For the node of each chain's cases
+
+/*-------------------------------
+| setting up a chain			|
+-------------------------------*/
+
+//Starting values of the model parameters
+void initialise_parameters(struct parameter_list *p_params)
+{
+	p_params->beta[0] = 0.01;		//Roughly one zoonotic case every hundred days
+	p_params->beta[1] = 0.1;		//Individual transmission
+	p_params->beta[2] = 0.05;		//Hospital / care transmission
+	p_params->beta[3] = 0.2;		//Burial transmission
+	p_params->dur_mean[DUR_INCUBATION] = 9.0;	//Typical Ebola values (days above the minimum)
+	p_params->dur_mean[DUR_INFECTIOUS] = 7.0;
+	p_params->dur_mean[DUR_BURIAL] = 2.0;
+	p_params->dur_mean[DUR_DIAGNOSIS] = 3.0;
+	p_params->dur_size[DUR_INCUBATION] = 2.0;
+	p_params->dur_size[DUR_INFECTIOUS] = 2.0;
+	p_params->dur_size[DUR_BURIAL] = 2.0;
+	p_params->dur_size[DUR_DIAGNOSIS] = 2.0;
+	p_params->p_diag = 0.5;
+	p_params->p_survive = 0.4;
+}
+
+//Sets parameters from spec, given as name=value,... with the names of the trace (beta0 to beta3,
+//dur_mean0 to dur_mean3, dur_size0 to dur_size3, p_diag and p_survive), e.g. beta1=0.3,p_diag=0.6.
+//Parameters not named keep their values. Returns 0, changing nothing, if spec is not understood.
+int set_parameter_values(struct parameter_list *p_params, const char *spec)
+{
+	struct parameter_list values = *p_params;
+	char name[32], *end;
+	const char *p = spec;
+	double value;
+	int n, k;
+
+	while (*p) {
+		for (n = 0; *p && *p != '=' && *p != ','; p++) if (n + 1 < (int)sizeof(name)) name[n++] = *p;
+		name[n] = 0;
+		if (*p++ != '=') return 0;
+		value = strtod(p, &end);
+		if (end == p || (*end && *end != ',')) return 0;
+		p = *end ? end + 1 : end;
+		k = name[n > 0 ? n - 1 : 0] - '0';
+		if (strncmp(name, "beta", 4) == 0 && n == 5 && k >= 0 && k < NUM_TRANS_TYPES && value >= 0) values.beta[k] = value;
+		else if (strncmp(name, "dur_mean", 8) == 0 && n == 9 && k >= 0 && k < NUM_DURATIONS && value > 0) values.dur_mean[k] = value;
+		else if (strncmp(name, "dur_size", 8) == 0 && n == 9 && k >= 0 && k < NUM_DURATIONS && value > 0) values.dur_size[k] = value;
+		else if (strcmp(name, "p_diag") == 0 && value >= 0 && value <= 1) values.p_diag = value;
+		else if (strcmp(name, "p_survive") == 0 && value >= 0 && value <= 1) values.p_survive = value;
+		else return 0;
+	}
+	*p_params = values;
+	return 1;
+}
+
+//Gives a case key dates consistent with its diagnosis day, using the mean durations
+static void initialise_case_dates(p_patient current, struct parameter_list *p_params)
+{
+	int *d = current->dates;
+
+	d[1] = current->diag_day - (int)p_params->dur_mean[DUR_DIAGNOSIS];
+	d[0] = d[1] - 1 - (int)p_params->dur_mean[DUR_INCUBATION];
+	if (d[0] < 0) {						//Too close to the start of the period - squeeze forwards
+		d[0] = 0;
+		if (d[1] < 1) d[1] = 1;
+	}
+	if (current->diag && current->diag_day < d[1]) d[1] = current->diag_day;
+	d[2] = d[1] + 1 + (int)p_params->dur_mean[DUR_INFECTIOUS];
+	d[3] = current->survive ? d[2] : d[2] + (int)p_params->dur_mean[DUR_BURIAL];
+	if (d[3] >= NUMDAYS) {				//Too close to the end of the period - squeeze backwards
+		d[3] = NUMDAYS - 1;
+		if (d[2] > d[3] || current->survive) d[2] = d[3];
+	}
+}
+
+//Copies the list of cases starting at first into a block owned by the chain, and gives the
+//chain a valid starting state: every case an index (zoonotic) case with dates from the mean durations.
+void initialise_chain(struct chain_state *chain, p_patient first, struct parameter_list *p_params,
+	int chain_ID, double heat, unsigned long seed)
+{
+	int i;
+	p_patient current;
+	unsigned long key[2];
+
+	memset(chain, 0, sizeof(struct chain_state));
+	chain->chain_ID = chain_ID;
+	chain->rung = chain_ID;
+	chain->heat = heat;
+	chain->params = *p_params;
+	key[0] = seed;
+	key[1] = (unsigned long)chain_ID;
+	init_by_array_r(&chain->rng, key, 2);	//A different stream for every chain
+	initialise_adaptation(&chain->adapt);
+
+	for (current = first; current != NULL; current = current->next) chain->num_cases++;
+	if (chain->num_cases == 0) { printf("No cases to sample in initialise_chain.\n"); exit(1); }
+	chain->num_observed = chain->num_cases;
+	chain->capacity = 2 * chain->num_cases + 16;		//Room for unobserved cases (the block grows if they need more)
+	chain->max_unobserved = unobserved_limit(chain->num_observed);
+	chain->cases = (struct patient*)mem_large(MEM_CASES, chain->capacity * sizeof(struct patient), node_for_index(chain_ID));
+	if (!chain->cases) { printf("Could not allocate cases in initialise_chain.\n"); exit(1); }
+
+	i = 0;
+	for (current = first; current != NULL; current = current->next) {
+		chain->cases[i] = *current;
+		chain->cases[i].index = i;
+		chain->cases[i].prev = i > 0 ? &chain->cases[i - 1] : NULL;
+		chain->cases[i].next = i < chain->num_cases - 1 ? &chain->cases[i + 1] : NULL;
+		i++;
+	}
+	chain->first_case = &chain->cases[0];
+
+	for (i = 0; i < chain->num_cases; i++) {
+		current = &chain->cases[i];
+		current->transmission_type = 0;
+		current->parent_case = NULL;
+		current->first_2dary = current->left_sib = current->right_sib = NULL;
+		current->secondary_cases = 0;
+		memset(current->secondary_cases_gen, 0, sizeof(current->secondary_cases_gen));
+		current->survive = 0;		//F:: survival is not yet sampled - every case starts as fatal
+		initialise_case_dates(current, &chain->params);
+	}
+
+	init_likelihood_cache(&chain->cache, chain->first_case, chain->capacity, &chain->params);
+	if (chain->cache.stats.num_invalid > 0) {
+		printf("%d cases could not be given valid starting dates (is NUMDAYS long enough?).\n", chain->cache.stats.num_invalid);
+		exit(1);
+	}
+	chain->log_lik = cache_log_lik(&chain->cache);
+	chain->log_prior = log_prior(&chain->params);
+}
+
+void free_chain(struct chain_state *chain)
+{
+	free_likelihood_cache(&chain->cache);
+	free_incidence(&chain->incidence);
+	mem_free(chain->cases);
+	chain->cases = chain->first_case = NULL;
+	chain->num_cases = chain->num_observed = chain->capacity = 0;
+}
+
+//Starting proposal scales, before any adaptation
+void initialise_adaptation(struct move_adaptation *adapt)
+{
+	int k;
+
+	memset(adapt, 0, sizeof(struct move_adaptation));
+	adapt->date_log_scale = log(DATE_STEP);
+	for (k = 0; k < NUM_DURATIONS; k++) adapt->dur_log_scale[k][0] = adapt->dur_log_scale[k][1] = log(DUR_STEP);
+}
+
+/*-------------------------------
+| keeping the tree linked		|
+-------------------------------*/
+
+//Adds child to the front of parent's list of secondary cases
+void attach_to_parent(p_patient child, p_patient parent)
+{
+	child->parent_case = parent;
+	child->left_sib = NULL;
+	child->right_sib = parent->first_2dary;
+	if (parent->first_2dary) parent->first_2dary->left_sib = child;
+	parent->first_2dary = child;
+	parent->secondary_cases++;
+	if (child->dates[0] >= 0 && child->dates[0] < NUMDAYS) parent->secondary_cases_gen[child->dates[0]]++;
+}
+
+//Removes child from its parent's list of secondary cases (the parent pointer is left alone)
+void detach_from_parent(p_patient child)
+{
+	p_patient parent = child->parent_case;
+
+	if (child->left_sib) child->left_sib->right_sib = child->right_sib;
+	else parent->first_2dary = child->right_sib;
+	if (child->right_sib) child->right_sib->left_sib = child->left_sib;
+	child->left_sib = child->right_sib = NULL;
+	parent->secondary_cases--;
+	if (child->dates[0] >= 0 && child->dates[0] < NUMDAYS) parent->secondary_cases_gen[child->dates[0]]--;
+}
+
+/*-------------------------------
+| the block of cases			|
+-------------------------------*/
+
+//The same case in a block that has moved from old_block to new_block
+static p_patient rebase(p_patient current, struct patient *old_block, struct patient *new_block)
+{
+	return current ? new_block + (current - old_block) : NULL;
+}
+
+//Most unobserved cases a chain with num_observed observed cases may hold: MAX_UNOBSERVED each, kept
+//small enough that the doubling block's size stays an int
+int unobserved_limit(int num_observed)
+{
+	long limit = (long)MAX_UNOBSERVED * num_observed;
+
+	if (limit > INT_MAX / 4 - num_observed) limit = INT_MAX / 4 - num_observed;
+	return (int)limit;
+}
+
+//Doubles the block of cases, repointing every link into it. Returns 0, leaving the block as it was,
+//if there is no memory for a bigger one (or it would go over the cases' budget).
+static int grow_cases(struct chain_state *chain)
+{
+	int i;
+	struct patient *old_block = chain->cases;
+	struct patient *block;
+	p_patient current;
+
+	block = (struct patient*)mem_large(MEM_CASES, 2 * (size_t)chain->capacity * sizeof(struct patient), node_for_index(chain->chain_ID));
+	if (!block) return 0;
+	memcpy(block, old_block, chain->num_cases * sizeof(struct patient));
+	for (i = 0; i < chain->num_cases; i++) {
+		current = &block[i];
+		current->parent_case = rebase(current->parent_case, old_block, block);
+		current->first_2dary = rebase(current->first_2dary, old_block, block);
+		current->left_sib = rebase(current->left_sib, old_block, block);
+		current->right_sib = rebase(current->right_sib, old_block, block);
+		current->next = rebase(current->next, old_block, block);
+		current->prev = rebase(current->prev, old_block, block);
+	}
+	chain->first_case = rebase(chain->first_case, old_block, block);
+	mem_free(old_block);
+	chain->cases = block;
+	chain->capacity *= 2;
+	cache_reserve(&chain->cache, chain->capacity);
+	return 1;
+}
+
+//A birth refused at the cap: the first one of each chain is warned of, as the posterior of the
+//number of unobserved cases is then cut off
+static void cap_birth(struct chain_state *chain, const char *reason)
+{
+	if (chain->births_capped++ == 0)
+		log_warn(LOG_SAMPLER, "Chain %d reached its cap of %d unobserved cases (%s); births past it are refused, "
+			"cutting off the posterior of their number.", chain->chain_ID, chain->max_unobserved, reason);
+}
+
+//Moves case from into the empty slot to, repointing everything that links to it
+static void move_case(struct chain_state *chain, p_patient from, p_patient to)
+{
+	p_patient child;
+
+	memcpy(to, from, sizeof(struct patient));
+	to->index = (int)(to - chain->cases);
+	if (to->left_sib) to->left_sib->right_sib = to;
+	else if (to->parent_case) to->parent_case->first_2dary = to;
+	if (to->right_sib) to->right_sib->left_sib = to;
+	for (child = to->first_2dary; child != NULL; child = child->right_sib) child->parent_case = to;
+	if (to->prev) to->prev->next = to;
+	else chain->first_case = to;
+	if (to->next) to->next->prev = to;
+	cache_move_case(&chain->cache, from->index, to->index);
+}
+
+/*-------------------------------
+| moves							|
+-------------------------------*/
+
+//What the heat multiplies in a tempered chain: the log likelihood plus UNOBSERVED_TEMPERING for
+//each unobserved case, which is taken off again untempered. At heat 1 the two cancel; below it a
+//chain pays (1 - heat) * UNOBSERVED_TEMPERING per case. Without it the hotter chains' number of
+//unobserved cases has no bound: flattening the likelihood of a new case lifts it by more than the
+//proposal terms take off (about 15 per case on the Mali data), so they grew until the cap.
+double tempered_log_lik(const struct chain_state *chain)
+{
+	return chain->log_lik + UNOBSERVED_TEMPERING * (chain->num_cases - chain->num_observed);
+}
+
+//Log prior of one more unobserved case: their number is geometric with mean UNOBSERVED_PRIOR_MEAN per
+//observed case. The likelihood alone leaves a ridge along which fewer diagnoses explain more cases.
+static double log_birth_prior(struct chain_state *chain)
+{
+	double mean = UNOBSERVED_PRIOR_MEAN * chain->num_observed;
+
+	return log(mean / (mean + 1));
+}
+
+static int random_index(struct chain_state *chain, int n)
+{
+	return (int)(uniform_r(&chain->rng) * n);
+}
+
+//Metropolis acceptance for a change in (untempered) log likelihood and log prior
+static int accept_move(struct chain_state *chain, double delta_log_lik, double delta_log_other)
+{
+	double log_ratio = chain->heat * delta_log_lik + delta_log_other;
+
+	if (log_ratio >= 0) return 1;
+	return log(uniform_r(&chain->rng)) < log_ratio;
+}
+
+//Robbins-Monro step of a log scale towards the target acceptance rate (during burn-in only)
+static void adapt_scale(struct chain_state *chain, double *log_scale, double accept_rate, double target)
+{
+	if (chain->adapting) *log_scale += SCALE_ADAPT_RATE / sqrt(chain->adapt.sweeps + 1) * (accept_rate - target);
+}
+
+//Largest date shift: the adapted scale, rounded
+static int date_step(struct chain_state *chain)
+{
+	int step = (int)(exp(chain->adapt.date_log_scale) + 0.5);
+
+	if (step < 1) return 1;
+	if (step > MAX_DATE_STEP) return MAX_DATE_STEP;
+	return step;
+}
+
+//Shifts one key date of a random case by up to step days either way.
+//Only the case and its children (whose exposures must fall in its windows) are recomputed.
+static void date_move(struct chain_state *chain, int step)
+{
+	p_patient current = &chain->cases[random_index(chain, chain->num_cases)];
+	p_patient child;
+	int slot = random_index(chain, 4);
+	int shift = 1 + random_index(chain, step);
+	int old_dates[4];
+	double new_log_lik;
+
+	if (uniform_r(&chain->rng) < 0.5) shift = -shift;
+	chain->proposed[MOVE_DATES]++;
+
+	memcpy(old_dates, current->dates, sizeof(old_dates));
+	if (current->parent_case) detach_from_parent(current);	//Parent's count of exposures per day changes
+	if (current->survive && slot >= 2) current->dates[2] = current->dates[3] = old_dates[2] + shift;
+	else current->dates[slot] += shift;
+
+	if (case_is_valid(current)) {
+		cache_begin_move(&chain->cache);
+		cache_update_case(&chain->cache, current);
+		for (child = current->first_2dary; child != NULL; child = child->right_sib)
+			cache_update_case(&chain->cache, child);
+		new_log_lik = cache_proposed_log_lik(&chain->cache);
+		if (accept_move(chain, new_log_lik - chain->log_lik, 0)) {
+			cache_accept(&chain->cache);
+			chain->log_lik = new_log_lik;
+			chain->accepted[MOVE_DATES]++;
+			if (chain->incidence.tree) incidence_move_dates(&chain->incidence, current, old_dates);
+			if (chain->renewal) renewal_move_onset(chain->renewal, current->location, old_dates[1], current->dates[1]);
+			if (current->parent_case) attach_to_parent(current, current->parent_case);
+			return;
+		}
+		cache_reject(&chain->cache);
+	}
+
+	memcpy(current->dates, old_dates, sizeof(old_dates));		//Rejected - put the dates back
+	if (current->parent_case) attach_to_parent(current, current->parent_case);
+}
+
+//Proposes a new parent and transmission type for a random case, uniformly over every other case
+//and the three types (or no parent, with probability ZOONOTIC_PROPOSAL). The proposal is symmetric.
+static void parent_move(struct chain_state *chain)
+{
+	p_patient current = &chain->cases[random_index(chain, chain->num_cases)];
+	p_patient old_parent = current->parent_case;
+	p_patient new_parent = NULL;
+	int old_type = current->transmission_type;
+	int new_type = 0;
+	double new_log_lik;
+
+	chain->proposed[MOVE_PARENT]++;
+	if (uniform_r(&chain->rng) >= ZOONOTIC_PROPOSAL) {
+		if (chain->num_cases < 2) return;
+		new_parent = &chain->cases[random_index(chain, chain->num_cases)];
+		if (new_parent == current) return;
+		new_type = 1 + random_index(chain, NUM_TRANS_TYPES - 1);
+	}
+	if (new_parent == old_parent && new_type == old_type) {
+		chain->accepted[MOVE_PARENT]++;
+		return;
+	}
+
+	if (old_parent) detach_from_parent(current);
+	current->parent_case = new_parent;
+	current->transmission_type = new_type;
+	if (case_is_valid(current)) {
+		if (new_parent) attach_to_parent(current, new_parent);
+		cache_begin_move(&chain->cache);
+		cache_update_case(&chain->cache, current);		//The parent's own terms don't depend on its children
+		new_log_lik = cache_proposed_log_lik(&chain->cache);
+		if (accept_move(chain, new_log_lik - chain->log_lik, 0)) {
+			cache_accept(&chain->cache);
+			chain->log_lik = new_log_lik;
+			chain->accepted[MOVE_PARENT]++;
+			return;
+		}
+		cache_reject(&chain->cache);
+		if (new_parent) detach_from_parent(current);
+	}
+
+	current->parent_case = old_parent;			//Rejected - back to the old parent
+	current->transmission_type = old_type;
+	if (old_parent) attach_to_parent(current, old_parent);
+}
+
+//Log density of birth_move proposing the case current, when there are num_others other cases
+static double log_birth_proposal(p_patient current, int num_others, struct parameter_list *p)
+{
+	int start, end;
+	int *d = current->dates;
+	double log_q;
+
+	if (current->parent_case == NULL) log_q = log(ZOONOTIC_PROPOSAL / NUMDAYS);
+	else {
+		infectious_window(current->parent_case, current->transmission_type, &start, &end);
+		log_q = log((1 - ZOONOTIC_PROPOSAL) / ((double)num_others * (NUM_TRANS_TYPES - 1) * (end - start)));
+	}
+	log_q += nb_log_pmf(d[1] - d[0] - 1, p->dur_mean[DUR_INCUBATION], p->dur_size[DUR_INCUBATION]);
+	log_q += nb_log_pmf(d[2] - d[1] - 1, p->dur_mean[DUR_INFECTIOUS], p->dur_size[DUR_INFECTIOUS]);
+	if (current->survive) log_q += log(p->p_survive);
+	else log_q += log(1 - p->p_survive) + nb_log_pmf(d[3] - d[2], p->dur_mean[DUR_BURIAL], p->dur_size[DUR_BURIAL]);
+	return log_q;
+}
+
+//Proposes a new undiagnosed case: a parent and type uniformly (or none, with probability
+//ZOONOTIC_PROPOSAL), a day of exposure uniformly in the parent's window, then its durations and
+//survival from the model itself. It goes in the first free slot of the block.
+static void birth_move(struct chain_state *chain)
+{
+	p_patient current, parent = NULL;
+	int type = 0, start = 0, end = NUMDAYS;
+	int *d;
+	double new_log_lik, log_q;
+	struct parameter_list *p = &chain->params;
+
+	if (chain->num_cases - chain->num_observed >= chain->max_unobserved) {
+		cap_birth(chain, "MAX_UNOBSERVED per observed case");
+		return;
+	}
+	if (chain->num_cases == chain->capacity && !grow_cases(chain)) {
+		chain->max_unobserved = chain->capacity - chain->num_observed;		//No room to grow, so no more tries
+		cap_birth(chain, "out of memory for more");
+		return;
+	}
+	if (uniform_r(&chain->rng) >= ZOONOTIC_PROPOSAL) {
+		parent = &chain->cases[random_index(chain, chain->num_cases)];
+		type = 1 + random_index(chain, NUM_TRANS_TYPES - 1);
+		if (!infectious_window(parent, type, &start, &end)) return;
+	}
+
+	current = &chain->cases[chain->num_cases];
+	memset(current, 0, sizeof(struct patient));
+	current->index = chain->num_cases;
+	if (parent) {								//Only observed cases have a known place
+		strcpy(current->country, parent->country);
+		strcpy(current->subregion, parent->subregion);
+		current->x = parent->x;
+		current->y = parent->y;
+		current->pop_dens = parent->pop_dens;
+		current->location = parent->location;
+	}
+	else current->location = NO_LOCATION;
+	current->diag_day = 9999;
+	current->parent_case = parent;
+	current->transmission_type = type;
+	d = current->dates;
+	d[0] = start + random_index(chain, end - start);
+	d[1] = d[0] + 1 + (int)rnbinom_r(&chain->rng, p->dur_mean[DUR_INCUBATION], p->dur_size[DUR_INCUBATION]);
+	d[2] = d[1] + 1 + (int)rnbinom_r(&chain->rng, p->dur_mean[DUR_INFECTIOUS], p->dur_size[DUR_INFECTIOUS]);
+	current->survive = uniform_r(&chain->rng) < p->p_survive;
+	d[3] = current->survive ? d[2] : d[2] + (int)rnbinom_r(&chain->rng, p->dur_mean[DUR_BURIAL], p->dur_size[DUR_BURIAL]);
+	if (!case_is_valid(current)) return;
+	log_q = log_birth_proposal(current, chain->num_cases, p);
+
+	if (parent) attach_to_parent(current, parent);
+	cache_begin_move(&chain->cache);
+	cache_update_case(&chain->cache, current);
+	new_log_lik = cache_proposed_log_lik(&chain->cache);
+	//The reverse move picks this case from num_unobserved + 1
+	if (accept_move(chain, new_log_lik - chain->log_lik + UNOBSERVED_TEMPERING,
+			log_birth_prior(chain) - UNOBSERVED_TEMPERING - log(chain->num_cases - chain->num_observed + 1.0) - log_q)) {
+		cache_accept(&chain->cache);
+		chain->log_lik = new_log_lik;
+		chain->accepted[MOVE_BIRTH_DEATH]++;
+		current->prev = NULL;
+		current->next = chain->first_case;
+		chain->first_case->prev = current;
+		chain->first_case = current;
+		chain->num_cases++;
+		chain->params.total_cases = chain->num_cases;
+		if (chain->incidence.tree) incidence_add_case(&chain->incidence, current, 1);
+		if (chain->renewal) renewal_add_onset(chain->renewal, current->location, current->dates[1], 1);
+		return;
+	}
+	cache_reject(&chain->cache);
+	if (parent) detach_from_parent(current);
+}
+
+//Proposes removing a random unobserved case (the reverse of birth_move). Cases with children are
+//never removed. The last case of the block fills the gap, so the unobserved cases stay together.
+static void death_move(struct chain_state *chain)
+{
+	int num_unobserved = chain->num_cases - chain->num_observed;
+	p_patient current;
+	double new_log_lik, log_q;
+
+	if (num_unobserved == 0) return;
+	current = &chain->cases[chain->num_observed + random_index(chain, num_unobserved)];
+	if (current->first_2dary) return;
+	log_q = log_birth_proposal(current, chain->num_cases - 1, &chain->params);
+
+	cache_begin_move(&chain->cache);
+	cache_remove_case(&chain->cache, current);
+	new_log_lik = cache_proposed_log_lik(&chain->cache);
+	if (!accept_move(chain, new_log_lik - chain->log_lik - UNOBSERVED_TEMPERING,
+			UNOBSERVED_TEMPERING - log_birth_prior(chain) + log((double)num_unobserved) + log_q)) {
+		cache_reject(&chain->cache);
+		return;
+	}
+	cache_accept(&chain->cache);
+	chain->log_lik = new_log_lik;
+	chain->accepted[MOVE_BIRTH_DEATH]++;
+	if (chain->incidence.tree) incidence_add_case(&chain->incidence, current, -1);
+	if (chain->renewal) renewal_add_onset(chain->renewal, current->location, current->dates[1], -1);
+
+	if (current->parent_case) detach_from_parent(current);
+	if (current->prev) current->prev->next = current->next;
+	else chain->first_case = current->next;
+	if (current->next) current->next->prev = current->prev;
+	chain->num_cases--;
+	if (current != &chain->cases[chain->num_cases]) move_case(chain, &chain->cases[chain->num_cases], current);
+	chain->params.total_cases = chain->num_cases;
+}
+
+//A birth or a death, with equal probability
+static void birth_death_move(struct chain_state *chain)
+{
+	chain->proposed[MOVE_BIRTH_DEATH]++;
+	if (uniform_r(&chain->rng) < 0.5) birth_move(chain);
+	else death_move(chain);
+}
+
+//Draws the transmission rates and the diagnosis and survival probabilities from their
+//(conjugate, tempered) full conditionals
+static void rates_move(struct chain_state *chain)
+{
+	int type;
+	double shape, rate;
+	struct model_stats *stats = &chain->cache.stats;
+	struct parameter_list *p = &chain->params;
+
+	chain->proposed[MOVE_RATES]++;
+	for (type = 0; type < NUM_TRANS_TYPES; type++) {
+		if (type == 0) {
+			shape = BETA0_PRIOR_SHAPE + chain->heat * stats->trans_count[0];
+			rate = BETA0_PRIOR_RATE + chain->heat * NUMDAYS;
+		}
+		else {
+			shape = BETA_PRIOR_SHAPE + chain->heat * stats->trans_count[type];
+			rate = BETA_PRIOR_RATE + chain->heat * stats->trans_exposure[type];
+		}
+		p->beta[type] = exp(rgama_r(&chain->rng, shape)) / rate;
+	}
+	p->p_diag = exp(beta_r(&chain->rng, P_DIAG_PRIOR_A + chain->heat * stats->num_diag,
+		P_DIAG_PRIOR_B + chain->heat * stats->num_undiag));
+	p->p_survive = exp(beta_r(&chain->rng, P_SURVIVE_PRIOR_A + chain->heat * stats->num_survive,
+		P_SURVIVE_PRIOR_B + chain->heat * stats->num_fatal));
+
+	cache_set_parameters(&chain->cache, p);
+	chain->log_lik = cache_log_lik(&chain->cache);
+	chain->log_prior = log_prior(p);
+	chain->accepted[MOVE_RATES]++;
+}
+
+//Log-scale random walk on the mean and size of each duration distribution in turn
+static void durations_move(struct chain_state *chain)
+{
+	int k, which, accepted;
+	double *value;
+	double old_value, old_dur_lik, new_dur_lik, new_log_prior;
+	struct parameter_list *p = &chain->params;
+
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		for (which = 0; which < 2; which++) {
+			value = which == 0 ? &p->dur_mean[k] : &p->dur_size[k];
+			chain->proposed[MOVE_DURATIONS]++;
+
+			old_value = *value;
+			old_dur_lik = duration_log_lik(chain->cache.stats.dur_hist[k], p->dur_mean[k], p->dur_size[k]);
+			*value = old_value * exp(exp(chain->adapt.dur_log_scale[k][which]) * rand_Normal_r(&chain->rng));
+			new_dur_lik = duration_log_lik(chain->cache.stats.dur_hist[k], p->dur_mean[k], p->dur_size[k]);
+			new_log_prior = log_prior(p);
+
+			//log(new/old) is the Jacobian of the log-scale walk
+			accepted = accept_move(chain, new_dur_lik - old_dur_lik, new_log_prior - chain->log_prior + log(*value / old_value));
+			if (accepted) {
+				chain->log_lik += new_dur_lik - old_dur_lik;
+				chain->log_prior = new_log_prior;
+				chain->accepted[MOVE_DURATIONS]++;
+			}
+			else *value = old_value;
+			adapt_scale(chain, &chain->adapt.dur_log_scale[k][which], accepted, TARGET_ACCEPT);
+		}
+	}
+}
+
+//Joint log-scale random walk on the mean and size of each duration, with the covariance learned
+//during burn-in (scaled by 2.38^2 / 2, as in Haario et al.'s adaptive Metropolis)
+static void duration_block_move(struct chain_state *chain)
+{
+	int k, accepted;
+	double l00, l10, l11, s00, s01, s11, n, c, z0, z1, step_mean, step_size;
+	double old_mean, old_size, old_dur_lik, new_dur_lik, new_log_prior;
+	struct parameter_list *p = &chain->params;
+	struct move_adaptation *adapt = &chain->adapt;
+
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		chain->proposed[MOVE_DURATION_BLOCK]++;
+
+		//Cholesky factor of the covariance, or independent steps until there is enough history
+		n = adapt->cov_count;
+		if (n >= COVARIANCE_MIN_SWEEPS) {
+			s00 = adapt->cov_sum[k][0] / (n - 1) + 1e-8;
+			s01 = adapt->cov_sum[k][1] / (n - 1);
+			s11 = adapt->cov_sum[k][2] / (n - 1) + 1e-8;
+			l00 = sqrt(s00);
+			l10 = s01 / l00;
+			l11 = s11 - l10 * l10 > 1e-8 ? sqrt(s11 - l10 * l10) : 1e-4;
+		}
+		else {
+			l00 = l11 = DUR_STEP;
+			l10 = 0;
+		}
+		c = exp(adapt->block_log_scale[k]) * 2.38 / sqrt(2.0);
+		z0 = rand_Normal_r(&chain->rng);
+		z1 = rand_Normal_r(&chain->rng);
+		step_mean = c * l00 * z0;
+		step_size = c * (l10 * z0 + l11 * z1);
+
+		old_mean = p->dur_mean[k];
+		old_size = p->dur_size[k];
+		old_dur_lik = duration_log_lik(chain->cache.stats.dur_hist[k], old_mean, old_size);
+		p->dur_mean[k] = old_mean * exp(step_mean);
+		p->dur_size[k] = old_size * exp(step_size);
+		new_dur_lik = duration_log_lik(chain->cache.stats.dur_hist[k], p->dur_mean[k], p->dur_size[k]);
+		new_log_prior = log_prior(p);
+
+		accepted = accept_move(chain, new_dur_lik - old_dur_lik, new_log_prior - chain->log_prior + step_mean + step_size);
+		if (accepted) {
+			chain->log_lik += new_dur_lik - old_dur_lik;
+			chain->log_prior = new_log_prior;
+			chain->accepted[MOVE_DURATION_BLOCK]++;
+		}
+		else {
+			p->dur_mean[k] = old_mean;
+			p->dur_size[k] = old_size;
+		}
+		adapt_scale(chain, &adapt->block_log_scale[k], accepted, TARGET_ACCEPT_BLOCK);
+	}
+	cache_set_parameters(&chain->cache, p);		//Per-day terms for the new durations
+	chain->log_lik = cache_log_lik(&chain->cache);
+}
+
+//Adds the current (log mean, log size) of every duration to the running covariance (Welford)
+static void learn_covariance(struct move_adaptation *adapt, struct parameter_list *p)
+{
+	int k;
+	double x0, x1, d0, d1;
+
+	adapt->cov_count++;
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		x0 = log(p->dur_mean[k]);
+		x1 = log(p->dur_size[k]);
+		d0 = x0 - adapt->cov_mean[k][0];
+		d1 = x1 - adapt->cov_mean[k][1];
+		adapt->cov_mean[k][0] += d0 / adapt->cov_count;
+		adapt->cov_mean[k][1] += d1 / adapt->cov_count;
+		adapt->cov_sum[k][0] += d0 * (x0 - adapt->cov_mean[k][0]);
+		adapt->cov_sum[k][1] += d0 * (x1 - adapt->cov_mean[k][1]);
+		adapt->cov_sum[k][2] += d1 * (x1 - adapt->cov_mean[k][1]);
+	}
+}
+
+//Nanoseconds since *since, which is then moved on to now
+static long lap_ns(struct timespec *since)
+{
+	struct timespec now;
+	long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (now.tv_sec - since->tv_sec) * 1000000000L + (now.tv_nsec - since->tv_nsec);
+	*since = now;
+	return ns;
+}
+
+//Adds the ticks since *since to a move's phase of the profile, and moves *since on to now
+static void lap_ticks(int move, unsigned long long *since)
+{
+	unsigned long long now = profile_ticks();
+
+	profile_stop(PROF_MOVE_FIRST + move, *since);
+	*since = now;
+}
+
+//One sweep: a date move and a parent move per case on average (exactly one date move per case in
+//a coloured sweep), births and deaths of unobserved cases, then the parameters
+void gibbs_sweep(struct chain_state *chain)
+{
+	int i, step = date_step(chain);
+	int births_deaths = 1 + (int)(BIRTH_DEATH_PER_CASE * chain->num_cases);
+	long date_proposed = chain->proposed[MOVE_DATES], date_accepted = chain->accepted[MOVE_DATES];
+	struct timespec clock;
+	unsigned long long ticks = profile_start();
+
+	clock_gettime(CLOCK_MONOTONIC, &clock);
+	if (chain->coloured && chain->cache.stats.num_invalid == 0) coloured_date_moves(chain->coloured, chain, step);
+	else for (i = 0; i < chain->num_cases; i++) date_move(chain, step);
+	chain->move_ns[MOVE_DATES] += lap_ns(&clock);
+	lap_ticks(MOVE_DATES, &ticks);
+	for (i = 0; i < chain->num_cases; i++) parent_move(chain);
+	chain->move_ns[MOVE_PARENT] += lap_ns(&clock);
+	lap_ticks(MOVE_PARENT, &ticks);
+	for (i = 0; i < births_deaths; i++) birth_death_move(chain);
+	chain->move_ns[MOVE_BIRTH_DEATH] += lap_ns(&clock);
+	lap_ticks(MOVE_BIRTH_DEATH, &ticks);
+	rates_move(chain);
+	chain->move_ns[MOVE_RATES] += lap_ns(&clock);
+	lap_ticks(MOVE_RATES, &ticks);
+	durations_move(chain);
+	chain->move_ns[MOVE_DURATIONS] += lap_ns(&clock);
+	lap_ticks(MOVE_DURATIONS, &ticks);
+	duration_block_move(chain);
+	chain->move_ns[MOVE_DURATION_BLOCK] += lap_ns(&clock);
+	lap_ticks(MOVE_DURATION_BLOCK, &ticks);
+	chain->sweeps++;
+
+	if (chain->adapting) {
+		adapt_scale(chain, &chain->adapt.date_log_scale, (double)(chain->accepted[MOVE_DATES] - date_accepted)
+			/ (chain->proposed[MOVE_DATES] - date_proposed), TARGET_ACCEPT);
+		learn_covariance(&chain->adapt, &chain->params);
+		chain->adapt.sweeps++;
+	}
+
+	//Running totals are checked against a full recompute now and then
+	if (chain->sweeps % DRIFT_CHECK_SWEEPS == 0) {
+		cache_check_drift(&chain->cache, chain->first_case, &chain->params);
+		if (chain->incidence.tree) check_incidence(&chain->incidence, chain->first_case);
+		if (chain->renewal) {
+			check_renewal(chain->renewal);
+			set_renewal_parameters(chain->renewal, &chain->params);
+			refresh_renewal(chain->renewal);
+		}
+		chain->log_lik = cache_log_lik(&chain->cache);
+	}
+}
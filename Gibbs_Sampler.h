@@ -0,0 +1,98 @@
+/********************************************************************************
+*	Gibbs_Sampler.h																*
+*	Contains:																	*
+*		- The state of one Markov chain (its own cases, parameters and random	*
+*			number stream), so that many chains can run side by side			*
+*		- Unobserved cases, added and removed by reversible-jump moves			*
+*		- Functions defined in Gibbs_Sampler.c									*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h and				*
+*		Incidence.h first.														*
+********************************************************************************/
+
+//Types of move made in each sweep
+#define NUM_MOVE_TYPES 6
+#define MOVE_DATES 0			//Shift one key date of one case
+#define MOVE_PARENT 1			//Change the parent (and transmission type) of one case
+#define MOVE_RATES 2			//Gibbs update of transmission rates and diagnosis/survival probabilities
+#define MOVE_DURATIONS 3		//Metropolis update of one parameter of a duration distribution
+#define MOVE_DURATION_BLOCK 4	//Joint update of the mean and size of a duration, from their learned covariance
+#define MOVE_BIRTH_DEATH 5		//Add or remove one unobserved case
+
+//Proposal settings (starting values - the scales adapt during burn-in)
+#define DATE_STEP 3				//Largest shift (in days) proposed for a date
+#define MAX_DATE_STEP 60
+#define DUR_STEP 0.1			//Standard deviation of the log-scale random walk for duration parameters
+#define ZOONOTIC_PROPOSAL 0.1	//Probability that a parent move proposes index (zoonotic) transmission
+#define BIRTH_DEATH_PER_CASE 0.25	//Birth/death proposals per case in each sweep
+#define UNOBSERVED_PRIOR_MEAN 100.0	//Prior mean of the unobserved cases per observed case (their number is geometric)
+#define UNOBSERVED_TEMPERING 20.0	//Log likelihood each unobserved case costs a chain at heat 0 (see tempered_log_lik)
+#define MAX_UNOBSERVED 1000		//Most unobserved cases per observed case - a memory guard (births beyond, or beyond the
+								//cases' memory budget, are refused, and the run summary counts them)
+
+//Adaptation of the proposal scales during burn-in (frozen afterwards, so the chain stays reversible)
+#define TARGET_ACCEPT 0.44			//Best acceptance rate of a one-dimensional random walk
+#define TARGET_ACCEPT_BLOCK 0.35	//Best acceptance rate of a two-dimensional random walk
+#define SCALE_ADAPT_RATE 1.0		//Step size of the Robbins-Monro updates of log(scale) in the first sweep
+#define COVARIANCE_MIN_SWEEPS 100	//Sweeps of history before block moves use the learned covariance
+
+/********************************************
+* Structures describing one chain			*
+********************************************/
+
+//Proposal scales, each moved by SCALE_ADAPT_RATE / sqrt(sweeps) * (accepted - target) after every
+//sweep of burn-in, and the running covariance of (log mean, log size) of every duration
+struct move_adaptation
+{
+	double date_log_scale;						//log of the largest shift of a date
+	double dur_log_scale[NUM_DURATIONS][2];		//log of the step for [k][0] dur_mean[k] and [k][1] dur_size[k]
+	double block_log_scale[NUM_DURATIONS];		//log of the multiple of the covariance used by block moves
+	double sweeps;								//Sweeps of adaptation so far
+	double cov_mean[NUM_DURATIONS][2];			//Running mean of (log mean, log size)
+	double cov_sum[NUM_DURATIONS][3];			//Running sums of squared deviations: mean-mean, mean-size, size-size
+	double cov_count;
+};
+
+struct chain_state
+{
+	int chain_ID;					//Which chain this is - fixed for the whole run
+	int rung;						//Position on the temperature ladder (0 = the posterior itself)
+	double heat;					//Inverse temperature: the likelihood is raised to this power
+	struct mt_state rng;			//Random number stream for this chain alone
+	struct parameter_list params;	//This chain's copy of the model parameters
+	struct patient *cases;			//Block of capacity cases, copied so chains share nothing: the observed cases
+									//first, then the unobserved ones with no gaps (so one can be picked in O(1))
+	p_patient first_case;			//Start of the linked list (next/prev) through the block
+	int num_cases;					//Observed and unobserved
+	int num_observed;				//Cases from the reports - never added or removed
+	int capacity;
+	int max_unobserved;				//Births that would take the unobserved cases past this are refused
+	long births_capped;				//Births refused at max_unobserved (the posterior is cut off there if any are)
+	struct likelihood_cache cache;	//Sufficient statistics and per-case terms of the current cases
+	struct incidence_counts incidence;	//Events of the current cases per subregion and day (tree NULL unless the run keeps them)
+	double log_lik;					//Log likelihood of the current state (not raised to heat)
+	double log_prior;				//Log prior of the current parameters
+	long sweeps;					//Number of sweeps made by this chain
+	long proposed[NUM_MOVE_TYPES];	//Moves proposed, by type
+	long accepted[NUM_MOVE_TYPES];	//Moves accepted, by type
+	long move_ns[NUM_MOVE_TYPES];	//Time spent in moves, by type
+	int adapting;					//1 while the proposal scales adapt (set by the caller before each sweep)
+	struct move_adaptation adapt;
+	struct coloured_sweep *coloured;	//If not NULL, date moves are spread over its threads (see Coloured_Sweep.h)
+	struct renewal_engine *renewal;		//If not NULL, kept up to date with the onsets (see Renewal.h)
+};
+
+/****************************************
+* Functions defined in Gibbs_Sampler.c	*
+****************************************/
+
+void initialise_parameters(struct parameter_list *p_params);
+int set_parameter_values(struct parameter_list *p_params, const char *spec);
+void initialise_chain(struct chain_state *chain, p_patient first, struct parameter_list *p_params,
+	int chain_ID, double heat, unsigned long seed);
+void free_chain(struct chain_state *chain);
+int unobserved_limit(int num_observed);
+double tempered_log_lik(const struct chain_state *chain);
+void attach_to_parent(p_patient child, p_patient parent);
+void detach_from_parent(p_patient child);
+void initialise_adaptation(struct move_adaptation *adapt);
+void gibbs_sweep(struct chain_state *chain);
@@ -0,0 +1,170 @@
+/********************************************************************************
+*	Incidence.c																	*
+*	Counts of key events per subregion and day (see Incidence.h).				*
+*	Each (subregion, event) pair has a Fenwick tree over the days: node i		*
+*		holds the events of the days i - (i & -i) + 1 to i (counting from 1),	*
+*		so a day's count is changed by walking up the nodes, and the events		*
+*		up to a day summed by walking down them, each in O(log NUMDAYS).		*
+*	Every event goes into its subregion's tree and into the tree of every		*
+*		case, so totals cost no more than a single subregion. Updates are		*
+*		atomic: coloured sweeps move the dates of several cases at once.		*
+*	Days outside 0 to NUMDAYS - 1 are left out (a valid case has none).			*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memset
+#include "Date_And_Reading_Reports.h"	//For the case structure
+#include "Incidence.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For reporting bugs
+
+/*-------------------------------
+| trees							|
+-------------------------------*/
+
+//Tree of one event for one location (NO_LOCATION, INCIDENCE_ALL or a subregion the counts cover)
+static int *event_tree(struct incidence_counts *counts, int location, int event)
+{
+	int row;
+
+	if (location == INCIDENCE_ALL) row = counts->num_locations + 1;
+	else if (location == NO_LOCATION) row = counts->num_locations;
+	else row = location;
+	return counts->tree + ((long)row * NUM_INCIDENCE_EVENTS + event) * NUMDAYS;
+}
+
+//1 if a query of location can have events (a subregion no case has has none)
+static int has_tree(struct incidence_counts *counts, int location)
+{
+	return location == INCIDENCE_ALL || location == NO_LOCATION || (location >= 0 && location < counts->num_locations);
+}
+
+//Adds change to one day of a tree
+static void tree_add(int *tree, int day, int change)
+{
+	int i;
+
+	if (day < 0 || day >= NUMDAYS) return;
+	for (i = day + 1; i <= NUMDAYS; i += i & -i) __atomic_fetch_add(&tree[i - 1], change, __ATOMIC_RELAXED);
+}
+
+//Events of a tree from day 0 to day (0 if day is negative)
+static int tree_prefix(const int *tree, int day)
+{
+	int i, total = 0;
+
+	if (day >= NUMDAYS) day = NUMDAYS - 1;
+	for (i = day + 1; i > 0; i -= i & -i) total += tree[i - 1];
+	return total;
+}
+
+//Moves one event of a case from one day to another, in its subregion and the total
+static void move_event(struct incidence_counts *counts, int location, int event, int from, int to)
+{
+	int *tree = event_tree(counts, location, event);
+	int *total = event_tree(counts, INCIDENCE_ALL, event);
+
+	tree_add(tree, from, -1);
+	tree_add(total, from, -1);
+	tree_add(tree, to, 1);
+	tree_add(total, to, 1);
+}
+
+/*-------------------------------
+| cases							|
+-------------------------------*/
+
+//Adds (sign 1) or takes away (sign -1) every event of a case
+void incidence_add_case(struct incidence_counts *counts, p_patient current, int sign)
+{
+	int event;
+
+	for (event = 0; event < NUM_INCIDENCE_EVENTS; event++) {
+		if (event == INCIDENCE_BURIAL && current->survive) continue;
+		tree_add(event_tree(counts, current->location, event), current->dates[event], sign);
+		tree_add(event_tree(counts, INCIDENCE_ALL, event), current->dates[event], sign);
+	}
+}
+
+//Moves the events of a case whose dates were old_dates to its dates now
+void incidence_move_dates(struct incidence_counts *counts, p_patient current, const int *old_dates)
+{
+	int event;
+
+	for (event = 0; event < NUM_INCIDENCE_EVENTS; event++) {
+		if (event == INCIDENCE_BURIAL && current->survive) continue;
+		if (current->dates[event] != old_dates[event])
+			move_event(counts, current->location, event, old_dates[event], current->dates[event]);
+	}
+}
+
+//Sets up the counts for every subregion the cases from first have, and counts them
+void build_incidence(struct incidence_counts *counts, p_patient first)
+{
+	p_patient current;
+
+	counts->num_locations = 0;
+	for (current = first; current != NULL; current = current->next)
+		if (current->location >= counts->num_locations) counts->num_locations = current->location + 1;
+
+	//Births copy their parent's subregion, so the cases never reach a new one
+	counts->tree = (int*)mem_calloc(MEM_SAMPLER, (size_t)(counts->num_locations + 2) * NUM_INCIDENCE_EVENTS * NUMDAYS, sizeof(int));
+	if (!counts->tree) { printf("Could not allocate tree in build_incidence.\n"); exit(1); }
+	for (current = first; current != NULL; current = current->next) incidence_add_case(counts, current, 1);
+}
+
+void free_incidence(struct incidence_counts *counts)
+{
+	mem_free(counts->tree);
+	counts->tree = NULL;
+	counts->num_locations = 0;
+}
+
+/*-------------------------------
+| queries						|
+-------------------------------*/
+
+//Events of one type in a location (a subregion, NO_LOCATION or INCIDENCE_ALL) from first_day to last_day
+int incidence_range(struct incidence_counts *counts, int location, int event, int first_day, int last_day)
+{
+	int *tree;
+
+	if (last_day < first_day || !has_tree(counts, location)) return 0;
+	tree = event_tree(counts, location, event);
+	return tree_prefix(tree, last_day) - tree_prefix(tree, first_day - 1);
+}
+
+//Cases of a location infectious (from onset until death or recovery) on any day from first_day to
+//last_day: those with onset by last_day, less those whose infectiousness ended by first_day
+int infectious_cases(struct incidence_counts *counts, int location, int first_day, int last_day)
+{
+	if (last_day < first_day || !has_tree(counts, location)) return 0;
+	return tree_prefix(event_tree(counts, location, INCIDENCE_ONSET), last_day)
+		- tree_prefix(event_tree(counts, location, INCIDENCE_END), first_day);
+}
+
+//Counts the events again from the cases and compares every day of every tree. Returns the number of
+//days that differ (0 if the counts are right).
+int check_incidence(struct incidence_counts *counts, p_patient first)
+{
+	struct incidence_counts fresh;
+	int row, event, day, *tree, *fresh_tree, wrong = 0;
+
+	fresh.num_locations = counts->num_locations;
+	fresh.tree = (int*)mem_calloc(MEM_SAMPLER, (size_t)(counts->num_locations + 2) * NUM_INCIDENCE_EVENTS * NUMDAYS, sizeof(int));
+	if (!fresh.tree) { printf("Could not allocate tree in check_incidence.\n"); exit(1); }
+	for (; first != NULL; first = first->next) incidence_add_case(&fresh, first, 1);
+
+	for (row = 0; row < counts->num_locations + 2; row++) {
+		for (event = 0; event < NUM_INCIDENCE_EVENTS; event++) {
+			tree = counts->tree + ((long)row * NUM_INCIDENCE_EVENTS + event) * NUMDAYS;
+			fresh_tree = fresh.tree + ((long)row * NUM_INCIDENCE_EVENTS + event) * NUMDAYS;
+			for (day = 0; day < NUMDAYS; day++) if (tree[day] != fresh_tree[day]) wrong++;
+		}
+	}
+	free_incidence(&fresh);
+	if (wrong > 0) log_error(LOG_SAMPLER, "Incidence counts differed from a recount on %d days - the moves have a bug.", wrong);
+	return wrong;
+}
@@ -0,0 +1,45 @@
+/********************************************************************************
+*	Incidence.h																	*
+*	Contains:																	*
+*		- Counts of each case's key events (exposure, onset, end of				*
+*			infectiousness and burial) per subregion and day, kept in			*
+*			binary-indexed (Fenwick) trees over the days, so moving one event	*
+*			or counting the events of a range of days costs O(log NUMDAYS)		*
+*			rather than a pass over the cases									*
+*		- Functions defined in Incidence.c										*
+*	Needs Date_And_Reading_Reports.h first.										*
+********************************************************************************/
+
+//Events counted (the same order as patient.dates)
+#define NUM_INCIDENCE_EVENTS 4
+#define INCIDENCE_EXPOSURE 0
+#define INCIDENCE_ONSET 1
+#define INCIDENCE_END 2				//Death or recovery
+#define INCIDENCE_BURIAL 3			//Fatal cases only
+
+#define INCIDENCE_ALL -2			//Location of the counts over every subregion (NO_LOCATION is the cases with none)
+
+/************************************************
+* Structure of the counts						*
+************************************************/
+
+//One block of trees, subregion by subregion and event by event within each, so one case's
+//events are updated within a few pages. Row num_locations holds the cases with no subregion
+//(NO_LOCATION), and row num_locations + 1 every case.
+struct incidence_counts
+{
+	int num_locations;
+	int *tree;						//tree[(row * NUM_INCIDENCE_EVENTS + event) * NUMDAYS + i]: node i + 1 of that tree
+};
+
+/****************************************
+* Functions defined in Incidence.c		*
+****************************************/
+
+void build_incidence(struct incidence_counts *counts, p_patient first);
+void free_incidence(struct incidence_counts *counts);
+void incidence_add_case(struct incidence_counts *counts, p_patient current, int sign);
+void incidence_move_dates(struct incidence_counts *counts, p_patient current, const int *old_dates);
+int incidence_range(struct incidence_counts *counts, int location, int event, int first_day, int last_day);
+int infectious_cases(struct incidence_counts *counts, int location, int first_day, int last_day);
+int check_incidence(struct incidence_counts *counts, p_patient first);
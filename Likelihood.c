@@ -0,0 +1,538 @@
+/********************************************************************************
+*	Likelihood.c																*
+*	Likelihood of the augmented case data (dates, parents and transmission		*
+*		types of every case) given the model parameters.						*
+*	Each case contributes counts to a model_stats structure, and the			*
+*		likelihood is then a function of those counts and the parameters.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For standard C library functions
+#include <string.h>						//For memset
+#include <math.h>						//For log, lgamma and HUGE_VAL
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For structures and declarations of functions needed in this file
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Log.h"							//For reporting bugs
+
+/*---------------------------------------
+| functions on individual cases			|
+---------------------------------------*/
+
+//Gives the days [start, end) on which source could expose a case by transmission of the given type.
+//Returns 1 if there are any such days, 0 otherwise.
+int infectious_window(p_patient source, int type, int *start, int *end)
+{
+	*start = *end = 0;
+	switch (type) {
+	case 1:		//Individual transmission - from symptoms until death/recovery, or until diagnosis
+		*start = source->dates[1];
+		*end = source->dates[2];
+		if (source->diag && source->diag_day < *end) *end = source->diag_day;
+		break;
+	case 2:		//Hospital / care transmission - from diagnosis until death/recovery
+		if (!source->diag) return 0;
+		*start = source->diag_day;
+		*end = source->dates[2];
+		break;
+	case 3:		//Burial transmission - from death until burial
+		if (source->survive) return 0;
+		*start = source->dates[2];
+		*end = source->dates[3];
+		break;
+	default:	//Index (zoonotic) transmission has no source case
+		return 0;
+	}
+	return *end > *start;
+}
+
+//Checks that a case's dates are in order and inside the study period, and that it was exposed
+//while its parent was infectious. Returns 1 for a valid case, 0 otherwise.
+int case_is_valid(p_patient current)
+{
+	int start, end;
+	int *d = current->dates;
+
+	if (d[0] < 0 || d[0] >= d[1] || d[1] >= d[2] || d[2] > d[3] || d[3] >= NUMDAYS) return 0;
+	if (current->survive && d[3] != d[2]) return 0;		//Survivors have no burial period
+	if (current->diag && (current->diag_day < d[1] || current->diag_day >= NUMDAYS)) return 0;
+
+	if (current->transmission_type == 0) return current->parent_case == NULL;
+	if (current->parent_case == NULL) return 0;
+	if (!infectious_window(current->parent_case, current->transmission_type, &start, &end)) return 0;
+	return d[0] >= start && d[0] < end;
+}
+
+/*---------------------------------------
+| functions on sets of cases			|
+---------------------------------------*/
+
+void clear_model_stats(struct model_stats *stats)
+{
+	memset(stats, 0, sizeof(struct model_stats));
+}
+
+//Works out what one case contributes to the statistics, from its current state
+void case_contribution(p_patient current, struct case_contribution *contrib)
+{
+	int k, type, start, end;
+	int *d = current->dates;
+
+	contrib->present = 1;
+	contrib->valid = case_is_valid(current);
+	contrib->type = current->transmission_type;
+	contrib->diag = current->diag;
+	contrib->survive = current->survive;
+	contrib->epoch = -1;		//Term not yet worked out
+	contrib->term = 0;
+	for (type = 0; type < NUM_TRANS_TYPES; type++) contrib->window[type] = 0;
+	for (k = 0; k < NUM_DURATIONS; k++) contrib->dur[k] = -1;
+	if (!contrib->valid) return;
+
+	for (type = 1; type < NUM_TRANS_TYPES; type++) {
+		if (infectious_window(current, type, &start, &end)) contrib->window[type] = end - start;
+	}
+	contrib->dur[DUR_INCUBATION] = d[1] - d[0] - 1;
+	contrib->dur[DUR_INFECTIOUS] = d[2] - d[1] - 1;
+	if (!current->survive) contrib->dur[DUR_BURIAL] = d[3] - d[2];
+	if (current->diag) contrib->dur[DUR_DIAGNOSIS] = current->diag_day - d[1];
+}
+
+//Adds (sign = 1) or removes (sign = -1) a contribution to the statistics
+void apply_contribution(struct model_stats *stats, struct case_contribution *contrib, int sign)
+{
+	int k, type;
+
+	if (!contrib->present) return;
+	if (!contrib->valid) {
+		stats->num_invalid += sign;
+		return;
+	}
+
+	stats->trans_count[contrib->type] += sign;
+	for (type = 1; type < NUM_TRANS_TYPES; type++) stats->trans_exposure[type] += sign * contrib->window[type];
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		if (contrib->dur[k] < 0) continue;
+		stats->dur_hist[k][contrib->dur[k]] += sign;
+		stats->dur_count[k] += sign;
+	}
+	if (contrib->survive) stats->num_survive += sign;
+	else stats->num_fatal += sign;
+	if (contrib->diag) stats->num_diag += sign;
+	else stats->num_undiag += sign;
+}
+
+//Adds (sign = 1) or removes (sign = -1) one case's contribution to the statistics.
+//A case must be removed in exactly the state in which it was added.
+void add_case_stats(struct model_stats *stats, p_patient current, int sign)
+{
+	struct case_contribution contrib;
+
+	case_contribution(current, &contrib);
+	apply_contribution(stats, &contrib, sign);
+}
+
+//Adds the counts in from to into
+void merge_model_stats(struct model_stats *into, struct model_stats *from)
+{
+	int k, x, type;
+
+	for (type = 0; type < NUM_TRANS_TYPES; type++) {
+		into->trans_count[type] += from->trans_count[type];
+		into->trans_exposure[type] += from->trans_exposure[type];
+	}
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		for (x = 0; x < NUMDAYS; x++) into->dur_hist[k][x] += from->dur_hist[k][x];
+		into->dur_count[k] += from->dur_count[k];
+	}
+	into->num_diag += from->num_diag;
+	into->num_undiag += from->num_undiag;
+	into->num_survive += from->num_survive;
+	into->num_fatal += from->num_fatal;
+	into->num_invalid += from->num_invalid;
+}
+
+//Full recompute of the statistics over a linked list of cases
+void compute_model_stats(struct model_stats *stats, p_patient first)
+{
+	p_patient current;
+
+	clear_model_stats(stats);
+	for (current = first; current != NULL; current = current->next)
+		add_case_stats(stats, current, 1);
+}
+
+/*---------------------------------------
+| likelihood and prior					|
+---------------------------------------*/
+
+//Log probability of x under a negative binomial with the given mean and size
+double nb_log_pmf(int x, double mean, double size)
+{
+	return lgamma(x + size) - lgamma(size) - lgamma(x + 1.0)
+		+ size * log(size / (size + mean)) + x * log(mean / (size + mean));
+}
+
+//Log likelihood of a histogram of durations (hist[x] cases with duration x)
+double duration_log_lik(int *hist, double mean, double size)
+{
+	int x;
+	int count = 0;
+	double value = 0;
+	double log_p = log(mean / (size + mean));	//Parts of nb_log_pmf that don't depend on x
+	double lgamma_size = lgamma(size);
+
+	for (x = 0; x < NUMDAYS; x++) {
+		if (hist[x] == 0) continue;
+		value += hist[x] * (lgamma(x + size) - lgamma_size - lgamma(x + 1.0) + x * log_p);
+		count += hist[x];
+	}
+	return value + count * size * log(size / (size + mean));
+}
+
+//n * log(p), taking 0 * log(0) as 0
+static double count_log(double n, double p)
+{
+	if (n == 0) return 0;
+	return n * log(p);
+}
+
+//Log likelihood of the valid cases, ignoring any invalid ones
+static double valid_log_likelihood(struct model_stats *stats, struct parameter_list *p_params)
+{
+	int type, k;
+	double value;
+	unsigned long long ticks = profile_start();
+
+	//Transmission: a Poisson process of exposures from each source, at rate beta[type]
+	value = count_log(stats->trans_count[0], p_params->beta[0]) - p_params->beta[0] * NUMDAYS;
+	for (type = 1; type < NUM_TRANS_TYPES; type++)
+		value += count_log(stats->trans_count[type], p_params->beta[type])
+			- p_params->beta[type] * stats->trans_exposure[type];
+
+	//Durations between key dates
+	for (k = 0; k < NUM_DURATIONS; k++)
+		value += duration_log_lik(stats->dur_hist[k], p_params->dur_mean[k], p_params->dur_size[k]);
+
+	//Diagnosis and survival
+	value += count_log(stats->num_diag, p_params->p_diag) + count_log(stats->num_undiag, 1 - p_params->p_diag);
+	value += count_log(stats->num_survive, p_params->p_survive) + count_log(stats->num_fatal, 1 - p_params->p_survive);
+
+	profile_stop(PROF_LIKELIHOOD, ticks);
+	profile_count(PROF_LIKELIHOODS, 1);
+	return value;
+}
+
+double log_likelihood(struct model_stats *stats, struct parameter_list *p_params)
+{
+	if (stats->num_invalid > 0) return -HUGE_VAL;
+	return valid_log_likelihood(stats, p_params);
+}
+
+//Unnormalised log density of a gamma(shape, rate) prior
+static double gamma_log_prior(double x, double shape, double rate)
+{
+	if (x <= 0) return -HUGE_VAL;
+	return (shape - 1) * log(x) - rate * x;
+}
+
+//Unnormalised log density of a beta(a, b) prior
+static double beta_log_prior(double p, double a, double b)
+{
+	if (p <= 0 || p >= 1) return -HUGE_VAL;
+	return (a - 1) * log(p) + (b - 1) * log(1 - p);
+}
+
+double log_prior(struct parameter_list *p_params)
+{
+	int type, k;
+	double value;
+
+	value = gamma_log_prior(p_params->beta[0], BETA0_PRIOR_SHAPE, BETA0_PRIOR_RATE);
+	for (type = 1; type < NUM_TRANS_TYPES; type++)
+		value += gamma_log_prior(p_params->beta[type], BETA_PRIOR_SHAPE, BETA_PRIOR_RATE);
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		value += gamma_log_prior(p_params->dur_mean[k], DUR_MEAN_PRIOR_SHAPE, DUR_MEAN_PRIOR_RATE);
+		value += gamma_log_prior(p_params->dur_size[k], DUR_SIZE_PRIOR_SHAPE, DUR_SIZE_PRIOR_RATE);
+	}
+	value += beta_log_prior(p_params->p_diag, P_DIAG_PRIOR_A, P_DIAG_PRIOR_B);
+	value += beta_log_prior(p_params->p_survive, P_SURVIVE_PRIOR_A, P_SURVIVE_PRIOR_B);
+
+	return value;
+}
+
+/*---------------------------------------
+| incremental likelihood cache			|
+---------------------------------------*/
+
+//Per-day term for duration k equal to x, worked out the first time it is needed after a change
+static double dur_term(struct likelihood_cache *cache, int k, int x)
+{
+	if (cache->dur_stamp[k][x] != cache->dur_epoch[k]) {
+		cache->dur_log_pmf[k][x] = nb_log_pmf(x, cache->dur_mean[k], cache->dur_size[k]);
+		cache->dur_stamp[k][x] = cache->dur_epoch[k];
+	}
+	return cache->dur_log_pmf[k][x];
+}
+
+//Per-day term as above, but never stored - so the cache can be shared by threads that only read it
+static double shared_dur_term(struct likelihood_cache *cache, int k, int x)
+{
+	if (cache->dur_stamp[k][x] == cache->dur_epoch[k]) return cache->dur_log_pmf[k][x];
+	return nb_log_pmf(x, cache->dur_mean[k], cache->dur_size[k]);
+}
+
+//Log likelihood contributed by one case under the current parameters - worked out once per epoch.
+//If shared, the per-day terms are only read.
+static double work_out_term(struct likelihood_cache *cache, struct case_contribution *contrib, int shared)
+{
+	int k, type;
+	double term;
+
+	if (contrib->epoch == cache->epoch) return contrib->term;
+
+	term = 0;
+	if (contrib->valid) {
+		term = cache->log_beta[contrib->type];
+		for (type = 1; type < NUM_TRANS_TYPES; type++) term -= cache->beta[type] * contrib->window[type];
+		for (k = 0; k < NUM_DURATIONS; k++) {
+			if (contrib->dur[k] < 0) continue;
+			term += shared ? shared_dur_term(cache, k, contrib->dur[k]) : dur_term(cache, k, contrib->dur[k]);
+		}
+		term += contrib->diag ? cache->log_p_diag : cache->log_p_undiag;
+		term += contrib->survive ? cache->log_p_survive : cache->log_p_fatal;
+	}
+	contrib->term = term;
+	contrib->epoch = cache->epoch;
+	return term;
+}
+
+static double contribution_term(struct likelihood_cache *cache, struct case_contribution *contrib)
+{
+	return work_out_term(cache, contrib, 0);
+}
+
+//Term of contrib for a thread that shares the cache with others. Only contrib itself is written,
+//so threads may call this at once as long as each has its own contributions.
+double cache_shared_term(struct likelihood_cache *cache, struct case_contribution *contrib)
+{
+	return work_out_term(cache, contrib, 1);
+}
+
+//Works out the per-day terms of every duration up to margin days beyond the longest in the
+//statistics, so threads sharing the cache seldom have to work out terms they cannot store
+void cache_prepare_terms(struct likelihood_cache *cache, int margin)
+{
+	int k, x, longest;
+
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		for (longest = NUMDAYS - 1; longest > 0 && cache->stats.dur_hist[k][longest] == 0; longest--);
+		for (x = 0; x <= longest + margin && x < NUMDAYS; x++) dur_term(cache, k, x);
+	}
+}
+
+//Adds changes made outside the cache (e.g. by threads working on separate cases) to its totals
+void cache_merge(struct likelihood_cache *cache, struct model_stats *delta, double delta_log_lik)
+{
+	merge_model_stats(&cache->stats, delta);
+	cache->log_lik += delta_log_lik;
+}
+
+//Takes up new parameters: per-day terms of changed durations are marked out of date, and the
+//total is worked out from the statistics
+void cache_set_parameters(struct likelihood_cache *cache, struct parameter_list *p_params)
+{
+	int k, type;
+
+	for (type = 0; type < NUM_TRANS_TYPES; type++) {
+		cache->beta[type] = p_params->beta[type];
+		cache->log_beta[type] = log(p_params->beta[type]);
+	}
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		if (cache->dur_mean[k] == p_params->dur_mean[k] && cache->dur_size[k] == p_params->dur_size[k]) continue;
+		cache->dur_mean[k] = p_params->dur_mean[k];
+		cache->dur_size[k] = p_params->dur_size[k];
+		cache->dur_epoch[k]++;
+	}
+	cache->log_p_diag = log(p_params->p_diag);
+	cache->log_p_undiag = log(1 - p_params->p_diag);
+	cache->log_p_survive = log(p_params->p_survive);
+	cache->log_p_fatal = log(1 - p_params->p_survive);
+
+	cache->epoch++;		//Every cached term is now out of date
+	cache->log_lik = valid_log_likelihood(&cache->stats, p_params);
+}
+
+//Fills the cache from every case in the list
+static void fill_cache(struct likelihood_cache *cache, p_patient first, struct parameter_list *p_params)
+{
+	p_patient current;
+
+	clear_model_stats(&cache->stats);
+	for (current = first; current != NULL; current = current->next) {
+		if (current->index < 0 || current->index >= cache->capacity) {
+			printf("Case index %d is outside the likelihood cache.\n", current->index);
+			exit(1);
+		}
+		case_contribution(current, &cache->contrib[current->index]);
+		apply_contribution(&cache->stats, &cache->contrib[current->index], 1);
+	}
+	cache_set_parameters(cache, p_params);
+}
+
+//Sets up the cache for cases with index 0 to capacity - 1
+void init_likelihood_cache(struct likelihood_cache *cache, p_patient first, int capacity, struct parameter_list *p_params)
+{
+	memset(cache, 0, sizeof(struct likelihood_cache));
+	memset(cache->dur_stamp, -1, sizeof(cache->dur_stamp));		//No per-day terms worked out yet
+	cache->capacity = capacity;
+	cache->contrib = (struct case_contribution*)mem_calloc(MEM_SAMPLER, capacity > 0 ? capacity : 1, sizeof(struct case_contribution));
+	if (!cache->contrib) { printf("Could not allocate contrib in init_likelihood_cache.\n"); exit(1); }
+	cache->journal_size = 16;
+	cache->journal = (struct cache_journal_entry*)mem_malloc(MEM_SAMPLER, cache->journal_size * sizeof(struct cache_journal_entry));
+	if (!cache->journal) { printf("Could not allocate journal in init_likelihood_cache.\n"); exit(1); }
+	fill_cache(cache, first, p_params);
+}
+
+void free_likelihood_cache(struct likelihood_cache *cache)
+{
+	mem_free(cache->contrib);
+	mem_free(cache->journal);
+	cache->contrib = NULL;
+	cache->journal = NULL;
+}
+
+//Log likelihood of the current state (minus infinity if any case is invalid)
+double cache_log_lik(struct likelihood_cache *cache)
+{
+	if (cache->stats.num_invalid > 0) return -HUGE_VAL;
+	return cache->log_lik;
+}
+
+void cache_begin_move(struct likelihood_cache *cache)
+{
+	cache->journal_length = 0;
+	cache->pending = 0;
+}
+
+//Saves the cached contribution of a case in the journal and takes it out of the running totals
+static struct case_contribution *journal_case(struct likelihood_cache *cache, p_patient current)
+{
+	struct case_contribution *cached = &cache->contrib[current->index];
+	struct cache_journal_entry *entry;
+
+	if (cache->journal_length == cache->journal_size) {
+		cache->journal_size *= 2;
+		cache->journal = (struct cache_journal_entry*)mem_realloc(MEM_SAMPLER, cache->journal, cache->journal_size * sizeof(struct cache_journal_entry));
+		if (!cache->journal) { printf("Could not grow journal in cache_update_case.\n"); exit(1); }
+	}
+	entry = &cache->journal[cache->journal_length++];
+	entry->index = current->index;
+	cache->pending -= contribution_term(cache, cached);
+	entry->old = *cached;
+	apply_contribution(&cache->stats, cached, -1);
+	return cached;
+}
+
+//Replaces the cached contribution of a case whose state the move has just changed (or which the
+//move has just added). Call it for the case moved and for every case whose validity depends on
+//it (its children).
+void cache_update_case(struct likelihood_cache *cache, p_patient current)
+{
+	struct case_contribution *cached = journal_case(cache, current);
+
+	case_contribution(current, cached);
+	apply_contribution(&cache->stats, cached, 1);
+	cache->pending += contribution_term(cache, cached);
+}
+
+//Takes out the contribution of a case the move is deleting (which must have no children)
+void cache_remove_case(struct likelihood_cache *cache, p_patient current)
+{
+	struct case_contribution *cached = journal_case(cache, current);
+
+	memset(cached, 0, sizeof(struct case_contribution));
+}
+
+//Moves the cached contribution of a case whose index has changed from from to to, leaving from
+//empty. Only between moves - the journal must be empty.
+void cache_move_case(struct likelihood_cache *cache, int from, int to)
+{
+	cache->contrib[to] = cache->contrib[from];
+	memset(&cache->contrib[from], 0, sizeof(struct case_contribution));
+}
+
+//Makes room for cases with index up to capacity - 1
+void cache_reserve(struct likelihood_cache *cache, int capacity)
+{
+	if (capacity <= cache->capacity) return;
+	cache->contrib = (struct case_contribution*)mem_realloc(MEM_SAMPLER, cache->contrib, capacity * sizeof(struct case_contribution));
+	if (!cache->contrib) { printf("Could not grow contrib in cache_reserve.\n"); exit(1); }
+	memset(cache->contrib + cache->capacity, 0, (capacity - cache->capacity) * sizeof(struct case_contribution));
+	cache->capacity = capacity;
+}
+
+//Log likelihood if the move in progress is accepted
+double cache_proposed_log_lik(struct likelihood_cache *cache)
+{
+	profile_count(PROF_LIKELIHOODS, 1);
+	if (cache->stats.num_invalid > 0) return -HUGE_VAL;
+	return cache->log_lik + cache->pending;
+}
+
+void cache_accept(struct likelihood_cache *cache)
+{
+	cache->log_lik += cache->pending;
+	cache_begin_move(cache);
+}
+
+//Puts back every contribution replaced since the move began
+void cache_reject(struct likelihood_cache *cache)
+{
+	int j;
+	struct cache_journal_entry *entry;
+
+	for (j = cache->journal_length - 1; j >= 0; j--) {
+		entry = &cache->journal[j];
+		apply_contribution(&cache->stats, &cache->contrib[entry->index], -1);
+		cache->contrib[entry->index] = entry->old;
+		apply_contribution(&cache->stats, &cache->contrib[entry->index], 1);
+	}
+	cache_begin_move(cache);
+}
+
+//1 if two sets of statistics are identical (they hold whole numbers, so they must match exactly)
+static int same_stats(struct model_stats *a, struct model_stats *b)
+{
+	int k, x, type;
+
+	for (type = 0; type < NUM_TRANS_TYPES; type++)
+		if (a->trans_count[type] != b->trans_count[type] || a->trans_exposure[type] != b->trans_exposure[type]) return 0;
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		if (a->dur_count[k] != b->dur_count[k]) return 0;
+		for (x = 0; x < NUMDAYS; x++) if (a->dur_hist[k][x] != b->dur_hist[k][x]) return 0;
+	}
+	return a->num_diag == b->num_diag && a->num_undiag == b->num_undiag && a->num_survive == b->num_survive
+		&& a->num_fatal == b->num_fatal && a->num_invalid == b->num_invalid;
+}
+
+//Recomputes everything from the cases, reports any difference from the running totals, and
+//carries on from the recomputed values. Returns the drift in the log likelihood.
+double cache_check_drift(struct likelihood_cache *cache, p_patient first, struct parameter_list *p_params)
+{
+	struct model_stats old_stats = cache->stats;
+	double old_log_lik = cache->log_lik;
+	double drift;
+
+	fill_cache(cache, first, p_params);
+	drift = fabs(cache->log_lik - old_log_lik);
+	if (!same_stats(&old_stats, &cache->stats))
+		log_error(LOG_SAMPLER, "Likelihood cache statistics differed from a full recompute - the cache has a bug.");
+	else if (drift > DRIFT_TOLERANCE)
+		log_error(LOG_SAMPLER, "Likelihood cache drifted by %g from a full recompute.", drift);
+	if (drift > cache->max_drift) cache->max_drift = drift;
+	cache->drift_checks++;
+	return drift;
+}
@@ -0,0 +1,131 @@
+/********************************************************************************
+*	Likelihood.h																*
+*	Contains:																	*
+*		- Sufficient statistics of a set of cases for the model likelihood		*
+*		- Prior hyperparameters for the model parameters						*
+*		- Functions defined in Likelihood.c										*
+*	Needs Date_And_Reading_Reports.h to be included first.						*
+********************************************************************************/
+
+//Prior hyperparameters - gamma(shape, rate) for rates and durations, beta(a, b) for probabilities
+#define BETA_PRIOR_SHAPE 1.0		//Transmission rates (beta[1] to beta[3])
+#define BETA_PRIOR_RATE 1.0
+#define BETA0_PRIOR_SHAPE 1.0		//Zoonotic rate (beta[0])
+#define BETA0_PRIOR_RATE 10.0
+#define DUR_MEAN_PRIOR_SHAPE 2.0	//Duration means - prior mean of 10 days
+#define DUR_MEAN_PRIOR_RATE 0.2
+#define DUR_SIZE_PRIOR_SHAPE 1.0	//Duration sizes - prior mean of 10
+#define DUR_SIZE_PRIOR_RATE 0.1
+#define P_DIAG_PRIOR_A 1.0			//Diagnosis probability - uniform prior
+#define P_DIAG_PRIOR_B 1.0
+#define P_SURVIVE_PRIOR_A 1.0		//Survival probability - uniform prior
+#define P_SURVIVE_PRIOR_B 1.0
+
+//Checks on the incremental likelihood cache
+#define DRIFT_CHECK_SWEEPS 100		//Sweeps between full recomputes that check the running totals
+#define DRIFT_TOLERANCE 1e-6		//Largest drift in the log likelihood that passes a check silently
+
+/************************************************************
+* Structure summarising a set of cases for the likelihood	*
+************************************************************/
+
+//Every term of the likelihood depends on the cases only through these counts, so parameter
+//updates never need to look at the cases themselves.
+struct model_stats
+{
+	double trans_count[NUM_TRANS_TYPES];	//Number of cases infected by each transmission type
+	double trans_exposure[NUM_TRANS_TYPES];	//Infectious case-days open to each transmission type
+											//(trans_exposure[0] is unused - the zoonotic source is always there)
+	int dur_hist[NUM_DURATIONS][NUMDAYS];	//dur_hist[k][x]: number of cases with duration k equal to x
+	int dur_count[NUM_DURATIONS];			//Number of cases contributing to each duration
+	int num_diag;							//Diagnosed cases
+	int num_undiag;							//Undiagnosed cases
+	int num_survive;						//Cases that survived
+	int num_fatal;							//Cases that died
+	int num_invalid;						//Cases whose dates or parent break the model (likelihood is then zero)
+};
+
+/********************************************************
+* Structures for updating the likelihood incrementally	*
+********************************************************/
+
+//What one case adds to the statistics. Cached for every case, so a move only has to work out
+//the new contributions of the cases it touches - the old ones are already known.
+struct case_contribution
+{
+	int present;					//0 for a slot with no case in it (it then adds nothing)
+	int valid;						//0 if the case breaks the model (it then only adds to num_invalid)
+	int type;						//transmission_type of the case
+	int diag;
+	int survive;
+	int window[NUM_TRANS_TYPES];	//Length of the case's infectious window for each type (0 = none)
+	int dur[NUM_DURATIONS];			//Value of each key duration (-1 where it doesn't apply)
+	long epoch;						//Parameter epoch in which term was worked out (-1 = not yet)
+	double term;					//Log likelihood contributed by the case under those parameters
+};
+
+struct cache_journal_entry
+{
+	int index;						//Case whose cached contribution was replaced
+	struct case_contribution old;	//The contribution before the move
+};
+
+//Running totals of the likelihood, updated case by case. A move is begun, each case it changes
+//is updated, and the move is then accepted or rejected - a rejection replays the journal backwards.
+struct likelihood_cache
+{
+	struct model_stats stats;				//Running totals over all cases
+	int capacity;							//Number of cases that can be held (indexed by patient index)
+	struct case_contribution *contrib;		//contrib[i]: contribution of the case with index i
+	double dur_log_pmf[NUM_DURATIONS][NUMDAYS];	//Per-day terms: log probability of each duration value
+	long dur_stamp[NUM_DURATIONS][NUMDAYS];		//dur_epoch[k] when dur_log_pmf[k][x] was worked out
+	long dur_epoch[NUM_DURATIONS];				//Goes up when the distribution of duration k changes
+	double dur_mean[NUM_DURATIONS];				//Parameters the per-day terms are for
+	double dur_size[NUM_DURATIONS];
+	double log_beta[NUM_TRANS_TYPES];		//Logs of the current parameters, so terms are cheap
+	double beta[NUM_TRANS_TYPES];
+	double log_p_diag, log_p_undiag;
+	double log_p_survive, log_p_fatal;
+	long epoch;								//Goes up whenever the parameters change
+	double log_lik;							//Running total (valid cases only - see cache_log_lik)
+	double pending;							//Change to log_lik from the move in progress
+	struct cache_journal_entry *journal;	//Contributions replaced by the move in progress
+	int journal_length;
+	int journal_size;
+	long drift_checks;						//Number of full recomputes so far
+	double max_drift;						//Largest drift found by those recomputes
+};
+
+/****************************************
+* Functions defined in Likelihood.c		*
+****************************************/
+
+int infectious_window(p_patient source, int type, int *start, int *end);
+int case_is_valid(p_patient current);
+void clear_model_stats(struct model_stats *stats);
+void case_contribution(p_patient current, struct case_contribution *contrib);
+void apply_contribution(struct model_stats *stats, struct case_contribution *contrib, int sign);
+void add_case_stats(struct model_stats *stats, p_patient current, int sign);
+void merge_model_stats(struct model_stats *into, struct model_stats *from);
+void compute_model_stats(struct model_stats *stats, p_patient first);
+double nb_log_pmf(int x, double mean, double size);
+double duration_log_lik(int *hist, double mean, double size);
+double log_likelihood(struct model_stats *stats, struct parameter_list *p_params);
+double log_prior(struct parameter_list *p_params);
+
+void init_likelihood_cache(struct likelihood_cache *cache, p_patient first, int capacity, struct parameter_list *p_params);
+void free_likelihood_cache(struct likelihood_cache *cache);
+void cache_set_parameters(struct likelihood_cache *cache, struct parameter_list *p_params);
+double cache_log_lik(struct likelihood_cache *cache);
+void cache_begin_move(struct likelihood_cache *cache);
+void cache_update_case(struct likelihood_cache *cache, p_patient current);
+void cache_remove_case(struct likelihood_cache *cache, p_patient current);
+void cache_move_case(struct likelihood_cache *cache, int from, int to);
+void cache_reserve(struct likelihood_cache *cache, int capacity);
+double cache_proposed_log_lik(struct likelihood_cache *cache);
+double cache_shared_term(struct likelihood_cache *cache, struct case_contribution *contrib);
+void cache_prepare_terms(struct likelihood_cache *cache, int margin);
+void cache_merge(struct likelihood_cache *cache, struct model_stats *delta, double delta_log_lik);
+void cache_accept(struct likelihood_cache *cache);
+void cache_reject(struct likelihood_cache *cache);
+double cache_check_drift(struct likelihood_cache *cache, p_patient first, struct parameter_list *p_params);
@@ -0,0 +1,84 @@
+/********************************************************************************
+*	Live_Ring.h																	*
+*	Contains:																	*
+*		- The layout of a live ring: a POSIX shared-memory segment in which		*
+*			the sampler publishes the cold chain's latest parameters, the		*
+*			acceptance counts of every move and the swap rates after every		*
+*			round, for monitors on the same machine to read while it runs		*
+*		- Functions defined in Live_Ring_Writer.c and Live_Ring_Reader.c		*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h, Trace.h, Posterior_Summary.h and						*
+*		Parallel_Tempering.h first.												*
+********************************************************************************/
+
+#define LIVE_MAGIC "EBOLALIV"			//First 8 bytes of the segment
+#define LIVE_VERSION 1
+#define LIVE_RING_SLOTS 1024			//Samples kept - older ones are written over
+#define LIVE_MAX_RUNGS 32				//Swap rates are published for the lowest this many rungs
+#define LIVE_TAIL_POLL_MS 100			//How often the tail looks for new samples
+
+/************************************************
+* Structures of a live ring						*
+************************************************/
+
+//One sample: the state after a round of sweeps and swaps
+struct live_sample
+{
+	long sample;						//Number of the sample, from 0
+	long sweep;
+	double seconds;						//Since the run (or the restart) began
+	double values[NUM_TRACE_VALUES];	//Of the cold chain, as in a trace (TRACE_ definitions)
+	long proposed[NUM_MOVE_TYPES];		//Moves so far, summed over every chain
+	long accepted[NUM_MOVE_TYPES];
+	double swap_rate[LIVE_MAX_RUNGS];	//Smoothed rate of swaps between rung r and rung r + 1
+	long summary_samples;				//Samples of the cold chain in the posterior summary
+};
+
+//Each slot is a sequence lock: the writer makes sequence odd, fills the sample and makes it even
+//again. A reader copies the sample and keeps it only if sequence was even and unchanged throughout,
+//so the writer never waits for a reader.
+struct live_slot
+{
+	unsigned long sequence;
+	struct live_sample sample;
+} __attribute__((aligned(64)));			//Slots never share a cache line
+
+struct live_ring_header
+{
+	char magic[8];
+	int version;
+	int num_slots;
+	int slot_size;						//sizeof(struct live_slot), to catch a reader built differently
+	int num_chains;
+	int num_rungs;
+	int finished;						//1 once the run is over
+	long pid;							//Of the sampler
+	long num_sweeps;
+	long burn_in;
+	long published;						//Samples published so far - sample n is in slot n % num_slots
+	char value_names[NUM_TRACE_VALUES][16];
+	char move_names[NUM_MOVE_TYPES][16];
+} __attribute__((aligned(64)));			//Followed by the slots
+
+struct live_ring;		//Defined in Live_Ring_Writer.c - only used through the functions below
+struct live_reader;		//Defined in Live_Ring_Reader.c - only used through the functions below
+
+/********************************************
+* Functions defined in Live_Ring_Writer.c	*
+********************************************/
+
+void live_ring_path(const char *name, char *path, size_t size);
+struct live_ring *open_live_ring(const char *name, struct sampler_run *run);
+void publish_live_sample(struct live_ring *ring, struct sampler_run *run, double seconds);
+void close_live_ring(struct live_ring *ring);
+
+/********************************************
+* Functions defined in Live_Ring_Reader.c	*
+********************************************/
+
+struct live_reader *attach_live_ring(const char *name);
+const struct live_ring_header *live_ring_header(struct live_reader *reader);
+long live_samples_published(struct live_reader *reader);
+int read_live_sample(struct live_reader *reader, long sample_number, struct live_sample *sample);
+void detach_live_ring(struct live_reader *reader);
+void tail_live_ring(const char *name);
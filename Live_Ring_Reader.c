@@ -0,0 +1,164 @@
+/********************************************************************************
+*	Live_Ring_Reader.c															*
+*	Reads samples from a live ring (layout in Live_Ring.h) while the sampler	*
+*		writes them. The segment is mapped read-only, so a reader cannot		*
+*		disturb the sampler, and a sample is read straight from the mapping.	*
+*	A sample that was written over before it was read (the reader fell more		*
+*		than LIVE_RING_SLOTS behind) is reported as lost rather than mixed		*
+*		up with a later one.													*
+*	Also the tail: prints the latest sample now and then, until the run ends	*
+*		or the sampler's process is gone.										*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcmp and memcpy
+#include <unistd.h>						//For close and usleep
+#include <errno.h>						//For telling a process that is gone from one we may not signal
+#include <signal.h>						//For kill, to see whether the sampler is still there
+#include <fcntl.h>						//For the flags of shm_open
+#include <sys/mman.h>					//For shared memory
+#include <sys/stat.h>					//For the size of the segment
+#include "MTrandom.h"					//Needed by Gibbs_Sampler.h
+#include "Date_And_Reading_Reports.h"	//Needed by Gibbs_Sampler.h
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the move types
+#include "Trace.h"						//For the values of a sample
+#include "Posterior_Summary.h"			//Needed by Parallel_Tempering.h
+#include "Parallel_Tempering.h"			//Needed by Live_Ring.h
+#include "Live_Ring.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For errors
+
+struct live_reader
+{
+	size_t size;
+	const struct live_ring_header *header;
+	const struct live_slot *slots;
+};
+
+//Maps the live ring of name. Returns NULL, having said why, if there is none or it is not one.
+struct live_reader *attach_live_ring(const char *name)
+{
+	struct live_reader *reader;
+	struct stat status;
+	char path[110];
+	void *mapping;
+	int fd;
+
+	live_ring_path(name, path, sizeof(path));
+	fd = shm_open(path, O_RDONLY, 0);
+	if (fd < 0) { log_error(LOG_MAIN, "No live ring %s - is the run going, with -live?", path); return NULL; }
+	if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(struct live_ring_header)) {
+		log_error(LOG_MAIN, "Live ring %s is not complete.", path);
+		close(fd);
+		return NULL;
+	}
+	mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) { printf("Could not map live ring %s.\n", path); return NULL; }
+
+	reader = (struct live_reader*)mem_malloc(MEM_IO, sizeof(struct live_reader));
+	if (!reader) { printf("Could not allocate reader in attach_live_ring.\n"); exit(1); }
+	reader->size = status.st_size;
+	reader->header = (const struct live_ring_header*)mapping;
+	reader->slots = (const struct live_slot*)(reader->header + 1);
+	if (memcmp(reader->header->magic, LIVE_MAGIC, 8) != 0 || reader->header->version != LIVE_VERSION
+		|| reader->header->slot_size != (int)sizeof(struct live_slot)
+		|| reader->size < sizeof(struct live_ring_header) + (size_t)reader->header->num_slots * sizeof(struct live_slot)) {
+		log_error(LOG_MAIN, "%s is not a live ring of this version.", path);
+		detach_live_ring(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+//The header, for the names of values and moves and the shape of the run
+const struct live_ring_header *live_ring_header(struct live_reader *reader)
+{
+	return reader->header;
+}
+
+long live_samples_published(struct live_reader *reader)
+{
+	return __atomic_load_n(&reader->header->published, __ATOMIC_ACQUIRE);
+}
+
+//Copies sample sample_number out of its slot. Returns 1 if it did, 0 if it is not published yet and
+//-1 if it has been written over.
+int read_live_sample(struct live_reader *reader, long sample_number, struct live_sample *sample)
+{
+	const struct live_slot *slot;
+	unsigned long sequence;
+	long published = live_samples_published(reader);
+
+	if (sample_number >= published) return 0;
+	if (sample_number < published - reader->header->num_slots) return -1;
+	slot = &reader->slots[sample_number % reader->header->num_slots];
+	for (;;) {
+		sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		if (sequence & 1) continue;					//Being written - a few hundred bytes, so not for long
+		memcpy(sample, &slot->sample, sizeof(struct live_sample));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence) break;
+	}
+	return sample->sample == sample_number ? 1 : -1;	//Or a later lap got there first
+}
+
+void detach_live_ring(struct live_reader *reader)
+{
+	munmap((void*)reader->header, reader->size);
+	mem_free(reader);
+}
+
+/*-------------------------------
+| the tail						|
+-------------------------------*/
+
+//Prints the latest sample of the live ring of name every LIVE_TAIL_POLL_MS, if there is a new one, until the run finishes.
+//Exits with a message if the sampler's process goes without finishing the run.
+void tail_live_ring(const char *name)
+{
+	struct live_reader *reader;
+	const struct live_ring_header *header;
+	struct live_sample sample;
+	long latest, shown = -1;
+	int m, finished;
+
+	reader = attach_live_ring(name);
+	if (!reader) exit(1);
+	header = live_ring_header(reader);
+	printf("Run %ld: %d chains, %ld sweeps (%ld burn-in).\n", header->pid, header->num_chains, header->num_sweeps, header->burn_in);
+	printf("%9s %8s %12s %10s %10s %10s %10s %7s %7s %5s", "sweep", "seconds", header->value_names[TRACE_LOG_LIK],
+		header->value_names[TRACE_BETA], header->value_names[TRACE_BETA + 1], header->value_names[TRACE_BETA + 2],
+		header->value_names[TRACE_BETA + 3], header->value_names[TRACE_P_DIAG], header->value_names[TRACE_P_SURVIVE], "unobs");
+	for (m = 0; m < NUM_MOVE_TYPES; m++) printf(" %10s", header->move_names[m]);
+	printf(" %6s\n", "swap0");
+
+	while (1) {
+		finished = __atomic_load_n(&header->finished, __ATOMIC_ACQUIRE);	//Before the count, so the last sample is shown
+		latest = live_samples_published(reader) - 1;
+		if (latest > shown && read_live_sample(reader, latest, &sample) == 1) {
+			printf("%9ld %8.2f %12.3f %10.4g %10.4g %10.4g %10.4g %7.3f %7.3f %5.0f", sample.sweep, sample.seconds,
+				sample.values[TRACE_LOG_LIK], sample.values[TRACE_BETA], sample.values[TRACE_BETA + 1], sample.values[TRACE_BETA + 2],
+				sample.values[TRACE_BETA + 3], sample.values[TRACE_P_DIAG], sample.values[TRACE_P_SURVIVE],
+				sample.values[TRACE_UNOBSERVED]);
+			for (m = 0; m < NUM_MOVE_TYPES; m++)
+				printf(" %10.3f", sample.proposed[m] > 0 ? (double)sample.accepted[m] / sample.proposed[m] : 0);
+			printf(" %6.3f\n", sample.swap_rate[0]);
+			fflush(stdout);
+			shown = latest;
+		}
+		if (finished) break;
+		if (kill((pid_t)header->pid, 0) != 0 && errno != EPERM && !__atomic_load_n(&header->finished, __ATOMIC_ACQUIRE)) {
+			printf("Run %ld ended without finishing, after %ld samples.\n", header->pid, live_samples_published(reader));
+			detach_live_ring(reader);
+			exit(1);
+		}
+		usleep(LIVE_TAIL_POLL_MS * 1000);
+	}
+	printf("Run finished after %ld samples.\n", live_samples_published(reader));
+	detach_live_ring(reader);
+}
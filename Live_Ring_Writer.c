@@ -0,0 +1,133 @@
+/********************************************************************************
+*	Live_Ring_Writer.c															*
+*	Publishes the sampler's progress into a live ring (layout in Live_Ring.h).	*
+*	The sampler's thread is the only writer. A sample is a few hundred bytes	*
+*		copied into shared memory after each round of swaps, with no system		*
+*		calls and no locks, so readers cost the sampler nothing.				*
+*	The segment is removed when the run ends. Readers still attached keep		*
+*		their mapping, and see finished set.									*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memset and strncpy
+#include <unistd.h>						//For ftruncate and getpid
+#include <fcntl.h>						//For the flags of shm_open
+#include <sys/mman.h>					//For shared memory
+#include "MTrandom.h"					//Needed by Gibbs_Sampler.h
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains and their move counts
+#include "Trace.h"						//For the values of a sample
+#include "Posterior_Summary.h"			//Needed by Parallel_Tempering.h
+#include "Parallel_Tempering.h"			//For the run and its ladder
+#include "Live_Ring.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+
+struct live_ring
+{
+	char path[110];						//Name of the segment
+	size_t size;
+	struct live_ring_header *header;	//The mapping - the slots follow the header
+	struct live_slot *slots;
+};
+
+//Name of the segment for name: POSIX names start with a single slash
+void live_ring_path(const char *name, char *path, size_t size)
+{
+	snprintf(path, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+//Makes (or replaces) the segment for name, sized for run. Returns NULL, having said why, if it cannot be made.
+struct live_ring *open_live_ring(const char *name, struct sampler_run *run)
+{
+	struct live_ring *ring;
+	const char *value_names[NUM_TRACE_VALUES] = { "log_lik", "log_prior", "beta0", "beta1", "beta2", "beta3",
+		"dur_mean0", "dur_mean1", "dur_mean2", "dur_mean3", "dur_size0", "dur_size1", "dur_size2", "dur_size3",
+		"p_diag", "p_survive", "unobserved" };
+	const char *move_names[NUM_MOVE_TYPES] = { "dates", "parent", "rates", "durations", "dur_blocks", "births" };
+	int fd, k;
+
+	ring = (struct live_ring*)mem_calloc(MEM_IO, 1, sizeof(struct live_ring));
+	if (!ring) { printf("Could not allocate ring in open_live_ring.\n"); exit(1); }
+	live_ring_path(name, ring->path, sizeof(ring->path));
+	ring->size = sizeof(struct live_ring_header) + LIVE_RING_SLOTS * sizeof(struct live_slot);
+	shm_unlink(ring->path);						//A segment left by a run that never finished
+	fd = shm_open(ring->path, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, ring->size) != 0
+		|| (ring->header = (struct live_ring_header*)mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		printf("Could not make the live ring %s - the run carries on without it.\n", ring->path);
+		if (fd >= 0) { close(fd); shm_unlink(ring->path); }
+		mem_free(ring);
+		return NULL;
+	}
+	close(fd);									//The mapping keeps it
+	ring->slots = (struct live_slot*)(ring->header + 1);
+
+	//The segment starts as zeros, so every slot's sequence is 0 (even, and no sample yet)
+	memcpy(ring->header->magic, LIVE_MAGIC, 8);
+	ring->header->version = LIVE_VERSION;
+	ring->header->num_slots = LIVE_RING_SLOTS;
+	ring->header->slot_size = sizeof(struct live_slot);
+	ring->header->num_chains = run->settings.num_chains;
+	ring->header->num_rungs = run->ladder.num_rungs;
+	ring->header->pid = getpid();
+	ring->header->num_sweeps = run->settings.num_sweeps;
+	ring->header->burn_in = run->settings.burn_in;
+	for (k = 0; k < NUM_TRACE_VALUES; k++) strncpy(ring->header->value_names[k], value_names[k], 15);
+	for (k = 0; k < NUM_MOVE_TYPES; k++) strncpy(ring->header->move_names[k], move_names[k], 15);
+	return ring;
+}
+
+//Publishes the state after a round. Called from the sampler's thread only, between rounds.
+void publish_live_sample(struct live_ring *ring, struct sampler_run *run, double seconds)
+{
+	struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+	struct parameter_list *p = &cold->params;
+	long n = ring->header->published;
+	struct live_slot *slot = &ring->slots[n % LIVE_RING_SLOTS];
+	struct live_sample *sample = &slot->sample;
+	unsigned long sequence = slot->sequence;
+	int c, k, m;
+
+	__atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);		//Odd: being written
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	sample->sample = n;
+	sample->sweep = run->sweeps_done;
+	sample->seconds = seconds;
+	sample->values[TRACE_LOG_LIK] = cold->log_lik;
+	sample->values[TRACE_LOG_PRIOR] = cold->log_prior;
+	for (k = 0; k < 4; k++) {
+		sample->values[TRACE_BETA + k] = p->beta[k];
+		sample->values[TRACE_DUR_MEAN + k] = p->dur_mean[k];
+		sample->values[TRACE_DUR_SIZE + k] = p->dur_size[k];
+	}
+	sample->values[TRACE_P_DIAG] = p->p_diag;
+	sample->values[TRACE_P_SURVIVE] = p->p_survive;
+	sample->values[TRACE_UNOBSERVED] = cold->num_cases - cold->num_observed;
+	for (m = 0; m < NUM_MOVE_TYPES; m++) {
+		sample->proposed[m] = 0;
+		sample->accepted[m] = 0;
+		for (c = 0; c < run->settings.num_chains; c++) {
+			sample->proposed[m] += run->chains[c].proposed[m];
+			sample->accepted[m] += run->chains[c].accepted[m];
+		}
+	}
+	for (k = 0; k < LIVE_MAX_RUNGS; k++) sample->swap_rate[k] = k < run->ladder.num_rungs - 1 ? run->ladder.swap_rate[k] : 0;
+	sample->summary_samples = run->summary.quantity ? run->summary.quantity[0].moments.count : 0;
+
+	__atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);		//Even again: complete
+	__atomic_store_n(&ring->header->published, n + 1, __ATOMIC_RELEASE);
+}
+
+//Marks the run finished and removes the segment
+void close_live_ring(struct live_ring *ring)
+{
+	__atomic_store_n(&ring->header->finished, 1, __ATOMIC_RELEASE);
+	munmap(ring->header, ring->size);
+	shm_unlink(ring->path);
+	mem_free(ring);
+}
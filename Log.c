@@ -0,0 +1,228 @@
+/********************************************************************************
+*	Log.c																		*
+*	Levelled logging (levels and macros in Log.h).								*
+*	Messages are formatted into the buffer being filled, under a lock. A full	*
+*		buffer is swapped with the spare and handed to a background thread,	*
+*		which writes it out; the thread also writes whatever is waiting every	*
+*		LOG_FLUSH_MS, so progress still shows. A caller only waits if both		*
+*		buffers are full. Errors are written out before write_log returns.		*
+*	Before open_log (or after close_log) messages are written directly.			*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>			//For standard input/output functions
+#include <stdlib.h>			//For memory allocation
+#include <string.h>			//For strncmp
+#include <stdarg.h>			//For the variable arguments of write_log
+#include <time.h>			//For the flush interval
+#include <pthread.h>		//For the background writer thread
+#include "Log.h"			//For declarations of functions in this file
+#include "Memory.h"			//For memory accounting
+
+int log_levels[LOG_NUM_MODULES] = { LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO };
+
+static const char *level_names[LOG_NUM_LEVELS] = { "error", "warn", "info", "debug", "trace" };
+static const char *module_names[LOG_NUM_MODULES] = { "main", "reading", "sampler", "simulation" };
+
+struct log_sink
+{
+	FILE *output;
+	int is_file;				//1 if output should be closed at the end
+	int open;					//0 until open_log, and again after close_log
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;		//Signalled when a buffer is handed over, or on shutdown
+	pthread_cond_t written;		//Signalled when the writer has written a buffer
+	char *filling;				//Buffer being filled by callers
+	size_t used;
+	char *pending;				//Handed to the writer (NULL when it is idle)
+	size_t pending_used;
+	char *spare;				//Free buffer (NULL while the writer holds it)
+	int shutdown;
+	long requested;				//Flushes asked for...
+	long completed;				//...and done
+};
+
+static struct log_sink sink = { NULL, 0, 0 };
+static int registered;			//close_log is registered with atexit, so an exit(1) still writes out the log
+
+/*-------------------------------
+| the writer thread				|
+-------------------------------*/
+
+//Hands the filling buffer to the writer. Called with the lock held, and only when the spare is free.
+static void hand_over()
+{
+	sink.pending = sink.filling;
+	sink.pending_used = sink.used;
+	sink.filling = sink.spare;
+	sink.spare = NULL;
+	sink.used = 0;
+	pthread_cond_signal(&sink.wake);
+}
+
+static void *log_writer(void *arg)
+{
+	struct timespec until;
+	char *buffer;
+	size_t length;
+	long requested;
+
+	pthread_mutex_lock(&sink.lock);
+	for (;;) {
+		if (!sink.pending && !sink.shutdown) {
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += LOG_FLUSH_MS * 1000000L;
+			until.tv_sec += until.tv_nsec / 1000000000L;
+			until.tv_nsec %= 1000000000L;
+			pthread_cond_timedwait(&sink.wake, &sink.lock, &until);
+		}
+		if (!sink.pending && sink.used > 0 && sink.spare) hand_over();	//Time is up - write what there is
+		if (!sink.pending) {
+			if (sink.shutdown) break;
+			continue;
+		}
+		buffer = sink.pending;
+		length = sink.pending_used;
+		requested = sink.requested;
+		pthread_mutex_unlock(&sink.lock);
+		fwrite(buffer, 1, length, sink.output);
+		fflush(sink.output);
+		pthread_mutex_lock(&sink.lock);
+		sink.pending = NULL;
+		sink.spare = buffer;
+		if (sink.used == 0) sink.completed = requested;
+		pthread_cond_broadcast(&sink.written);
+	}
+	pthread_mutex_unlock(&sink.lock);
+	return NULL;
+}
+
+/*-------------------------------
+| using the log					|
+-------------------------------*/
+
+//Starts the writer thread. Messages go to file_name, or to the console if it is NULL or empty.
+void open_log(const char *file_name)
+{
+	if (sink.open) return;
+	sink.output = stdout;
+	sink.is_file = 0;
+	if (file_name && file_name[0]) {
+		sink.output = fopen(file_name, "w");
+		if (!sink.output) { printf("Could not open log file %s.\n", file_name); exit(1); }
+		sink.is_file = 1;
+	}
+	sink.filling = (char*)mem_malloc(MEM_IO, LOG_BUFFER_SIZE);
+	sink.spare = (char*)mem_malloc(MEM_IO, LOG_BUFFER_SIZE);
+	if (!sink.filling || !sink.spare) { printf("Could not allocate buffers in open_log.\n"); exit(1); }
+	sink.used = 0;
+	sink.pending = NULL;
+	sink.shutdown = 0;
+	sink.requested = sink.completed = 0;
+	pthread_mutex_init(&sink.lock, NULL);
+	pthread_cond_init(&sink.wake, NULL);
+	pthread_cond_init(&sink.written, NULL);
+	if (pthread_create(&sink.thread, NULL, log_writer, NULL) != 0) { printf("Could not start the log writer.\n"); exit(1); }
+	sink.open = 1;
+	if (!registered) atexit(close_log);
+	registered = 1;
+}
+
+//Sets module levels from a list such as "debug" (every module) or "reading=debug,sampler=warn".
+//Returns 0 if any part is not understood.
+int set_log_levels(const char *spec)
+{
+	const char *part = spec, *equals, *end;
+	int module, level, first_module, last_module;
+
+	while (*part) {
+		end = strchr(part, ',');
+		if (!end) end = part + strlen(part);
+		equals = memchr(part, '=', end - part);
+		first_module = 0;
+		last_module = LOG_NUM_MODULES - 1;
+		if (equals) {
+			for (module = 0; module < LOG_NUM_MODULES; module++)
+				if ((size_t)(equals - part) == strlen(module_names[module]) && strncmp(part, module_names[module], equals - part) == 0) break;
+			if (module == LOG_NUM_MODULES) return 0;
+			first_module = last_module = module;
+			part = equals + 1;
+		}
+		for (level = 0; level < LOG_NUM_LEVELS; level++)
+			if ((size_t)(end - part) == strlen(level_names[level]) && strncmp(part, level_names[level], end - part) == 0) break;
+		if (level == LOG_NUM_LEVELS) return 0;
+		for (module = first_module; module <= last_module; module++) log_levels[module] = level;
+		part = *end ? end + 1 : end;
+	}
+	return 1;
+}
+
+//One message: a line, with a newline added if it has none. Information is written as it is; the
+//other levels are marked with their level and module.
+void write_log(int module, int level, const char *format, ...)
+{
+	char line[LOG_BUFFER_SIZE / 4];
+	va_list args;
+	int length = 0;
+
+	if (level != LOG_INFO) length = snprintf(line, sizeof(line), "[%s %s] ", level_names[level], module_names[module]);
+	va_start(args, format);
+	length += vsnprintf(line + length, sizeof(line) - length, format, args);
+	va_end(args);
+	if (length > (int)sizeof(line) - 2) length = sizeof(line) - 2;
+	if (length == 0 || line[length - 1] != '\n') line[length++] = '\n';
+
+	if (!sink.open) {
+		fwrite(line, 1, length, stdout);
+		return;
+	}
+	pthread_mutex_lock(&sink.lock);
+	while (sink.used + length > LOG_BUFFER_SIZE) {
+		if (sink.spare) hand_over();
+		else pthread_cond_wait(&sink.written, &sink.lock);
+	}
+	memcpy(sink.filling + sink.used, line, length);
+	sink.used += length;
+	pthread_mutex_unlock(&sink.lock);
+	if (level == LOG_ERROR) flush_log();
+}
+
+//Waits until everything logged so far has been written
+void flush_log()
+{
+	long ticket;
+
+	if (!sink.open) return;
+	pthread_mutex_lock(&sink.lock);
+	ticket = ++sink.requested;
+	pthread_cond_signal(&sink.wake);
+	while (sink.completed < ticket) {
+		if (!sink.pending && sink.used == 0) {			//Nothing left - already written
+			sink.completed = sink.requested;
+			break;
+		}
+		if (!sink.pending && sink.spare) hand_over();
+		pthread_cond_wait(&sink.written, &sink.lock);
+	}
+	pthread_mutex_unlock(&sink.lock);
+}
+
+//Writes everything out and stops the writer thread. Later messages are written directly.
+void close_log()
+{
+	if (!sink.open) return;
+	flush_log();
+	pthread_mutex_lock(&sink.lock);
+	sink.shutdown = 1;
+	pthread_cond_signal(&sink.wake);
+	pthread_mutex_unlock(&sink.lock);
+	pthread_join(sink.thread, NULL);
+	if (sink.is_file) fclose(sink.output);
+	pthread_mutex_destroy(&sink.lock);
+	pthread_cond_destroy(&sink.wake);
+	pthread_cond_destroy(&sink.written);
+	mem_free(sink.filling);
+	mem_free(sink.spare);
+	sink.open = 0;
+}
@@ -0,0 +1,54 @@
+/********************************************************************************
+*	Log.h																		*
+*	Contains:																	*
+*		- Levelled logging with a level for each module. Calls above			*
+*			LOG_COMPILED_LEVEL compile to nothing; the others cost a compare	*
+*			unless their module's level lets them through						*
+*		- Functions defined in Log.c (messages are written by a background		*
+*			thread, so callers never wait on the console or disk)				*
+********************************************************************************/
+
+//Levels, most severe first
+#define LOG_ERROR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+#define LOG_TRACE 4
+#define LOG_NUM_LEVELS 5
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_INFO	//Build with -DLOG_COMPILED_LEVEL=4 to keep the debug and trace calls
+#endif
+
+//Modules, each with its own level
+#define LOG_MAIN 0				//Ebola_A.c
+#define LOG_READING 1			//Reading the reports and making the cases
+#define LOG_SAMPLER 2			//The chains and tempering
+#define LOG_SIMULATION 3		//Forward simulation, ABC-SMC and predictive checks
+#define LOG_NUM_MODULES 4
+
+#define LOG_BUFFER_SIZE 65536	//Messages are gathered into buffers of this size...
+#define LOG_FLUSH_MS 200		//...and written at least this often
+
+extern int log_levels[LOG_NUM_MODULES];	//Most verbose level let through for each module (default LOG_INFO)
+
+//do-while so each macro is one statement. With a level above LOG_COMPILED_LEVEL the condition is
+//a constant 0, and the call (with its arguments) is compiled away.
+#define LOG_AT(module, level, ...) do { \
+	if ((level) <= LOG_COMPILED_LEVEL && (level) <= log_levels[module]) write_log(module, level, __VA_ARGS__); \
+} while (0)
+#define log_error(module, ...) LOG_AT(module, LOG_ERROR, __VA_ARGS__)
+#define log_warn(module, ...) LOG_AT(module, LOG_WARN, __VA_ARGS__)
+#define log_info(module, ...) LOG_AT(module, LOG_INFO, __VA_ARGS__)
+#define log_debug(module, ...) LOG_AT(module, LOG_DEBUG, __VA_ARGS__)
+#define log_trace(module, ...) LOG_AT(module, LOG_TRACE, __VA_ARGS__)
+
+/****************************************
+* Functions defined in Log.c			*
+****************************************/
+
+void open_log(const char *file_name);
+int set_log_levels(const char *spec);
+void write_log(int module, int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void flush_log();
+void close_log();
@@ -60,20 +60,24 @@
 #include <math.h>
 #include "MTrandom.h"
 #include "lfunc.h"
+#include "Profile.h"
 
 /* Period parameters */  
-#define N 624
+#define N MT_STATE_SIZE
 #define M 397
 #define MATRIX_A 0x9908b0dfUL   /* constant vector a */
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti=N+1; /* mti==N+1 means mt[N] is not initialized */
+static struct mt_state mt_default={{0x0UL},N+1}; /* state used by the functions without _r */
+/* mti==N+1 means mt[N] is not initialized */
 
 /* initializes mt[N] with a seed */
-void init_genrand(unsigned long s)
+void init_genrand_r(struct mt_state *state, unsigned long s)
 {
+    unsigned long *mt=state->mt;
+    int mti;
+
     mt[0]= s & 0xffffffffUL;
     for (mti=1; mti<N; mti++) {
         mt[mti] = 
@@ -85,16 +89,34 @@ void init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
+    state->mti=mti;
+}
+
+void init_genrand(unsigned long s)
+{
+    init_genrand_r(&mt_default,s);
+}
+
+/* copies the default state out (e.g. to save it) and back in */
+void get_genrand_state(struct mt_state *state)
+{
+    *state=mt_default;
+}
+
+void set_genrand_state(struct mt_state *state)
+{
+    mt_default=*state;
 }
 
 /* initialize by an array with array-length */
 /* init_key is the array for initializing keys */
 /* key_length is its length */
 /* slight change for C++, 2004/2/26 */
-void init_by_array(unsigned long init_key[], int key_length)
+void init_by_array_r(struct mt_state *state, unsigned long init_key[], int key_length)
 {
+    unsigned long *mt=state->mt;
     int i, j, k;
-    init_genrand(19650218UL);
+    init_genrand_r(state,19650218UL);
     i=1; j=0;
     k = (N>key_length ? N : key_length);
     for (; k; k--) {
@@ -116,18 +138,24 @@ void init_by_array(unsigned long init_key[], int key_length)
     mt[0] = 0x80000000UL; /* MSB is 1; assuring non-zero initial array */ 
 }
 
+void init_by_array(unsigned long init_key[], int key_length)
+{
+    init_by_array_r(&mt_default,init_key,key_length);
+}
+
 /* generates a random number on [0,0xffffffff]-interval */
-unsigned long genrand_int32(void)
+unsigned long genrand_int32_r(struct mt_state *state)
 {
+    unsigned long *mt=state->mt;
     unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
+    static const unsigned long mag01[2]={0x0UL, MATRIX_A};
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
-    if (mti >= N) { /* generate N words at one time */
+    if (state->mti >= N) { /* generate N words at one time */
         int kk;
 
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
+        if (state->mti == N+1)   /* if init_genrand() has not been called, */
+            init_genrand_r(state,5489UL); /* a default initial seed is used */
 
         for (kk=0;kk<N-M;kk++) {
             y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
@@ -140,10 +168,11 @@ unsigned long genrand_int32(void)
         y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
         mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        mti = 0;
+        state->mti = 0;
+        profile_count(PROF_RNG_WORDS, N);
     }
   
-    y = mt[mti++];
+    y = mt[state->mti++];
 
     /* Tempering */
     y ^= (y >> 11);
@@ -154,167 +183,69 @@ unsigned long genrand_int32(void)
     return y;
 }
 
-/* generates a random number on [0,0x7fffffff]-interval */
-long genrand_int31(void)
+unsigned long genrand_int32(void)
 {
-    unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-    if (mti >= N) { /* generate N words at one time */
-        int kk;
-
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
-
-        for (kk=0;kk<N-M;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<N-1;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-        mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-        mti = 0;
-    }
-  
-    y = mt[mti++];
+    return genrand_int32_r(&mt_default);
+}
 
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
+/* generates a random number on [0,0x7fffffff]-interval */
+long genrand_int31_r(struct mt_state *state)
+{
+    return (long)(genrand_int32_r(state)>>1);
+}
 
-    return (long)(y>>1);
+long genrand_int31(void)
+{
+    return genrand_int31_r(&mt_default);
 }
 
 /* generates a random number on [0,1]-real-interval */
-double genrand_real1(void)
+double genrand_real1_r(struct mt_state *state)
 {
-    unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-    if (mti >= N) { /* generate N words at one time */
-        int kk;
-
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
-
-        for (kk=0;kk<N-M;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<N-1;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-        mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-        mti = 0;
-    }
-  
-    y = mt[mti++];
-
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
-
-    return y*(1.0/4294967295.0); 
+    return genrand_int32_r(state)*(1.0/4294967295.0); 
     /* divided by 2^32-1 */ 
 }
 
-/* generates a random number on [0,1)-real-interval */
-double genrand_real2(void)
+double genrand_real1(void)
 {
-    unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-    if (mti >= N) { /* generate N words at one time */
-        int kk;
-
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
-
-        for (kk=0;kk<N-M;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<N-1;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-        mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
+    return genrand_real1_r(&mt_default);
+}
 
-        mti = 0;
-    }
-  
-    y = mt[mti++];
+/* generates a random number on [0,1)-real-interval */
+double genrand_real2_r(struct mt_state *state)
+{
+    return genrand_int32_r(state)*(1.0/4294967296.0); 
+    /* divided by 2^32 */
+}
 
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
+double genrand_real2(void)
+{
+    return genrand_real2_r(&mt_default);
+}
 
-    return y*(1.0/4294967296.0); 
+/* generates a random number on (0,1)-real-interval */
+double genrand_real3_r(struct mt_state *state)
+{
+    return (((double)genrand_int32_r(state)) + 0.5)*(1.0/4294967296.0); 
     /* divided by 2^32 */
 }
 
-/* generates a random number on (0,1)-real-interval */
 double genrand_real3(void)
 {
-    unsigned long y;
-    static unsigned long mag01[2]={0x0UL, MATRIX_A};
-    /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-    if (mti >= N) { /* generate N words at one time */
-        int kk;
-
-        if (mti == N+1)   /* if init_genrand() has not been called, */
-            init_genrand(5489UL); /* a default initial seed is used */
-
-        for (kk=0;kk<N-M;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (;kk<N-1;kk++) {
-            y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-            mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-        mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-        mti = 0;
-    }
-  
-    y = mt[mti++];
-
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
-
-    return (((double)y) + 0.5)*(1.0/4294967296.0); 
-    /* divided by 2^32 */
+    return genrand_real3_r(&mt_default);
 }
 
 /* generates a random number on [0,1) with 53-bit resolution*/
-double genrand_res53(void) 
+double genrand_res53_r(struct mt_state *state) 
 { 
-    unsigned long a=genrand_int32()>>5, b=genrand_int32()>>6; 
+    unsigned long a=genrand_int32_r(state)>>5, b=genrand_int32_r(state)>>6; 
     return(a*67108864.0+b)*(1.0/9007199254740992.0); 
 } 
+
+double genrand_res53(void) 
+{ 
+    return genrand_res53_r(&mt_default);
+} 
 /* These real versions are due to Isaku Wada, 2002/01/09 added */
 
 
@@ -371,7 +302,7 @@ static double pdf_Normal (double x)
 /*         hat / squeeze ratio = 1.00858                            */
 /* ---------------------------------------------------------------- */
 
-double rand_Normal (void)
+double rand_Normal_r (struct mt_state *state)
 {
         /* data */
         const int guide_size = 78;
@@ -516,13 +447,13 @@ double rand_Normal (void)
         double Thx;
 
         while (1) {
-                U = uniform();
+                U = uniform_r(state);
                 I =  guide[(int) (U * guide_size)];
                 U *= Atotal;
                 while (iv[I].Acum < U) I++;
                 U -= iv[I].Acum - iv[I].Ahatr;
                 X = iv[I].x + (U * iv[I].Tfx * iv[I].Tfx) / (1.-iv[I].Tfx*iv[I].dTfx*U);
-                V = uniform();
+                V = uniform_r(state);
                 if (V <= iv[I].sq) return X;
                 Thx = iv[I].Tfx + iv[I].dTfx * (X - iv[I].x);
                 V /= Thx*Thx;
@@ -530,6 +461,11 @@ double rand_Normal (void)
         }
 }
 
+double rand_Normal (void)
+{
+        return rand_Normal_r(&mt_default);
+}
+
 /* ---------------------------------------------------------------- */
 /* End of Generator                                                 */
 /* ---------------------------------------------------------------- */
@@ -590,7 +526,7 @@ static double pdf_Exponential (double x)
 /*         hat / squeeze ratio = 1.01009                            */
 /* ---------------------------------------------------------------- */
 
-double rand_Exponential (void)
+double rand_Exponential_r (struct mt_state *state)
 {
         /* data */
         const int guide_size = 36;
@@ -670,13 +606,13 @@ double rand_Exponential (void)
         double Thx;
 
         while (1) {
-                U = uniform();
+                U = uniform_r(state);
                 I =  guide[(int) (U * guide_size)];
                 U *= Atotal;
                 while (iv[I].Acum < U) I++;
                 U -= iv[I].Acum - iv[I].Ahatr;
                 X = iv[I].x + (U * iv[I].Tfx * iv[I].Tfx) / (1.-iv[I].Tfx*iv[I].dTfx*U);
-                V = uniform();
+                V = uniform_r(state);
                 if (V <= iv[I].sq) return X;
                 Thx = iv[I].Tfx + iv[I].dTfx * (X - iv[I].x);
                 V /= Thx*Thx;
@@ -684,11 +620,16 @@ double rand_Exponential (void)
         }
 }
 
+double rand_Exponential (void)
+{
+        return rand_Exponential_r(&mt_default);
+}
+
 /* ---------------------------------------------------------------- */
 /* End of Generator                                                 */
 /* ---------------------------------------------------------------- */
 
-double rgama(double a)
+double rgama_r(struct mt_state *state, double a)
 //Returns the log of a gamma variate
 {
   double d,c,x,v,u;
@@ -700,35 +641,73 @@ double rgama(double a)
   
   if(a<1.0)
 //    return rgama(1+a)+log(pow(uniform(),1/a));
-    return rgama(1+a)-rand_Exponential()/a; 
+    return rgama_r(state,1+a)-rand_Exponential_r(state)/a; 
   else{
     //Published routine suitable only for a>=1
     d=a-1.0/3.0;
     c=1.0/sqrt(9.0*d);
     for(;;){ 
       do {
-        x=rand_Normal(); 
+        x=rand_Normal_r(state); 
         v=1.0+c*x;
       } while(v<=0.0);
       v=v*v*v;
-      u=uniform();
+      u=uniform_r(state);
       if(u<1.0-0.0331*(x*x)*(x*x)) return log(d*v);
       if(log(u)<0.5*x*x+d*(1.0-v+log(v))) return log(d*v);
     }
   }
 }
 
-double beta(double alpha1,double alpha2)
+double rgama(double a)
+{
+  return rgama_r(&mt_default,a);
+}
+
+double beta_r(struct mt_state *state,double alpha1,double alpha2)
 //Returns the log of a beta variate
 {
   double x1,x2;
   
-  x1=rgama(alpha1);
-  x2=rgama(alpha2);
+  x1=rgama_r(state,alpha1);
+  x2=rgama_r(state,alpha2);
   
   return x1-lnsum(x1,x2);
 }
 
+double beta(double alpha1,double alpha2)
+{
+  return beta_r(&mt_default,alpha1,alpha2);
+}
+
+long rpois_r(struct mt_state *state, double mean)
+//Returns a Poisson variate, by inversion in steps of at most 30 (so exp(-mean) never underflows)
+{
+  long n=0,x;
+  double step,p,cdf,u;
+
+  while(mean>0.0){
+    step=mean<30.0?mean:30.0;
+    mean-=step;
+    x=0;
+    p=cdf=exp(-step);
+    u=uniform_r(state);
+    while(u>cdf && x<1000){
+      x++;
+      p*=step/x;
+      cdf+=p;
+    }
+    n+=x;
+  }
+  return n;
+}
+
+long rnbinom_r(struct mt_state *state, double mean, double size)
+//Returns a negative binomial variate with the given mean and size, as a Poisson with a gamma mean
+{
+  return rpois_r(state,exp(rgama_r(state,size))*mean/size);
+}
+
 void dirichlet(double *x,double *alpha,unsigned long dim)
 //Returns the log of a Dirichlet variate
 {
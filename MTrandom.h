@@ -53,46 +53,77 @@
 */
 
 #define uniform() genrand_real3()
+#define uniform_r(state) genrand_real3_r(state)
+
+/* Functions ending in _r draw from an explicit generator state, so that */
+/* each chain or thread can own an independent stream. The functions     */
+/* without _r use a single default state inside MTrandom.cpp.            */
+#define MT_STATE_SIZE 624
+struct mt_state
+{
+  unsigned long mt[MT_STATE_SIZE]; /* the array for the state vector */
+  int mti;                         /* mti==MT_STATE_SIZE+1 means mt[] is not initialized */
+};
 
 /* initializes mt[N] with a seed */
 void init_genrand(unsigned long s);
+void init_genrand_r(struct mt_state *state, unsigned long s);
+
+/* copies the default state out (e.g. to save it) and back in */
+void get_genrand_state(struct mt_state *state);
+void set_genrand_state(struct mt_state *state);
 
 /* initialize by an array with array-length */
 /* init_key is the array for initializing keys */
 /* key_length is its length */
 /* slight change for C++, 2004/2/26 */
 void init_by_array(unsigned long init_key[], int key_length);
+void init_by_array_r(struct mt_state *state, unsigned long init_key[], int key_length);
 
 /* generates a random number on [0,0xffffffff]-interval */
 unsigned long genrand_int32(void);
+unsigned long genrand_int32_r(struct mt_state *state);
 
 /* generates a random number on [0,0x7fffffff]-interval */
 long genrand_int31(void);
+long genrand_int31_r(struct mt_state *state);
 
 /* These real versions are due to Isaku Wada, 2002/01/09 added */
 /* generates a random number on [0,1]-real-interval */
 double genrand_real1(void);
+double genrand_real1_r(struct mt_state *state);
 
 /* generates a random number on [0,1)-real-interval */
 double genrand_real2(void);
+double genrand_real2_r(struct mt_state *state);
 
 /* generates a random number on (0,1)-real-interval */
 double genrand_real3(void);
+double genrand_real3_r(struct mt_state *state);
 
 /* generates a random number on [0,1) with 53-bit resolution*/
 double genrand_res53(void);
+double genrand_res53_r(struct mt_state *state);
 
 /* generates standard normal variate */
 double rand_Normal (void);
+double rand_Normal_r (struct mt_state *state);
 
 /* generates exponential variate */
 double rand_Exponential (void);
+double rand_Exponential_r (struct mt_state *state);
 
 /* generates gamma variate */
 double rgama(double a);
+double rgama_r(struct mt_state *state, double a);
 
 /* generates beta variate note alpha1=alpha, alpha2=beta*/
 double beta(double alpha1,double alpha2);
+double beta_r(struct mt_state *state,double alpha1,double alpha2);
+
+/* generates Poisson and negative binomial (mean, size) variates */
+long rpois_r(struct mt_state *state, double mean);
+long rnbinom_r(struct mt_state *state, double mean, double size);
 
 /* generates dirichlet variate */
 void dirichlet(double *x,double *alpha,unsigned long dim);
@@ -0,0 +1,301 @@
+/********************************************************************************
+*	Memory.c																	*
+*	Memory accounting by subsystem (see Memory.h).								*
+*	Every block starts with a header holding its size, subsystem and the		*
+*		distance back to the start of what malloc returned, so mem_free and		*
+*		mem_realloc know what to take off without being told.					*
+*	Usage is kept with atomic adds, and peaks raised by compare-and-swap, so	*
+*		threads never take a lock to allocate.									*
+*	A budget is checked by adding the request first and taking it off again		*
+*		if it went over, so two threads cannot both slip under it.				*
+*	A failed allocation prints why and returns NULL, leaving the caller's own	*
+*		"Could not allocate" message and exit to follow.						*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>			//For standard input/output functions
+#include <stdlib.h>			//For memory allocation
+#include <string.h>			//For memset and strncmp
+#include <sys/mman.h>		//For mapping large blocks
+#include "Memory.h"			//For declarations of functions in this file
+#include "Placement.h"		//For huge pages and NUMA nodes of large blocks
+
+//Ahead of every block (16 bytes, so the block keeps malloc's alignment)
+struct memory_header
+{
+	size_t size;
+	int subsystem;
+	int offset;				//From the start of the malloc'd memory to the block (minus that, for a mapping from mem_large)
+};
+
+#define LARGE_BLOCK_OFFSET 64		//From the start of a mapping from mem_large (which begins with its length) to the block
+
+static const char *subsystem_names[MEM_NUM_SUBSYSTEMS + 1] = { "reports", "cases", "lfunc", "sampler", "simulation", "io",
+	"threads", "spatial", "other", "total" };
+static struct memory_usage usage[MEM_NUM_SUBSYSTEMS + 1];	//usage[MEM_TOTAL]: every subsystem together
+
+const char *memory_subsystem_name(int subsystem)
+{
+	return subsystem >= 0 && subsystem <= MEM_TOTAL ? subsystem_names[subsystem] : "unknown";
+}
+
+//Bytes in a short form for messages (e.g. 1.5 GB)
+static const char *format_bytes(long long bytes, char *text, size_t size)
+{
+	static const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+	double value = (double)bytes;
+	int u = 0;
+
+	while ((value >= 1024.0 || value <= -1024.0) && u < 4) { value /= 1024.0; u++; }
+	if (u == 0) snprintf(text, size, "%lld B", bytes);
+	else snprintf(text, size, "%.1f %s", value, units[u]);
+	return text;
+}
+
+/*-------------------------------
+| accounting					|
+-------------------------------*/
+
+static void raise_peak(struct memory_usage *use, long long live)
+{
+	long long peak = __atomic_load_n(&use->peak, __ATOMIC_RELAXED);
+
+	while (live > peak && !__atomic_compare_exchange_n(&use->peak, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//Adds bytes to one usage, unless that takes it over its budget. Returns 0 if it would.
+static int charge_one(struct memory_usage *use, long long bytes)
+{
+	long long live = __atomic_add_fetch(&use->live, bytes, __ATOMIC_RELAXED);
+
+	if (use->budget > 0 && bytes > 0 && live > use->budget) {
+		__atomic_sub_fetch(&use->live, bytes, __ATOMIC_RELAXED);
+		return 0;
+	}
+	raise_peak(use, live);
+	return 1;
+}
+
+static void over_budget(int subsystem, int which, long long bytes)
+{
+	char request[32], live[32], budget[32];
+
+	printf("Memory budget of %s exceeded: %s more for %s, with %s live against a budget of %s.\n",
+		memory_subsystem_name(which), format_bytes(bytes, request, sizeof(request)), memory_subsystem_name(subsystem),
+		format_bytes(__atomic_load_n(&usage[which].live, __ATOMIC_RELAXED), live, sizeof(live)),
+		format_bytes(usage[which].budget, budget, sizeof(budget)));
+}
+
+//Charges bytes to a subsystem and the total. Returns 0, having said why, if either budget is exceeded.
+static int charge(int subsystem, long long bytes)
+{
+	if (!charge_one(&usage[subsystem], bytes)) { over_budget(subsystem, subsystem, bytes); return 0; }
+	if (!charge_one(&usage[MEM_TOTAL], bytes)) {
+		__atomic_sub_fetch(&usage[subsystem].live, bytes, __ATOMIC_RELAXED);
+		over_budget(subsystem, MEM_TOTAL, bytes);
+		return 0;
+	}
+	return 1;
+}
+
+//Counts an allocation (or a free) of the subsystem and the total
+static void count(int subsystem, int freed)
+{
+	__atomic_add_fetch(freed ? &usage[subsystem].frees : &usage[subsystem].allocations, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(freed ? &usage[MEM_TOTAL].frees : &usage[MEM_TOTAL].allocations, 1, __ATOMIC_RELAXED);
+}
+
+static void out_of_memory(int subsystem, size_t size)
+{
+	char request[32];
+
+	printf("Out of memory allocating %s for %s.\n", format_bytes((long long)size, request, sizeof(request)),
+		memory_subsystem_name(subsystem));
+}
+
+/*-------------------------------
+| allocation					|
+-------------------------------*/
+
+//Puts the header in front of a block from malloc (offset bytes in) and returns the block
+static void *finish_block(void *memory, int offset, int subsystem, size_t size)
+{
+	struct memory_header *header = (struct memory_header*)((char*)memory + offset) - 1;
+
+	header->size = size;
+	header->subsystem = subsystem;
+	header->offset = offset;
+	return header + 1;
+}
+
+void *mem_malloc(int subsystem, size_t size)
+{
+	void *memory;
+
+	if (!charge(subsystem, size)) return NULL;
+	memory = malloc(sizeof(struct memory_header) + size);
+	if (!memory) {
+		charge(subsystem, -(long long)size);
+		out_of_memory(subsystem, size);
+		return NULL;
+	}
+	count(subsystem, 0);
+	return finish_block(memory, sizeof(struct memory_header), subsystem, size);
+}
+
+void *mem_calloc(int subsystem, size_t count, size_t size)
+{
+	void *block;
+
+	if (size > 0 && count > ((size_t)-1 - sizeof(struct memory_header)) / size) { out_of_memory(subsystem, (size_t)-1); return NULL; }
+	block = mem_malloc(subsystem, count * size);
+	if (block) memset(block, 0, count * size);
+	return block;
+}
+
+//A block of NULL is allocated for subsystem; otherwise the block stays with the subsystem it has.
+//Blocks from mem_aligned cannot be reallocated.
+void *mem_realloc(int subsystem, void *block, size_t size)
+{
+	struct memory_header *header, old;
+	void *memory;
+
+	if (!block) return mem_malloc(subsystem, size);
+	header = (struct memory_header*)block - 1;
+	old = *header;
+	if (old.offset != sizeof(struct memory_header)) { printf("Cannot reallocate an aligned block of %s.\n", memory_subsystem_name(old.subsystem)); return NULL; }
+	if (!charge(old.subsystem, (long long)size - (long long)old.size)) return NULL;
+	memory = realloc(header, sizeof(struct memory_header) + size);
+	if (!memory) {
+		charge(old.subsystem, (long long)old.size - (long long)size);
+		out_of_memory(old.subsystem, size);
+		return NULL;
+	}
+	return finish_block(memory, sizeof(struct memory_header), old.subsystem, size);
+}
+
+//A block starting on a multiple of alignment (a power of two, at least 16)
+void *mem_aligned(int subsystem, size_t alignment, size_t size)
+{
+	void *memory;
+
+	if (alignment < sizeof(struct memory_header)) alignment = sizeof(struct memory_header);
+	if (!charge(subsystem, size)) return NULL;
+	if (posix_memalign(&memory, alignment, alignment + size) != 0) {
+		charge(subsystem, -(long long)size);
+		out_of_memory(subsystem, size);
+		return NULL;
+	}
+	count(subsystem, 0);
+	return finish_block(memory, (int)alignment, subsystem, size);
+}
+
+//A zeroed block for a large, long-lived table, mapped on its own so it can be given huge pages and bound
+//to node (PLACE_ANY_NODE for wherever it is first touched) as Placement.c is set. Small blocks, and every
+//block when neither huge pages nor NUMA placement are on, come from mem_calloc instead.
+//Blocks from mem_large cannot be reallocated.
+void *mem_large(int subsystem, size_t size, int node)
+{
+	size_t length, unit;
+	char *memory = MAP_FAILED, *start;
+	void *block;
+	int explicit = huge_pages_mode() == HUGE_PAGES_EXPLICIT;
+
+	if (size < PLACE_MIN_LARGE || (huge_pages_mode() == HUGE_PAGES_OFF && !numa_placement())) return mem_calloc(subsystem, 1, size);
+	if (!charge(subsystem, size)) return NULL;
+	unit = huge_pages_mode() == HUGE_PAGES_OFF ? 4096 : HUGE_PAGE_SIZE;
+	length = (size + LARGE_BLOCK_OFFSET + unit - 1) / unit * unit;
+	if (explicit) memory = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (memory == MAP_FAILED) {						//Ordinary pages, over-mapped so the block can start on a huge page
+		start = (char*)mmap(NULL, length + unit, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (start == MAP_FAILED) {
+			charge(subsystem, -(long long)size);
+			out_of_memory(subsystem, size);
+			return NULL;
+		}
+		memory = (char*)(((size_t)start + unit - 1) / unit * unit);
+		if (memory > start) munmap(start, memory - start);
+		munmap(memory + length, start + length + unit - (memory + length));
+	}
+	place_mapping(memory, length, node, 0);
+	*(size_t*)memory = length;						//For mem_free
+	count(subsystem, 0);
+	block = finish_block(memory, LARGE_BLOCK_OFFSET, subsystem, size);
+	((struct memory_header*)block - 1)->offset = -LARGE_BLOCK_OFFSET;
+	return block;
+}
+
+void mem_free(void *block)
+{
+	struct memory_header *header;
+
+	if (!block) return;
+	header = (struct memory_header*)block - 1;
+	charge(header->subsystem, -(long long)header->size);
+	count(header->subsystem, 1);
+	if (header->offset < 0) munmap((char*)block + header->offset, *(size_t*)((char*)block + header->offset));
+	else free((char*)block - header->offset);
+}
+
+/*-------------------------------
+| reporting and budgets			|
+-------------------------------*/
+
+void memory_usage(int subsystem, struct memory_usage *use)
+{
+	use->live = __atomic_load_n(&usage[subsystem].live, __ATOMIC_RELAXED);
+	use->peak = __atomic_load_n(&usage[subsystem].peak, __ATOMIC_RELAXED);
+	use->allocations = __atomic_load_n(&usage[subsystem].allocations, __ATOMIC_RELAXED);
+	use->frees = __atomic_load_n(&usage[subsystem].frees, __ATOMIC_RELAXED);
+	use->budget = usage[subsystem].budget;
+}
+
+//Budgets as subsystem=size,... with sizes in bytes or with a K, M or G suffix (e.g. cases=2G,total=6G).
+//Returns 0 if the list cannot be understood.
+int set_memory_budgets(const char *spec)
+{
+	const char *part = spec, *equals, *end;
+	char *number_end;
+	double size;
+	int subsystem;
+
+	while (*part) {
+		end = strchr(part, ',');
+		if (!end) end = part + strlen(part);
+		equals = memchr(part, '=', end - part);
+		if (!equals) return 0;
+		for (subsystem = 0; subsystem <= MEM_TOTAL; subsystem++)
+			if ((size_t)(equals - part) == strlen(subsystem_names[subsystem]) && strncmp(part, subsystem_names[subsystem], equals - part) == 0) break;
+		if (subsystem > MEM_TOTAL) return 0;
+		size = strtod(equals + 1, &number_end);
+		if (number_end == equals + 1 || size < 0) return 0;
+		if (number_end < end) {
+			switch (*number_end++) {
+			case 'K': case 'k': size *= 1024.0; break;
+			case 'M': case 'm': size *= 1024.0 * 1024.0; break;
+			case 'G': case 'g': size *= 1024.0 * 1024.0 * 1024.0; break;
+			default: return 0;
+			}
+			if (number_end < end) return 0;
+		}
+		usage[subsystem].budget = (long long)size;
+		part = *end ? end + 1 : end;
+	}
+	return 1;
+}
+
+//Live bytes, peak and allocations of every subsystem that has allocated anything
+void print_memory_report()
+{
+	struct memory_usage use;
+	char live[32], peak[32], budget[32];
+	int s;
+
+	printf("Memory by subsystem:\n\t%-12s%20s%12s%14s%12s\n", "", "live", "peak", "allocations", "budget");
+	for (s = 0; s <= MEM_TOTAL; s++) {
+		memory_usage(s, &use);
+		if (use.allocations == 0 && use.budget == 0 && s != MEM_TOTAL) continue;
+		printf("\t%-12s%20s%12s%14ld%12s\n", subsystem_names[s], format_bytes(use.live, live, sizeof(live)),
+			format_bytes(use.peak, peak, sizeof(peak)), use.allocations, use.budget > 0 ? format_bytes(use.budget, budget, sizeof(budget)) : "-");
+	}
+}
@@ -0,0 +1,48 @@
+/********************************************************************************
+*	Memory.h																	*
+*	Contains:																	*
+*		- The subsystems every allocation is charged to, each with its live		*
+*			bytes, allocations and peak, and an optional budget past which		*
+*			allocations fail with a message naming the subsystem				*
+*		- Functions defined in Memory.c, which stand in for malloc, calloc,		*
+*			realloc and free (a block from mem_ functions must be freed by		*
+*			mem_free, and a block from malloc by free)							*
+********************************************************************************/
+
+//Subsystems
+#define MEM_REPORTS 0				//The report list
+#define MEM_CASES 1					//Patient records: the reported cases, the chains' blocks and simulated patients
+#define MEM_LFUNC 2					//initlfunc2's table
+#define MEM_SAMPLER 3				//Chains, ladder, likelihood caches, coloured sweeps and summaries
+#define MEM_SIMULATION 4			//Forward simulations, ABC-SMC and predictive batches
+#define MEM_IO 5					//Checkpoint, trace and log buffers
+#define MEM_THREADS 6				//Thread pools
+#define MEM_SPATIAL 7				//Subregions and the spatial kernel
+#define MEM_OTHER 8					//Anything else (profile totals, synthetic data)
+#define MEM_NUM_SUBSYSTEMS 9
+#define MEM_TOTAL MEM_NUM_SUBSYSTEMS	//Every subsystem together - it may have a budget too
+
+//Usage of a subsystem (or of MEM_TOTAL)
+struct memory_usage
+{
+	long long live;					//Bytes allocated and not yet freed
+	long long peak;					//Largest live
+	long allocations;				//Blocks allocated (a reallocation is not a new one)
+	long frees;
+	long long budget;				//0 for none
+};
+
+/****************************************
+* Functions defined in Memory.c			*
+****************************************/
+
+void *mem_malloc(int subsystem, size_t size);
+void *mem_calloc(int subsystem, size_t count, size_t size);
+void *mem_realloc(int subsystem, void *block, size_t size);
+void *mem_aligned(int subsystem, size_t alignment, size_t size);
+void *mem_large(int subsystem, size_t size, int node);
+void mem_free(void *block);
+const char *memory_subsystem_name(int subsystem);
+void memory_usage(int subsystem, struct memory_usage *usage);
+int set_memory_budgets(const char *spec);
+void print_memory_report();
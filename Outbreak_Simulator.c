@@ -0,0 +1,717 @@
+/********************************************************************************
+*	Outbreak_Simulator.c														*
+*	Forward simulation of the model: index cases arrive from the zoonotic		*
+*		source, and each case exposes others while infectious, by each of		*
+*		the three transmission types, at rate beta[type] per day of its		*
+*		window. Key dates are drawn from the duration distributions.			*
+*	Events wait in one bucket per day, so the work done is proportional to		*
+*		the number of cases, not to the number of days times cases.			*
+*	In a hybrid run, a location whose exposures in a day pass a threshold is	*
+*		handed to compartments of counts (by stage and day of entry), which	*
+*		are moved on a day at a time with binomial and Poisson draws - so at	*
+*		the peak the work grows with the locations, not the cases. Each		*
+*		stage's wait is drawn from its distribution given the time already		*
+*		waited, so cases can change hands in either direction at any time.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memset
+#include <math.h>						//For exp, log and sqrt
+#include <time.h>						//For timing the simulation
+#include "MTrandom.h"					//For random number generation
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the model constants
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For linking cases into a transmission tree
+#include "Outbreak_Simulator.h"			//For structures and declarations of functions needed in this file
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Log.h"							//For progress
+
+/*-------------------------------
+| setting up					|
+-------------------------------*/
+
+void default_simulation_settings(struct simulation_settings *settings)
+{
+	settings->num_days = NUMDAYS;
+	settings->max_cases = DEFAULT_SIM_MAX_CASES;
+	settings->seed = 5489UL;
+	settings->num_locations = 1;
+	settings->location_weights = NULL;
+	settings->hybrid_threshold = 0;
+}
+
+void init_simulation(struct simulation *sim, struct parameter_list *p_params, struct simulation_settings *settings)
+{
+	int l, num_locations;
+	double total = 0;
+
+	memset(sim, 0, sizeof(struct simulation));
+	sim->settings = *settings;
+	if (sim->settings.num_days < 1) sim->settings.num_days = 1;
+	if (sim->settings.num_locations < 1) sim->settings.num_locations = 1;
+	num_locations = sim->settings.num_locations;
+
+	sim->case_capacity = 1024;
+	sim->cases = (struct sim_case*)mem_malloc(MEM_SIMULATION, sim->case_capacity * sizeof(struct sim_case));
+	sim->bucket = (int*)mem_malloc(MEM_SIMULATION, sim->settings.num_days * sizeof(int));
+	sim->event_capacity = 1024;
+	sim->events = (struct sim_event*)mem_malloc(MEM_SIMULATION, sim->event_capacity * sizeof(struct sim_event));
+	sim->location_cdf = (double*)mem_malloc(MEM_SIMULATION, num_locations * sizeof(double));
+	sim->diagnoses = (long*)mem_malloc(MEM_SIMULATION, (long)sim->settings.num_days * num_locations * sizeof(long));
+	sim->incidence = (long*)mem_malloc(MEM_SIMULATION, num_locations * sizeof(long));
+	if (!sim->cases || !sim->bucket || !sim->events || !sim->location_cdf || !sim->diagnoses || !sim->incidence) {
+		printf("Could not allocate simulation in init_simulation.\n");
+		exit(1);
+	}
+	if (sim->settings.hybrid_threshold > 0) {
+		sim->compartments = (struct sim_compartments*)mem_calloc(MEM_SIMULATION, num_locations, sizeof(struct sim_compartments));
+		if (!sim->compartments) { printf("Could not allocate compartments in init_simulation.\n"); exit(1); }
+		for (l = 0; l < num_locations; l++) {
+			sim->compartments[l].exposed = (long*)mem_malloc(MEM_SIMULATION, 6L * sim->settings.num_days * sizeof(long));
+			if (!sim->compartments[l].exposed) { printf("Could not allocate compartments in init_simulation.\n"); exit(1); }
+			sim->compartments[l].undiagnosed = sim->compartments[l].exposed + sim->settings.num_days;
+			sim->compartments[l].awaiting = sim->compartments[l].exposed + 2 * sim->settings.num_days;
+			sim->compartments[l].diagnosed = sim->compartments[l].exposed + 3 * sim->settings.num_days;
+			sim->compartments[l].reporting = sim->compartments[l].exposed + 4 * sim->settings.num_days;
+			sim->compartments[l].burial = sim->compartments[l].exposed + 5 * sim->settings.num_days;
+		}
+	}
+	for (l = 0; l < num_locations; l++) {
+		total += settings->location_weights ? settings->location_weights[l] : 1;
+		sim->location_cdf[l] = total;
+	}
+	for (l = 0; l < num_locations; l++) sim->location_cdf[l] = total > 0 ? sim->location_cdf[l] / total : (l + 1.0) / num_locations;
+	sim->settings.location_weights = NULL;		//Not kept - the caller's copy may go
+	restart_simulation(sim, p_params, settings->seed);
+}
+
+//Readies sim for a new run with new parameters, keeping its memory (so many runs can share it)
+void restart_simulation(struct simulation *sim, struct parameter_list *p_params, unsigned long seed)
+{
+	int day, l, k, x;
+
+	sim->params = *p_params;
+	sim->settings.seed = seed;
+	init_genrand_r(&sim->rng, seed);
+	for (day = 0; day < sim->settings.num_days; day++) sim->bucket[day] = NO_EVENT;
+	memset(sim->diagnoses, 0, (long)sim->settings.num_days * sim->settings.num_locations * sizeof(long));
+	sim->num_cases = 0;
+	sim->num_events = 0;
+	sim->free_event = NO_EVENT;
+	memset(sim->events_run, 0, sizeof(sim->events_run));
+	memset(sim->cases_by_type, 0, sizeof(sim->cases_by_type));
+	sim->stopped = 0;
+	sim->last_day = -1;
+	sim->seconds = 0;
+	memset(sim->incidence, 0, sim->settings.num_locations * sizeof(long));
+	sim->switches[0] = sim->switches[1] = 0;
+	sim->compartment_cases = 0;
+	if (!sim->compartments) return;
+	for (l = 0; l < sim->settings.num_locations; l++) {
+		sim->compartments[l].active = 0;
+		memset(sim->compartments[l].exposed, 0, 6L * sim->settings.num_days * sizeof(long));
+	}
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		for (x = 0; x < NUMDAYS; x++) sim->dur_pmf[k][x] = exp(nb_log_pmf(x, p_params->dur_mean[k], p_params->dur_size[k]));
+		sim->dur_tail[k][NUMDAYS - 1] = sim->dur_pmf[k][NUMDAYS - 1];
+		for (x = NUMDAYS - 2; x >= 0; x--) sim->dur_tail[k][x] = sim->dur_tail[k][x + 1] + sim->dur_pmf[k][x];
+	}
+}
+
+void free_simulation(struct simulation *sim)
+{
+	int l;
+
+	mem_free(sim->cases);
+	mem_free(sim->bucket);
+	mem_free(sim->events);
+	mem_free(sim->location_cdf);
+	mem_free(sim->diagnoses);
+	mem_free(sim->incidence);
+	if (sim->compartments)
+		for (l = 0; l < sim->settings.num_locations; l++) mem_free(sim->compartments[l].exposed);
+	mem_free(sim->compartments);
+	sim->compartments = NULL;
+	sim->incidence = NULL;
+	sim->cases = NULL;
+	sim->bucket = NULL;
+	sim->events = NULL;
+	sim->location_cdf = NULL;
+	sim->diagnoses = NULL;
+}
+
+/*-------------------------------
+| events						|
+-------------------------------*/
+
+static void run_event(struct simulation *sim, int case_number, int kind);
+
+//Adds an event to the bucket of its day. Events after the last day are run at once, which only
+//fills in the case's remaining dates - any cases they would expose are too late to count.
+static void schedule(struct simulation *sim, int day, int kind, int case_number)
+{
+	int e;
+
+	if (day >= sim->settings.num_days) {
+		run_event(sim, case_number, kind);
+		return;
+	}
+	if (sim->free_event != NO_EVENT) {
+		e = sim->free_event;
+		sim->free_event = sim->events[e].next;
+	}
+	else {
+		if (sim->num_events == sim->event_capacity) {
+			sim->event_capacity *= 2;
+			sim->events = (struct sim_event*)mem_realloc(MEM_SIMULATION, sim->events, sim->event_capacity * sizeof(struct sim_event));
+			if (!sim->events) { printf("Could not grow events in schedule.\n"); exit(1); }
+		}
+		e = sim->num_events++;
+	}
+	sim->events[e].case_number = case_number;
+	sim->events[e].kind = kind;
+	sim->events[e].next = sim->bucket[day];
+	sim->bucket[day] = e;
+}
+
+//Location of a new index case, drawn from the cumulative chances
+static int index_location(struct simulation *sim)
+{
+	double u;
+	int lo = 0, hi = sim->settings.num_locations - 1, mid;
+
+	if (hi == 0) return 0;
+	u = uniform_r(&sim->rng);
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sim->location_cdf[mid] > u) hi = mid;
+		else lo = mid + 1;
+	}
+	return lo;
+}
+
+//Cases exposed so far, as single cases or in compartments - what max_cases limits. A case handed from
+//one to the other counts once, and a dropped case not at all.
+static long cases_made(struct simulation *sim)
+{
+	int type;
+	long made = 0;
+
+	for (type = 0; type < NUM_TRANS_TYPES; type++) made += sim->cases_by_type[type];
+	return made;
+}
+
+//Adds a case exposed on day exposure by parent at location, with its other dates still to come.
+//Returns its number, or -1 if there is no room for more cases. A case made from the compartments
+//(type -1) was counted when it was exposed there, so it always has room.
+static int add_case(struct simulation *sim, int parent, int location, int type, int exposure)
+{
+	struct sim_case *current;
+
+	if (type >= 0 && cases_made(sim) >= sim->settings.max_cases) {
+		sim->stopped = SIM_STOPPED_MAX_CASES;
+		return -1;
+	}
+	if (sim->num_cases == sim->case_capacity) {
+		sim->case_capacity *= 2;
+		sim->cases = (struct sim_case*)mem_realloc(MEM_SIMULATION, sim->cases, sim->case_capacity * sizeof(struct sim_case));
+		if (!sim->cases) { printf("Could not grow cases in new_case.\n"); exit(1); }
+	}
+	current = &sim->cases[sim->num_cases];
+	memset(current, 0, sizeof(struct sim_case));
+	current->dates[0] = exposure;
+	current->dates[1] = current->dates[2] = current->dates[3] = -1;
+	current->diag_day = 9999;
+	current->parent = parent;
+	current->location = location;
+	current->transmission_type = (char)type;
+	if (type >= 0) sim->cases_by_type[type]++;
+	return (int)sim->num_cases++;
+}
+
+//Makes a case exposed on day exposure by parent (-1 for the zoonotic source)
+static void new_case(struct simulation *sim, int parent, int type, int exposure)
+{
+	int location = parent >= 0 ? sim->cases[parent].location : index_location(sim);
+	int case_number = add_case(sim, parent, location, type, exposure);
+
+	if (case_number >= 0) schedule(sim, exposure, EVENT_EXPOSURE, case_number);
+}
+
+//Exposures by source over the days [start, end): a Poisson number, on days drawn uniformly
+static void expose(struct simulation *sim, int source, int type, int start, int end)
+{
+	long n;
+	int exposure;
+
+	if (end <= start) return;
+	for (n = rpois_r(&sim->rng, sim->params.beta[type] * (end - start)); n > 0; n--) {
+		exposure = start + (int)(uniform_r(&sim->rng) * (end - start));
+		if (exposure < sim->settings.num_days) new_case(sim, source, type, exposure);
+	}
+}
+
+static int duration(struct simulation *sim, int k)
+{
+	return (int)rnbinom_r(&sim->rng, sim->params.dur_mean[k], sim->params.dur_size[k]);
+}
+
+//Windows as in infectious_window (Likelihood.c). The case is looked up again after every call
+//that can add cases, as the block may move.
+static void run_event(struct simulation *sim, int case_number, int kind)
+{
+	struct sim_case *current = &sim->cases[case_number];
+	int *d = current->dates;
+	int end_individual;
+
+	sim->events_run[kind]++;
+	switch (kind) {
+	case EVENT_EXPOSURE:
+		sim->incidence[current->location]++;
+		d[1] = d[0] + 1 + duration(sim, DUR_INCUBATION);
+		schedule(sim, d[1], EVENT_ONSET, case_number);
+		break;
+	case EVENT_ONSET:
+		d[2] = d[1] + 1 + duration(sim, DUR_INFECTIOUS);
+		current->diag = uniform_r(&sim->rng) < sim->params.p_diag;
+		if (current->diag) {
+			current->diag_day = d[1] + duration(sim, DUR_DIAGNOSIS);
+			if (current->diag_day < sim->settings.num_days)
+				sim->diagnoses[(long)current->diag_day * sim->settings.num_locations + current->location]++;
+		}
+		current->survive = uniform_r(&sim->rng) < sim->params.p_survive;
+		end_individual = current->diag && current->diag_day < d[2] ? current->diag_day : d[2];
+		schedule(sim, d[2], EVENT_END, case_number);
+		current = &sim->cases[case_number];
+		expose(sim, case_number, 1, current->dates[1], end_individual);
+		current = &sim->cases[case_number];
+		if (current->diag) expose(sim, case_number, 2, current->diag_day, current->dates[2]);
+		break;
+	case EVENT_END:
+		if (current->survive) {
+			d[3] = d[2];
+			break;
+		}
+		d[3] = d[2] + duration(sim, DUR_BURIAL);
+		schedule(sim, d[3], EVENT_BURIAL, case_number);
+		current = &sim->cases[case_number];
+		expose(sim, case_number, 3, current->dates[2], current->dates[3]);
+		break;
+	default:		//Burial - nothing follows
+		break;
+	}
+}
+
+/*-------------------------------
+| hybrid runs					|
+-------------------------------*/
+
+//Binomial draw for tau-leaping: exact (by inversion, splitting n so that no part has a mean above
+//30), or by the normal approximation when both outcomes are expected often
+static long leap_binomial(struct mt_state *rng, long n, double p)
+{
+	double q, ratio, f, u;
+	long k;
+
+	if (n <= 0 || p <= 0) return 0;
+	if (p >= 1) return n;
+	if (p > 0.5) return n - leap_binomial(rng, n, 1 - p);
+	if (n * p > HYBRID_NORMAL_DRAWS) {
+		k = (long)floor(n * p + sqrt(n * p * (1 - p)) * rand_Normal_r(rng) + 0.5);
+		return k < 0 ? 0 : k > n ? n : k;
+	}
+	if (n * p > 30) return leap_binomial(rng, n / 2, p) + leap_binomial(rng, n - n / 2, p);
+	q = 1 - p;
+	ratio = p / q;
+	f = exp(n * log(q));
+	u = uniform_r(rng);
+	for (k = 0; u > f && k < n; k++) {
+		u -= f;
+		f *= ratio * (n - k) / (k + 1);
+	}
+	return k;
+}
+
+static long leap_poisson(struct mt_state *rng, double mean)
+{
+	long k;
+
+	if (mean <= 0) return 0;
+	if (mean <= HYBRID_NORMAL_DRAWS) return rpois_r(rng, mean);
+	k = (long)floor(mean + sqrt(mean) * rand_Normal_r(rng) + 0.5);
+	return k < 0 ? 0 : k;
+}
+
+//Chance that duration k ends at x, given it has lasted x already
+static double hazard(struct simulation *sim, int k, int x)
+{
+	if (x < 0) return 0;
+	if (x >= NUMDAYS || sim->dur_tail[k][x] <= 0) return 1;
+	return sim->dur_pmf[k][x] / sim->dur_tail[k][x];
+}
+
+//Duration k drawn given that it is at least at_least
+static int duration_at_least(struct simulation *sim, int k, int at_least)
+{
+	double u;
+	int x;
+
+	if (at_least <= 0) return duration(sim, k);
+	if (at_least >= NUMDAYS || sim->dur_tail[k][at_least] <= 0) return at_least;
+	u = uniform_r(&sim->rng) * sim->dur_tail[k][at_least];
+	for (x = at_least; x < NUMDAYS - 1 && u > sim->dur_pmf[k][x]; x++) u -= sim->dur_pmf[k][x];
+	return x;
+}
+
+static void count_diagnosis(struct simulation *sim, int day, int location, long change)
+{
+	if (day >= 0 && day < sim->settings.num_days) sim->diagnoses[(long)day * sim->settings.num_locations + location] += change;
+}
+
+//Moves the compartments of a location on by day, in the order the event simulator would: diagnoses
+//and ends of cases, burials, then onsets, then the day's exposures
+static void leap_location(struct simulation *sim, int location, int day)
+{
+	struct sim_compartments *c = &sim->compartments[location];
+	struct mt_state *rng = &sim->rng;
+	double p_fatal = 1 - sim->params.p_survive;
+	long n, ended, diagnosed, onsets, to_diagnose, individual = 0, hospital = 0, burial = 0, reports = 0, exposures[NUM_TRANS_TYPES];
+	long room;
+	int e, type;
+
+	for (e = 0; e < day; e++) {							//Entered on day e, so day - e days ago
+		if ((n = c->reporting[e]) > 0) {
+			diagnosed = leap_binomial(rng, n, hazard(sim, DUR_DIAGNOSIS, day - e));
+			c->reporting[e] -= diagnosed;
+			reports += diagnosed;
+		}
+		if ((n = c->diagnosed[e]) > 0) {
+			ended = leap_binomial(rng, n, hazard(sim, DUR_INFECTIOUS, day - e - 1));
+			c->diagnosed[e] -= ended;
+			c->burial[day] += leap_binomial(rng, ended, p_fatal);
+		}
+		if ((n = c->undiagnosed[e]) > 0) {
+			ended = leap_binomial(rng, n, hazard(sim, DUR_INFECTIOUS, day - e - 1));
+			c->undiagnosed[e] -= ended;
+			c->burial[day] += leap_binomial(rng, ended, p_fatal);
+		}
+		if ((n = c->awaiting[e]) > 0) {				//Diagnosis and the end are independent
+			ended = leap_binomial(rng, n, hazard(sim, DUR_INFECTIOUS, day - e - 1));
+			diagnosed = leap_binomial(rng, ended, hazard(sim, DUR_DIAGNOSIS, day - e));
+			c->reporting[e] += ended - diagnosed;
+			c->burial[day] += leap_binomial(rng, ended, p_fatal);
+			reports += diagnosed;
+			diagnosed = leap_binomial(rng, n - ended, hazard(sim, DUR_DIAGNOSIS, day - e));
+			c->awaiting[e] -= ended + diagnosed;
+			c->diagnosed[e] += diagnosed;
+			reports += diagnosed;
+		}
+	}
+	for (e = 0; e <= day; e++)
+		if ((n = c->burial[e]) > 0) c->burial[e] -= leap_binomial(rng, n, hazard(sim, DUR_BURIAL, day - e));
+
+	onsets = 0;
+	for (e = 0; e < day; e++)
+		if ((n = c->exposed[e]) > 0) {
+			n = leap_binomial(rng, n, hazard(sim, DUR_INCUBATION, day - e - 1));
+			c->exposed[e] -= n;
+			onsets += n;
+		}
+	to_diagnose = leap_binomial(rng, onsets, sim->params.p_diag);
+	diagnosed = leap_binomial(rng, to_diagnose, sim->dur_pmf[DUR_DIAGNOSIS][0]);	//Diagnosed on the day of onset
+	c->undiagnosed[day] += onsets - to_diagnose;
+	c->awaiting[day] += to_diagnose - diagnosed;
+	c->diagnosed[day] += diagnosed;
+	reports += diagnosed;
+	count_diagnosis(sim, day, location, reports);
+
+	for (e = 0; e <= day; e++) {
+		individual += c->undiagnosed[e] + c->awaiting[e];
+		hospital += c->diagnosed[e];
+		burial += c->burial[e];
+	}
+	exposures[0] = leap_poisson(rng, sim->params.beta[0] * (sim->location_cdf[location] - (location > 0 ? sim->location_cdf[location - 1] : 0)));
+	exposures[1] = leap_poisson(rng, sim->params.beta[1] * individual);
+	exposures[2] = leap_poisson(rng, sim->params.beta[2] * hospital);
+	exposures[3] = leap_poisson(rng, sim->params.beta[3] * burial);
+	room = sim->settings.max_cases - cases_made(sim);
+	for (type = 0; type < NUM_TRANS_TYPES; type++) {
+		if (exposures[type] > room) {				//As in add_case: later exposures are dropped, and the run carries on
+			exposures[type] = room > 0 ? room : 0;
+			sim->stopped = SIM_STOPPED_MAX_CASES;
+		}
+		room -= exposures[type];
+		c->exposed[day] += exposures[type];
+		sim->cases_by_type[type] += exposures[type];
+		sim->compartment_cases += exposures[type];
+		sim->incidence[location] += exposures[type];
+	}
+}
+
+//Takes the events of location's cases off the buckets of day and later
+static void cancel_events(struct simulation *sim, int location, int day)
+{
+	int *link, e;
+
+	for (; day < sim->settings.num_days; day++)
+		for (link = &sim->bucket[day]; (e = *link) != NO_EVENT; ) {
+			if (sim->cases[sim->events[e].case_number].location != location) {
+				link = &sim->events[e].next;
+				continue;
+			}
+			*link = sim->events[e].next;
+			sim->events[e].next = sim->free_event;
+			sim->free_event = e;
+		}
+}
+
+//Hands location's cases to its compartments from the start of day. Dates from day on are forgotten
+//(and drawn again by the compartments), as are cases not yet exposed.
+static void to_compartments(struct simulation *sim, int location, int day)
+{
+	struct sim_compartments *c = &sim->compartments[location];
+	struct sim_case *current;
+	int *d;
+	long i;
+
+	c->active = 1;
+	cancel_events(sim, location, day);
+	for (i = 0; i < sim->num_cases; i++) {
+		current = &sim->cases[i];
+		d = current->dates;
+		if (current->location != location || current->phase != CASE_AGENT) continue;
+		if (d[0] >= day) {
+			current->phase = CASE_DROPPED;
+			if (current->transmission_type >= 0) sim->cases_by_type[(int)current->transmission_type]--;
+			continue;
+		}
+		if (current->diag && current->diag_day >= day) {			//Counted at onset - to be counted again when it happens
+			count_diagnosis(sim, current->diag_day, location, -1);
+			current->diag_day = 9999;
+			current->phase = CASE_HANDED_OVER;
+			if (d[1] < day && d[2] < day) c->reporting[d[1]]++;
+		}
+		if (d[1] >= day) {
+			c->exposed[d[0]]++;
+			d[1] = d[2] = d[3] = -1;
+			current->phase = CASE_HANDED_OVER;
+		}
+		else if (d[2] >= day) {
+			if (!current->diag) c->undiagnosed[d[1]]++;
+			else if (current->diag_day == 9999) c->awaiting[d[1]]++;
+			else c->diagnosed[d[1]]++;
+			d[2] = d[3] = -1;
+			current->phase = CASE_HANDED_OVER;
+		}
+		else if (!current->survive && d[3] >= day) {
+			c->burial[d[2]]++;
+			d[3] = -1;
+			current->phase = CASE_HANDED_OVER;
+		}
+	}
+	sim->switches[0]++;
+}
+
+//Makes a case from the compartments, exposed on day exposure, and returns its number (-1 if there is no room)
+static int case_from_compartments(struct simulation *sim, int location, int exposure)
+{
+	return add_case(sim, PARENT_COMPARTMENTS, location, -1, exposure);
+}
+
+//Gives location's cases back as single cases from the start of day. Each case's wait in its stage is
+//drawn given the time it has waited. Dates before its stage began are not known, and are set a day
+//apart; cases waiting only for their diagnosis just have it counted.
+static void to_agents(struct simulation *sim, int location, int day)
+{
+	struct sim_compartments *c = &sim->compartments[location];
+	struct sim_case *current;
+	double share = sim->location_cdf[location] - (location > 0 ? sim->location_cdf[location - 1] : 0);
+	int e, i, *d, end_individual;
+	long n;
+
+	c->active = 0;
+	for (e = 0; e < day; e++) {
+		for (n = c->reporting[e]; n > 0; n--)
+			count_diagnosis(sim, e + duration_at_least(sim, DUR_DIAGNOSIS, day - e), location, 1);
+		for (n = c->exposed[e]; n > 0 && (i = case_from_compartments(sim, location, e)) >= 0; n--) {
+			d = sim->cases[i].dates;
+			d[1] = e + 1 + duration_at_least(sim, DUR_INCUBATION, day - e - 1);
+			schedule(sim, d[1], EVENT_ONSET, i);
+		}
+		for (n = c->burial[e]; n > 0 && (i = case_from_compartments(sim, location, e - 2)) >= 0; n--) {
+			d = sim->cases[i].dates;
+			d[1] = e - 1;
+			d[2] = e;
+			d[3] = e + duration_at_least(sim, DUR_BURIAL, day - e);
+			schedule(sim, d[3], EVENT_BURIAL, i);
+			expose(sim, i, 3, day, sim->cases[i].dates[3]);
+		}
+		for (n = c->undiagnosed[e] + c->awaiting[e] + c->diagnosed[e]; n > 0 && (i = case_from_compartments(sim, location, e - 1)) >= 0; n--) {
+			current = &sim->cases[i];
+			d = current->dates;
+			d[1] = e;
+			d[2] = e + 1 + duration_at_least(sim, DUR_INFECTIOUS, day - e - 1);
+			current->survive = uniform_r(&sim->rng) < sim->params.p_survive;
+			current->diag = n <= c->awaiting[e] + c->diagnosed[e];
+			if (n <= c->diagnosed[e]) current->diag_day = day - 1;					//Already diagnosed (and counted)
+			else if (current->diag) {
+				current->diag_day = e + duration_at_least(sim, DUR_DIAGNOSIS, day - e);
+				count_diagnosis(sim, current->diag_day, location, 1);
+			}
+			end_individual = current->diag && current->diag_day < d[2] ? current->diag_day : d[2];
+			schedule(sim, d[2], EVENT_END, i);
+			expose(sim, i, 1, day, end_individual);
+			current = &sim->cases[i];
+			if (current->diag) expose(sim, i, 2, current->diag_day > day ? current->diag_day : day, current->dates[2]);
+		}
+	}
+	memset(c->exposed, 0, 6L * sim->settings.num_days * sizeof(long));
+
+	for (n = rpois_r(&sim->rng, sim->params.beta[0] * share * (sim->settings.num_days - day)); n > 0; n--)	//Index cases to come
+		if ((i = add_case(sim, -1, location, 0, day + (int)(uniform_r(&sim->rng) * (sim->settings.num_days - day)))) >= 0)
+			schedule(sim, sim->cases[i].dates[0], EVENT_EXPOSURE, i);
+	sim->switches[1]++;
+}
+
+//At the end of day: switches locations whose exposures passed the threshold to compartments, and
+//those whose exposures fell well below it back to single cases
+static void switch_locations(struct simulation *sim, int day)
+{
+	int l;
+
+	if (day + 1 >= sim->settings.num_days) return;
+	for (l = 0; l < sim->settings.num_locations; l++) {
+		if (!sim->compartments[l].active && sim->incidence[l] > sim->settings.hybrid_threshold) to_compartments(sim, l, day + 1);
+		else if (sim->compartments[l].active && sim->incidence[l] < HYBRID_SWITCH_BACK * sim->settings.hybrid_threshold)
+			to_agents(sim, l, day + 1);
+	}
+}
+
+//Runs the outbreak from day 0 to the last day, starting with the index cases, or until the
+//observer stops it. Returns the number of cases.
+long run_simulation(struct simulation *sim)
+{
+	int day, e, l;
+	long n;
+	struct timespec start, end;
+	unsigned long long ticks = profile_start();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = rpois_r(&sim->rng, sim->params.beta[0] * sim->settings.num_days); n > 0; n--)
+		new_case(sim, -1, 0, (int)(uniform_r(&sim->rng) * sim->settings.num_days));
+
+	for (day = 0; day < sim->settings.num_days; day++) {
+		if (sim->compartments)
+			for (l = 0; l < sim->settings.num_locations; l++)
+				if (sim->compartments[l].active) leap_location(sim, l, day);
+		while ((e = sim->bucket[day]) != NO_EVENT) {	//Events of the same day may add more to it
+			sim->bucket[day] = sim->events[e].next;
+			sim->events[e].next = sim->free_event;
+			sim->free_event = e;
+			run_event(sim, sim->events[e].case_number, sim->events[e].kind);
+		}
+		sim->last_day = day;
+		if (sim->compartments) switch_locations(sim, day);
+		memset(sim->incidence, 0, sim->settings.num_locations * sizeof(long));
+		if (sim->observer && sim->observer(sim, day, sim->observer_arg)) {
+			if (!sim->stopped) sim->stopped = SIM_STOPPED_OBSERVER;	//A run at max_cases keeps that as the reason
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sim->seconds = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+	profile_stop(PROF_SIMULATION, ticks);
+	return sim->num_cases;
+}
+
+/*-------------------------------
+| output						|
+-------------------------------*/
+
+//Parent of case i as written out: PARENT_COMPARTMENTS if the parent is not (it went to the compartments)
+static int written_parent(struct simulation *sim, long i)
+{
+	int parent = sim->cases[i].parent;
+
+	if (parent >= 0 && sim->cases[parent].phase != CASE_AGENT) return PARENT_COMPARTMENTS;
+	return parent;
+}
+
+//The simulated cases as a linked list of patients, with parents and children linked as the
+//sampler expects (the list starts at the first element of the block). Only cases simulated singly
+//throughout are in it, as in write_simulation. Each patient takes about 2kB, so this is for
+//outbreaks of moderate size - write_simulation suits big ones.
+p_patient simulated_patients(struct simulation *sim)
+{
+	long i, n = 0, *row;
+	p_patient block, current;
+	struct sim_case *source;
+
+	row = (long*)mem_malloc(MEM_SIMULATION, (sim->num_cases + 1) * sizeof(long));
+	if (!row) { printf("Could not allocate rows in simulated_patients.\n"); exit(1); }
+	for (i = 0; i < sim->num_cases; i++) row[i] = sim->cases[i].phase == CASE_AGENT ? n++ : -1;
+	if (n == 0) { mem_free(row); return NULL; }
+	block = (struct patient*)mem_calloc(MEM_CASES, n, sizeof(struct patient));
+	if (!block) { printf("Could not allocate patients in simulated_patients.\n"); exit(1); }
+	for (i = 0; i < sim->num_cases; i++) {
+		if (row[i] < 0) continue;
+		current = &block[row[i]];
+		source = &sim->cases[i];
+		current->index = (int)row[i];
+		current->location = source->location;
+		memcpy(current->dates, source->dates, sizeof(current->dates));
+		current->transmission_type = source->transmission_type;
+		current->survive = source->survive;
+		current->est_case = 1;
+		current->diag = source->diag;
+		current->diag_day = source->diag_day;
+		current->prev = row[i] > 0 ? &block[row[i] - 1] : NULL;
+		current->next = row[i] < n - 1 ? &block[row[i] + 1] : NULL;
+	}
+	for (i = sim->num_cases - 1; i >= 0; i--)			//Backwards, so children end up in order
+		if (row[i] >= 0 && written_parent(sim, i) >= 0) attach_to_parent(&block[row[i]], &block[row[sim->cases[i].parent]]);
+	mem_free(row);
+	return block;
+}
+
+void print_simulation(struct simulation *sim)
+{
+	log_info(LOG_SIMULATION, "Simulated %ld cases over %d days in %.2f s%s.", cases_made(sim), sim->last_day + 1, sim->seconds,
+		sim->stopped == SIM_STOPPED_MAX_CASES ? " (stopped at the largest number of cases)" :
+		sim->stopped == SIM_STOPPED_OBSERVER ? " (stopped early)" : "");
+	log_info(LOG_SIMULATION, "\tBy transmission type: %ld index, %ld individual, %ld hospital, %ld burial",
+		sim->cases_by_type[0], sim->cases_by_type[1], sim->cases_by_type[2], sim->cases_by_type[3]);
+	log_info(LOG_SIMULATION, "\tEvents: %ld exposures, %ld onsets, %ld deaths/recoveries, %ld burials",
+		sim->events_run[EVENT_EXPOSURE], sim->events_run[EVENT_ONSET], sim->events_run[EVENT_END], sim->events_run[EVENT_BURIAL]);
+	if (sim->compartments)
+		log_info(LOG_SIMULATION, "\tHybrid: %ld switches to compartments, %ld back, %ld cases exposed in compartments",
+			sim->switches[0], sim->switches[1], sim->compartment_cases);
+}
+
+//One line per case: its number, parent (-1 for index cases, -2 for cases made from compartments or
+//whose parent went to them), transmission type, key dates, survival, diagnosis and day of diagnosis.
+//Only cases simulated singly throughout are written. Dropped cases are made again by the
+//compartments, and handed-over ones lack the dates from their switch on: those still in the
+//compartments at a switch back are made again as cases with parent -2, and the rest are counted
+//only in the diagnoses.
+void write_simulation(struct simulation *sim, const char *file_name)
+{
+	FILE *out = fopen(file_name, "w");
+	struct sim_case *current;
+	long i;
+
+	if (!out) { printf("Could not open %s to write the simulation.\n", file_name); exit(1); }
+	fprintf(out, "case,parent,transmission_type,exposure,onset,death_or_recovery,burial,survive,diagnosed,diag_day\n");
+	for (i = 0; i < sim->num_cases; i++) {
+		current = &sim->cases[i];
+		if (current->phase != CASE_AGENT) continue;
+		fprintf(out, "%ld,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", i, written_parent(sim, i), current->transmission_type,
+			current->dates[0], current->dates[1], current->dates[2], current->dates[3],
+			current->survive, current->diag, current->diag ? current->diag_day : -1);
+	}
+	fclose(out);
+}
@@ -0,0 +1,140 @@
+/********************************************************************************
+*	Outbreak_Simulator.h														*
+*	Contains:																	*
+*		- Settings and state of a forward simulation of an outbreak from the	*
+*			model parameters: exposures, onsets, deaths/recoveries and			*
+*			burials, taken day by day from a bucket (calendar) queue of events	*
+*		- An observer, called at the end of every day, that can stop a run		*
+*			early (e.g. once it can no longer match the reports)				*
+*		- Hybrid runs, in which a location with many exposures a day is			*
+*			switched from single cases to counts in compartments, advanced a	*
+*			day at a time by tau-leaping, and back again once they fall		*
+*		- Functions defined in Outbreak_Simulator.c								*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h and				*
+*		Gibbs_Sampler.h first.													*
+********************************************************************************/
+
+#define DEFAULT_SIM_MAX_CASES 1000000	//The simulation stops making cases beyond this many
+#define NO_EVENT -1						//End of a bucket's list of events
+
+//Kinds of event - each fills in one of the key dates of a case (see struct patient)
+#define EVENT_EXPOSURE 0		//dates[0]: draws the incubation period
+#define EVENT_ONSET 1			//dates[1]: draws the infectious period, diagnosis and survival, and
+								//exposes others by individual and hospital transmission
+#define EVENT_END 2				//dates[2]: death or recovery - a fatal case draws its burial and exposes
+								//others by burial transmission
+#define EVENT_BURIAL 3			//dates[3]
+#define NUM_EVENT_KINDS 4
+
+//Why a run stopped before its last day (simulation.stopped)
+#define SIM_STOPPED_MAX_CASES 1	//max_cases was reached - later exposures were dropped, but the run carries on
+#define SIM_STOPPED_OBSERVER 2	//The observer asked for the run to end (before max_cases was reached)
+
+//Hybrid runs
+#define HYBRID_SWITCH_BACK 0.25		//A location goes back to single cases below this fraction of the threshold
+#define HYBRID_NORMAL_DRAWS 1000.0	//Tau-leaping draws with larger means use the normal approximation
+#define PARENT_COMPARTMENTS -2		//Parent of a case made from the compartments (its parent is not known)
+
+//What became of a case (sim_case.phase)
+#define CASE_AGENT 0			//Simulated as a single case throughout
+#define CASE_HANDED_OVER 1		//Handed to the compartments - dates from the switch on were never drawn (-1)
+#define CASE_DROPPED 2			//Exposed after its location switched, so made again by the compartments
+
+/************************************************
+* Structures of a simulation					*
+************************************************/
+
+struct simulation_settings
+{
+	int num_days;			//Events on day num_days or later are not run (their cases expose nobody)
+	long max_cases;
+	unsigned long seed;
+	int num_locations;		//Index cases are placed at a location, and their descendants stay there
+	const double *location_weights;	//Relative chance of each location for an index case (NULL for equal chances)
+	long hybrid_threshold;	//Exposures in a day at one location above which it switches to compartments (0: never)
+};
+
+struct simulation;
+
+//Called at the end of each day, once every diagnosis up to and including day is known (a case is
+//diagnosed no earlier than its onset). Returns nonzero to stop the run.
+typedef int (*sim_observer)(struct simulation *sim, int day, void *arg);
+
+//A simulated case, kept small so that millions fit in memory - see simulated_patients for the full form
+struct sim_case
+{
+	int dates[4];
+	int diag_day;			//9999 if never diagnosed
+	int parent;				//Position of the parent in the simulation's cases (-1 for index cases)
+	int location;
+	char transmission_type;
+	char survive;
+	char diag;
+	char phase;				//CASE_ definitions
+};
+
+//A location's cases as counts, each compartment indexed by the day its cases entered it. Cases
+//waiting for their diagnosis after their end, and fatal cases waiting for burial, are counted
+//apart (one case can be in both), as the two waits are independent.
+struct sim_compartments
+{
+	int active;				//1 while the location is simulated by compartments
+	long *exposed;			//By day of exposure, until onset
+	long *undiagnosed;		//By day of onset, until the end - never to be diagnosed
+	long *awaiting;			//By day of onset, until diagnosis or the end - to be diagnosed
+	long *diagnosed;		//By day of onset, from diagnosis until the end
+	long *reporting;		//By day of onset, ended but still to be diagnosed
+	long *burial;			//By day of the end, fatal cases until burial
+};
+
+struct sim_event
+{
+	int next;				//Next event in the same bucket (NO_EVENT at the end)
+	int case_number;
+	int kind;
+};
+
+//Every day has a bucket holding a list of its events. Events are only ever added for the day being
+//run or later, so the days are simply taken in turn.
+struct simulation
+{
+	struct simulation_settings settings;
+	struct parameter_list params;
+	struct mt_state rng;
+	struct sim_case *cases;
+	long num_cases;
+	long case_capacity;
+	int *bucket;							//bucket[day]: first event of the day
+	struct sim_event *events;				//Pool of events, linked into buckets or the free list
+	int num_events;							//Events ever taken from the end of the pool
+	int event_capacity;
+	int free_event;							//First event on the free list
+	long events_run[NUM_EVENT_KINDS];
+	long cases_by_type[NUM_TRANS_TYPES];
+	int stopped;							//0, or why the run stopped early (SIM_STOPPED_ definitions)
+	int last_day;							//Last day run
+	double *location_cdf;					//Cumulative chances of the locations for index cases
+	long *diagnoses;						//diagnoses[day * num_locations + location]: cases diagnosed that day
+	sim_observer observer;					//NULL, or called at the end of each day
+	void *observer_arg;
+	struct sim_compartments *compartments;	//compartments[location] (hybrid runs only)
+	long *incidence;						//incidence[location]: exposures today
+	long switches[2];						//Switches to compartments [0] and back to single cases [1]
+	long compartment_cases;					//Cases exposed in the compartments
+	double dur_pmf[NUM_DURATIONS][NUMDAYS];	//Chance of each duration (hybrid runs only)
+	double dur_tail[NUM_DURATIONS][NUMDAYS];	//Chance of each duration or more
+	double seconds;							//Time taken by run_simulation
+};
+
+/********************************************
+* Functions defined in Outbreak_Simulator.c	*
+********************************************/
+
+void default_simulation_settings(struct simulation_settings *settings);
+void init_simulation(struct simulation *sim, struct parameter_list *p_params, struct simulation_settings *settings);
+void restart_simulation(struct simulation *sim, struct parameter_list *p_params, unsigned long seed);
+void free_simulation(struct simulation *sim);
+long run_simulation(struct simulation *sim);
+p_patient simulated_patients(struct simulation *sim);
+void print_simulation(struct simulation *sim);
+void write_simulation(struct simulation *sim, const char *file_name);
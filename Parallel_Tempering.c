@@ -0,0 +1,604 @@
+/********************************************************************************
+*	Parallel_Tempering.c														*
+*	Runs K chains at different temperatures on a pool of threads. Between		*
+*		rounds of sweeps, chains on neighbouring rungs of the ladder propose	*
+*		to swap temperatures, so the cold chain (the posterior) can escape		*
+*		local modes of the transmission tree via the hotter chains.				*
+*	Swaps exchange temperatures rather than states, so nothing is copied.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <math.h>						//For log and exp
+#include <string.h>						//For strcpy
+#include <time.h>						//For wall-clock timing
+#include "MTrandom.h"					//For random number generation (accept/reject situations)
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains and their moves
+#include "Thread_Pool.h"				//For running chains on every core
+#include "Coloured_Sweep.h"				//For spreading the cases of each chain over the cores
+#include "Posterior_Summary.h"			//For summaries of the cold chain
+#include "Parallel_Tempering.h"			//For structures and declarations of functions needed in this file
+#include "Checkpoint.h"					//For saving and restoring the state of a run
+#include "Trace.h"						//For recording samples of the cold chain
+#include "Spatial_Kernel.h"				//For the spatial pressure of the cold chain
+#include "Pressure_Field.h"				//For the same on a grid, for many subregions
+#include "Renewal.h"					//For expected onsets and diagnoses of each subregion
+#include "Live_Ring.h"					//For publishing progress to monitors
+#include "Placement.h"					//For running chains on the node holding their cases
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For warnings
+
+/*-------------------------------
+| settings and set up			|
+-------------------------------*/
+
+void default_sampler_settings(struct sampler_settings *settings)
+{
+	settings->num_threads = number_of_cores();
+	settings->num_chains = settings->num_threads;
+	settings->case_threads = 0;
+	settings->num_sweeps = DEFAULT_SWEEPS;
+	settings->burn_in = DEFAULT_BURN_IN;
+	settings->swap_interval = DEFAULT_SWAP_INTERVAL;
+	settings->max_temperature = DEFAULT_MAX_TEMPERATURE;
+	settings->seed = DEFAULT_SEED;
+	settings->checkpoint_file[0] = 0;
+	settings->checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+	settings->restart_file[0] = 0;
+	settings->trace_file[0] = 0;
+	settings->trace_interval = DEFAULT_TRACE_INTERVAL;
+	settings->summary_file[0] = 0;
+	settings->spatial_file[0] = 0;
+	settings->coords_file[0] = 0;
+	settings->kernel_scale = DEFAULT_KERNEL_SCALE;
+	settings->kernel_exponent = DEFAULT_KERNEL_EXPONENT;
+	settings->field_tolerance = 0;
+	settings->renewal_file[0] = 0;
+	settings->incidence = 0;
+	settings->quiet = 0;
+	settings->live_name[0] = 0;
+}
+
+//Sets heat[] from the gaps, and gives each chain the heat of its rung
+void apply_ladder(struct sampler_run *run)
+{
+	int r;
+	double log_temperature = 0;
+	struct tempering_ladder *ladder = &run->ladder;
+
+	for (r = 0; r < ladder->num_rungs; r++) {
+		ladder->heat[r] = exp(-log_temperature);
+		run->chains[ladder->chain_on_rung[r]].heat = ladder->heat[r];
+		run->chains[ladder->chain_on_rung[r]].rung = r;
+		if (r < ladder->num_rungs - 1) log_temperature += ladder->log_gap[r];
+	}
+}
+
+static void *ladder_alloc(size_t size)
+{
+	void *block = mem_calloc(MEM_SAMPLER, size, 1);
+	if (!block) { printf("Could not allocate ladder in allocate_ladder.\n"); exit(1); }
+	return block;
+}
+
+void allocate_ladder(struct tempering_ladder *ladder, int num_rungs)
+{
+	ladder->num_rungs = num_rungs;
+	ladder->heat = (double*)ladder_alloc(num_rungs * sizeof(double));
+	ladder->log_gap = (double*)ladder_alloc(num_rungs * sizeof(double));
+	ladder->chain_on_rung = (int*)ladder_alloc(num_rungs * sizeof(int));
+	ladder->swaps_proposed = (long*)ladder_alloc(num_rungs * sizeof(long));
+	ladder->swaps_accepted = (long*)ladder_alloc(num_rungs * sizeof(long));
+	ladder->swap_rate = (double*)ladder_alloc(num_rungs * sizeof(double));
+	ladder->adaptations = 0;
+}
+
+//Sets up K chains on an evenly spaced (in log temperature) ladder
+void initialise_sampler_run(struct sampler_run *run, p_patient first, struct parameter_list *p_params,
+	struct sampler_settings *settings)
+{
+	int c, K;
+	unsigned long key[2];
+	struct tempering_ladder *ladder = &run->ladder;
+
+	run->settings = *settings;
+	if (run->settings.num_chains < 1) run->settings.num_chains = 1;
+	if (run->settings.swap_interval < 1) run->settings.swap_interval = 1;
+	K = run->settings.num_chains;
+	run->sweeps_done = 0;
+	run->swap_rounds = 0;
+	key[0] = settings->seed;
+	key[1] = (unsigned long)K;			//Chains use (seed, 0) to (seed, K - 1)
+	init_by_array_r(&run->rng, key, 2);
+
+	allocate_ladder(ladder, K);
+
+	run->chains = (struct chain_state*)mem_malloc(MEM_SAMPLER, K * sizeof(struct chain_state));
+	if (!run->chains) { printf("Could not allocate chains in initialise_sampler_run.\n"); exit(1); }
+	for (c = 0; c < K; c++) {
+		initialise_chain(&run->chains[c], first, p_params, c, 1.0, settings->seed);
+		ladder->chain_on_rung[c] = c;
+		if (c < K - 1) {
+			ladder->log_gap[c] = log(run->settings.max_temperature) / (K - 1);
+			ladder->swap_rate[c] = 0.5;
+		}
+	}
+	apply_ladder(run);
+	init_posterior_summary(&run->summary, &run->chains[0]);
+}
+
+void free_sampler_run(struct sampler_run *run)
+{
+	int c;
+
+	for (c = 0; c < run->settings.num_chains; c++) free_chain(&run->chains[c]);
+	mem_free(run->chains);
+	mem_free(run->ladder.heat);
+	mem_free(run->ladder.log_gap);
+	mem_free(run->ladder.chain_on_rung);
+	mem_free(run->ladder.swaps_proposed);
+	mem_free(run->ladder.swaps_accepted);
+	mem_free(run->ladder.swap_rate);
+	free_posterior_summary(&run->summary);
+}
+
+/*-------------------------------
+| swaps and ladder adaptation	|
+-------------------------------*/
+
+//Proposes swaps between rungs r and r + 1 for every even r (or every odd r, on alternate rounds).
+//Non-overlapping pairs can all be decided at once.
+static void propose_swaps(struct sampler_run *run)
+{
+	int r, a, b, accepted;
+	double log_ratio;
+	struct tempering_ladder *ladder = &run->ladder;
+
+	for (r = (int)(run->swap_rounds % 2); r < ladder->num_rungs - 1; r += 2) {
+		a = ladder->chain_on_rung[r];
+		b = ladder->chain_on_rung[r + 1];
+		log_ratio = (ladder->heat[r] - ladder->heat[r + 1]) * (tempered_log_lik(&run->chains[b]) - tempered_log_lik(&run->chains[a]));
+		accepted = log_ratio >= 0 || log(uniform_r(&run->rng)) < log_ratio;
+
+		ladder->swaps_proposed[r]++;
+		ladder->swap_rate[r] += SWAP_RATE_SMOOTHING * (accepted - ladder->swap_rate[r]);
+		if (accepted) {
+			ladder->swaps_accepted[r]++;
+			ladder->chain_on_rung[r] = b;
+			ladder->chain_on_rung[r + 1] = a;
+		}
+	}
+	run->swap_rounds++;
+	apply_ladder(run);
+}
+
+//Log(temperature) of the hottest rung: the sum of the gaps
+static double ladder_span(struct tempering_ladder *ladder)
+{
+	int r;
+	double span = 0;
+
+	for (r = 0; r < ladder->num_rungs - 1; r++) span += ladder->log_gap[r];
+	return span;
+}
+
+//Widens gaps whose swap rate is above the average and narrows those below it. The span of the
+//ladder shrinks while the average is below LADDER_TARGET_SWAP_RATE and grows back while it is
+//above, between LADDER_MIN_SPAN of log(max_temperature) and all of it, so a ladder too wide for
+//its chains still swaps. No gap goes below LADDER_MIN_GAP of the even gap: a pair that never
+//swaps however close (chains in far apart states) would otherwise pull the whole ladder onto
+//heat 1, as would the span without its floor. The step size decays so the ladder settles during
+//burn-in.
+static void adapt_ladder(struct sampler_run *run)
+{
+	int r;
+	double mean_rate = 0, span = 0, total_gap = 0, step, min_gap;
+	double max_span = log(run->settings.max_temperature);
+	struct tempering_ladder *ladder = &run->ladder;
+	int num_gaps = ladder->num_rungs - 1;
+
+	if (num_gaps < 1) return;
+	for (r = 0; r < num_gaps; r++) {
+		mean_rate += ladder->swap_rate[r] / num_gaps;
+		span += ladder->log_gap[r];
+	}
+	step = LADDER_ADAPT_RATE / (1.0 + ladder->adaptations / LADDER_ADAPT_DECAY);
+	span *= exp(step * (mean_rate - LADDER_TARGET_SWAP_RATE));
+	if (span > max_span) span = max_span;
+	if (span < LADDER_MIN_SPAN * max_span) span = LADDER_MIN_SPAN * max_span;
+	//Each gap is the floor plus its share of what is left, so none goes below the floor
+	min_gap = LADDER_MIN_GAP * span / num_gaps;
+	for (r = 0; r < num_gaps; r++) {
+		ladder->log_gap[r] *= exp(step * (ladder->swap_rate[r] - mean_rate));
+		total_gap += ladder->log_gap[r];
+	}
+	for (r = 0; r < num_gaps; r++)
+		ladder->log_gap[r] = min_gap + (span - num_gaps * min_gap) * ladder->log_gap[r] / total_gap;
+	ladder->adaptations++;
+	apply_ladder(run);
+}
+
+//Once burn-in is over: warns of neighbouring rungs that hardly ever swap, as the cold chain
+//then gains nothing from the hotter ones, and of a ladder that shrank onto its floor, as its
+//chains then barely differ from the cold one. The smoothed rate starts at 0.5, so after a short
+//burn-in the rate over every round so far is looked at too.
+static void check_swap_rates(struct sampler_run *run)
+{
+	int r;
+	double rate, max_span = log(run->settings.max_temperature);
+	struct tempering_ladder *ladder = &run->ladder;
+
+	if (ladder->num_rungs > 1 && max_span > 0 && ladder_span(ladder) <= LADDER_MIN_SPAN * max_span * (1 + 1e-9))
+		log_warn(LOG_SAMPLER, "The ladder shrank onto its floor (hottest temperature %.3f of %.3f): its chains swap "
+			"too rarely for a wider one, so they add little to the cold chain. More chains would help.",
+			1 / ladder->heat[ladder->num_rungs - 1], run->settings.max_temperature);
+
+	for (r = 0; r < ladder->num_rungs - 1; r++) {
+		rate = ladder->swap_rate[r];
+		if (ladder->swaps_proposed[r] > 0 && (double)ladder->swaps_accepted[r] / ladder->swaps_proposed[r] < rate)
+			rate = (double)ladder->swaps_accepted[r] / ladder->swaps_proposed[r];
+		if (rate < LADDER_LOW_SWAP_RATE)
+			log_warn(LOG_SAMPLER, "Swaps between rungs %d and %d (temperatures %.3f and %.3f) are accepted at %.3f after burn-in; "
+				"more chains or a longer burn-in would help.", r, r + 1, 1 / ladder->heat[r], 1 / ladder->heat[r + 1], rate);
+	}
+}
+
+/*-------------------------------
+| running the chains			|
+-------------------------------*/
+
+//Pool task: one chain makes swap_interval sweeps
+static void run_chain_sweeps(void *arg, int task, int thread)
+{
+	struct sampler_run *run = (struct sampler_run*)arg;
+	struct chain_state *chain = &run->chains[task];
+	int i;
+
+	//Rungs only change between rounds, so only one thread ever adds to the summary
+	for (i = 0; i < run->round_sweeps; i++) {
+		chain->adapting = run->sweeps_done + i < run->settings.burn_in;
+		gibbs_sweep(chain);
+		if (chain->rung == 0 && run->sweeps_done + i + 1 > run->settings.burn_in)
+			record_posterior_sample(&run->summary, chain);
+	}
+}
+
+//Chains of each node still to run this round, when they are spread over NUMA nodes
+struct node_round
+{
+	struct sampler_run *run;
+	int next[PLACE_MAX_NODES];		//next[n]: how many of node n's chains (n, n + nodes, ...) have been taken
+};
+
+//Pool task when chains are spread over NUMA nodes: a thread runs the chains whose cases are on its own
+//node, then helps with those of the other nodes. There is a task per thread, so every thread joins in.
+static void run_node_sweeps(void *arg, int task, int thread)
+{
+	struct node_round *round = (struct node_round*)arg;
+	int nodes = num_nodes(), home = current_node(), n, node, c;
+
+	for (n = 0; n < nodes; n++) {
+		node = (home + n) % nodes;
+		while ((c = node + nodes * __atomic_fetch_add(&round->next[node], 1, __ATOMIC_RELAXED)) < round->run->settings.num_chains)
+			run_chain_sweeps(round->run, c, thread);
+	}
+}
+
+//Progress of the cold chain, at info level (debug for quiet runs, so fits run side by side can still be followed)
+static void log_cold_chain(struct sampler_run *run)
+{
+	struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+
+	LOG_AT(LOG_SAMPLER, run->settings.quiet ? LOG_DEBUG : LOG_INFO,
+		"Sweep %ld: log likelihood %.3f, beta = (%.4g, %.4g, %.4g, %.4g), p_diag = %.3f, p_survive = %.3f, %d unobserved",
+		run->sweeps_done, cold->log_lik, cold->params.beta[0], cold->params.beta[1], cold->params.beta[2],
+		cold->params.beta[3], cold->params.p_diag, cold->params.p_survive, cold->num_cases - cold->num_observed);
+}
+
+//Effective sample size (in the cold chain's summary) of what each type of move changes: the median
+//over the cases exposed on each day for date moves, the median over the mean offspring of each
+//subregion for parent moves, the number of unobserved cases for births and deaths, and the
+//smallest over the parameters for the others
+static double move_ess(struct sampler_run *run, int move)
+{
+	struct posterior_summary *summary = &run->summary;
+	double ess[NUMDAYS + 1], swap;
+	int first, count, q, i, j, n = 0;
+
+	switch (move) {
+	case MOVE_DATES: first = SUMMARY_EXPOSURES; count = NUMDAYS; break;
+	case MOVE_PARENT: first = SUMMARY_SUBREGIONS + summary->num_subregions; count = summary->num_subregions; break;
+	case MOVE_RATES: first = 2; count = 4; break;			//beta (p_diag and p_survive are added below)
+	case MOVE_BIRTH_DEATH: first = SUMMARY_UNOBSERVED; count = 1; break;
+	default: first = 6; count = 8; break;					//dur_mean and dur_size
+	}
+	for (q = first; q < first + count && n < NUMDAYS; q++)
+		if (summary->quantity[q].moments.m2 > 0) ess[n++] = batch_ess(&summary->quantity[q].batches);
+	if (move == MOVE_RATES) {
+		ess[n++] = batch_ess(&summary->quantity[14].batches);
+		ess[n++] = batch_ess(&summary->quantity[15].batches);
+	}
+	if (n == 0) return 0;
+	for (i = 1; i < n; i++)								//Few values, so an insertion sort is fine
+		for (j = i; j > 0 && ess[j - 1] > ess[j]; j--) { swap = ess[j]; ess[j] = ess[j - 1]; ess[j - 1] = swap; }
+	return (move == MOVE_DATES || move == MOVE_PARENT) ? ess[n / 2] : ess[0];
+}
+
+static void print_run_summary(struct sampler_run *run, int num_threads, double seconds)
+{
+	int r, m;
+	long proposed[NUM_MOVE_TYPES] = { 0 }, accepted[NUM_MOVE_TYPES] = { 0 }, move_ns[NUM_MOVE_TYPES] = { 0 };
+	const char *move_names[NUM_MOVE_TYPES] = { "dates", "parent", "rates", "durations", "duration blocks",
+		"births/deaths" };
+	double chain_seconds, ess;
+	struct tempering_ladder *ladder = &run->ladder;
+
+	printf("Sampler finished: %ld sweeps of %d chains on %d threads in %.2f s (%.1f chain sweeps per second).\n",
+		run->sweeps_done, run->settings.num_chains, num_threads, seconds,
+		seconds > 0 ? run->sweeps_done * run->settings.num_chains / seconds : 0);
+	for (r = 0; r < ladder->num_rungs; r++) {
+		printf("\tRung %d: temperature %.3f", r, 1 / ladder->heat[r]);
+		if (r < ladder->num_rungs - 1 && ladder->swaps_proposed[r] > 0)
+			printf(", swaps with rung %d accepted %.3f", r + 1, (double)ladder->swaps_accepted[r] / ladder->swaps_proposed[r]);
+		printf("\n");
+	}
+	for (r = 0; r < run->settings.num_chains; r++) {
+		for (m = 0; m < NUM_MOVE_TYPES; m++) {
+			proposed[m] += run->chains[r].proposed[m];
+			accepted[m] += run->chains[r].accepted[m];
+			move_ns[m] += run->chains[r].move_ns[m];
+		}
+	}
+	//Time per chain in each move, against the effective samples the cold chain gained from it
+	for (m = 0; m < NUM_MOVE_TYPES; m++) {
+		if (proposed[m] == 0) continue;
+		chain_seconds = 1e-9 * move_ns[m] / run->settings.num_chains;
+		printf("\tMove %s: accepted %.3f of %ld, %.0f ns each", move_names[m], (double)accepted[m] / proposed[m],
+			proposed[m], (double)move_ns[m] / proposed[m]);
+		ess = move_ess(run, m);
+		if (ess > 0 && chain_seconds > 0) printf(", ESS %.0f (%.1f per second of these moves)", ess, ess / chain_seconds);
+		printf("\n");
+	}
+	{
+		struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+		printf("\tProposal scales: largest date shift %.1f days, duration steps", exp(cold->adapt.date_log_scale));
+		for (m = 0; m < NUM_DURATIONS; m++)
+			printf(" (%.3g, %.3g)", exp(cold->adapt.dur_log_scale[m][0]), exp(cold->adapt.dur_log_scale[m][1]));
+		printf("\n");
+	}
+	{
+		long capped = 0;
+		for (r = 0; r < run->settings.num_chains; r++) capped += run->chains[r].births_capped;
+		if (capped > 0) printf("\tBirths refused at the cap of unobserved cases: %ld (their number's posterior is cut off)\n", capped);
+	}
+	ess = move_ess(run, MOVE_DURATIONS);
+	if (move_ess(run, MOVE_RATES) < ess) ess = move_ess(run, MOVE_RATES);
+	if (ess > 0) printf("\tSlowest parameter: ESS %.0f, %.2f per CPU second\n", ess, ess / (seconds * num_threads));
+}
+
+static double wall_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+//Writes the infectious pressure on every subregion from the cold chain's cases, spread between
+//subregions by the kernel - through the matrix of every pair, or the grid if a field tolerance is set
+static void write_cold_chain_pressure(struct sampler_run *run, struct current_case_report *reports, int num_reports)
+{
+	struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+	struct location_table table;
+	struct spatial_kernel kernel;
+	double *load, *pressure, start, built, done;
+	int with_coordinates = 0;
+
+	start = wall_seconds();
+	build_location_table(&table, reports, num_reports);
+	if (run->settings.coords_file[0]) with_coordinates = read_location_coordinates(&table, run->settings.coords_file);
+	if (run->settings.field_tolerance <= 0) init_spatial_kernel(&kernel, &table, run->settings.kernel_scale, run->settings.kernel_exponent);
+	built = wall_seconds();
+	load = (double*)mem_malloc(MEM_SPATIAL, ((long)table.num_locations * NUMDAYS + 1) * sizeof(double));
+	pressure = (double*)mem_malloc(MEM_SPATIAL, ((long)table.num_locations * NUMDAYS + 1) * sizeof(double));
+	if (!load || !pressure) { printf("Could not allocate the pressure in write_cold_chain_pressure.\n"); exit(1); }
+	location_load(cold->first_case, &cold->params, table.num_locations, load);
+	if (run->settings.field_tolerance > 0)
+		field_location_pressure(&table, load, pressure, run->settings.kernel_scale, run->settings.kernel_exponent,
+			run->settings.field_tolerance);
+	else spatial_pressure(&kernel, load, pressure);
+	done = wall_seconds();
+	write_spatial_pressure(run->settings.spatial_file, &table, load, pressure);
+	if (run->settings.field_tolerance > 0)
+		log_info(LOG_SAMPLER, "Spatial pressure on %d subregions (%d with coordinates, grid to a tolerance of %g): %.2f ms.",
+			table.num_locations, with_coordinates, run->settings.field_tolerance, 1e3 * (done - start));
+	else {
+		log_info(LOG_SAMPLER, "Spatial pressure on %d subregions (%d with coordinates, %s kernel of %ld pairs): kernel %.2f ms, pressure %.2f ms.",
+			table.num_locations, with_coordinates, kernel.sparse ? "sparse" : "dense", kernel.num_entries, 1e3 * (built - start),
+			1e3 * (done - built));
+		free_spatial_kernel(&kernel);
+	}
+	mem_free(load);
+	mem_free(pressure);
+	free_location_table(&table);
+}
+
+//Writes the cold chain's onsets and the onsets and diagnoses expected from them, with the Poisson
+//log likelihood of the reports given the expected diagnoses
+static void write_cold_chain_renewal(struct sampler_run *run, struct current_case_report *reports, int num_reports)
+{
+	struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+	struct location_table table;
+	long updates = cold->renewal->updates, transforms = cold->renewal->transforms;
+
+	build_location_table(&table, reports, num_reports);
+	set_renewal_parameters(cold->renewal, &cold->params);
+	write_renewal(run->settings.renewal_file, cold->renewal, &table, reports, num_reports);
+	log_info(LOG_SAMPLER, "Renewal: %d subregions, %ld onsets moved and %ld subregions transformed again; reports' log likelihood %.2f.",
+		table.num_locations, updates, transforms, renewal_report_log_lik(cold->renewal, reports, num_reports));
+	free_location_table(&table);
+}
+
+//First sweep after done that is a multiple of interval, with interval rounded up to a whole number of
+//rounds of swaps (checkpoints, trace samples and progress reports can only come between rounds)
+static long next_round_multiple(long done, long interval, int swap_interval)
+{
+	interval = (interval + swap_interval - 1) / swap_interval * swap_interval;
+	return (done / interval + 1) * interval;
+}
+
+//Runs the tempered chains until every chain has made num_sweeps sweeps (the last round is cut short
+//if need be), saving the run every checkpoint_interval sweeps if a checkpoint file was given, and
+//recording the cold chain every trace_interval sweeps if a trace file was given - each interval rounded
+//up to a multiple of the swap interval
+static void run_sampler(struct sampler_run *run, struct parameter_list *p_params, struct current_case_report *reports)
+{
+	struct thread_pool *pool;
+	struct coloured_sweep *coloured = NULL;
+	struct checkpoint_writer *writer = NULL;
+	struct trace_writer *trace = NULL;
+	struct live_ring *live = NULL;
+	struct node_round round;
+	int num_threads, c, r, num_locations = 0;
+	long next_print, next_checkpoint = 0, next_trace = 0;
+	double start;
+
+	if (run->settings.case_threads > 0) {		//One chain at a time, its cases on every thread
+		num_threads = run->settings.case_threads;
+		pool = create_thread_pool(num_threads);
+		coloured = create_coloured_sweep(pool);
+		for (c = 0; c < run->settings.num_chains; c++) run->chains[c].coloured = coloured;
+	}
+	else {
+		num_threads = run->settings.num_threads;
+		if (num_threads > run->settings.num_chains) num_threads = run->settings.num_chains;	//No use for more
+		pool = create_thread_pool(num_threads);
+	}
+	if (run->settings.incidence)
+		for (c = 0; c < run->settings.num_chains; c++) build_incidence(&run->chains[c].incidence, run->chains[c].first_case);
+	if (run->settings.renewal_file[0]) {			//Every chain, as the cold chain can be any of them
+		for (r = 0; r < p_params->total_reports; r++) if (reports[r].location >= num_locations) num_locations = reports[r].location + 1;
+		for (c = 0; c < run->settings.num_chains; c++)
+			run->chains[c].renewal = create_renewal(run->chains[c].first_case, num_locations, &run->chains[c].params);
+	}
+	if (run->settings.checkpoint_file[0]) writer = start_checkpoint_writer(run->settings.checkpoint_file);
+	if (run->settings.trace_file[0])
+		trace = open_trace_writer(run->settings.trace_file, run->chains[0].num_observed, run->settings.trace_interval);
+	if (run->settings.live_name[0]) live = open_live_ring(run->settings.live_name, run);
+	if (coloured) LOG_AT(LOG_SAMPLER, run->settings.quiet ? LOG_DEBUG : LOG_INFO,
+		"Running %d tempered chains in turn, each on %d threads.", run->settings.num_chains, num_threads);
+	else LOG_AT(LOG_SAMPLER, run->settings.quiet ? LOG_DEBUG : LOG_INFO,
+		"Running %d tempered chains on %d threads.", run->settings.num_chains, num_threads);
+
+	next_print = next_round_multiple(run->sweeps_done, PRINT_INTERVAL, run->settings.swap_interval);
+	if (run->settings.checkpoint_interval > 0)
+		next_checkpoint = next_round_multiple(run->sweeps_done, run->settings.checkpoint_interval, run->settings.swap_interval);
+	if (run->settings.trace_interval > 0)
+		next_trace = next_round_multiple(run->sweeps_done, run->settings.trace_interval, run->settings.swap_interval);
+	start = wall_seconds();
+	while (run->sweeps_done < run->settings.num_sweeps) {
+		run->round_sweeps = run->settings.swap_interval;
+		if (run->sweeps_done + run->round_sweeps > run->settings.num_sweeps)
+			run->round_sweeps = (int)(run->settings.num_sweeps - run->sweeps_done);
+		if (coloured) for (c = 0; c < run->settings.num_chains; c++) run_chain_sweeps(run, c, 0);
+		else if (numa_placement()) {				//Chain c's cases are on node c % nodes (see node_for_index)
+			memset(&round, 0, sizeof(round));
+			round.run = run;
+			run_pool_tasks(pool, run_node_sweeps, &round, pool_size(pool));
+		}
+		else run_pool_tasks(pool, run_chain_sweeps, run, run->settings.num_chains);
+		run->sweeps_done += run->round_sweeps;
+		propose_swaps(run);
+		if (run->sweeps_done <= run->settings.burn_in) adapt_ladder(run);
+		if (run->sweeps_done > run->settings.burn_in && run->sweeps_done - run->round_sweeps <= run->settings.burn_in)
+			check_swap_rates(run);
+		if (run->sweeps_done >= next_print) {
+			log_cold_chain(run);
+			next_print = next_round_multiple(run->sweeps_done, PRINT_INTERVAL, run->settings.swap_interval);
+		}
+		if (writer && run->settings.checkpoint_interval > 0 && run->sweeps_done >= next_checkpoint) {
+			write_checkpoint(writer, run, p_params, reports);
+			next_checkpoint = next_round_multiple(run->sweeps_done, run->settings.checkpoint_interval, run->settings.swap_interval);
+		}
+		if (trace && run->settings.trace_interval > 0 && run->sweeps_done >= next_trace) {
+			record_trace_sample(trace, run->sweeps_done, &run->chains[run->ladder.chain_on_rung[0]]);
+			next_trace = next_round_multiple(run->sweeps_done, run->settings.trace_interval, run->settings.swap_interval);
+		}
+		if (live) publish_live_sample(live, run, wall_seconds() - start);
+	}
+	if (!run->settings.quiet) {
+		flush_log();							//The progress lines first
+		print_run_summary(run, num_threads, wall_seconds() - start);
+		print_posterior_summary(&run->summary);
+	}
+	if (run->settings.summary_file[0]) write_posterior_summary(&run->summary, run->settings.summary_file);
+	if (run->settings.spatial_file[0]) write_cold_chain_pressure(run, reports, p_params->total_reports);
+	if (run->settings.renewal_file[0]) write_cold_chain_renewal(run, reports, p_params->total_reports);
+
+	if (live) close_live_ring(live);
+	if (trace) close_trace_writer(trace);			//Waits for the last samples to reach the disk
+	if (writer) stop_checkpoint_writer(writer);		//Waits for the last checkpoint to reach the disk
+	if (coloured) {
+		for (c = 0; c < run->settings.num_chains; c++) run->chains[c].coloured = NULL;
+		free_coloured_sweep(coloured);
+	}
+	for (c = 0; c < run->settings.num_chains; c++) {
+		if (run->chains[c].renewal) free_renewal(run->chains[c].renewal);
+		run->chains[c].renewal = NULL;
+	}
+	destroy_thread_pool(pool);
+}
+
+//Starts a new run from the context's cases. Returns the log likelihood of the cold chain's last state.
+double run_gibbs_sampler(struct model_context *model, struct sampler_settings *settings)
+{
+	struct sampler_run run;
+	double log_lik;
+
+	initialise_sampler_run(&run, model->cases, &model->params, settings);
+	run_sampler(&run, &model->params, model->reports);
+	log_lik = run.chains[run.ladder.chain_on_rung[0]].log_lik;
+	free_sampler_run(&run);
+	return log_lik;
+}
+
+//Carries on from settings->restart_file. The run keeps its own chains, ladder and seed, but takes
+//the number of sweeps, threads and the checkpoint, trace and summary settings from settings. A trace given
+//here starts afresh at the sweep the checkpoint was taken. The checkpoint's reports and parameters
+//replace the context's.
+double resume_gibbs_sampler(struct model_context *model, struct sampler_settings *settings)
+{
+	struct sampler_run run;
+	double log_lik;
+
+	mem_free(model->reports);
+	model->reports = NULL;
+	read_checkpoint(settings->restart_file, &run, &model->params, &model->reports);
+	run.settings.num_sweeps = settings->num_sweeps;
+	run.settings.num_threads = settings->num_threads;
+	run.settings.case_threads = settings->case_threads;
+	strcpy(run.settings.checkpoint_file, settings->checkpoint_file);
+	run.settings.checkpoint_interval = settings->checkpoint_interval;
+	strcpy(run.settings.trace_file, settings->trace_file);
+	run.settings.trace_interval = settings->trace_interval;
+	strcpy(run.settings.summary_file, settings->summary_file);
+	strcpy(run.settings.spatial_file, settings->spatial_file);
+	strcpy(run.settings.coords_file, settings->coords_file);
+	run.settings.kernel_scale = settings->kernel_scale;
+	run.settings.kernel_exponent = settings->kernel_exponent;
+	run.settings.field_tolerance = settings->field_tolerance;
+	strcpy(run.settings.renewal_file, settings->renewal_file);
+	run.settings.incidence = settings->incidence;
+	run.settings.quiet = settings->quiet;
+	strcpy(run.settings.live_name, settings->live_name);
+	run.settings.restart_file[0] = 0;
+	LOG_AT(LOG_SAMPLER, run.settings.quiet ? LOG_DEBUG : LOG_INFO, "Carrying on from sweep %ld of %s.", run.sweeps_done,
+		settings->restart_file);
+	run_sampler(&run, &model->params, model->reports);
+	log_lik = run.chains[run.ladder.chain_on_rung[0]].log_lik;
+	free_sampler_run(&run);
+	return log_lik;
+}
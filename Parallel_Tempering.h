@@ -0,0 +1,100 @@
+/********************************************************************************
+*	Parallel_Tempering.h														*
+*	Contains:																	*
+*		- Settings and state of a run of several tempered chains, with			*
+*			replica-exchange swaps between neighbouring temperatures			*
+*		- Functions defined in Parallel_Tempering.c								*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h and Posterior_Summary.h first.							*
+********************************************************************************/
+
+//Default settings (each can be changed on the command line)
+#define DEFAULT_SWEEPS 10000			//Sweeps made by every chain
+#define DEFAULT_BURN_IN 2000			//Sweeps before the ladder stops adapting
+#define DEFAULT_SWAP_INTERVAL 10		//Sweeps between rounds of swaps
+#define DEFAULT_MAX_TEMPERATURE 100.0	//Temperature of the hottest chain (heat = 1/temperature)
+#define DEFAULT_SEED 5489UL
+#define DEFAULT_CHECKPOINT_INTERVAL 1000	//Sweeps between checkpoints (when a checkpoint file is given)
+
+#define PRINT_INTERVAL 1000				//Sweeps between progress reports of the cold chain
+#define LADDER_ADAPT_RATE 0.5			//Initial step size of the ladder adaptation
+#define LADDER_ADAPT_DECAY 100.0		//Rounds of swaps over which the step size halves
+#define SWAP_RATE_SMOOTHING 0.1			//Weight of each new swap attempt in the smoothed swap rate
+#define LADDER_TARGET_SWAP_RATE 0.25	//Average swap rate the span of the ladder is adapted towards
+#define LADDER_LOW_SWAP_RATE 0.01		//Swap rates below this after burn-in are warned of
+#define LADDER_MIN_SPAN 0.25			//Least span of the ladder, as a share of log(max_temperature)
+#define LADDER_MIN_GAP 0.2				//Least gap between neighbouring rungs, as a share of the even gap
+
+/************************************************
+* Structures describing a tempered run			*
+************************************************/
+
+struct sampler_settings
+{
+	int num_chains;			//One chain per rung of the ladder
+	int num_threads;		//Threads sharing the chains (default: one per core)
+	int case_threads;		//Threads sharing the date moves of each chain (0 for none) - if given, the
+							//chains take turns instead of running side by side
+	long num_sweeps;
+	long burn_in;
+	int swap_interval;
+	double max_temperature;
+	unsigned long seed;
+	char checkpoint_file[200];	//Where to save the state of the run ("" for no checkpoints)
+	long checkpoint_interval;	//Sweeps between checkpoints
+	char restart_file[200];		//Checkpoint to carry on from ("" to start a new run)
+	char trace_file[200];		//Where to record samples of the cold chain ("" for no trace)
+	long trace_interval;		//Sweeps between samples
+	char summary_file[200];		//Where to write the summary of every quantity ("" for none)
+	char spatial_file[200];		//Where to write the spatial pressure of the cold chain's last cases ("" for none)
+	char coords_file[200];		//Coordinates of the subregions ("" for none - each then only reaches itself)
+	double kernel_scale;		//Parameters of the spatial kernel (see Spatial_Kernel.h)
+	double kernel_exponent;
+	double field_tolerance;		//If above 0, the pressure is taken from a grid to this relative error (see Pressure_Field.h)
+	char renewal_file[200];		//Where to write the cold chain's expected onsets and diagnoses ("" for none - see Renewal.h)
+	int incidence;				//1 to keep every chain's incidence counts (see Incidence.h) - nothing in the run reads them
+	int quiet;					//1 to print nothing but errors, and log progress at debug level (for fits run side by side)
+	char live_name[100];		//Shared-memory segment the run publishes its progress to ("" for none - see Live_Ring.h)
+};
+
+//The ladder is spaced in log(temperature), from 0 (heat 1) to log(max_temperature) at first.
+//During burn-in the gaps are adjusted to give every neighbouring pair the same swap rate, and
+//the span is narrowed (or widened again, up to max_temperature) towards LADDER_TARGET_SWAP_RATE,
+//but never below LADDER_MIN_SPAN of log(max_temperature), and no gap below LADDER_MIN_GAP of the
+//even gap - otherwise a pair of chains that never swap shrinks the ladder onto heat 1.
+struct tempering_ladder
+{
+	int num_rungs;
+	double *heat;				//heat[r]: inverse temperature of rung r (heat[0] = 1)
+	double *log_gap;			//log_gap[r]: log(temperature) of rung r + 1 minus that of rung r
+	int *chain_on_rung;			//chain_on_rung[r]: which chain is currently at rung r
+	long *swaps_proposed;		//Between rung r and rung r + 1
+	long *swaps_accepted;
+	double *swap_rate;			//Smoothed acceptance rate of swaps between rung r and rung r + 1
+	long adaptations;			//Rounds of adaptation so far
+};
+
+struct sampler_run
+{
+	struct sampler_settings settings;
+	struct chain_state *chains;
+	struct tempering_ladder ladder;
+	struct mt_state rng;		//For swaps - each chain has its own stream for its moves
+	long sweeps_done;			//Sweeps made by every chain so far
+	int round_sweeps;			//Sweeps in the current round: swap_interval, or fewer to end at num_sweeps
+	long swap_rounds;
+	struct posterior_summary summary;	//Of the cold chain after burn-in, updated every sweep
+};
+
+/********************************************
+* Functions defined in Parallel_Tempering.c	*
+********************************************/
+
+void default_sampler_settings(struct sampler_settings *settings);
+void initialise_sampler_run(struct sampler_run *run, p_patient first, struct parameter_list *p_params,
+	struct sampler_settings *settings);
+void allocate_ladder(struct tempering_ladder *ladder, int num_rungs);
+void apply_ladder(struct sampler_run *run);
+void free_sampler_run(struct sampler_run *run);
+double run_gibbs_sampler(struct model_context *model, struct sampler_settings *settings);
+double resume_gibbs_sampler(struct model_context *model, struct sampler_settings *settings);
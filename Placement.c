@@ -0,0 +1,208 @@
+/********************************************************************************
+*	Placement.c																	*
+*	Huge pages, NUMA nodes and performance counters (see Placement.h).			*
+*	The kernel is asked directly (mbind, getcpu and perf_event_open system		*
+*		calls, and the node lists in /sys), so nothing needs linking beyond		*
+*		what the program already uses. On a machine with one node, or where		*
+*		a call is not allowed (e.g. in a container), placement falls back to	*
+*		what the kernel would do anyway.										*
+*	Memory.c maps the large blocks (mem_large) and calls place_mapping.			*
+********************************************************************************/
+
+//preprocessor directives
+#define _GNU_SOURCE						//For CPU sets
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For strtol
+#include <string.h>						//For strcmp and memset
+#include <sched.h>						//For binding threads to the CPUs of a node
+#include <unistd.h>						//For syscall
+#include <sys/syscall.h>				//For the system call numbers
+#include <sys/mman.h>					//For madvise
+#include <sys/ioctl.h>					//For starting the counters
+#include <linux/perf_event.h>			//For the performance events
+#include "Placement.h"					//For declarations of functions in this file
+
+//Memory policies and flags of mbind (as in numaif.h)
+#define MPOL_BIND 2
+#define MPOL_MF_MOVE (1 << 1)
+
+static int huge_pages = HUGE_PAGES_OFF;
+static int numa_on;
+static int nodes_found;					//0 until the nodes are counted
+static int counter_fd[PLACE_NUM_COUNTERS] = { -1, -1, -1, -1 };
+static const char *counter_names[PLACE_NUM_COUNTERS] = { "dTLB loads", "dTLB misses", "memory reads", "remote reads" };
+
+/*-------------------------------
+| settings						|
+-------------------------------*/
+
+//Mode as off, thp or explicit. Returns 0 if it is not understood.
+int set_huge_pages(const char *mode)
+{
+	if (strcmp(mode, "off") == 0) huge_pages = HUGE_PAGES_OFF;
+	else if (strcmp(mode, "thp") == 0) huge_pages = HUGE_PAGES_TRANSPARENT;
+	else if (strcmp(mode, "explicit") == 0) huge_pages = HUGE_PAGES_EXPLICIT;
+	else return 0;
+	return 1;
+}
+
+int huge_pages_mode()
+{
+	return huge_pages;
+}
+
+void set_numa_placement(int on)
+{
+	numa_on = on;
+}
+
+//1 if blocks are being spread over more than one node
+int numa_placement()
+{
+	return numa_on && num_nodes() > 1;
+}
+
+/*-------------------------------
+| nodes							|
+-------------------------------*/
+
+//Nodes with memory, from /sys (1 if it cannot be read)
+int num_nodes()
+{
+	FILE *list;
+	char path[80];
+
+	if (nodes_found) return nodes_found;
+	for (nodes_found = 0; nodes_found < PLACE_MAX_NODES; nodes_found++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes_found);
+		list = fopen(path, "r");
+		if (!list) break;
+		fclose(list);
+	}
+	if (nodes_found == 0) nodes_found = 1;
+	return nodes_found;
+}
+
+//Node of the CPU the calling thread is on now (0 if it cannot be told)
+int current_node()
+{
+	unsigned cpu, node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 || (int)node >= num_nodes()) return 0;
+	return (int)node;
+}
+
+//Home node of chain (or other numbered thing) index, if blocks are spread over nodes
+int node_for_index(int index)
+{
+	return numa_placement() ? index % num_nodes() : PLACE_ANY_NODE;
+}
+
+//Keeps the calling thread on the CPUs of node (from its cpulist, e.g. 0-15,32-47)
+void bind_thread_to_node(int node)
+{
+	FILE *list;
+	char path[80], text[4096], *p, *end;
+	long first, last, cpu;
+	cpu_set_t cpus;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	list = fopen(path, "r");
+	if (!list) return;
+	if (!fgets(text, sizeof(text), list)) text[0] = 0;
+	fclose(list);
+	CPU_ZERO(&cpus);
+	for (p = text; *p >= '0' && *p <= '9'; p = *end == ',' ? end + 1 : end) {
+		first = last = strtol(p, &end, 10);
+		if (*end == '-') last = strtol(end + 1, &end, 10);
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &cpus);
+	}
+	if (CPU_COUNT(&cpus) > 0) sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+//Asks for huge pages for a mapping, and binds it to node (unless PLACE_ANY_NODE). With move set, pages
+//already touched are moved there too.
+void place_mapping(void *start, size_t length, int node, int move)
+{
+	unsigned long mask[PLACE_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+
+	if (huge_pages != HUGE_PAGES_OFF) madvise(start, length, MADV_HUGEPAGE);
+	if (node == PLACE_ANY_NODE || node >= num_nodes()) return;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	syscall(SYS_mbind, start, length, MPOL_BIND, mask, (unsigned long)PLACE_MAX_NODES + 1, move ? MPOL_MF_MOVE : 0);
+}
+
+/*-------------------------------
+| performance counters			|
+-------------------------------*/
+
+static int open_counter(unsigned type, unsigned long long config)
+{
+	struct perf_event_attr event;
+
+	memset(&event, 0, sizeof(event));
+	event.size = sizeof(event);
+	event.type = type;
+	event.config = config;
+	event.disabled = 1;
+	event.inherit = 1;					//Threads started later are counted too
+	event.exclude_kernel = 1;
+	event.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &event, 0, -1, -1, 0);
+}
+
+//Starts counting for this thread and every thread it starts from now on - call before any pool is made
+void start_placement_counters()
+{
+	unsigned long long read_access = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+	unsigned long long read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	int c;
+
+	counter_fd[PLACE_DTLB_LOADS] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | read_access);
+	counter_fd[PLACE_DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | read_miss);
+	counter_fd[PLACE_NODE_LOADS] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE | read_access);
+	counter_fd[PLACE_REMOTE_LOADS] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE | read_miss);
+	for (c = 0; c < PLACE_NUM_COUNTERS; c++)
+		if (counter_fd[c] >= 0) ioctl(counter_fd[c], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+//Huge pages in use by the process, in kB (-1 if it cannot be read)
+static long anon_huge_kb()
+{
+	FILE *rollup;
+	char line[200];
+	long kb = -1;
+
+	rollup = fopen("/proc/self/smaps_rollup", "r");
+	if (!rollup) return -1;
+	while (fgets(line, sizeof(line), rollup))
+		if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+	fclose(rollup);
+	return kb;
+}
+
+//The placement asked for, the huge pages in use and the counters (those the kernel allows)
+void print_placement_report()
+{
+	long long value[PLACE_NUM_COUNTERS];
+	int c, counted = 0;
+
+	printf("Placement: %d NUMA node%s (%s), huge pages %s, %ld kB of transparent huge pages in use.\n", num_nodes(),
+		num_nodes() == 1 ? "" : "s", numa_placement() ? "blocks spread over them" : "not spread",
+		huge_pages == HUGE_PAGES_EXPLICIT ? "explicit" : huge_pages == HUGE_PAGES_TRANSPARENT ? "transparent" : "off",
+		anon_huge_kb());
+	for (c = 0; c < PLACE_NUM_COUNTERS; c++) {
+		value[c] = -1;
+		if (counter_fd[c] >= 0 && read(counter_fd[c], &value[c], sizeof(long long)) != sizeof(long long)) value[c] = -1;
+		if (value[c] >= 0) {
+			printf("\t%-14s%16lld\n", counter_names[c], value[c]);
+			counted++;
+		}
+	}
+	if (counted == 0) printf("\tNo performance counters (not supported, or perf_event_paranoid forbids them).\n");
+	if (value[PLACE_DTLB_LOADS] > 0 && value[PLACE_DTLB_MISSES] >= 0)
+		printf("\tdTLB miss rate %.4f%%\n", 100.0 * value[PLACE_DTLB_MISSES] / value[PLACE_DTLB_LOADS]);
+	if (value[PLACE_NODE_LOADS] > 0 && value[PLACE_REMOTE_LOADS] >= 0)
+		printf("\tRemote share of memory reads %.2f%%\n", 100.0 * value[PLACE_REMOTE_LOADS] / value[PLACE_NODE_LOADS]);
+}
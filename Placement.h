@@ -0,0 +1,43 @@
+/********************************************************************************
+*	Placement.h																	*
+*	Contains:																	*
+*		- Where the chains' blocks of cases go: on huge pages, transparent or	*
+*			reserved, and on which NUMA node									*
+*		- The machine's NUMA nodes, and the node a thread is running on			*
+*		- Counts of dTLB misses and of memory reads from this node and from		*
+*			others, from the kernel's performance events						*
+*		- Functions defined in Placement.c										*
+********************************************************************************/
+
+#define PLACE_ANY_NODE -1				//Wherever the kernel puts it (the node of the first thread to touch it)
+#define PLACE_MAX_NODES 64
+#define PLACE_MIN_LARGE (1 << 20)		//Smaller blocks stay with malloc, whatever the settings
+#define HUGE_PAGE_SIZE (2 << 20)
+
+//Huge pages for large blocks (-hugepages)
+#define HUGE_PAGES_OFF 0				//Ordinary pages
+#define HUGE_PAGES_TRANSPARENT 1		//Asked of the kernel with madvise, as it finds them
+#define HUGE_PAGES_EXPLICIT 2			//From the pool reserved in /proc/sys/vm/nr_hugepages, else as above
+
+//Performance events counted over the whole run
+#define PLACE_DTLB_LOADS 0
+#define PLACE_DTLB_MISSES 1
+#define PLACE_NODE_LOADS 2				//Reads that went to memory
+#define PLACE_REMOTE_LOADS 3			//...of which from another node
+#define PLACE_NUM_COUNTERS 4
+
+/****************************************
+* Functions defined in Placement.c		*
+****************************************/
+
+int set_huge_pages(const char *mode);
+int huge_pages_mode();
+void set_numa_placement(int on);
+int numa_placement();
+int num_nodes();
+int current_node();
+int node_for_index(int index);
+void bind_thread_to_node(int node);
+void place_mapping(void *start, size_t length, int node, int move);
+void start_placement_counters();
+void print_placement_report();
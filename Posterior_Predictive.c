@@ -0,0 +1,432 @@
+/********************************************************************************
+*	Posterior_Predictive.c														*
+*	Posterior predictive checks: for each draw of the parameters, R replicate	*
+*		outbreaks are run together, day by day. Each day every replicate		*
+*		draws its new exposures (Poisson, from the pressure of earlier			*
+*		exposures) and its diagnoses (Poisson, from earlier exposures thinned	*
+*		by p_diag), then spreads the new exposures' future pressure and			*
+*		diagnoses over the days ahead.											*
+*	A case's offspring are Poisson given its expected infectiousness on each	*
+*		day after exposure (the kernels), so the mean matches the event			*
+*		simulator but the spread between cases' durations is averaged out.		*
+*	Spreading a day's exposures over the days ahead, most of the work, uses		*
+*		GCC vector types, PREDICT_LANES replicates at a time - or goes			*
+*		replicate by replicate on days when fewer than 1 in PREDICT_SPARSE		*
+*		have exposures. The uniforms are drawn in bulk by a loop with no		*
+*		branches, which the compiler vectorises when optimising (-O2 and		*
+*		up, as built in the README). Only the Poisson draws go replicate by		*
+*		replicate.																*
+*	Index cases are placed as in ABC-SMC, in proportion to reported cases.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strcmp and memset
+#include <math.h>						//For exp, log and sqrt
+#include <time.h>						//For timing the batches
+#include "MTrandom.h"					//For seeding the replicates' generators
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For nb_log_pmf
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the model parameters
+#include "Trace.h"						//For reading posterior draws
+#include "Outbreak_Simulator.h"			//For timing the one-replicate-at-a-time path
+#include "Posterior_Predictive.h"		//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For progress
+
+/*-------------------------------
+| setting up					|
+-------------------------------*/
+
+void default_predictive_settings(struct predictive_settings *settings)
+{
+	settings->num_replicates = DEFAULT_PREDICT_REPLICATES;
+	settings->num_draws = DEFAULT_PREDICT_DRAWS;
+	settings->seed = 5489UL;
+	settings->draws_file[0] = 0;
+	settings->output_file[0] = 0;
+}
+
+//Chance of each duration from 0 to NUMDAYS - 1, and of each duration or more (tail[x] = P(X >= x))
+static void duration_pmf(struct parameter_list *p_params, int k, double *pmf, double *tail)
+{
+	int x;
+
+	for (x = 0; x < NUMDAYS; x++) pmf[x] = exp(nb_log_pmf(x, p_params->dur_mean[k], p_params->dur_size[k]));
+	tail[NUMDAYS - 1] = pmf[NUMDAYS - 1];
+	for (x = NUMDAYS - 2; x >= 0; x--) tail[x] = tail[x + 1] + pmf[x];
+}
+
+//Works out the kernels of the windows in infectious_window (Likelihood.c), taking every day a
+//after exposure in turn. Onset is 1 + incubation after exposure, the end 1 + infectious period
+//after onset, diagnosis a diagnosis delay after onset and burial a burial delay after the end.
+void predictive_kernels(struct parameter_list *p_params, struct predictive_kernels *kernels)
+{
+	double pmf[NUM_DURATIONS][NUMDAYS], tail[NUM_DURATIONS][NUMDAYS], end[NUMDAYS];
+	double p_diag = p_params->p_diag, p_fatal = 1 - p_params->p_survive;
+	double individual, hospital, burial, onset, diagnosis, largest = 0;
+	int k, a, d;
+
+	for (k = 0; k < NUM_DURATIONS; k++) duration_pmf(p_params, k, pmf[k], tail[k]);
+	for (a = 0; a < NUMDAYS; a++) {								//Chance the case ends on day a
+		end[a] = 0;
+		for (d = 2; d <= a; d++) end[a] += pmf[DUR_INCUBATION][d - 2] * pmf[DUR_INFECTIOUS][a - d];
+	}
+	for (a = 0; a < NUMDAYS; a++) {
+		individual = hospital = burial = diagnosis = 0;
+		for (d = 0; d < a; d++) {								//Onset on day a - d, d days before day a
+			onset = pmf[DUR_INCUBATION][a - d - 1];
+			individual += onset * tail[DUR_INFECTIOUS][d] * (1 - p_diag + p_diag * (d + 1 < NUMDAYS ? tail[DUR_DIAGNOSIS][d + 1] : 0));
+			hospital += onset * tail[DUR_INFECTIOUS][d] * p_diag * (1 - (d + 1 < NUMDAYS ? tail[DUR_DIAGNOSIS][d + 1] : 0));
+			diagnosis += onset * pmf[DUR_DIAGNOSIS][d];
+		}
+		for (d = 0; d <= a; d++)								//Ended on day a - d
+			if (d + 1 < NUMDAYS) burial += end[a - d] * tail[DUR_BURIAL][d + 1];
+		kernels->pressure[a] = (float)(p_params->beta[1] * individual + p_params->beta[2] * hospital + p_params->beta[3] * p_fatal * burial);
+		kernels->diagnosis[a] = (float)(p_diag * diagnosis);
+		if (kernels->pressure[a] > largest) largest = kernels->pressure[a];
+		if (kernels->diagnosis[a] > largest) largest = kernels->diagnosis[a];
+	}
+	for (kernels->length = NUMDAYS; kernels->length > 1; kernels->length--)
+		if (kernels->pressure[kernels->length - 1] > PREDICT_KERNEL_TAIL * largest
+			|| kernels->diagnosis[kernels->length - 1] > PREDICT_KERNEL_TAIL * largest) break;
+}
+
+static unsigned long long splitmix(unsigned long long *x)
+{
+	unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//Memory aligned for whole vectors of lanes (NULL if there is none)
+static void *lane_alloc(size_t size)
+{
+	return mem_aligned(MEM_SIMULATION, sizeof(lane_vector), size);
+}
+
+struct predictive_batch *create_predictive_batch(int num_replicates, int num_locations, const double *location_weights,
+	int num_days, unsigned long seed)
+{
+	struct predictive_batch *batch = (struct predictive_batch*)mem_calloc(MEM_SIMULATION, 1, sizeof(struct predictive_batch));
+	long cells;
+	double total = 0;
+	unsigned long long x;
+	struct mt_state rng;
+	int r, l;
+
+	if (!batch) { printf("Could not allocate batch in create_predictive_batch.\n"); exit(1); }
+	batch->num_replicates = num_replicates > 0 ? num_replicates : 1;
+	batch->num_lanes = (batch->num_replicates + PREDICT_LANES - 1) / PREDICT_LANES * PREDICT_LANES;
+	batch->num_locations = num_locations > 0 ? num_locations : 1;
+	batch->num_days = num_days < 1 ? 1 : num_days > NUMDAYS ? NUMDAYS : num_days;
+	cells = (long)batch->num_locations * batch->num_days;
+
+	batch->location_weights = (double*)mem_malloc(MEM_SIMULATION, batch->num_locations * sizeof(double));
+	batch->pressure = (float*)lane_alloc(cells * batch->num_lanes * sizeof(float));
+	batch->diagnosis_mean = (float*)lane_alloc(cells * batch->num_lanes * sizeof(float));
+	batch->exposures = (float*)lane_alloc(batch->num_lanes * sizeof(float));
+	batch->uniform = (float*)lane_alloc(batch->num_lanes * sizeof(float));
+	batch->rng0 = (unsigned long long*)lane_alloc(batch->num_lanes * sizeof(unsigned long long));
+	batch->rng1 = (unsigned long long*)lane_alloc(batch->num_lanes * sizeof(unsigned long long));
+	batch->histogram = (unsigned int*)mem_calloc(MEM_SIMULATION, cells * PREDICT_BINS, sizeof(unsigned int));
+	batch->sum = (double*)mem_calloc(MEM_SIMULATION, cells, sizeof(double));
+	if (!batch->location_weights || !batch->pressure || !batch->diagnosis_mean || !batch->exposures || !batch->uniform
+		|| !batch->rng0 || !batch->rng1 || !batch->histogram || !batch->sum) {
+		printf("Could not allocate batch arrays in create_predictive_batch.\n");
+		exit(1);
+	}
+
+	for (l = 0; l < batch->num_locations; l++) total += location_weights && num_locations > 0 ? location_weights[l] : 1;
+	for (l = 0; l < batch->num_locations; l++)
+		batch->location_weights[l] = total > 0 ? (location_weights && num_locations > 0 ? location_weights[l] : 1) / total
+			: 1.0 / batch->num_locations;
+
+	init_genrand_r(&rng, seed);									//Each replicate's generator seeded from one stream
+	x = ((unsigned long long)genrand_int32_r(&rng) << 32) | genrand_int32_r(&rng);
+	for (r = 0; r < batch->num_lanes; r++) {
+		batch->rng0[r] = splitmix(&x);
+		batch->rng1[r] = splitmix(&x) | 1;						//Never both zero
+	}
+	return batch;
+}
+
+void free_predictive_batch(struct predictive_batch *batch)
+{
+	mem_free(batch->location_weights);
+	mem_free(batch->pressure);
+	mem_free(batch->diagnosis_mean);
+	mem_free(batch->exposures);
+	mem_free(batch->uniform);
+	mem_free(batch->rng0);
+	mem_free(batch->rng1);
+	mem_free(batch->histogram);
+	mem_free(batch->sum);
+	mem_free(batch);
+}
+
+/*-------------------------------
+| simulating a batch			|
+-------------------------------*/
+
+//n uniform numbers in (0, 1), one step of each replicate's xorshift128+ generator
+static void fill_uniform(float *restrict u, unsigned long long *restrict s0, unsigned long long *restrict s1, int n)
+{
+	unsigned long long x, y;
+	int r;
+
+	for (r = 0; r < n; r++) {
+		x = s0[r];
+		y = s1[r];
+		s0[r] = y;
+		x ^= x << 23;
+		s1[r] = x ^ y ^ (x >> 17) ^ (y >> 26);
+		u[r] = ((float)(unsigned int)((s1[r] + y) >> 40) + 0.5f) * (1.0f / 16777216.0f);
+	}
+}
+
+//Poisson draw for replicate r from its uniform u, by inversion - or for large means by the normal
+//approximation, taking a second uniform from the replicate's generator
+static float poisson_from_uniform(struct predictive_batch *batch, int r, double mean, float u)
+{
+	double p, cumulative, k;
+	float v;
+
+	if (mean <= 0) return 0;
+	if (mean > PREDICT_INVERSION_LIMIT) {
+		if (mean > PREDICT_MAX_MEAN) mean = PREDICT_MAX_MEAN;
+		fill_uniform(&v, batch->rng0 + r, batch->rng1 + r, 1);
+		k = floor(mean + sqrt(mean) * sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * v) + 0.5);
+		return k > 0 ? (float)k : 0;
+	}
+	p = cumulative = exp(-mean);
+	for (k = 0; u > cumulative && k < 10 * PREDICT_INVERSION_LIMIT; ) {
+		k++;
+		p *= mean / k;
+		cumulative += p;
+	}
+	return (float)k;
+}
+
+//Histogram bin of a count
+static int count_bin(float count)
+{
+	int bin;
+
+	if (count < PREDICT_EXACT_COUNTS) return (int)count;
+	bin = PREDICT_EXACT_COUNTS + (int)(PREDICT_BINS_PER_DOUBLING * log2(count / PREDICT_EXACT_COUNTS));
+	return bin < PREDICT_BINS ? bin : PREDICT_BINS - 1;
+}
+
+//Smallest count in a bin
+static double bin_count(int bin)
+{
+	if (bin < PREDICT_EXACT_COUNTS) return bin;
+	return ceil(PREDICT_EXACT_COUNTS * pow(2, (double)(bin - PREDICT_EXACT_COUNTS) / PREDICT_BINS_PER_DOUBLING));
+}
+
+//Adds count times the kernels to the days ahead of every replicate, PREDICT_LANES replicates at a
+//time: pressure[a * n + r] += kernels->pressure[a] * count[r], and the same for diagnoses
+static void spread(float *pressure, float *diagnoses, struct predictive_kernels *kernels, const float *count, int days, int n)
+{
+	const lane_vector *counts = (const lane_vector*)count;
+	lane_vector *p, *d;
+	int a, r, lanes = n / PREDICT_LANES;
+	float weight, diagnosed;
+
+	for (a = 1; a < days; a++) {
+		weight = kernels->pressure[a];
+		diagnosed = kernels->diagnosis[a];
+		p = (lane_vector*)(pressure + (long)a * n);
+		d = (lane_vector*)(diagnoses + (long)a * n);
+		for (r = 0; r < lanes; r++) {
+			p[r] += weight * counts[r];
+			d[r] += diagnosed * counts[r];
+		}
+	}
+}
+
+//Adds count times the kernels to the days ahead of replicate r alone - for days when few replicates have exposures
+static void spread_replicate(float *pressure, float *diagnoses, struct predictive_kernels *kernels, float count, int days, int n, int r)
+{
+	int a;
+
+	for (a = 1; a < days; a++) {
+		pressure[(long)a * n + r] += kernels->pressure[a] * count;
+		diagnoses[(long)a * n + r] += kernels->diagnosis[a] * count;
+	}
+}
+
+//Runs every replicate of the batch over every day under p_params, adding each day's diagnoses to the histograms
+void simulate_predictive_batch(struct predictive_batch *batch, struct parameter_list *p_params)
+{
+	struct predictive_kernels kernels;
+	struct timespec start, finish;
+	int n = batch->num_lanes, days = batch->num_days, l, t, r, ahead, exposed;
+	long cell;
+	float *pressure, *diagnoses, *u = batch->uniform, *exposures = batch->exposures, count;
+	double zoonotic;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	predictive_kernels(p_params, &kernels);
+	memset(batch->pressure, 0, (long)batch->num_locations * days * n * sizeof(float));
+	memset(batch->diagnosis_mean, 0, (long)batch->num_locations * days * n * sizeof(float));
+
+	for (l = 0; l < batch->num_locations; l++) {
+		zoonotic = p_params->beta[0] * batch->location_weights[l];
+		for (t = 0; t < days; t++) {
+			cell = (long)l * days + t;
+			pressure = batch->pressure + cell * n;
+			diagnoses = batch->diagnosis_mean + cell * n;
+
+			//Today's exposures, and the pressure and diagnoses they bring on later days
+			fill_uniform(u, batch->rng0, batch->rng1, n);
+			exposed = 0;
+			for (r = 0; r < n; r++) {
+				exposures[r] = poisson_from_uniform(batch, r, zoonotic + pressure[r], u[r]);
+				exposed += exposures[r] > 0;
+			}
+			ahead = kernels.length < days - t ? kernels.length : days - t;
+			if (exposed * PREDICT_SPARSE >= n) spread(pressure, diagnoses, &kernels, exposures, ahead, n);
+			else if (exposed > 0) {
+				for (r = 0; r < n; r++)
+					if (exposures[r] > 0) spread_replicate(pressure, diagnoses, &kernels, exposures[r], ahead, n, r);
+			}
+
+			//Today's diagnoses (the lanes beyond the last replicate are not counted)
+			fill_uniform(u, batch->rng0, batch->rng1, n);
+			for (r = 0; r < batch->num_replicates; r++) {
+				count = poisson_from_uniform(batch, r, diagnoses[r], u[r]);
+				batch->histogram[cell * PREDICT_BINS + count_bin(count)]++;
+				batch->sum[cell] += count;
+			}
+		}
+	}
+	batch->runs += batch->num_replicates;
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	batch->seconds += (finish.tv_sec - start.tv_sec) + 1e-9 * (finish.tv_nsec - start.tv_nsec);
+}
+
+//Quantile q of the diagnoses at location on day, over every replicate so far (exact below
+//PREDICT_EXACT_COUNTS, then within about 9%)
+double predictive_quantile(struct predictive_batch *batch, int location, int day, double q)
+{
+	unsigned int *histogram = batch->histogram + ((long)location * batch->num_days + day) * PREDICT_BINS;
+	long rank = (long)(q * (batch->runs - 1)), seen = 0;
+	int bin;
+
+	for (bin = 0; bin < PREDICT_BINS; bin++) {
+		seen += histogram[bin];
+		if (seen > rank) return bin_count(bin);
+	}
+	return bin_count(PREDICT_BINS - 1);
+}
+
+/*-------------------------------
+| posterior predictive checks	|
+-------------------------------*/
+
+//Replicate-days per second of the event simulator, one replicate at a time
+static double event_simulator_rate(struct parameter_list *p_params, int num_locations, double *weights, int num_days)
+{
+	struct simulation sim;
+	struct simulation_settings sim_settings;
+	double seconds = 0;
+	int i;
+
+	default_simulation_settings(&sim_settings);
+	sim_settings.num_days = num_days;
+	sim_settings.num_locations = num_locations;
+	sim_settings.location_weights = weights;
+	init_simulation(&sim, p_params, &sim_settings);
+	for (i = 0; i < PREDICT_TIMING_RUNS; i++) {
+		restart_simulation(&sim, p_params, i + 1);
+		run_simulation(&sim);
+		seconds += sim.seconds;
+	}
+	free_simulation(&sim);
+	return seconds > 0 ? PREDICT_TIMING_RUNS * (double)num_days / seconds : 0;
+}
+
+//Simulates settings->num_replicates outbreaks for each draw (from the trace, or the starting
+//parameters alone) and writes the reported and predicted diagnoses of each subregion and day
+void run_posterior_predictive(struct current_case_report *reports, struct parameter_list *p_params,
+	struct predictive_settings *settings)
+{
+	struct predictive_batch *batch;
+	struct trace_reader *reader = NULL;
+	struct trace_sample sample;
+	struct parameter_list params = *p_params;
+	char (*names)[100];
+	double *weights;
+	int *reported;
+	int num_locations = 0, num_days = 1, num_draws = 1, r, l, t, d;
+	long num_samples = 0;
+	FILE *out;
+
+	//Subregions as in the reports, each with its reported cases on each day
+	names = (char(*)[100])mem_malloc(MEM_SIMULATION, (p_params->total_reports > 0 ? p_params->total_reports : 1) * sizeof(*names));
+	weights = (double*)mem_calloc(MEM_SIMULATION, p_params->total_reports > 0 ? p_params->total_reports : 1, sizeof(double));
+	if (!names || !weights) { printf("Could not allocate subregions in run_posterior_predictive.\n"); exit(1); }
+	for (r = 0; r < p_params->total_reports; r++) {
+		for (l = 0; l < num_locations; l++) if (strcmp(names[l], reports[r].subregion) == 0) break;
+		if (l == num_locations) strcpy(names[num_locations++], reports[r].subregion);
+		if (reports[r].cases > 0) weights[l] += reports[r].cases;
+		if (reports[r].date_ID + 1 > num_days) num_days = reports[r].date_ID + 1;
+	}
+	if (num_days > NUMDAYS) num_days = NUMDAYS;
+	if (num_locations == 0) strcpy(names[num_locations++], "all");
+	reported = (int*)mem_calloc(MEM_SIMULATION, (long)num_locations * num_days, sizeof(int));
+	if (!reported) { printf("Could not allocate reported cases in run_posterior_predictive.\n"); exit(1); }
+	for (r = 0; r < p_params->total_reports; r++) {
+		for (l = 0; strcmp(names[l], reports[r].subregion) != 0; l++);
+		if (reports[r].date_ID >= 0 && reports[r].date_ID < num_days && reports[r].cases > 0)
+			reported[(long)l * num_days + reports[r].date_ID] += reports[r].cases;
+	}
+
+	if (settings->draws_file[0]) {
+		reader = open_trace(settings->draws_file);
+		allocate_trace_sample(reader, &sample);
+		num_samples = trace_num_samples(reader);
+		num_draws = settings->num_draws < num_samples ? settings->num_draws : (int)num_samples;
+		if (num_draws < 1) { printf("There are no samples in %s.\n", settings->draws_file); exit(1); }
+	}
+	log_info(LOG_SIMULATION, "Posterior predictive: %d draws of %d replicates over %d subregions and %d days.",
+		num_draws, settings->num_replicates, num_locations, num_days);
+
+	batch = create_predictive_batch(settings->num_replicates, num_locations, weights, num_days, settings->seed);
+	for (d = 0; d < num_draws; d++) {
+		if (reader) {
+			read_trace_sample(reader, (long)((double)d * num_samples / num_draws), &sample);
+			trace_sample_parameters(&sample, &params);
+		}
+		simulate_predictive_batch(batch, &params);
+	}
+	log_info(LOG_SIMULATION, "\t%ld replicates in %.2f s: %.3g replicate-days per second (the event simulator, one at a time: %.3g)",
+		batch->runs, batch->seconds, batch->seconds > 0 ? batch->runs * (double)num_days / batch->seconds : 0,
+		event_simulator_rate(&params, num_locations, weights, num_days));
+
+	out = fopen(settings->output_file, "w");
+	if (!out) { printf("Could not open %s to write the predictions.\n", settings->output_file); exit(1); }
+	fprintf(out, "subregion,day,reported,mean,q2.5,q25,q50,q75,q97.5\n");
+	for (l = 0; l < num_locations; l++)
+		for (t = 0; t < num_days; t++)
+			fprintf(out, "%s,%d,%d,%g,%g,%g,%g,%g,%g\n", names[l], t, reported[(long)l * num_days + t],
+				batch->sum[(long)l * num_days + t] / batch->runs, predictive_quantile(batch, l, t, 0.025),
+				predictive_quantile(batch, l, t, 0.25), predictive_quantile(batch, l, t, 0.5),
+				predictive_quantile(batch, l, t, 0.75), predictive_quantile(batch, l, t, 0.975));
+	fclose(out);
+
+	if (reader) {
+		mem_free(sample.case_values);
+		close_trace(reader);
+	}
+	free_predictive_batch(batch);
+	mem_free(reported);
+	mem_free(weights);
+	mem_free(names);
+}
@@ -0,0 +1,84 @@
+/********************************************************************************
+*	Posterior_Predictive.h														*
+*	Contains:																	*
+*		- Settings and state of a batch of replicate outbreaks simulated side	*
+*			by side for posterior predictive checks: every array is laid out	*
+*			by replicate (structure of arrays), so each day's work runs down	*
+*			contiguous memory and vectorises across replicates					*
+*		- Functions defined in Posterior_Predictive.c							*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h,					*
+*		Gibbs_Sampler.h and Trace.h first.										*
+********************************************************************************/
+
+//Default settings (each can be changed on the command line)
+#define DEFAULT_PREDICT_REPLICATES 1000	//Replicates of every posterior draw
+#define DEFAULT_PREDICT_DRAWS 100		//Draws taken (evenly spaced) from a trace
+
+#define PREDICT_LANES 8					//Replicates in one vector (rounded up to whole vectors)
+#define PREDICT_SPARSE 16				//Days when fewer than 1 in this many replicates have exposures spread them replicate by replicate
+#define PREDICT_KERNEL_TAIL 1e-7		//Kernels end where they fall below this fraction of their largest value
+#define PREDICT_INVERSION_LIMIT 30.0	//Poisson draws with larger means use the normal approximation
+#define PREDICT_MAX_MEAN 1e7			//Means are capped here, so runaway replicates saturate
+#define PREDICT_EXACT_COUNTS 64			//Histogram bins below this hold one count each...
+#define PREDICT_BINS_PER_DOUBLING 8		//...and above it, bins are log spaced
+#define PREDICT_BINS 128
+#define PREDICT_TIMING_RUNS 20			//Runs of the event simulator timed for comparison
+
+/************************************************
+* Structures of a predictive batch				*
+************************************************/
+
+//PREDICT_LANES floats worked on together (GCC vector extension - split into narrower vectors where
+//the target has none this wide)
+typedef float lane_vector __attribute__((vector_size(PREDICT_LANES * sizeof(float))));
+
+struct predictive_settings
+{
+	int num_replicates;
+	int num_draws;
+	unsigned long seed;
+	char draws_file[200];		//Trace to take the draws from ("" for the starting parameters alone)
+	char output_file[200];		//Where the quantiles are written
+};
+
+//Expected infectiousness and diagnoses of a case at each day after its exposure, under one set of parameters
+struct predictive_kernels
+{
+	int length;					//Days after exposure covered (both kernels are 0 on day 0)
+	float pressure[NUMDAYS];	//Exposures caused per day, summed over individual, hospital and burial transmission
+	float diagnosis[NUMDAYS];	//Chance of being diagnosed that day
+};
+
+//Per-replicate arrays are indexed [... * num_replicates + replicate]
+struct predictive_batch
+{
+	int num_replicates;
+	int num_lanes;						//num_replicates rounded up to a whole number of vectors (R below)
+	int num_locations;
+	int num_days;
+	double *location_weights;			//Share of the zoonotic rate of each location
+	float *pressure;					//pressure[(location * num_days + day) * R + r]: expected exposures
+	float *diagnosis_mean;				//As pressure, for diagnoses
+	float *exposures;					//exposures[r]: today's draws
+	float *uniform;						//uniform[r]: today's random numbers
+	unsigned long long *rng0;			//rng0[r], rng1[r]: xorshift128+ state of each replicate
+	unsigned long long *rng1;
+	unsigned int *histogram;			//histogram[(location * num_days + day) * PREDICT_BINS + bin]: replicates
+	double *sum;						//sum[location * num_days + day]: diagnoses over all replicates
+	long runs;							//Replicates simulated so far
+	double seconds;
+};
+
+/************************************************
+* Functions defined in Posterior_Predictive.c	*
+************************************************/
+
+void default_predictive_settings(struct predictive_settings *settings);
+void predictive_kernels(struct parameter_list *p_params, struct predictive_kernels *kernels);
+struct predictive_batch *create_predictive_batch(int num_replicates, int num_locations, const double *location_weights,
+	int num_days, unsigned long seed);
+void simulate_predictive_batch(struct predictive_batch *batch, struct parameter_list *p_params);
+double predictive_quantile(struct predictive_batch *batch, int location, int day, double q);
+void free_predictive_batch(struct predictive_batch *batch);
+void run_posterior_predictive(struct current_case_report *reports, struct parameter_list *p_params,
+	struct predictive_settings *settings);
@@ -0,0 +1,434 @@
+/********************************************************************************
+*	Posterior_Summary.c															*
+*	Summarises the posterior as the cold chain runs, so the full trace never	*
+*		needs to be stored and post-processed. Every quantity keeps:			*
+*		- running moments (Welford), merged with Chan's formula					*
+*		- a quantile sketch with a fixed relative error (log-spaced buckets,	*
+*			as in DDSketch), merged by adding bucket counts						*
+*		- batch means, for the effective sample size and split R-hat. When		*
+*			all NUM_BATCHES batches are full, pairs merge and the batch size	*
+*			doubles, so memory stays fixed however long the run.				*
+*	Moments and sketches merge across threads, chains or runs. Batches follow	*
+*		one chain each - split_r_hat compares the batches of several chains.	*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strcmp
+#include <math.h>						//For log, pow and sqrt
+#include "MTrandom.h"					//For the random number streams of the chains
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood cache of the chains
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Posterior_Summary.h"			//For structures and declarations of functions needed in this file
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Log.h"							//For progress
+
+#define SKETCH_GAMMA ((1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY))
+
+/*-------------------------------
+| running moments				|
+-------------------------------*/
+
+void add_moments(struct running_moments *moments, double x)
+{
+	double delta;
+
+	if (moments->count == 0 || x < moments->min) moments->min = x;
+	if (moments->count == 0 || x > moments->max) moments->max = x;
+	moments->count++;
+	delta = x - moments->mean;
+	moments->mean += delta / moments->count;
+	moments->m2 += delta * (x - moments->mean);
+}
+
+void merge_moments(struct running_moments *into, struct running_moments *from)
+{
+	long count = into->count + from->count;
+	double delta = from->mean - into->mean;
+
+	if (from->count == 0) return;
+	if (into->count == 0) { *into = *from; return; }
+	into->m2 += from->m2 + delta * delta * into->count * from->count / count;
+	into->mean += delta * from->count / count;
+	if (from->min < into->min) into->min = from->min;
+	if (from->max > into->max) into->max = from->max;
+	into->count = count;
+}
+
+/*-------------------------------
+| quantile sketch				|
+-------------------------------*/
+
+//Adds count values with the given key to store (0 positive, 1 negative). The store covers
+//SKETCH_BUCKETS consecutive keys - it slides to take new keys, and if it cannot, the smallest
+//magnitudes are merged into its lowest bucket.
+static void add_to_store(struct quantile_sketch *sketch, int store, int key, long count)
+{
+	long *bucket = sketch->bucket[store];
+	long lowest;
+	int low, high, shift, b;
+
+	if (sketch->filled[store] == 0) sketch->low_key[store] = key - SKETCH_BUCKETS / 2;	//Room either side
+	low = sketch->low_key[store];
+	if (key < low) {
+		for (high = SKETCH_BUCKETS - 1; bucket[high] == 0; high--);
+		shift = low - key;
+		if (high + shift >= SKETCH_BUCKETS) shift = SKETCH_BUCKETS - 1 - high;
+		if (shift > 0) {
+			memmove(bucket + shift, bucket, (SKETCH_BUCKETS - shift) * sizeof(long));
+			memset(bucket, 0, shift * sizeof(long));
+			low -= shift;
+		}
+		if (key < low) key = low;
+	}
+	else if (key >= low + SKETCH_BUCKETS) {
+		shift = key - (low + SKETCH_BUCKETS - 1);
+		if (shift >= SKETCH_BUCKETS) {
+			memset(bucket, 0, SKETCH_BUCKETS * sizeof(long));
+			bucket[0] = sketch->filled[store];
+		}
+		else {
+			for (lowest = 0, b = 0; b <= shift; b++) lowest += bucket[b];
+			memmove(bucket, bucket + shift, (SKETCH_BUCKETS - shift) * sizeof(long));
+			memset(bucket + SKETCH_BUCKETS - shift, 0, shift * sizeof(long));
+			bucket[0] = lowest;
+		}
+		low += shift;
+	}
+	sketch->low_key[store] = low;
+	bucket[key - low] += count;
+	sketch->filled[store] += count;
+}
+
+void add_to_sketch(struct quantile_sketch *sketch, double x)
+{
+	sketch->count++;
+	if (fabs(x) < SKETCH_ZERO) sketch->zeros++;
+	else add_to_store(sketch, x < 0, (int)ceil(log(fabs(x)) / log(SKETCH_GAMMA)), 1);
+}
+
+void merge_sketches(struct quantile_sketch *into, struct quantile_sketch *from)
+{
+	int store, b;
+
+	for (store = 0; store < 2; store++)
+		for (b = 0; b < SKETCH_BUCKETS; b++)
+			if (from->bucket[store][b]) add_to_store(into, store, from->low_key[store] + b, from->bucket[store][b]);
+	into->zeros += from->zeros;
+	into->count += from->count;
+}
+
+static double bucket_value(int key)
+{
+	return 2 * pow(SKETCH_GAMMA, key) / (SKETCH_GAMMA + 1);
+}
+
+//The q-quantile (0 <= q <= 1), to within SKETCH_ACCURACY of its size
+double sketch_quantile(struct quantile_sketch *sketch, double q)
+{
+	long rank, seen = 0;
+	int b;
+
+	if (sketch->count == 0) return 0;
+	rank = (long)(q * (sketch->count - 1));
+	for (b = SKETCH_BUCKETS - 1; b >= 0; b--) {		//Negative values, largest magnitude first
+		seen += sketch->bucket[1][b];
+		if (seen > rank) return -bucket_value(sketch->low_key[1] + b);
+	}
+	seen += sketch->zeros;
+	if (seen > rank) return 0;
+	for (b = 0; b < SKETCH_BUCKETS; b++) {
+		seen += sketch->bucket[0][b];
+		if (seen > rank) return bucket_value(sketch->low_key[0] + b);
+	}
+	return bucket_value(sketch->low_key[0] + SKETCH_BUCKETS - 1);
+}
+
+/*-------------------------------
+| batch means					|
+-------------------------------*/
+
+void add_to_batches(struct batch_means *batches, double x)
+{
+	int j;
+
+	if (batches->batch_size == 0) batches->batch_size = 1;
+	batches->partial_sum += x;
+	batches->partial_sum2 += x * x;
+	if (++batches->in_batch < batches->batch_size) return;
+
+	batches->sum[batches->num_batches] = batches->partial_sum;
+	batches->sum2[batches->num_batches] = batches->partial_sum2;
+	batches->num_batches++;
+	batches->in_batch = 0;
+	batches->partial_sum = batches->partial_sum2 = 0;
+	if (batches->num_batches == NUM_BATCHES) {
+		for (j = 0; j < NUM_BATCHES / 2; j++) {
+			batches->sum[j] = batches->sum[2 * j] + batches->sum[2 * j + 1];
+			batches->sum2[j] = batches->sum2[2 * j] + batches->sum2[2 * j + 1];
+		}
+		batches->num_batches = NUM_BATCHES / 2;
+		batches->batch_size *= 2;
+	}
+}
+
+//Mean and variance of the values in batches [first, first + count)
+static void batch_range_moments(struct batch_means *batches, int first, int count, double *mean, double *variance)
+{
+	double sum = 0, sum2 = 0, n = (double)count * batches->batch_size;
+	int j;
+
+	for (j = first; j < first + count; j++) {
+		sum += batches->sum[j];
+		sum2 += batches->sum2[j];
+	}
+	*mean = sum / n;
+	*variance = n > 1 ? (sum2 - n * *mean * *mean) / (n - 1) : 0;
+	if (*variance < 0) *variance = 0;
+}
+
+//Effective sample size of the complete batches: n * (variance of the values) / (batch size * variance
+//of the batch means). 0 if there are too few batches to tell.
+double batch_ess(struct batch_means *batches)
+{
+	int j, b = batches->num_batches;
+	double mean, variance, batch_variance = 0, y;
+
+	if (b < 4) return 0;
+	batch_range_moments(batches, 0, b, &mean, &variance);
+	for (j = 0; j < b; j++) {
+		y = batches->sum[j] / batches->batch_size - mean;
+		batch_variance += y * y;
+	}
+	batch_variance /= b - 1;
+	if (batch_variance <= 0) return (double)b * batches->batch_size;		//Constant: every value is independent
+	return b * variance / batch_variance;
+}
+
+//Split R-hat (Gelman et al.) of several chains, each split into halves of equal numbers of complete
+//batches. 0 if any chain has too few batches.
+double split_r_hat(struct batch_means **chains, int num_chains)
+{
+	int c, h, half;
+	double n = 0, mean, variance, W = 0, B = 0, grand = 0, means[2 * 64], chain_n;
+
+	if (num_chains < 1 || num_chains > 64) return 0;
+	for (c = 0; c < num_chains; c++) {
+		if (chains[c]->num_batches < 2) return 0;
+		chain_n = (double)(chains[c]->num_batches / 2) * chains[c]->batch_size;
+		if (c == 0 || chain_n < n) n = chain_n;
+	}
+	for (c = 0; c < num_chains; c++) {
+		half = chains[c]->num_batches / 2;
+		for (h = 0; h < 2; h++) {
+			batch_range_moments(chains[c], h * half, half, &mean, &variance);
+			means[2 * c + h] = mean;
+			grand += mean;
+			W += variance;
+		}
+	}
+	grand /= 2 * num_chains;
+	W /= 2 * num_chains;
+	for (c = 0; c < 2 * num_chains; c++) B += (means[c] - grand) * (means[c] - grand);
+	B *= n / (2 * num_chains - 1);
+	if (W <= 0) return B > 0 ? INFINITY : 1;
+	return sqrt(((n - 1) / n * W + B / n) / W);
+}
+
+/*-------------------------------
+| summaries of a chain			|
+-------------------------------*/
+
+//Sets up the quantities of chain's cases - subregions are numbered in the order they are first met
+void init_posterior_summary(struct posterior_summary *summary, struct chain_state *chain)
+{
+	int i, s;
+
+	summary->num_cases = chain->num_observed;
+	summary->num_subregions = 0;
+	summary->subregion_name = (char(*)[100])mem_malloc(MEM_SAMPLER, chain->num_observed * sizeof(*summary->subregion_name));
+	summary->case_subregion = (int*)mem_malloc(MEM_SAMPLER, chain->num_observed * sizeof(int));
+	summary->subregion_cases = (int*)mem_calloc(MEM_SAMPLER, chain->num_observed, sizeof(int));
+	if (!summary->subregion_name || !summary->case_subregion || !summary->subregion_cases) {
+		printf("Could not allocate subregions in init_posterior_summary.\n");
+		exit(1);
+	}
+	for (i = 0; i < chain->num_observed; i++) {
+		for (s = 0; s < summary->num_subregions; s++)
+			if (strcmp(summary->subregion_name[s], chain->cases[i].subregion) == 0) break;
+		if (s == summary->num_subregions) {
+			strcpy(summary->subregion_name[s], chain->cases[i].subregion);
+			summary->num_subregions++;
+		}
+		summary->case_subregion[i] = s;
+		summary->subregion_cases[s]++;
+	}
+
+	summary->num_quantities = SUMMARY_SUBREGIONS + 2 * summary->num_subregions;
+	summary->quantity = (struct quantity_summary*)mem_calloc(MEM_SAMPLER, summary->num_quantities, sizeof(struct quantity_summary));
+	summary->scratch = (int*)mem_malloc(MEM_SAMPLER, summary->num_quantities * sizeof(int));
+	if (!summary->quantity || !summary->scratch) {
+		printf("Could not allocate quantities in init_posterior_summary.\n");
+		exit(1);
+	}
+}
+
+void free_posterior_summary(struct posterior_summary *summary)
+{
+	mem_free(summary->subregion_name);
+	mem_free(summary->case_subregion);
+	mem_free(summary->subregion_cases);
+	mem_free(summary->scratch);
+	mem_free(summary->quantity);
+}
+
+static void add_value(struct quantity_summary *quantity, double x)
+{
+	add_moments(&quantity->moments, x);
+	add_to_sketch(&quantity->sketch, x);
+	add_to_batches(&quantity->batches, x);
+}
+
+//Adds the current state of chain (which must be at heat 1) to every quantity
+void record_posterior_sample(struct posterior_summary *summary, struct chain_state *chain)
+{
+	struct parameter_list *p = &chain->params;
+	struct quantity_summary *quantity = summary->quantity;
+	int *count = summary->scratch;
+	int *index_cases = count + SUMMARY_SUBREGIONS;
+	int *offspring = index_cases + summary->num_subregions;
+	int i, k, s, d;
+	p_patient current;
+
+	add_value(&quantity[0], chain->log_lik);
+	add_value(&quantity[1], chain->log_prior);
+	for (k = 0; k < 4; k++) {
+		add_value(&quantity[2 + k], p->beta[k]);
+		add_value(&quantity[6 + k], p->dur_mean[k]);
+		add_value(&quantity[10 + k], p->dur_size[k]);
+	}
+	add_value(&quantity[14], p->p_diag);
+	add_value(&quantity[15], p->p_survive);
+	add_value(&quantity[SUMMARY_UNOBSERVED], chain->num_cases - chain->num_observed);
+
+	//scratch holds exposures per day, then index cases and offspring per subregion
+	memset(count, 0, summary->num_quantities * sizeof(int));
+	for (i = 0; i < chain->num_cases; i++) {
+		current = &chain->cases[i];
+		d = current->dates[0];
+		if (d >= 0 && d < NUMDAYS) count[SUMMARY_EXPOSURES + d]++;
+		if (i >= chain->num_observed) continue;
+		s = summary->case_subregion[i];
+		if (current->parent_case == NULL) index_cases[s]++;
+		offspring[s] += current->secondary_cases;
+	}
+	for (d = 0; d < NUMDAYS; d++) add_value(&quantity[SUMMARY_EXPOSURES + d], count[SUMMARY_EXPOSURES + d]);
+	for (s = 0; s < summary->num_subregions; s++) {
+		add_value(&quantity[SUMMARY_SUBREGIONS + s], index_cases[s]);
+		add_value(&quantity[SUMMARY_SUBREGIONS + summary->num_subregions + s],
+			(double)offspring[s] / summary->subregion_cases[s]);
+	}
+}
+
+//Adds the moments and sketches of from (a summary of the same cases) to into. The batches of
+//into are kept as they are - use split_r_hat to compare chains.
+void merge_posterior_summary(struct posterior_summary *into, struct posterior_summary *from)
+{
+	int q;
+
+	if (into->num_quantities != from->num_quantities) {
+		printf("Summaries of different cases cannot be merged.\n");
+		exit(1);
+	}
+	for (q = 0; q < into->num_quantities; q++) {
+		merge_moments(&into->quantity[q].moments, &from->quantity[q].moments);
+		merge_sketches(&into->quantity[q].sketch, &from->quantity[q].sketch);
+	}
+}
+
+/*-------------------------------
+| output						|
+-------------------------------*/
+
+//Writes the name of quantity q into name (at least 140 characters) and returns it
+const char *summary_quantity_name(struct posterior_summary *summary, int q, char *name)
+{
+	const char *value_names[NUM_SUMMARY_VALUES] = { "log_lik", "log_prior", "beta0", "beta1", "beta2", "beta3",
+		"dur_mean0", "dur_mean1", "dur_mean2", "dur_mean3", "dur_size0", "dur_size1", "dur_size2", "dur_size3",
+		"p_diag", "p_survive", "unobserved" };
+
+	if (q < NUM_SUMMARY_VALUES) strcpy(name, value_names[q]);
+	else if (q < SUMMARY_SUBREGIONS) sprintf(name, "exposures_day_%d", q - SUMMARY_EXPOSURES);
+	else if (q < SUMMARY_SUBREGIONS + summary->num_subregions)
+		sprintf(name, "index_cases_%s", summary->subregion_name[q - SUMMARY_SUBREGIONS]);
+	else sprintf(name, "offspring_%s", summary->subregion_name[q - SUMMARY_SUBREGIONS - summary->num_subregions]);
+	return name;
+}
+
+//Quantile from the sketch, kept within the smallest and largest values seen
+static double summary_quantile(struct quantity_summary *quantity, double q)
+{
+	double x = sketch_quantile(&quantity->sketch, q);
+
+	if (x < quantity->moments.min) return quantity->moments.min;
+	if (x > quantity->moments.max) return quantity->moments.max;
+	return x;
+}
+
+static double summary_sd(struct quantity_summary *quantity)
+{
+	return quantity->moments.count > 1 ? sqrt(quantity->moments.m2 / (quantity->moments.count - 1)) : 0;
+}
+
+//Prints the parameters and likelihood
+void print_posterior_summary(struct posterior_summary *summary)
+{
+	int q;
+	char name[140];
+	struct quantity_summary *quantity;
+	struct batch_means *batches;
+
+	if (summary->quantity[0].moments.count == 0) return;
+	printf("Posterior summary of %ld sweeps of the cold chain:\n", summary->quantity[0].moments.count);
+	printf("\t%-10s %12s %12s %12s %12s %12s %8s %7s\n", "", "mean", "sd", "2.5%", "50%", "97.5%", "ESS", "R-hat");
+	for (q = 0; q < NUM_SUMMARY_VALUES; q++) {
+		quantity = &summary->quantity[q];
+		batches = &quantity->batches;
+		printf("\t%-10s %12.5g %12.5g %12.5g %12.5g %12.5g %8.1f %7.3f\n", summary_quantity_name(summary, q, name),
+			quantity->moments.mean, summary_sd(quantity), summary_quantile(quantity, 0.025),
+			summary_quantile(quantity, 0.5), summary_quantile(quantity, 0.975), batch_ess(batches),
+			split_r_hat(&batches, 1));
+	}
+}
+
+//Writes every quantity to a CSV file
+void write_posterior_summary(struct posterior_summary *summary, const char *file_name)
+{
+	FILE *output;
+	int q;
+	char name[140];
+	struct quantity_summary *quantity;
+	struct batch_means *batches;
+	unsigned long long ticks = profile_start();
+
+	output = fopen(file_name, "w");
+	if (output == NULL) { log_error(LOG_SAMPLER, "Summary file %s could not be opened.", file_name); return; }
+	fprintf(output, "quantity,samples,mean,sd,min,q2.5,q25,q50,q75,q97.5,max,ess,split_r_hat\n");
+	for (q = 0; q < summary->num_quantities; q++) {
+		quantity = &summary->quantity[q];
+		batches = &quantity->batches;
+		fprintf(output, "\"%s\",%ld,%.8g,%.8g,%.8g,%.8g,%.8g,%.8g,%.8g,%.8g,%.8g,%.1f,%.4f\n",
+			summary_quantity_name(summary, q, name), quantity->moments.count, quantity->moments.mean,
+			summary_sd(quantity), quantity->moments.min, summary_quantile(quantity, 0.025),
+			summary_quantile(quantity, 0.25), summary_quantile(quantity, 0.5),
+			summary_quantile(quantity, 0.75), summary_quantile(quantity, 0.975),
+			quantity->moments.max, batch_ess(batches), split_r_hat(&batches, 1));
+	}
+	fclose(output);
+	profile_stop(PROF_SUMMARY_IO, ticks);
+	log_info(LOG_SAMPLER, "Wrote summaries of %d quantities to %s.", summary->num_quantities, file_name);
+}
@@ -0,0 +1,101 @@
+/********************************************************************************
+*	Posterior_Summary.h															*
+*	Contains:																	*
+*		- Streaming summaries of the posterior, updated every sweep of the		*
+*			cold chain in fixed memory per quantity: running moments, a			*
+*			mergeable quantile sketch, and batch means for the effective		*
+*			sample size and split R-hat											*
+*		- Functions defined in Posterior_Summary.c								*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h and				*
+*		Gibbs_Sampler.h first.													*
+********************************************************************************/
+
+#define SKETCH_BUCKETS 1024		//Buckets for each sign - beyond a range of ~27000 the smallest values merge
+#define SKETCH_ACCURACY 0.005		//Relative error of every quantile
+#define SKETCH_ZERO 1e-300			//Magnitudes below this count as zero
+#define NUM_BATCHES 64				//Batches kept for batch means - pairs merge when they fill
+
+//Quantities summarised, in order: the parameters and likelihood (as in a trace) and the number
+//of unobserved cases, the cases exposed on each day, then for each subregion the observed index
+//(zoonotic) cases and the mean number of secondary cases per observed case
+#define NUM_SUMMARY_VALUES 17
+#define SUMMARY_UNOBSERVED 16
+#define SUMMARY_EXPOSURES NUM_SUMMARY_VALUES
+#define SUMMARY_SUBREGIONS (NUM_SUMMARY_VALUES + NUMDAYS)
+
+/************************************************
+* Structures of a summary						*
+************************************************/
+
+//Welford's running mean and sum of squared deviations
+struct running_moments
+{
+	long count;
+	double mean;
+	double m2;
+	double min;
+	double max;
+};
+
+//Log-spaced buckets (key k holds magnitudes in (g^(k-1), g^k], g = (1 + a)/(1 - a)), one store for
+//positive values and one for negative ones. Sketches merge by adding bucket counts.
+struct quantile_sketch
+{
+	long count;
+	long zeros;
+	int low_key[2];					//Key of bucket 0 of each store ([0] positive, [1] negative)
+	long filled[2];					//Values in each store
+	long bucket[2][SKETCH_BUCKETS];
+};
+
+//Sums (and sums of squares) of consecutive batches of batch_size values
+struct batch_means
+{
+	long batch_size;
+	int num_batches;				//Complete batches
+	long in_batch;					//Values in the batch being filled
+	double partial_sum;
+	double partial_sum2;
+	double sum[NUM_BATCHES];
+	double sum2[NUM_BATCHES];
+};
+
+struct quantity_summary
+{
+	struct running_moments moments;
+	struct quantile_sketch sketch;
+	struct batch_means batches;
+};
+
+struct posterior_summary
+{
+	int num_quantities;
+	int num_subregions;
+	int num_cases;
+	char (*subregion_name)[100];	//subregion_name[s]
+	int *case_subregion;			//case_subregion[i]: subregion of observed case i of the chain's block
+	int *subregion_cases;			//subregion_cases[s]: cases in subregion s
+	int *scratch;					//One count per quantity, reused every sweep
+	struct quantity_summary *quantity;
+};
+
+/********************************************
+* Functions defined in Posterior_Summary.c	*
+********************************************/
+
+void add_moments(struct running_moments *moments, double x);
+void merge_moments(struct running_moments *into, struct running_moments *from);
+void add_to_sketch(struct quantile_sketch *sketch, double x);
+void merge_sketches(struct quantile_sketch *into, struct quantile_sketch *from);
+double sketch_quantile(struct quantile_sketch *sketch, double q);
+void add_to_batches(struct batch_means *batches, double x);
+double batch_ess(struct batch_means *batches);
+double split_r_hat(struct batch_means **chains, int num_chains);
+
+void init_posterior_summary(struct posterior_summary *summary, struct chain_state *chain);
+void free_posterior_summary(struct posterior_summary *summary);
+void record_posterior_sample(struct posterior_summary *summary, struct chain_state *chain);
+void merge_posterior_summary(struct posterior_summary *into, struct posterior_summary *from);
+const char *summary_quantity_name(struct posterior_summary *summary, int q, char *name);
+void print_posterior_summary(struct posterior_summary *summary);
+void write_posterior_summary(struct posterior_summary *summary, const char *file_name);
@@ -0,0 +1,328 @@
+/********************************************************************************
+*	Pressure_Field.c															*
+*	Grid approximation of the spatial kernel's pressure (see Pressure_Field.h).	*
+*	Each source is shared between the four nodes around it (cloud in cell),		*
+*		the grid is convolved with the kernel by 2D FFTs (radix 2, padded to	*
+*		twice the nodes so it never wraps), and pressure at a point is the		*
+*		bilinear interpolation of the four nodes around it.						*
+*	Near a point the grid is poor, so the sources in the cells around it are	*
+*		added exactly, and their part of the grid - the same sharing and		*
+*		interpolation through a table of the kernel at small node offsets -		*
+*		is taken off. That part cancels exactly, so the error is only that of	*
+*		far sources, where the kernel is smooth on the scale of a cell.			*
+*	Sizes: relative curvature of the kernel at distance r is about				*
+*		(exponent + 1)^2 / r^2, and spreading plus interpolation err by about	*
+*		cell^2 / 8 times the curvature, so a near field of						*
+*		(exponent + 1) / sqrt(8 tolerance) cells keeps within the tolerance.	*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memset
+#include <math.h>						//For log, exp, sqrt and floor
+#include <complex.h>					//For the FFTs
+#include "FFT.h"						//For the transforms themselves
+#include "Date_And_Reading_Reports.h"	//For NUMDAYS
+#include "Spatial_Kernel.h"				//For the subregions and their coordinates
+#include "Pressure_Field.h"				//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+
+#define NEAR_TABLE(field) ((field)->near_cells + 3)		//Node offsets 0 to near_cells + 2 either way
+
+static double kernel_at(struct pressure_field *field, double distance)
+{
+	return 1.0 / (1.0 + pow(distance / field->scale, field->exponent));
+}
+
+/*-------------------------------
+| 2D FFT						|
+-------------------------------*/
+
+//Rows (px long) in place, then columns through the scratch column
+static void fft_2d(struct pressure_field *field, double _Complex *grid, int inverse)
+{
+	int x, y;
+
+	for (y = 0; y < field->py; y++) fft(&grid[(long)y * field->px], field->px, field->twiddle_x, inverse);
+	for (x = 0; x < field->px; x++) {
+		for (y = 0; y < field->py; y++) field->column[y] = grid[(long)y * field->px + x];
+		fft(field->column, field->py, field->twiddle_y, inverse);
+		for (y = 0; y < field->py; y++) grid[(long)y * field->px + x] = field->column[y];
+	}
+}
+
+/*-------------------------------
+| setting up					|
+-------------------------------*/
+
+//The area should hold every source and every point the pressure is wanted at
+void init_pressure_field(struct pressure_field *field, double x_min, double x_max, double y_min, double y_max,
+	double scale, double exponent, double tolerance)
+{
+	double extent = x_max - x_min > y_max - y_min ? x_max - x_min : y_max - y_min;
+	long nodes;
+
+	memset(field, 0, sizeof(struct pressure_field));
+	field->scale = scale;
+	field->exponent = exponent;
+	field->tolerance = tolerance > 0 ? tolerance : DEFAULT_FIELD_TOLERANCE;
+	field->near_cells = (int)ceil((exponent + 1.0) / sqrt(8.0 * field->tolerance));
+	if (field->near_cells < 2) field->near_cells = 2;
+	if (field->near_cells > FIELD_MAX_NEAR_CELLS) field->near_cells = FIELD_MAX_NEAR_CELLS;
+	field->cell = scale / 2;										//Finer than this gains nothing...
+	if (extent / (FIELD_MAX_NODES - 3) > field->cell) field->cell = extent / (FIELD_MAX_NODES - 3);	//...and coarser keeps the grid in bounds
+	field->x0 = x_min - field->cell;
+	field->y0 = y_min - field->cell;
+	field->nx = (int)ceil((x_max - x_min) / field->cell) + 3;
+	field->ny = (int)ceil((y_max - y_min) / field->cell) + 3;
+	field->px = fft_size(2 * field->nx);
+	field->py = fft_size(2 * field->ny);
+	nodes = (long)field->px * field->py;
+
+	field->kernel_hat = (double _Complex*)mem_malloc(MEM_SPATIAL, nodes * sizeof(double _Complex));
+	field->grid = (double _Complex*)mem_malloc(MEM_SPATIAL, nodes * sizeof(double _Complex));
+	field->twiddle_x = (double _Complex*)mem_malloc(MEM_SPATIAL, field->px * sizeof(double _Complex));
+	field->twiddle_y = (double _Complex*)mem_malloc(MEM_SPATIAL, field->py * sizeof(double _Complex));
+	field->column = (double _Complex*)mem_malloc(MEM_SPATIAL, field->py * sizeof(double _Complex));
+	field->cell_start = (int*)mem_malloc(MEM_SPATIAL, ((long)field->nx * field->ny + 1) * sizeof(int));
+	field->near_table = (double*)mem_malloc(MEM_SPATIAL, NEAR_TABLE(field) * NEAR_TABLE(field) * sizeof(double));
+	if (!field->kernel_hat || !field->grid || !field->twiddle_x || !field->twiddle_y || !field->column || !field->cell_start
+		|| !field->near_table) {
+		printf("Could not allocate a grid of %d by %d in init_pressure_field.\n", field->px, field->py);
+		exit(1);
+	}
+	fft_twiddles(field->twiddle_x, field->px);
+	fft_twiddles(field->twiddle_y, field->py);
+	field->stale = 1;
+}
+
+//Only marks the kernel stale - it is transformed again at the next load_field_sources
+void set_field_kernel(struct pressure_field *field, double scale, double exponent)
+{
+	if (scale == field->scale && exponent == field->exponent) return;
+	field->scale = scale;
+	field->exponent = exponent;
+	field->stale = 1;
+}
+
+//The kernel at every node offset, wrapped so negative offsets sit at the end, transformed, and
+//the table of it at the small offsets the near field uses
+static void transform_kernel(struct pressure_field *field)
+{
+	int x, y, dx, dy;
+
+	for (y = 0; y < NEAR_TABLE(field); y++)
+		for (x = 0; x < NEAR_TABLE(field); x++)
+			field->near_table[y * NEAR_TABLE(field) + x] = kernel_at(field, field->cell * sqrt((double)x * x + (double)y * y));
+
+	for (y = 0; y < field->py; y++) {
+		dy = y < field->py / 2 ? y : y - field->py;
+		for (x = 0; x < field->px; x++) {
+			dx = x < field->px / 2 ? x : x - field->px;
+			field->kernel_hat[(long)y * field->px + x] = kernel_at(field, field->cell * sqrt((double)dx * dx + (double)dy * dy));
+		}
+	}
+	fft_2d(field, field->kernel_hat, 0);
+	field->stale = 0;
+}
+
+/*-------------------------------
+| sources						|
+-------------------------------*/
+
+//Node (ix, iy) below and left of a point, and how far across the cell it is
+static void locate(struct pressure_field *field, double x, double y, int *ix, int *iy, double *tx, double *ty)
+{
+	double fx = (x - field->x0) / field->cell, fy = (y - field->y0) / field->cell;
+
+	*ix = (int)floor(fx);
+	*iy = (int)floor(fy);
+	if (*ix < 0) *ix = 0;
+	if (*ix > field->nx - 2) *ix = field->nx - 2;
+	if (*iy < 0) *iy = 0;
+	if (*iy > field->ny - 2) *iy = field->ny - 2;
+	*tx = fx - *ix;
+	*ty = fy - *iy;
+}
+
+//Spreads the sources onto the grid and convolves them with the kernel, and sorts them into cells for
+//the near field. The arrays are copied, so they may change afterwards.
+void load_field_sources(struct pressure_field *field, const double *x, const double *y, const double *weight, int num_sources)
+{
+	long nodes = (long)field->px * field->py, c, num_cells = (long)field->nx * field->ny;
+	int s, ix, iy, *cell_of;
+	double tx, ty;
+	double _Complex *g = field->grid;
+
+	if (field->stale) transform_kernel(field);
+	if (num_sources > field->num_sources || !field->source_x) {
+		field->source_x = (double*)mem_realloc(MEM_SPATIAL, field->source_x, (num_sources + 1) * sizeof(double));
+		field->source_y = (double*)mem_realloc(MEM_SPATIAL, field->source_y, (num_sources + 1) * sizeof(double));
+		field->source_weight = (double*)mem_realloc(MEM_SPATIAL, field->source_weight, (num_sources + 1) * sizeof(double));
+		if (!field->source_x || !field->source_y || !field->source_weight) {
+			printf("Could not allocate %d sources in load_field_sources.\n", num_sources);
+			exit(1);
+		}
+	}
+	cell_of = (int*)mem_malloc(MEM_SPATIAL, (num_sources + 1) * sizeof(int));
+	if (!cell_of) { printf("Could not allocate cell_of in load_field_sources.\n"); exit(1); }
+	field->num_sources = num_sources;
+
+	memset(g, 0, nodes * sizeof(double _Complex));
+	memset(field->cell_start, 0, (num_cells + 1) * sizeof(int));
+	for (s = 0; s < num_sources; s++) {
+		locate(field, x[s], y[s], &ix, &iy, &tx, &ty);
+		g[(long)iy * field->px + ix] += weight[s] * (1 - tx) * (1 - ty);
+		g[(long)iy * field->px + ix + 1] += weight[s] * tx * (1 - ty);
+		g[(long)(iy + 1) * field->px + ix] += weight[s] * (1 - tx) * ty;
+		g[(long)(iy + 1) * field->px + ix + 1] += weight[s] * tx * ty;
+		cell_of[s] = iy * field->nx + ix;
+		field->cell_start[cell_of[s] + 1]++;
+	}
+	for (c = 0; c < num_cells; c++) field->cell_start[c + 1] += field->cell_start[c];	//Counting sort into cells
+	for (s = 0; s < num_sources; s++) {
+		c = field->cell_start[cell_of[s]]++;
+		field->source_x[c] = x[s];
+		field->source_y[c] = y[s];
+		field->source_weight[c] = weight[s];
+	}
+	for (c = num_cells; c > 0; c--) field->cell_start[c] = field->cell_start[c - 1];	//Back to starts
+	field->cell_start[0] = 0;
+	mem_free(cell_of);
+
+	fft_2d(field, g, 0);
+	fft_multiply(g, g, field->kernel_hat, nodes);
+	fft_2d(field, g, 1);
+	for (c = 0; c < nodes; c++) g[c] = creal(g[c]) / nodes;
+	field->loads++;
+}
+
+/*-------------------------------
+| pressure at a point			|
+-------------------------------*/
+
+//What the grid makes of one source's pressure at a point: its share of each of its four nodes,
+//through the kernel at the node offsets, interpolated from the point's four nodes
+static double grid_pair(struct pressure_field *field, int six, int siy, double stx, double sty,
+	int tix, int tiy, double ttx, double tty)
+{
+	double share[2][2], read[2][2], sum = 0;
+	int a, b, c, d, dx, dy;
+
+	share[0][0] = (1 - stx) * (1 - sty); share[0][1] = stx * (1 - sty); share[1][0] = (1 - stx) * sty; share[1][1] = stx * sty;
+	read[0][0] = (1 - ttx) * (1 - tty); read[0][1] = ttx * (1 - tty); read[1][0] = (1 - ttx) * tty; read[1][1] = ttx * tty;
+	for (a = 0; a < 2; a++) for (b = 0; b < 2; b++) for (c = 0; c < 2; c++) for (d = 0; d < 2; d++) {
+		dx = abs(tix + d - six - b);
+		dy = abs(tiy + c - siy - a);
+		sum += share[a][b] * read[c][d] * field->near_table[dy * NEAR_TABLE(field) + dx];
+	}
+	return sum;
+}
+
+double field_pressure_at(struct pressure_field *field, double x, double y)
+{
+	double tx, ty, stx, sty, pressure, dx, dy;
+	int ix, iy, six, siy, cx, cy, n = field->near_cells;
+	long c, s;
+	double _Complex *g = field->grid;
+
+	locate(field, x, y, &ix, &iy, &tx, &ty);
+	pressure = creal(g[(long)iy * field->px + ix]) * (1 - tx) * (1 - ty) + creal(g[(long)iy * field->px + ix + 1]) * tx * (1 - ty)
+		+ creal(g[(long)(iy + 1) * field->px + ix]) * (1 - tx) * ty + creal(g[(long)(iy + 1) * field->px + ix + 1]) * tx * ty;
+
+	for (cy = iy - n; cy <= iy + n; cy++) {
+		if (cy < 0 || cy >= field->ny) continue;
+		for (cx = ix - n; cx <= ix + n; cx++) {
+			if (cx < 0 || cx >= field->nx) continue;
+			c = (long)cy * field->nx + cx;
+			for (s = field->cell_start[c]; s < field->cell_start[c + 1]; s++) {
+				locate(field, field->source_x[s], field->source_y[s], &six, &siy, &stx, &sty);
+				dx = field->source_x[s] - x;
+				dy = field->source_y[s] - y;
+				pressure += field->source_weight[s] * (kernel_at(field, sqrt(dx * dx + dy * dy))
+					- grid_pair(field, six, siy, stx, sty, ix, iy, tx, ty));
+			}
+		}
+	}
+	return pressure;
+}
+
+//Sum over every source (for checking the grid)
+double exact_pressure_at(struct pressure_field *field, double x, double y)
+{
+	double pressure = 0, dx, dy;
+	int s;
+
+	for (s = 0; s < field->num_sources; s++) {
+		dx = field->source_x[s] - x;
+		dy = field->source_y[s] - y;
+		pressure += field->source_weight[s] * kernel_at(field, sqrt(dx * dx + dy * dy));
+	}
+	return pressure;
+}
+
+void free_pressure_field(struct pressure_field *field)
+{
+	mem_free(field->kernel_hat);
+	mem_free(field->grid);
+	mem_free(field->twiddle_x);
+	mem_free(field->twiddle_y);
+	mem_free(field->column);
+	mem_free(field->cell_start);
+	mem_free(field->near_table);
+	mem_free(field->source_x);
+	mem_free(field->source_y);
+	mem_free(field->source_weight);
+}
+
+/*-------------------------------
+| subregions					|
+-------------------------------*/
+
+//As spatial_pressure, from the grid: pressure[location * NUMDAYS + day] from every subregion's load
+//that day. Subregions without coordinates only reach themselves.
+void field_location_pressure(struct location_table *table, const double *load, double *pressure, double scale,
+	double exponent, double tolerance)
+{
+	struct pressure_field field;
+	double *x, *y, *weight, x_min = 0, x_max = 0, y_min = 0, y_max = 0, any;
+	int *placed, num_placed = 0, l, s, day;
+
+	x = (double*)mem_malloc(MEM_SPATIAL, (table->num_locations + 1) * sizeof(double));
+	y = (double*)mem_malloc(MEM_SPATIAL, (table->num_locations + 1) * sizeof(double));
+	weight = (double*)mem_malloc(MEM_SPATIAL, (table->num_locations + 1) * sizeof(double));
+	placed = (int*)mem_malloc(MEM_SPATIAL, (table->num_locations + 1) * sizeof(int));
+	if (!x || !y || !weight || !placed) { printf("Could not allocate sources in field_location_pressure.\n"); exit(1); }
+	for (l = 0; l < table->num_locations; l++) {
+		if (!table->has_coordinates[l]) {
+			memcpy(&pressure[(long)l * NUMDAYS], &load[(long)l * NUMDAYS], NUMDAYS * sizeof(double));
+			continue;
+		}
+		x[num_placed] = table->x[l];
+		y[num_placed] = table->y[l];
+		if (num_placed == 0 || x[num_placed] < x_min) x_min = x[num_placed];
+		if (num_placed == 0 || x[num_placed] > x_max) x_max = x[num_placed];
+		if (num_placed == 0 || y[num_placed] < y_min) y_min = y[num_placed];
+		if (num_placed == 0 || y[num_placed] > y_max) y_max = y[num_placed];
+		placed[num_placed++] = l;
+	}
+
+	if (num_placed > 0) {
+		init_pressure_field(&field, x_min, x_max, y_min, y_max, scale, exponent, tolerance);
+		for (day = 0; day < NUMDAYS; day++) {
+			for (s = 0, any = 0; s < num_placed; s++) any += fabs(weight[s] = load[(long)placed[s] * NUMDAYS + day]);
+			if (any == 0) {
+				for (s = 0; s < num_placed; s++) pressure[(long)placed[s] * NUMDAYS + day] = 0;
+				continue;
+			}
+			load_field_sources(&field, x, y, weight, num_placed);
+			for (s = 0; s < num_placed; s++) pressure[(long)placed[s] * NUMDAYS + day] = field_pressure_at(&field, x[s], y[s]);
+		}
+		free_pressure_field(&field);
+	}
+	mem_free(x);
+	mem_free(y);
+	mem_free(weight);
+	mem_free(placed);
+}
@@ -0,0 +1,60 @@
+/********************************************************************************
+*	Pressure_Field.h															*
+*	Contains:																	*
+*		- A grid approximation of the spatial kernel's pressure from many		*
+*			point sources (infectious cases or subregions): the sources are		*
+*			spread onto a grid, convolved with the kernel by FFTs, and the		*
+*			pressure read off anywhere by interpolation. Sources near a point	*
+*			are summed exactly instead, with their grid part taken off, so the	*
+*			grid only carries the smooth far field								*
+*		- Functions defined in Pressure_Field.c									*
+*	Needs Date_And_Reading_Reports.h and Spatial_Kernel.h first.				*
+********************************************************************************/
+
+#define DEFAULT_FIELD_TOLERANCE 0.01	//Relative error aimed for in the far field
+#define FIELD_MAX_NODES 1024			//Most grid nodes along a side (before padding for the FFT)
+#define FIELD_MAX_NEAR_CELLS 32			//Largest near field, in grid cells either way
+
+/************************************************
+* Structure of a pressure field					*
+************************************************/
+
+//The kernel is 1 / (1 + (d / scale)^exponent), as in Spatial_Kernel.h. The near field reaches
+//near_cells cells, chosen from the tolerance: beyond it the kernel's relative curvature is small
+//enough that spreading and interpolation over a cell stay within it.
+struct pressure_field
+{
+	double scale;					//Kernel parameters
+	double exponent;
+	double tolerance;
+	double x0, y0;					//Position of node (0, 0)
+	double cell;					//Grid spacing
+	int nx, ny;						//Nodes covering the area
+	int px, py;						//FFT sizes (powers of two, at least twice the nodes, so it does not wrap)
+	int near_cells;
+	double _Complex *kernel_hat;	//FFT of the kernel at every node offset (stale until the kernel is set)
+	double _Complex *grid;			//Sources spread onto the grid, then the pressure at every node
+	double _Complex *twiddle_x;		//exp(-2 pi i k / px) and the same for py
+	double _Complex *twiddle_y;
+	double _Complex *column;		//Scratch for the FFT down columns
+	double *near_table;				//near_table[dy * (near_cells + 3) + dx]: kernel at node offset (dx, dy)
+	int stale;						//1 once the kernel parameters change, until kernel_hat is worked out again
+	int num_sources;				//Sources of the last load_field_sources, sorted into cells
+	double *source_x, *source_y, *source_weight;
+	int *cell_start;				//Sources in cell c (c = iy * nx + ix) are cell_start[c] to cell_start[c + 1] - 1
+	long loads;						//Calls of load_field_sources
+};
+
+/****************************************
+* Functions defined in Pressure_Field.c	*
+****************************************/
+
+void init_pressure_field(struct pressure_field *field, double x_min, double x_max, double y_min, double y_max,
+	double scale, double exponent, double tolerance);
+void set_field_kernel(struct pressure_field *field, double scale, double exponent);
+void load_field_sources(struct pressure_field *field, const double *x, const double *y, const double *weight, int num_sources);
+double field_pressure_at(struct pressure_field *field, double x, double y);
+double exact_pressure_at(struct pressure_field *field, double x, double y);
+void free_pressure_field(struct pressure_field *field);
+void field_location_pressure(struct location_table *table, const double *load, double *pressure, double scale,
+	double exponent, double tolerance);
@@ -0,0 +1,252 @@
+/********************************************************************************
+*	Profile.c																	*
+*	Timers and counters of the phases of a run (see Profile.h).					*
+*	Each thread adds to its own totals, found through a thread-local pointer	*
+*		and registered in a list on first use, so adding never takes a lock.	*
+*		Totals are written with relaxed atomic stores (plain moves on x86),		*
+*		so the exporter can read them while they change.						*
+*	Ticks are turned into seconds by comparing the time-stamp counter with		*
+*		the monotonic clock over the whole run.									*
+*	Files are written to a temporary name and renamed, so a scraper never		*
+*		sees half a file. They also carry the memory of each subsystem.			*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>			//For standard input/output functions
+#include <stdlib.h>			//For memory allocation
+#include <string.h>			//For strncpy
+#include <time.h>			//For the monotonic clock
+#include <pthread.h>		//For the list of threads and the export thread
+#include "Profile.h"		//For declarations of functions in this file
+#include "Memory.h"			//For memory accounting
+
+static const char *phase_names[PROF_NUM_PHASES] = { "ingest", "cases", "lfunc_table", "move_dates", "move_parent",
+	"move_rates", "move_durations", "move_duration_block", "move_birth_death", "likelihood", "checkpoint_io",
+	"trace_io", "summary_io", "simulation" };
+static const char *counter_names[PROF_NUM_COUNTERS] = { "rng_words", "likelihoods", "reports", "bytes_written" };
+
+//One thread's totals
+struct profile_totals
+{
+	unsigned long long ticks[PROF_NUM_PHASES];
+	long calls[PROF_NUM_PHASES];
+	long counts[PROF_NUM_COUNTERS];
+	struct profile_totals *next;		//Next thread in the list
+};
+
+struct profile_export
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int running;
+	int shutdown;
+	int interval;
+	char json_file[200];
+	char prometheus_file[200];
+};
+
+static __thread struct profile_totals *local;		//This thread's totals (NULL until it first adds)
+static struct profile_totals *all_threads;
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct profile_export exporter = { 0 };
+static unsigned long long start_ticks, start_ns;	//Taken as the program loads
+
+unsigned long long profile_clock_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+//Runs before main, so the ticks are measured against the clock over the whole run
+static void __attribute__((constructor)) start_clock()
+{
+	start_ns = profile_clock_ns();
+	start_ticks = profile_ticks();
+}
+
+static struct profile_totals *register_thread()
+{
+	local = (struct profile_totals*)mem_calloc(MEM_OTHER, 1, sizeof(struct profile_totals));
+	if (!local) { printf("Could not allocate totals in register_thread.\n"); exit(1); }
+	pthread_mutex_lock(&list_lock);
+	local->next = all_threads;
+	all_threads = local;
+	pthread_mutex_unlock(&list_lock);
+	return local;
+}
+
+void profile_add(int phase, unsigned long long ticks)
+{
+	struct profile_totals *totals = local ? local : register_thread();
+
+	__atomic_store_n(&totals->ticks[phase], totals->ticks[phase] + ticks, __ATOMIC_RELAXED);
+	__atomic_store_n(&totals->calls[phase], totals->calls[phase] + 1, __ATOMIC_RELAXED);
+}
+
+void profile_add_count(int counter, long n)
+{
+	struct profile_totals *totals = local ? local : register_thread();
+
+	__atomic_store_n(&totals->counts[counter], totals->counts[counter] + n, __ATOMIC_RELAXED);
+}
+
+/*-------------------------------
+| export						|
+-------------------------------*/
+
+//Every thread's totals added up, with the seconds run so far and the ticks in a second
+static void sum_totals(struct profile_totals *sum, double *seconds, double *ticks_per_second)
+{
+	struct profile_totals *totals;
+	unsigned long long ticks, ns;
+	int k;
+
+	memset(sum, 0, sizeof(struct profile_totals));
+	pthread_mutex_lock(&list_lock);
+	for (totals = all_threads; totals; totals = totals->next) {
+		for (k = 0; k < PROF_NUM_PHASES; k++) {
+			sum->ticks[k] += __atomic_load_n(&totals->ticks[k], __ATOMIC_RELAXED);
+			sum->calls[k] += __atomic_load_n(&totals->calls[k], __ATOMIC_RELAXED);
+		}
+		for (k = 0; k < PROF_NUM_COUNTERS; k++) sum->counts[k] += __atomic_load_n(&totals->counts[k], __ATOMIC_RELAXED);
+	}
+	ns = profile_clock_ns();
+	ticks = profile_ticks();
+	*seconds = 1e-9 * (ns - start_ns);
+	*ticks_per_second = ns > start_ns && ticks > start_ticks ? (ticks - start_ticks) / (1e-9 * (ns - start_ns)) : 1e9;
+	pthread_mutex_unlock(&list_lock);
+}
+
+static FILE *open_temporary(const char *file_name, char *temp_name, size_t size)
+{
+	FILE *output;
+
+	snprintf(temp_name, size, "%s.tmp", file_name);
+	output = fopen(temp_name, "w");
+	if (!output) printf("Could not open %s to write the profile.\n", temp_name);
+	return output;
+}
+
+static void replace_file(FILE *output, const char *temp_name, const char *file_name)
+{
+	if (fclose(output) != 0 || rename(temp_name, file_name) != 0) printf("Could not write the profile to %s.\n", file_name);
+}
+
+//Seconds spent in phase so far, over every thread
+double profile_seconds(int phase)
+{
+	struct profile_totals sum;
+	double seconds, ticks_per_second;
+
+	sum_totals(&sum, &seconds, &ticks_per_second);
+	return sum.ticks[phase] / ticks_per_second;
+}
+
+//Writes the totals so far to either file (NULL or "" to leave it out)
+void write_profile(const char *json_file, const char *prometheus_file)
+{
+	struct profile_totals sum;
+	struct memory_usage memory;
+	double seconds, ticks_per_second;
+	char temp_name[220];
+	FILE *output;
+	int k;
+
+	sum_totals(&sum, &seconds, &ticks_per_second);
+	if (json_file && json_file[0] && (output = open_temporary(json_file, temp_name, sizeof(temp_name)))) {
+		fprintf(output, "{\n\t\"seconds\": %.6f,\n\t\"ticks_per_second\": %.0f,\n\t\"phases\": {\n", seconds, ticks_per_second);
+		for (k = 0; k < PROF_NUM_PHASES; k++)
+			fprintf(output, "\t\t\"%s\": {\"calls\": %ld, \"seconds\": %.6f}%s\n", phase_names[k], sum.calls[k],
+				sum.ticks[k] / ticks_per_second, k < PROF_NUM_PHASES - 1 ? "," : "");
+		fprintf(output, "\t},\n\t\"counters\": {\n");
+		for (k = 0; k < PROF_NUM_COUNTERS; k++)
+			fprintf(output, "\t\t\"%s\": %ld%s\n", counter_names[k], sum.counts[k], k < PROF_NUM_COUNTERS - 1 ? "," : "");
+		fprintf(output, "\t},\n\t\"memory\": {\n");
+		for (k = 0; k <= MEM_TOTAL; k++) {
+			memory_usage(k, &memory);
+			fprintf(output, "\t\t\"%s\": {\"live\": %lld, \"peak\": %lld, \"allocations\": %ld, \"frees\": %ld, \"budget\": %lld}%s\n",
+				memory_subsystem_name(k), memory.live, memory.peak, memory.allocations, memory.frees, memory.budget, k < MEM_TOTAL ? "," : "");
+		}
+		fprintf(output, "\t}\n}\n");
+		replace_file(output, temp_name, json_file);
+	}
+	if (prometheus_file && prometheus_file[0] && (output = open_temporary(prometheus_file, temp_name, sizeof(temp_name)))) {
+		fprintf(output, "# HELP ebola_run_seconds Time since the run started.\n# TYPE ebola_run_seconds gauge\n");
+		fprintf(output, "ebola_run_seconds %.6f\n", seconds);
+		fprintf(output, "# HELP ebola_phase_seconds_total Time spent in each phase, over all threads.\n");
+		fprintf(output, "# TYPE ebola_phase_seconds_total counter\n");
+		for (k = 0; k < PROF_NUM_PHASES; k++)
+			fprintf(output, "ebola_phase_seconds_total{phase=\"%s\"} %.6f\n", phase_names[k], sum.ticks[k] / ticks_per_second);
+		fprintf(output, "# HELP ebola_phase_calls_total Times each phase was timed.\n# TYPE ebola_phase_calls_total counter\n");
+		for (k = 0; k < PROF_NUM_PHASES; k++)
+			fprintf(output, "ebola_phase_calls_total{phase=\"%s\"} %ld\n", phase_names[k], sum.calls[k]);
+		for (k = 0; k < PROF_NUM_COUNTERS; k++)
+			fprintf(output, "# TYPE ebola_%s_total counter\nebola_%s_total %ld\n", counter_names[k], counter_names[k], sum.counts[k]);
+		fprintf(output, "# HELP ebola_memory_live_bytes Bytes allocated and not yet freed, by subsystem.\n# TYPE ebola_memory_live_bytes gauge\n");
+		for (k = 0; k <= MEM_TOTAL; k++) {
+			memory_usage(k, &memory);
+			fprintf(output, "ebola_memory_live_bytes{subsystem=\"%s\"} %lld\n", memory_subsystem_name(k), memory.live);
+		}
+		fprintf(output, "# HELP ebola_memory_peak_bytes Most bytes live at once, by subsystem.\n# TYPE ebola_memory_peak_bytes gauge\n");
+		for (k = 0; k <= MEM_TOTAL; k++) {
+			memory_usage(k, &memory);
+			fprintf(output, "ebola_memory_peak_bytes{subsystem=\"%s\"} %lld\n", memory_subsystem_name(k), memory.peak);
+		}
+		fprintf(output, "# HELP ebola_memory_allocations_total Blocks allocated, by subsystem.\n# TYPE ebola_memory_allocations_total counter\n");
+		for (k = 0; k <= MEM_TOTAL; k++) {
+			memory_usage(k, &memory);
+			fprintf(output, "ebola_memory_allocations_total{subsystem=\"%s\"} %ld\n", memory_subsystem_name(k), memory.allocations);
+		}
+		replace_file(output, temp_name, prometheus_file);
+	}
+}
+
+static void *export_main(void *arg)
+{
+	struct timespec until;
+
+	pthread_mutex_lock(&exporter.lock);
+	while (!exporter.shutdown) {
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += exporter.interval;
+		if (pthread_cond_timedwait(&exporter.wake, &exporter.lock, &until) == 0 && exporter.shutdown) break;
+		pthread_mutex_unlock(&exporter.lock);
+		write_profile(exporter.json_file, exporter.prometheus_file);
+		pthread_mutex_lock(&exporter.lock);
+	}
+	pthread_mutex_unlock(&exporter.lock);
+	return NULL;
+}
+
+//Writes the totals to the files every interval seconds until stop_profile_export
+void start_profile_export(const char *json_file, const char *prometheus_file, int interval)
+{
+	if (exporter.running) return;
+	strncpy(exporter.json_file, json_file ? json_file : "", sizeof(exporter.json_file) - 1);
+	strncpy(exporter.prometheus_file, prometheus_file ? prometheus_file : "", sizeof(exporter.prometheus_file) - 1);
+	if (!exporter.json_file[0] && !exporter.prometheus_file[0]) return;
+	exporter.interval = interval > 0 ? interval : DEFAULT_PROFILE_INTERVAL;
+	exporter.shutdown = 0;
+	pthread_mutex_init(&exporter.lock, NULL);
+	pthread_cond_init(&exporter.wake, NULL);
+	if (pthread_create(&exporter.thread, NULL, export_main, NULL) != 0) { printf("Could not start the profile export.\n"); exit(1); }
+	exporter.running = 1;
+}
+
+//Stops the export thread and writes the final totals
+void stop_profile_export()
+{
+	if (!exporter.running) return;
+	pthread_mutex_lock(&exporter.lock);
+	exporter.shutdown = 1;
+	pthread_cond_signal(&exporter.wake);
+	pthread_mutex_unlock(&exporter.lock);
+	pthread_join(exporter.thread, NULL);
+	pthread_mutex_destroy(&exporter.lock);
+	pthread_cond_destroy(&exporter.wake);
+	exporter.running = 0;
+	write_profile(exporter.json_file, exporter.prometheus_file);
+}
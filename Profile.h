@@ -0,0 +1,64 @@
+/********************************************************************************
+*	Profile.h																	*
+*	Contains:																	*
+*		- Timers and counters for the phases of a run (reading, making cases,	*
+*			each move type, likelihoods, writing files...), kept per thread		*
+*			and timed by the processor's time-stamp counter, so they can be		*
+*			left on. Build with -DPROFILE_ENABLED=0 to compile them out.		*
+*		- Functions defined in Profile.c, which add up every thread's totals	*
+*			and write them as JSON and in the Prometheus text format			*
+********************************************************************************/
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+
+//Phases, each timed and counted (they may nest - e.g. likelihoods within moves)
+#define PROF_INGEST 0				//Reading the case file
+#define PROF_CASES 1				//Making the reported cases
+#define PROF_LFUNC_TABLE 2			//initlfunc2's table
+#define PROF_MOVE_FIRST 3			//Moves, in the order of the MOVE_ definitions (Gibbs_Sampler.h)
+#define PROF_LIKELIHOOD 9			//Full likelihood evaluations (incremental ones are part of the moves)
+#define PROF_CHECKPOINT_IO 10		//Writing checkpoints (background thread)
+#define PROF_TRACE_IO 11			//Compressing and writing trace chunks (background thread)
+#define PROF_SUMMARY_IO 12			//Writing the posterior summary
+#define PROF_SIMULATION 13			//Forward simulations
+#define PROF_NUM_PHASES 14
+
+//Counters
+#define PROF_RNG_WORDS 0			//32-bit words drawn from the Mersenne twisters (counted a block of 624 at a time)
+#define PROF_LIKELIHOODS 1			//Likelihoods of proposals and full evaluations
+#define PROF_REPORTS 2				//Reports read
+#define PROF_BYTES_WRITTEN 3		//By the checkpoint and trace writers
+#define PROF_NUM_COUNTERS 4
+
+#define DEFAULT_PROFILE_INTERVAL 10	//Seconds between exports
+
+#if PROFILE_ENABLED
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profile_ticks() __rdtsc()
+#else
+#define profile_ticks() profile_clock_ns()
+#endif
+#define profile_start() profile_ticks()
+#define profile_stop(phase, start) profile_add(phase, profile_ticks() - (start))
+#define profile_count(counter, n) profile_add_count(counter, n)
+#else
+#define profile_ticks() 0ULL
+#define profile_start() 0ULL
+#define profile_stop(phase, start) ((void)(start))
+#define profile_count(counter, n) ((void)0)
+#endif
+
+/****************************************
+* Functions defined in Profile.c		*
+****************************************/
+
+unsigned long long profile_clock_ns();
+void profile_add(int phase, unsigned long long ticks);
+void profile_add_count(int counter, long n);
+double profile_seconds(int phase);
+void start_profile_export(const char *json_file, const char *prometheus_file, int interval);
+void write_profile(const char *json_file, const char *prometheus_file);
+void stop_profile_export();
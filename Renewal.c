@@ -0,0 +1,329 @@
+/********************************************************************************
+*	Renewal.c																	*
+*	Expected onsets and diagnoses per subregion and day (see Renewal.h).		*
+*	The generation profile follows one case from its onset: on day u it			*
+*		transmits at beta[1] while infectious and undiagnosed, beta[2] while	*
+*		infectious and diagnosed, and beta[3] from death until burial, each		*
+*		weighted by the chance of being in that state on day u (durations		*
+*		independent, as in the model). Every exposure then adds one onset		*
+*		1 + incubation days later.												*
+*	A full recompute transforms each subregion's onsets (only those that		*
+*		moved since), multiplies by the transformed profiles and transforms		*
+*		back: O(NUMDAYS log NUMDAYS) per subregion instead of NUMDAYS^2.		*
+*		When only the reporting delay changes, the expected onsets are kept.	*
+*	A moved onset changes the expected values of the window of days after		*
+*		it, so a date move costs the length of the profiles as they are cut.	*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memset and memcmp
+#include <math.h>						//For log, exp and lgamma
+#include <complex.h>					//For the FFTs
+#include "Date_And_Reading_Reports.h"	//For the case, report and parameter structures
+#include "Likelihood.h"					//For nb_log_pmf
+#include "Spatial_Kernel.h"				//For the names of the subregions
+#include "FFT.h"						//For the transforms
+#include "Renewal.h"					//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For reporting bugs
+
+/*-------------------------------
+| profiles						|
+-------------------------------*/
+
+//pmf[x] for every day, of a duration with the given mean and size
+static void duration_pmf(double *pmf, double mean, double size)
+{
+	int x;
+
+	for (x = 0; x < NUMDAYS; x++) pmf[x] = exp(nb_log_pmf(x, mean, size));
+}
+
+//Last s of a profile to keep: what lies beyond it is below RENEWAL_TAIL of the total
+static int profile_window(double *profile)
+{
+	double total = 0, tail = 0;
+	int s;
+
+	for (s = 0; s < NUMDAYS; s++) total += profile[s];
+	for (s = NUMDAYS - 1; s > 0; s--) {
+		if (tail + profile[s] > RENEWAL_TAIL * total) break;
+		tail += profile[s];
+		profile[s] = 0;
+	}
+	return s;
+}
+
+static void make_generation(struct renewal_engine *engine)
+{
+	struct parameter_list *p = &engine->params;
+	double incubation[NUMDAYS], infectious[NUMDAYS], burial[NUMDAYS], diagnosis[NUMDAYS], rate[NUMDAYS];
+	double still_infectious = 1, diagnosed = 0, burying;
+	int u, i, s;
+
+	duration_pmf(incubation, p->dur_mean[DUR_INCUBATION], p->dur_size[DUR_INCUBATION]);
+	duration_pmf(infectious, p->dur_mean[DUR_INFECTIOUS], p->dur_size[DUR_INFECTIOUS]);
+	duration_pmf(burial, p->dur_mean[DUR_BURIAL], p->dur_size[DUR_BURIAL]);
+	duration_pmf(diagnosis, p->dur_mean[DUR_DIAGNOSIS], p->dur_size[DUR_DIAGNOSIS]);
+	for (s = 0; s < NUMDAYS; s++) burial[s] = (s > 0 ? burial[s - 1] : 1) - burial[s];	//Now the chance that B > s
+
+	//rate[u]: exposures expected on day u after onset. Infectious until 1 + I days after onset,
+	//diagnosed from D days after (with chance p_diag), buried B days after death.
+	for (u = 0; u < NUMDAYS; u++) {
+		diagnosed += p->p_diag * diagnosis[u];
+		rate[u] = still_infectious * (p->beta[1] * (1 - diagnosed) + p->beta[2] * diagnosed);
+		burying = 0;									//Dead by day u, and not yet buried
+		for (i = 0; i + 1 <= u; i++) burying += infectious[i] * burial[u - 1 - i];
+		rate[u] += p->beta[3] * (1 - p->p_survive) * burying;
+		still_infectious -= infectious[u];	//Chance that I > u, i.e. still infectious on day u + 1
+	}
+
+	engine->generation[0] = 0;
+	for (s = 1; s < NUMDAYS; s++) {
+		engine->generation[s] = 0;
+		for (u = 0; u <= s - 1; u++) engine->generation[s] += rate[u] * incubation[s - 1 - u];
+	}
+	engine->generation_window = profile_window(engine->generation);
+}
+
+static void make_delay(struct renewal_engine *engine)
+{
+	int s;
+
+	duration_pmf(engine->delay, engine->params.dur_mean[DUR_DIAGNOSIS], engine->params.dur_size[DUR_DIAGNOSIS]);
+	for (s = 0; s < NUMDAYS; s++) engine->delay[s] *= engine->params.p_diag;
+	engine->delay_window = profile_window(engine->delay);
+}
+
+//FFT of NUMDAYS values, padded with zeros to the engine's size
+static void transform(struct renewal_engine *engine, const double *values, double _Complex *hat)
+{
+	int t;
+
+	for (t = 0; t < engine->size; t++) hat[t] = t < NUMDAYS ? values[t] : 0;
+	fft(hat, engine->size, engine->twiddle, 0);
+}
+
+//Days 0 to NUMDAYS - 1 of the convolution of two transformed sequences
+static void convolve(struct renewal_engine *engine, const double _Complex *a_hat, const double _Complex *b_hat, double *result)
+{
+	int k;
+
+	fft_multiply(engine->work, a_hat, b_hat, engine->size);
+	fft(engine->work, engine->size, engine->twiddle, 1);
+	for (k = 0; k < NUMDAYS; k++) {
+		result[k] = creal(engine->work[k]) / engine->size;
+		if (result[k] < 0) result[k] = 0;				//Rounding, where the sum is 0
+	}
+}
+
+/*-------------------------------
+| setting up					|
+-------------------------------*/
+
+//An engine for the onsets of the cases from first, in num_locations subregions
+struct renewal_engine *create_renewal(p_patient first, int num_locations, struct parameter_list *p_params)
+{
+	struct renewal_engine *engine = (struct renewal_engine*)mem_calloc(MEM_SAMPLER, 1, sizeof(struct renewal_engine));
+	long cells = (long)(num_locations > 0 ? num_locations : 1) * NUMDAYS;
+	p_patient current;
+
+	if (!engine) { printf("Could not allocate engine in create_renewal.\n"); exit(1); }
+	engine->num_locations = num_locations;
+	engine->size = fft_size(2 * NUMDAYS);
+	engine->onsets = (double*)mem_calloc(MEM_SAMPLER, cells, sizeof(double));
+	engine->expected_onsets = (double*)mem_calloc(MEM_SAMPLER, cells, sizeof(double));
+	engine->expected_diagnoses = (double*)mem_calloc(MEM_SAMPLER, cells, sizeof(double));
+	engine->onset_hat = (double _Complex*)mem_malloc(MEM_SAMPLER, (num_locations > 0 ? num_locations : 1) * (long)engine->size * sizeof(double _Complex));
+	engine->onset_stale = (char*)mem_malloc(MEM_SAMPLER, num_locations > 0 ? num_locations : 1);
+	engine->generation_hat = (double _Complex*)mem_malloc(MEM_SAMPLER, engine->size * sizeof(double _Complex));
+	engine->delay_hat = (double _Complex*)mem_malloc(MEM_SAMPLER, engine->size * sizeof(double _Complex));
+	engine->twiddle = (double _Complex*)mem_malloc(MEM_SAMPLER, engine->size / 2 * sizeof(double _Complex));
+	engine->work = (double _Complex*)mem_malloc(MEM_SAMPLER, engine->size * sizeof(double _Complex));
+	if (!engine->onsets || !engine->expected_onsets || !engine->expected_diagnoses || !engine->onset_hat || !engine->onset_stale
+		|| !engine->generation_hat || !engine->delay_hat || !engine->twiddle || !engine->work) {
+		printf("Could not allocate the engine's arrays in create_renewal.\n");
+		exit(1);
+	}
+	fft_twiddles(engine->twiddle, engine->size);
+	memset(engine->onset_stale, 1, num_locations > 0 ? num_locations : 1);
+
+	for (current = first; current != NULL; current = current->next)
+		if (current->location >= 0 && current->location < num_locations && current->dates[1] >= 0 && current->dates[1] < NUMDAYS)
+			engine->onsets[(long)current->location * NUMDAYS + current->dates[1]]++;
+	engine->params = *p_params;
+	engine->generation_stale = engine->delay_stale = 1;
+	refresh_renewal(engine);
+	return engine;
+}
+
+void free_renewal(struct renewal_engine *engine)
+{
+	mem_free(engine->onsets);
+	mem_free(engine->expected_onsets);
+	mem_free(engine->expected_diagnoses);
+	mem_free(engine->onset_hat);
+	mem_free(engine->onset_stale);
+	mem_free(engine->generation_hat);
+	mem_free(engine->delay_hat);
+	mem_free(engine->twiddle);
+	mem_free(engine->work);
+	mem_free(engine);
+}
+
+//Notes the parameters: a profile they change is stale until the next refresh
+void set_renewal_parameters(struct renewal_engine *engine, struct parameter_list *p_params)
+{
+	struct parameter_list *old = &engine->params;
+	int k, changed = 0;
+
+	for (k = 1; k < NUM_TRANS_TYPES; k++) if (p_params->beta[k] != old->beta[k]) changed = 1;
+	for (k = 0; k < NUM_DURATIONS; k++)
+		if (p_params->dur_mean[k] != old->dur_mean[k] || p_params->dur_size[k] != old->dur_size[k]) changed = 1;
+	if (changed || p_params->p_diag != old->p_diag || p_params->p_survive != old->p_survive) engine->generation_stale = 1;
+	if (p_params->p_diag != old->p_diag || p_params->dur_mean[DUR_DIAGNOSIS] != old->dur_mean[DUR_DIAGNOSIS]
+		|| p_params->dur_size[DUR_DIAGNOSIS] != old->dur_size[DUR_DIAGNOSIS]) engine->delay_stale = 1;
+	*old = *p_params;
+}
+
+//Works out the stale profiles and every expected value that depends on them. Each subregion's
+//onsets are transformed again only if one moved since they last were.
+void refresh_renewal(struct renewal_engine *engine)
+{
+	int l;
+	long row;
+
+	if (!engine->generation_stale && !engine->delay_stale) return;
+	if (engine->generation_stale) {
+		make_generation(engine);
+		transform(engine, engine->generation, engine->generation_hat);
+	}
+	if (engine->delay_stale) {
+		make_delay(engine);
+		transform(engine, engine->delay, engine->delay_hat);
+	}
+	for (l = 0; l < engine->num_locations; l++) {
+		row = (long)l * NUMDAYS;
+		if (engine->onset_stale[l]) {
+			transform(engine, &engine->onsets[row], &engine->onset_hat[(long)l * engine->size]);
+			engine->onset_stale[l] = 0;
+			engine->transforms++;
+		}
+		if (engine->generation_stale)
+			convolve(engine, &engine->onset_hat[(long)l * engine->size], engine->generation_hat, &engine->expected_onsets[row]);
+		if (engine->delay_stale)
+			convolve(engine, &engine->onset_hat[(long)l * engine->size], engine->delay_hat, &engine->expected_diagnoses[row]);
+	}
+	engine->generation_stale = engine->delay_stale = 0;
+	engine->refreshes++;
+}
+
+/*-------------------------------
+| moving onsets					|
+-------------------------------*/
+
+//Adds (sign 1) or takes away (sign -1) one onset, and what it adds to the days after
+void renewal_add_onset(struct renewal_engine *engine, int location, int day, int sign)
+{
+	long row = (long)location * NUMDAYS;
+	int s, last;
+
+	if (location < 0 || location >= engine->num_locations || day < 0 || day >= NUMDAYS) return;
+	engine->onsets[row + day] += sign;
+	last = day + engine->generation_window < NUMDAYS - 1 ? day + engine->generation_window : NUMDAYS - 1;
+	for (s = day + 1; s <= last; s++) engine->expected_onsets[row + s] += sign * engine->generation[s - day];
+	last = day + engine->delay_window < NUMDAYS - 1 ? day + engine->delay_window : NUMDAYS - 1;
+	for (s = day; s <= last; s++) engine->expected_diagnoses[row + s] += sign * engine->delay[s - day];
+	engine->onset_stale[location] = 1;
+	engine->updates++;
+}
+
+void renewal_move_onset(struct renewal_engine *engine, int location, int from, int to)
+{
+	if (from == to) return;
+	renewal_add_onset(engine, location, from, -1);
+	renewal_add_onset(engine, location, to, 1);
+}
+
+/*-------------------------------
+| checks and output				|
+-------------------------------*/
+
+//Sums the convolutions directly and compares them with the expected values kept. Returns the
+//largest difference.
+double check_renewal(struct renewal_engine *engine)
+{
+	double expected, difference, largest = 0;
+	long row;
+	int l, t, s;
+
+	for (l = 0; l < engine->num_locations; l++) {
+		row = (long)l * NUMDAYS;
+		for (t = 0; t < NUMDAYS; t++) {
+			expected = 0;
+			for (s = 1; s <= engine->generation_window && s <= t; s++) expected += engine->onsets[row + t - s] * engine->generation[s];
+			difference = fabs(expected - engine->expected_onsets[row + t]);
+			if (difference > largest) largest = difference;
+			expected = 0;
+			for (s = 0; s <= engine->delay_window && s <= t; s++) expected += engine->onsets[row + t - s] * engine->delay[s];
+			difference = fabs(expected - engine->expected_diagnoses[row + t]);
+			if (difference > largest) largest = difference;
+		}
+	}
+	if (largest > RENEWAL_DRIFT) log_error(LOG_SAMPLER, "Renewal engine differed from a direct sum by %g - the updates have a bug.", largest);
+	return largest;
+}
+
+//Poisson log likelihood of each report's cases, given the diagnoses expected in its subregion
+//since the report before it (previous_date_ID + 1 to date_ID)
+double renewal_report_log_lik(struct renewal_engine *engine, struct current_case_report *reports, int num_reports)
+{
+	double log_lik = 0, mean;
+	int r, t;
+
+	for (r = 0; r < num_reports; r++) {
+		if (reports[r].location < 0 || reports[r].location >= engine->num_locations || reports[r].cases < 0) continue;
+		mean = 0;
+		for (t = reports[r].previous_date_ID + 1; t <= reports[r].date_ID; t++)
+			if (t >= 0 && t < NUMDAYS) mean += engine->expected_diagnoses[(long)reports[r].location * NUMDAYS + t];
+		if (mean <= 0) {
+			if (reports[r].cases > 0) return -INFINITY;
+			continue;
+		}
+		log_lik += reports[r].cases * log(mean) - mean - lgamma(reports[r].cases + 1.0);
+	}
+	return log_lik;
+}
+
+//Writes the onsets and expected values of every subregion and day (refreshing them first)
+void write_renewal(const char *file_name, struct renewal_engine *engine, struct location_table *table,
+	struct current_case_report *reports, int num_reports)
+{
+	FILE *output = fopen(file_name, "w");
+	double *reported;
+	long cell;
+	int l, day, r;
+
+	if (!output) { printf("Could not open %s to write the expected onsets.\n", file_name); exit(1); }
+	reported = (double*)mem_calloc(MEM_SAMPLER, (long)(engine->num_locations > 0 ? engine->num_locations : 1) * NUMDAYS, sizeof(double));
+	if (!reported) { printf("Could not allocate reported in write_renewal.\n"); exit(1); }
+	for (r = 0; r < num_reports; r++)
+		if (reports[r].location >= 0 && reports[r].location < engine->num_locations && reports[r].date_ID >= 0
+			&& reports[r].date_ID < NUMDAYS && reports[r].cases > 0)
+			reported[(long)reports[r].location * NUMDAYS + reports[r].date_ID] += reports[r].cases;
+
+	refresh_renewal(engine);
+	fprintf(output, "country,subregion,day,onsets,expected_onsets,reported,expected_diagnoses\n");
+	for (l = 0; l < engine->num_locations && l < table->num_locations; l++)
+		for (day = 0; day < NUMDAYS; day++) {
+			cell = (long)l * NUMDAYS + day;
+			if (engine->onsets[cell] > 0 || engine->expected_onsets[cell] > 1e-12 || reported[cell] > 0
+				|| engine->expected_diagnoses[cell] > 1e-12)
+				fprintf(output, "%s,%s,%d,%g,%.6g,%g,%.6g\n", table->country[l], table->subregion[l], day, engine->onsets[cell],
+					engine->expected_onsets[cell], reported[cell], engine->expected_diagnoses[cell]);
+		}
+	fclose(output);
+	mem_free(reported);
+}
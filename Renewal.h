@@ -0,0 +1,64 @@
+/********************************************************************************
+*	Renewal.h																	*
+*	Contains:																	*
+*		- Expected onsets and diagnoses per subregion and day from the onsets	*
+*			(dates[1]) already there: onsets convolved with the generation		*
+*			profile (onsets expected s days after one onset, from the			*
+*			transmission rates and durations), and with the reporting delay		*
+*			(diagnoses expected s days after one onset)							*
+*		- A full recompute by FFT, keeping each subregion's transformed			*
+*			onsets so new parameters cost one inverse FFT per subregion, and	*
+*			updates of O(window) when one onset moves							*
+*		- Functions defined in Renewal.c										*
+*	Needs Date_And_Reading_Reports.h and Spatial_Kernel.h first.				*
+********************************************************************************/
+
+#define RENEWAL_TAIL 1e-9			//Profiles are cut where what is left falls below this share of the total
+#define RENEWAL_DRIFT 1e-6			//Largest difference from a direct sum that passes a check silently
+
+/************************************************
+* Structure of the renewal engine				*
+************************************************/
+
+//Cases with no subregion (NO_LOCATION) are left out. The expected values are for the profiles as
+//they were at the last refresh: new parameters only mark them stale, and moves carry on with the
+//profiles the expected values were worked out with, until refresh_renewal.
+struct renewal_engine
+{
+	int num_locations;
+	int size;						//FFT length (a power of two of at least 2 NUMDAYS, so nothing wraps)
+	double *onsets;					//onsets[l * NUMDAYS + t]: cases of subregion l with onset on day t
+	double *expected_onsets;		//Onsets expected on each day from the onsets before it
+	double *expected_diagnoses;		//Diagnoses expected on each day from the onsets up to it
+	double generation[NUMDAYS];		//generation[s]: onsets expected s days after one onset
+	double delay[NUMDAYS];			//delay[s]: chance of a diagnosis s days after onset
+	int generation_window;			//Last s kept in each profile (the rest are 0)
+	int delay_window;
+	struct parameter_list params;	//Parameters the profiles are for (once refreshed)
+	int generation_stale;			//1 once the parameters change a profile, until refresh_renewal
+	int delay_stale;
+	double _Complex *onset_hat;		//onset_hat[l * size + k]: FFT of the onsets of subregion l...
+	char *onset_stale;				//...out of date since an onset moved, if onset_stale[l]
+	double _Complex *generation_hat;	//FFTs of the profiles
+	double _Complex *delay_hat;
+	double _Complex *twiddle;
+	double _Complex *work;
+	long refreshes;
+	long transforms;				//FFTs of onsets made (one per subregion moved between refreshes)
+	long updates;					//Onsets moved, added or taken away
+};
+
+/****************************************
+* Functions defined in Renewal.c		*
+****************************************/
+
+struct renewal_engine *create_renewal(p_patient first, int num_locations, struct parameter_list *p_params);
+void free_renewal(struct renewal_engine *engine);
+void set_renewal_parameters(struct renewal_engine *engine, struct parameter_list *p_params);
+void refresh_renewal(struct renewal_engine *engine);
+void renewal_add_onset(struct renewal_engine *engine, int location, int day, int sign);
+void renewal_move_onset(struct renewal_engine *engine, int location, int from, int to);
+double check_renewal(struct renewal_engine *engine);
+double renewal_report_log_lik(struct renewal_engine *engine, struct current_case_report *reports, int num_reports);
+void write_renewal(const char *file_name, struct renewal_engine *engine, struct location_table *table,
+	struct current_case_report *reports, int num_reports);
@@ -0,0 +1,753 @@
+/********************************************************************************
+*	Self_Test.c																	*
+*	Checks the fast paths against slow, direct versions of the same work (see	*
+*		Self_Test.h). Each test draws its inputs from its own stream, seeded	*
+*		from the seed given, so a failure can be run again as it was.			*
+*	A test returns the number of checks that failed, printing the first			*
+*		SELF_TEST_MAX_MESSAGES of them, and -selftest exits with status 1 if	*
+*		any did.																*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation and mkstemp
+#include <string.h>						//For memcmp
+#include <stdarg.h>						//For the failures' formats
+#include <unistd.h>						//For close and truncate
+#include <time.h>						//For timing the tests
+#include <math.h>						//For fabs and cexp
+#include <complex.h>					//For the FFTs
+#include <pthread.h>					//For a live ring written while it is read
+#include "MTrandom.h"					//For the tests' random inputs
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Trace.h"						//For writing and reading traces
+#include "FFT.h"						//For the transforms checked
+#include "Spatial_Kernel.h"				//Needed by Pressure_Field.h
+#include "Pressure_Field.h"				//For the grid pressure checked
+#include "Renewal.h"					//For the renewal engine checked
+#include "Posterior_Summary.h"			//Needed by Parallel_Tempering.h
+#include "Parallel_Tempering.h"			//For the run a live ring publishes
+#include "Live_Ring.h"					//For writing and reading live rings
+#include "Self_Test.h"					//For declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+
+#define TRACE_TEST_OBSERVED 40			//Observed cases of the chain recorded
+#define TRACE_TEST_UNOBSERVED 20		//Room for unobserved cases (parents of some observed ones)
+#define TRACE_TEST_SAMPLES 700			//Over TRACE_MAX_CHUNK_SAMPLES, so the trace has several chunks
+#define FFT_TEST_MAX 1024				//Longest transform checked against the direct sum
+#define FIELD_TEST_SOURCES 2000			//Sources of each pressure field, half of them in clusters
+#define FIELD_TEST_POINTS 400			//Points each field is read at (besides every tenth source)
+#define FIELD_TEST_AREA 300.0			//Side of the square the sources are in
+#define INCIDENCE_TEST_CASES 3000		//Cases counted, some with no subregion
+#define INCIDENCE_TEST_LOCATIONS 20
+#define INCIDENCE_TEST_ROUNDS 50		//Rounds of moves, each followed by queries
+#define INCIDENCE_TEST_QUERIES 200		//Queries of random ranges each round
+#define RENEWAL_TEST_CASES 5000			//Cases whose onsets are counted
+#define RENEWAL_TEST_LOCATIONS 12
+#define RENEWAL_TEST_ROUNDS 20			//Rounds of moves, with new parameters every other round
+#define LIVE_TEST_SAMPLES (3 * LIVE_RING_SLOTS + 100)	//Published in batches and read after each, so the ring wraps three times
+#define LIVE_TEST_RACING 2000000		//Then published by a thread while they are read
+
+struct self_test
+{
+	const char *name;
+	int (*run)(struct mt_state *rng, char *detail, size_t size);	//Returns the checks that failed, and says what it checked in detail
+};
+
+static int messages;					//Failures printed by the test running
+
+//Counts one failed check, printing it if the test has not printed too many already
+static int failed(const char *format, ...)
+{
+	va_list arguments;
+
+	if (messages++ < SELF_TEST_MAX_MESSAGES) {
+		printf("\t");
+		va_start(arguments, format);
+		vprintf(format, arguments);
+		va_end(arguments);
+		printf("\n");
+	}
+	return 1;
+}
+
+//An empty file for a test to write, in $TMPDIR (or /tmp)
+static void scratch_file(char *path, size_t size, const char *what)
+{
+	const char *directory = getenv("TMPDIR");
+	int descriptor;
+
+	snprintf(path, size, "%s/ebola_selftest_%s_XXXXXX", directory && directory[0] ? directory : "/tmp", what);
+	descriptor = mkstemp(path);
+	if (descriptor < 0) { printf("Could not make a scratch file %s.\n", path); exit(1); }
+	close(descriptor);
+}
+
+static int uniform_int(struct mt_state *rng, int low, int high)
+{
+	return low + (int)(genrand_real2_r(rng) * (high - low + 1));
+}
+
+/*-------------------------------
+| traces						|
+-------------------------------*/
+
+//What record_trace_sample should store for the chain as it is now
+static void expected_trace_sample(struct chain_state *chain, double *values, int *case_values)
+{
+	struct parameter_list *p = &chain->params;
+	p_patient current;
+	int i, k;
+
+	values[TRACE_LOG_LIK] = chain->log_lik;
+	values[TRACE_LOG_PRIOR] = chain->log_prior;
+	for (k = 0; k < 4; k++) {
+		values[TRACE_BETA + k] = p->beta[k];
+		values[TRACE_DUR_MEAN + k] = p->dur_mean[k];
+		values[TRACE_DUR_SIZE + k] = p->dur_size[k];
+	}
+	values[TRACE_P_DIAG] = p->p_diag;
+	values[TRACE_P_SURVIVE] = p->p_survive;
+	values[TRACE_UNOBSERVED] = chain->num_cases - chain->num_observed;
+	for (i = 0; i < chain->num_observed; i++) {
+		current = &chain->cases[i];
+		for (k = 0; k < 4; k++) case_values[i * NUM_TRACE_CASE_FIELDS + TRACE_DATES + k] = current->dates[k];
+		case_values[i * NUM_TRACE_CASE_FIELDS + TRACE_PARENT] = current->parent_case == NULL ? -1
+			: current->parent_case->index >= chain->num_observed ? -2 : current->parent_case->index;
+		case_values[i * NUM_TRACE_CASE_FIELDS + TRACE_TYPE] = current->transmission_type;
+		case_values[i * NUM_TRACE_CASE_FIELDS + TRACE_SURVIVE] = current->survive;
+	}
+}
+
+//Changes a few cases and values of the chain, as a sweep might (most columns stay the same, to
+//exercise the runs of no change)
+static void change_chain(struct mt_state *rng, struct chain_state *chain)
+{
+	p_patient current;
+	int n, k;
+
+	chain->log_lik = -1000 * genrand_real2_r(rng);
+	chain->log_prior = genrand_real2_r(rng) < 0.5 ? chain->log_prior : -10 * genrand_real2_r(rng);
+	chain->params.beta[uniform_int(rng, 0, 3)] = genrand_real2_r(rng);
+	if (genrand_real2_r(rng) < 0.1) chain->params.p_diag = genrand_real2_r(rng);
+	chain->num_cases = chain->num_observed + uniform_int(rng, 0, TRACE_TEST_UNOBSERVED);
+	for (n = uniform_int(rng, 0, 5); n > 0; n--) {
+		current = &chain->cases[uniform_int(rng, 0, chain->num_observed - 1)];
+		for (k = 0; k < 4; k++) current->dates[k] = uniform_int(rng, -1, NUMDAYS - 1);
+		k = uniform_int(rng, -1, TRACE_TEST_OBSERVED + TRACE_TEST_UNOBSERVED - 1);
+		current->parent_case = k < 0 ? NULL : &chain->cases[k];
+		current->transmission_type = uniform_int(rng, 0, 3);
+		current->survive = uniform_int(rng, 0, 1);
+	}
+}
+
+//Reads every sample of the trace back and compares it with what was recorded
+static int compare_trace(const char *path, long *sweeps, double *values, int *case_values, int num_samples, const char *which)
+{
+	struct trace_reader *reader = open_trace(path);
+	struct trace_sample sample;
+	int s, k, columns = TRACE_TEST_OBSERVED * NUM_TRACE_CASE_FIELDS, failures = 0;
+
+	if (trace_num_samples(reader) != num_samples || trace_num_cases(reader) != TRACE_TEST_OBSERVED) {
+		failures += failed("trace %s: %ld samples of %d cases read, %d of %d written", which, trace_num_samples(reader),
+			trace_num_cases(reader), num_samples, TRACE_TEST_OBSERVED);
+		close_trace(reader);
+		return failures;
+	}
+	allocate_trace_sample(reader, &sample);
+	for (s = 0; s < num_samples; s++) {
+		if (!read_trace_sample(reader, s, &sample)) { failures += failed("trace %s: sample %d could not be read", which, s); continue; }
+		if (sample.sweep != sweeps[s]) failures += failed("trace %s: sample %d has sweep %ld, not %ld", which, s, sample.sweep, sweeps[s]);
+		for (k = 0; k < NUM_TRACE_VALUES; k++)
+			if (memcmp(&sample.values[k], &values[s * NUM_TRACE_VALUES + k], sizeof(double)) != 0)
+				failures += failed("trace %s: sample %d has %s %.17g, not %.17g", which, s, trace_value_name(reader, k),
+					sample.values[k], values[s * NUM_TRACE_VALUES + k]);
+		for (k = 0; k < columns; k++)
+			if (sample.case_values[k] != case_values[(size_t)s * columns + k])
+				failures += failed("trace %s: sample %d has %d for field %d of case %d, not %d", which, s, sample.case_values[k],
+					k % NUM_TRACE_CASE_FIELDS, k / NUM_TRACE_CASE_FIELDS, case_values[(size_t)s * columns + k]);
+		if (find_trace_sweep(reader, sweeps[s]) != s)
+			failures += failed("trace %s: sweep %ld found at sample %ld, not %d", which, sweeps[s], find_trace_sweep(reader, sweeps[s]), s);
+	}
+	if (find_trace_sweep(reader, sweeps[num_samples - 1] + 1) != num_samples)
+		failures += failed("trace %s: a sweep after the last was found at sample %ld", which, find_trace_sweep(reader, sweeps[num_samples - 1] + 1));
+	mem_free(sample.case_values);
+	close_trace(reader);
+	return failures;
+}
+
+//The column codecs on awkward values, then a chain recorded by the writer thread and read back
+//sample by sample, with its index and again without (as a run that stopped without closing it)
+static int test_trace(struct mt_state *rng, char *detail, size_t size)
+{
+	int counts[] = { 0, 0, 0, 1, -1, 2147483647, -2147483647 - 1, 5, 5, 5, 5, -3, 1000000, 0 };
+	double doubles[] = { 0.0, -0.0, 1.0, 1.0, 1.0, 1e-300, -1e300, 3.141592653589793, 0.1, 0.1, -2.5, 1.0 / 3 };
+	int num_counts = sizeof(counts) / sizeof(int), num_doubles = sizeof(doubles) / sizeof(double);
+	int decoded_counts[sizeof(counts) / sizeof(int)];
+	double decoded_doubles[sizeof(doubles) / sizeof(double)];
+	unsigned char encoded[1024];
+	struct chain_state *chain;
+	struct trace_writer *writer;
+	struct trace_trailer trailer;
+	char path[300];
+	long *sweeps;
+	double *values;
+	int *case_values, s, k, columns = TRACE_TEST_OBSERVED * NUM_TRACE_CASE_FIELDS, failures = 0;
+	size_t length;
+	FILE *trace;
+
+	length = encode_counts(encoded, counts, num_counts);
+	if (decode_counts(encoded, decoded_counts, num_counts) != length || memcmp(counts, decoded_counts, sizeof(counts)) != 0)
+		failures += failed("encode_counts and decode_counts differ");
+	length = encode_doubles(encoded, doubles, num_doubles);
+	if (decode_doubles(encoded, decoded_doubles, num_doubles) != length || memcmp(doubles, decoded_doubles, sizeof(doubles)) != 0)
+		failures += failed("encode_doubles and decode_doubles differ");
+
+	chain = (struct chain_state*)mem_calloc(MEM_OTHER, 1, sizeof(struct chain_state));
+	if (chain) chain->cases = (struct patient*)mem_calloc(MEM_OTHER, TRACE_TEST_OBSERVED + TRACE_TEST_UNOBSERVED, sizeof(struct patient));
+	sweeps = (long*)mem_malloc(MEM_OTHER, TRACE_TEST_SAMPLES * sizeof(long));
+	values = (double*)mem_malloc(MEM_OTHER, TRACE_TEST_SAMPLES * NUM_TRACE_VALUES * sizeof(double));
+	case_values = (int*)mem_malloc(MEM_OTHER, (size_t)TRACE_TEST_SAMPLES * columns * sizeof(int));
+	if (!chain || !chain->cases || !sweeps || !values || !case_values) { printf("Could not allocate the chain in test_trace.\n"); exit(1); }
+	for (k = 0; k < TRACE_TEST_OBSERVED + TRACE_TEST_UNOBSERVED; k++) chain->cases[k].index = k;
+	chain->num_observed = chain->num_cases = TRACE_TEST_OBSERVED;
+	initialise_parameters(&chain->params);
+
+	scratch_file(path, sizeof(path), "trace");
+	writer = open_trace_writer(path, TRACE_TEST_OBSERVED, 10);
+	for (s = 0; s < TRACE_TEST_SAMPLES; s++) {
+		change_chain(rng, chain);
+		sweeps[s] = (s > 0 ? sweeps[s - 1] : 0) + uniform_int(rng, 1, 30);
+		expected_trace_sample(chain, values + s * NUM_TRACE_VALUES, case_values + (size_t)s * columns);
+		record_trace_sample(writer, sweeps[s], chain);
+	}
+	close_trace_writer(writer);
+	failures += compare_trace(path, sweeps, values, case_values, TRACE_TEST_SAMPLES, "with its index");
+
+	trace = fopen(path, "rb");
+	if (trace == NULL || fseek(trace, -(long)sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, trace) != 1)
+		failures += failed("the trailer of trace %s could not be read", path);
+	else if (truncate(path, trailer.index_offset) != 0) failures += failed("trace %s could not be cut short", path);
+	else failures += compare_trace(path, sweeps, values, case_values, TRACE_TEST_SAMPLES, "without its index");
+	if (trace) fclose(trace);
+
+	remove(path);
+	mem_free(case_values);
+	mem_free(values);
+	mem_free(sweeps);
+	mem_free(chain->cases);
+	mem_free(chain);
+	snprintf(detail, size, "%d samples of %d cases, with and without the index", TRACE_TEST_SAMPLES, TRACE_TEST_OBSERVED);
+	return failures;
+}
+
+/*-------------------------------
+| incidence counts				|
+-------------------------------*/
+
+//Random dates (a few outside the days counted), subregion and outcome
+static void random_case(struct mt_state *rng, p_patient current)
+{
+	int k;
+
+	current->location = genrand_real2_r(rng) < 0.05 ? NO_LOCATION : uniform_int(rng, 0, INCIDENCE_TEST_LOCATIONS - 1);
+	current->survive = uniform_int(rng, 0, 1);
+	current->dates[0] = uniform_int(rng, -3, NUMDAYS - 1);
+	for (k = 1; k < 4; k++) current->dates[k] = current->dates[k - 1] + uniform_int(rng, 0, 20);
+}
+
+//Events of a location from first_day to last_day, counted case by case
+static int direct_range(struct patient *cases, const char *counted, int location, int event, int first_day, int last_day)
+{
+	int i, day, total = 0;
+
+	if (location >= INCIDENCE_TEST_LOCATIONS) return 0;
+	for (i = 0; i < INCIDENCE_TEST_CASES; i++) {
+		if (!counted[i] || (location != INCIDENCE_ALL && cases[i].location != location)) continue;
+		if (event == INCIDENCE_BURIAL && cases[i].survive) continue;
+		day = cases[i].dates[event];
+		if (day >= first_day && day <= last_day && day >= 0 && day < NUMDAYS) total++;
+	}
+	return total;
+}
+
+//Fenwick counts of cases moved, taken away and put back, against counts case by case for random
+//subregions and ranges of days (some empty or past either end), and against check_incidence
+static int test_incidence(struct mt_state *rng, char *detail, size_t size)
+{
+	struct incidence_counts counts;
+	struct patient *cases;
+	p_patient first = NULL, current;
+	char *counted;
+	int old_dates[4], i, round, q, location, survive, event, first_day, last_day, expected, found, failures = 0;
+	long queries = 0;
+
+	cases = (struct patient*)mem_calloc(MEM_OTHER, INCIDENCE_TEST_CASES, sizeof(struct patient));
+	counted = (char*)mem_malloc(MEM_OTHER, INCIDENCE_TEST_CASES);
+	if (!cases || !counted) { printf("Could not allocate cases in test_incidence.\n"); exit(1); }
+	for (i = INCIDENCE_TEST_CASES - 1; i >= 0; i--) {
+		cases[i].index = i;
+		random_case(rng, &cases[i]);
+		if (i == 0) cases[i].location = INCIDENCE_TEST_LOCATIONS - 1;	//So every subregion has a tree
+		cases[i].next = first;
+		if (first) first->prev = &cases[i];
+		first = &cases[i];
+		counted[i] = 1;
+	}
+	build_incidence(&counts, first);
+
+	for (round = 0; round < INCIDENCE_TEST_ROUNDS; round++) {
+		for (q = 0; q < INCIDENCE_TEST_CASES / 20; q++) {
+			current = &cases[uniform_int(rng, 1, INCIDENCE_TEST_CASES - 1)];
+			if (!counted[current->index]) {							//Put back, with new dates
+				random_case(rng, current);
+				incidence_add_case(&counts, current, 1);
+				counted[current->index] = 1;
+				current->prev = &cases[0];
+				current->next = cases[0].next;
+				if (current->next) current->next->prev = current;
+				cases[0].next = current;
+			}
+			else if (genrand_real2_r(rng) < 0.1) {					//Taken away
+				incidence_add_case(&counts, current, -1);
+				counted[current->index] = 0;
+				current->prev->next = current->next;
+				if (current->next) current->next->prev = current->prev;
+			}
+			else {													//Dates moved, in its subregion
+				memcpy(old_dates, current->dates, sizeof(old_dates));
+				location = current->location;
+				survive = current->survive;
+				random_case(rng, current);
+				current->location = location;
+				current->survive = survive;
+				incidence_move_dates(&counts, current, old_dates);
+			}
+		}
+		for (q = 0; q < INCIDENCE_TEST_QUERIES; q++, queries++) {
+			location = uniform_int(rng, -2, INCIDENCE_TEST_LOCATIONS);
+			event = uniform_int(rng, 0, NUM_INCIDENCE_EVENTS - 1);
+			first_day = uniform_int(rng, -5, NUMDAYS + 5);
+			last_day = genrand_real2_r(rng) < 0.1 ? first_day - 1 : uniform_int(rng, first_day, NUMDAYS + 5);
+			expected = direct_range(cases, counted, location, event, first_day, last_day);
+			found = incidence_range(&counts, location, event, first_day, last_day);
+			if (found != expected)
+				failures += failed("round %d: %d events of type %d in location %d from day %d to %d, not %d", round, found, event,
+					location, first_day, last_day, expected);
+			expected = direct_range(cases, counted, location, INCIDENCE_ONSET, -1, last_day)
+				- direct_range(cases, counted, location, INCIDENCE_END, -1, first_day);
+			found = infectious_cases(&counts, location, first_day, last_day);
+			if (last_day >= first_day && found != expected)
+				failures += failed("round %d: %d cases infectious in location %d from day %d to %d, not %d", round, found, location,
+					first_day, last_day, expected);
+		}
+		if (check_incidence(&counts, &cases[0]) != 0) failures += failed("round %d: check_incidence found the counts wrong", round);
+	}
+	free_incidence(&counts);
+	mem_free(counted);
+	mem_free(cases);
+	snprintf(detail, size, "%d cases in %d subregions, %ld queries over %d rounds of moves", INCIDENCE_TEST_CASES,
+		INCIDENCE_TEST_LOCATIONS, queries, INCIDENCE_TEST_ROUNDS);
+	return failures;
+}
+
+/*-------------------------------
+| the FFT and pressure field	|
+-------------------------------*/
+
+//Transforms of every power of two up to FFT_TEST_MAX against the direct sum, and back again
+static int test_fft(struct mt_state *rng, char *detail, size_t size)
+{
+	double _Complex *a, *transformed, *twiddle, sum;
+	double scale, error, worst = 0;
+	int n, j, k, failures = 0;
+
+	a = (double _Complex*)mem_malloc(MEM_OTHER, FFT_TEST_MAX * sizeof(double _Complex));
+	transformed = (double _Complex*)mem_malloc(MEM_OTHER, FFT_TEST_MAX * sizeof(double _Complex));
+	twiddle = (double _Complex*)mem_malloc(MEM_OTHER, FFT_TEST_MAX * sizeof(double _Complex));
+	if (!a || !transformed || !twiddle) { printf("Could not allocate arrays in test_fft.\n"); exit(1); }
+	for (n = 1; n <= FFT_TEST_MAX; n *= 2) {
+		for (j = 0, scale = 0; j < n; j++) {
+			a[j] = (2 * genrand_real2_r(rng) - 1) + I * (2 * genrand_real2_r(rng) - 1);
+			transformed[j] = a[j];
+			scale += cabs(a[j]);
+		}
+		fft_twiddles(twiddle, n);
+		fft(transformed, n, twiddle, 0);
+		for (k = 0; k < n; k++) {
+			for (j = 0, sum = 0; j < n; j++) sum += a[j] * cexp(-2.0 * M_PI * I * (double)((long)j * k % n) / n);
+			error = cabs(transformed[k] - sum) / scale;
+			if (error > worst) worst = error;
+			if (error > 1e-12) failures += failed("fft of length %d: term %d is off by %.3g of the total", n, k, error);
+		}
+		fft(transformed, n, twiddle, 1);
+		for (j = 0; j < n; j++) {
+			error = cabs(transformed[j] / n - a[j]) / scale;
+			if (error > worst) worst = error;
+			if (error > 1e-12) failures += failed("fft of length %d: entry %d comes back off by %.3g of the total", n, j, error);
+		}
+	}
+	mem_free(a);
+	mem_free(transformed);
+	mem_free(twiddle);
+	snprintf(detail, size, "lengths 1 to %d, largest error %.2g of the total", FFT_TEST_MAX, worst);
+	return failures;
+}
+
+//Worst relative error of the field against the direct sum, at every tenth source and at points
+//spread over the area
+static double field_error(struct mt_state *rng, struct pressure_field *field, const double *x, const double *y)
+{
+	double exact, error, worst = 0, px, py;
+	int p;
+
+	for (p = 0; p < FIELD_TEST_SOURCES / 10 + FIELD_TEST_POINTS; p++) {
+		if (p < FIELD_TEST_SOURCES / 10) { px = x[10 * p]; py = y[10 * p]; }
+		else { px = FIELD_TEST_AREA * genrand_real2_r(rng); py = FIELD_TEST_AREA * genrand_real2_r(rng); }
+		exact = exact_pressure_at(field, px, py);
+		error = fabs(field_pressure_at(field, px, py) - exact) / exact;
+		if (error > worst) worst = error;
+	}
+	return worst;
+}
+
+//Grid pressure of clustered and scattered sources against exact_pressure_at, for kernels of
+//different scales and shapes, each again after the kernel changes
+static int test_field(struct mt_state *rng, char *detail, size_t size)
+{
+	double kernels[][3] = { { 5, 2, 0.01 }, { 2, 3, 0.005 }, { 20, 1.5, 0.02 }, { 1, 2, 0.01 } };	//Scale, exponent, tolerance
+	int num_kernels = sizeof(kernels) / sizeof(kernels[0]), k, s, failures = 0;
+	double *x, *y, *weight, centre_x = 0, centre_y = 0, error, worst = 0;
+	struct pressure_field field;
+
+	x = (double*)mem_malloc(MEM_OTHER, FIELD_TEST_SOURCES * sizeof(double));
+	y = (double*)mem_malloc(MEM_OTHER, FIELD_TEST_SOURCES * sizeof(double));
+	weight = (double*)mem_malloc(MEM_OTHER, FIELD_TEST_SOURCES * sizeof(double));
+	if (!x || !y || !weight) { printf("Could not allocate sources in test_field.\n"); exit(1); }
+	for (s = 0; s < FIELD_TEST_SOURCES; s++) {
+		if (s % 100 == 0) { centre_x = FIELD_TEST_AREA * genrand_real2_r(rng); centre_y = FIELD_TEST_AREA * genrand_real2_r(rng); }
+		if (s % 2 == 0) { x[s] = centre_x + 5 * rand_Normal_r(rng); y[s] = centre_y + 5 * rand_Normal_r(rng); }
+		else { x[s] = FIELD_TEST_AREA * genrand_real2_r(rng); y[s] = FIELD_TEST_AREA * genrand_real2_r(rng); }
+		if (x[s] < 0) x[s] = 0;
+		if (x[s] > FIELD_TEST_AREA) x[s] = FIELD_TEST_AREA;
+		if (y[s] < 0) y[s] = 0;
+		if (y[s] > FIELD_TEST_AREA) y[s] = FIELD_TEST_AREA;
+		weight[s] = 1 - genrand_real2_r(rng);
+	}
+	for (k = 0; k < num_kernels; k++) {
+		init_pressure_field(&field, 0, FIELD_TEST_AREA, 0, FIELD_TEST_AREA, kernels[k][0], kernels[k][1], kernels[k][2]);
+		load_field_sources(&field, x, y, weight, FIELD_TEST_SOURCES);
+		error = field_error(rng, &field, x, y);
+		if (error > worst) worst = error;
+		if (error > kernels[k][2])
+			failures += failed("field of scale %g and exponent %g: relative error %.3g, over the tolerance %g", kernels[k][0],
+				kernels[k][1], error, kernels[k][2]);
+		set_field_kernel(&field, 1.5 * kernels[k][0], kernels[k][1]);
+		load_field_sources(&field, x, y, weight, FIELD_TEST_SOURCES);
+		error = field_error(rng, &field, x, y);
+		if (error > worst) worst = error;
+		if (error > kernels[k][2])
+			failures += failed("field of scale %g (changed from %g) and exponent %g: relative error %.3g, over the tolerance %g",
+				1.5 * kernels[k][0], kernels[k][0], kernels[k][1], error, kernels[k][2]);
+		free_pressure_field(&field);
+	}
+	mem_free(x);
+	mem_free(y);
+	mem_free(weight);
+	snprintf(detail, size, "%d kernels, %d sources, largest relative error %.2g", 2 * num_kernels, FIELD_TEST_SOURCES, worst);
+	return failures;
+}
+
+/*-------------------------------
+| the renewal engine			|
+-------------------------------*/
+
+//Largest difference of the engine's expected onsets and diagnoses from the convolutions of the
+//onsets counted here with its profiles, summed day by day
+static double renewal_error(struct renewal_engine *engine, const double *onsets)
+{
+	double onset_sum, diagnosis_sum, difference, worst = 0;
+	long row;
+	int l, t, s;
+
+	for (l = 0; l < RENEWAL_TEST_LOCATIONS; l++) {
+		row = (long)l * NUMDAYS;
+		for (t = 0; t < NUMDAYS; t++) {
+			onset_sum = diagnosis_sum = 0;
+			for (s = 0; s <= t; s++) {
+				onset_sum += onsets[row + t - s] * engine->generation[s];
+				diagnosis_sum += onsets[row + t - s] * engine->delay[s];
+			}
+			difference = fabs(onset_sum - engine->expected_onsets[row + t]);
+			if (difference > worst) worst = difference;
+			difference = fabs(diagnosis_sum - engine->expected_diagnoses[row + t]);
+			if (difference > worst) worst = difference;
+			if (onsets[row + t] != engine->onsets[row + t]) worst = 1e300;
+		}
+	}
+	return worst;
+}
+
+//Expected onsets and diagnoses by FFT and by moves of single onsets, through changes of the
+//parameters, against direct convolutions of the onsets counted case by case
+static int test_renewal(struct mt_state *rng, char *detail, size_t size)
+{
+	struct renewal_engine *engine;
+	struct parameter_list params;
+	struct patient *cases;
+	p_patient first = NULL, current;
+	double *onsets, error, worst = 0;
+	int i, k, round, from, failures = 0;
+
+	cases = (struct patient*)mem_calloc(MEM_OTHER, RENEWAL_TEST_CASES, sizeof(struct patient));
+	onsets = (double*)mem_calloc(MEM_OTHER, (long)RENEWAL_TEST_LOCATIONS * NUMDAYS, sizeof(double));
+	if (!cases || !onsets) { printf("Could not allocate cases in test_renewal.\n"); exit(1); }
+	for (i = RENEWAL_TEST_CASES - 1; i >= 0; i--) {
+		cases[i].location = genrand_real2_r(rng) < 0.05 ? NO_LOCATION : uniform_int(rng, 0, RENEWAL_TEST_LOCATIONS - 1);
+		cases[i].dates[1] = uniform_int(rng, -2, NUMDAYS - 1);
+		if (cases[i].location >= 0 && cases[i].dates[1] >= 0) onsets[(long)cases[i].location * NUMDAYS + cases[i].dates[1]]++;
+		cases[i].next = first;
+		first = &cases[i];
+	}
+	memset(&params, 0, sizeof(struct parameter_list));
+	initialise_parameters(&params);
+	engine = create_renewal(first, RENEWAL_TEST_LOCATIONS, &params);
+	error = renewal_error(engine, onsets);
+	if (error > worst) worst = error;
+	if (error > RENEWAL_DRIFT) failures += failed("renewal from the cases: off by %.3g from the direct sums", error);
+
+	for (round = 0; round < RENEWAL_TEST_ROUNDS; round++) {
+		for (k = 0; k < RENEWAL_TEST_CASES / 10; k++) {
+			current = &cases[uniform_int(rng, 0, RENEWAL_TEST_CASES - 1)];
+			from = current->dates[1];
+			current->dates[1] = uniform_int(rng, -2, NUMDAYS - 1);
+			renewal_move_onset(engine, current->location, from, current->dates[1]);
+			if (current->location < 0) continue;
+			if (from >= 0) onsets[(long)current->location * NUMDAYS + from]--;
+			if (current->dates[1] >= 0) onsets[(long)current->location * NUMDAYS + current->dates[1]]++;
+		}
+		error = renewal_error(engine, onsets);
+		if (error > worst) worst = error;
+		if (error > RENEWAL_DRIFT) failures += failed("round %d, after moves: off by %.3g from the direct sums", round, error);
+		if (round % 2 == 1) {
+			for (k = 1; k < NUM_TRANS_TYPES; k++) params.beta[k] *= 0.8 + 0.45 * genrand_real2_r(rng);
+			k = uniform_int(rng, 0, NUM_DURATIONS - 1);
+			params.dur_mean[k] *= 0.8 + 0.45 * genrand_real2_r(rng);
+			if (round % 4 == 1) params.p_diag = 0.3 + 0.6 * genrand_real2_r(rng);
+			set_renewal_parameters(engine, &params);
+			refresh_renewal(engine);
+			error = renewal_error(engine, onsets);
+			if (error > worst) worst = error;
+			if (error > RENEWAL_DRIFT) failures += failed("round %d, after new parameters: off by %.3g from the direct sums", round, error);
+		}
+	}
+	if (check_renewal(engine) > RENEWAL_DRIFT) failures += failed("check_renewal found the expected values wrong");
+	free_renewal(engine);
+	mem_free(onsets);
+	mem_free(cases);
+	snprintf(detail, size, "%d cases in %d subregions over %d rounds, largest difference %.2g", RENEWAL_TEST_CASES,
+		RENEWAL_TEST_LOCATIONS, RENEWAL_TEST_ROUNDS, worst);
+	return failures;
+}
+
+/*-------------------------------
+| live rings					|
+-------------------------------*/
+
+//A writer publishing samples from a thread of its own
+struct live_test_writer
+{
+	struct live_ring *ring;
+	struct sampler_run *run;
+	long first;
+	long count;
+	int done;
+};
+
+//Sets the run to a state that depends only on n, so a sample read can be checked against its number
+static void set_live_state(struct sampler_run *run, long n)
+{
+	struct chain_state *cold = &run->chains[run->ladder.chain_on_rung[0]];
+	int k, m;
+
+	run->sweeps_done = 5 * n + 5;
+	cold->log_lik = -0.25 * n;
+	cold->log_prior = 0.5 * n;
+	for (k = 0; k < 4; k++) {
+		cold->params.beta[k] = n + 0.125 * k;
+		cold->params.dur_mean[k] = 2 * n + k;
+		cold->params.dur_size[k] = 3 * n + k;
+	}
+	cold->params.p_diag = 1e-6 * n;
+	cold->params.p_survive = 2e-6 * n;
+	cold->num_cases = cold->num_observed + n % 1000;
+	for (m = 0; m < NUM_MOVE_TYPES; m++) {
+		run->chains[0].proposed[m] = n * (m + 1);
+		run->chains[0].accepted[m] = n * m;
+		run->chains[1].proposed[m] = n;
+	}
+	run->ladder.swap_rate[0] = 1.0 / (n + 1);
+}
+
+//1 if the sample is the one set_live_state made for n, published after n / 100 seconds
+static int live_sample_matches(const struct live_sample *sample, long n)
+{
+	int k, m;
+
+	if (sample->sample != n || sample->sweep != 5 * n + 5 || sample->seconds != 0.01 * n) return 0;
+	if (sample->values[TRACE_LOG_LIK] != -0.25 * n || sample->values[TRACE_LOG_PRIOR] != 0.5 * n) return 0;
+	for (k = 0; k < 4; k++)
+		if (sample->values[TRACE_BETA + k] != n + 0.125 * k || sample->values[TRACE_DUR_MEAN + k] != 2 * n + k
+			|| sample->values[TRACE_DUR_SIZE + k] != 3 * n + k) return 0;
+	if (sample->values[TRACE_P_DIAG] != 1e-6 * n || sample->values[TRACE_P_SURVIVE] != 2e-6 * n
+		|| sample->values[TRACE_UNOBSERVED] != n % 1000) return 0;
+	for (m = 0; m < NUM_MOVE_TYPES; m++)
+		if (sample->proposed[m] != n * (m + 2) || sample->accepted[m] != n * m) return 0;
+	if (sample->swap_rate[0] != 1.0 / (n + 1)) return 0;
+	for (k = 1; k < LIVE_MAX_RUNGS; k++) if (sample->swap_rate[k] != 0) return 0;
+	return 1;
+}
+
+static void *live_writer_main(void *arg)
+{
+	struct live_test_writer *writer = (struct live_test_writer*)arg;
+	long n;
+
+	for (n = writer->first; n < writer->first + writer->count; n++) {
+		set_live_state(writer->run, n);
+		publish_live_sample(writer->ring, writer->run, 0.01 * n);
+	}
+	__atomic_store_n(&writer->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+//A ring published in batches and read after each - samples still in the ring must come back as
+//written, older ones as lost, later ones as not there yet - then published by a thread while read,
+//where a sample read must never be a mix of two
+static int test_live(struct mt_state *rng, char *detail, size_t size)
+{
+	struct sampler_run *run;
+	struct live_ring *ring;
+	struct live_reader *reader;
+	struct live_sample sample;
+	struct live_test_writer writer;
+	pthread_t thread;
+	char name[64];
+	long n, published = 0, read_back = 0, lost = 0, racing_reads = 0, racing_lost = 0;
+	int result, failures = 0;
+
+	run = (struct sampler_run*)mem_calloc(MEM_OTHER, 1, sizeof(struct sampler_run));
+	if (run) run->chains = (struct chain_state*)mem_calloc(MEM_OTHER, 2, sizeof(struct chain_state));
+	if (!run || !run->chains) { printf("Could not allocate the run in test_live.\n"); exit(1); }
+	run->settings.num_chains = 2;
+	run->settings.num_sweeps = 5 * (LIVE_TEST_SAMPLES + LIVE_TEST_RACING);
+	allocate_ladder(&run->ladder, 2);
+	run->ladder.chain_on_rung[0] = 1;
+	run->ladder.chain_on_rung[1] = 0;
+
+	snprintf(name, sizeof(name), "ebola_selftest_%ld", (long)getpid());
+	ring = open_live_ring(name, run);
+	reader = ring ? attach_live_ring(name) : NULL;
+	if (!reader) {
+		if (ring) close_live_ring(ring);
+		failures += failed("the live ring %s could not be made and attached", name);
+	}
+	else {
+		if (live_ring_header(reader)->num_chains != 2 || live_ring_header(reader)->pid != (long)getpid())
+			failures += failed("the header read does not match the run");
+		while (published < LIVE_TEST_SAMPLES) {
+			for (n = uniform_int(rng, 1, LIVE_RING_SLOTS / 3); n > 0 && published < LIVE_TEST_SAMPLES; n--, published++) {
+				set_live_state(run, published);
+				publish_live_sample(ring, run, 0.01 * published);
+			}
+			if (live_samples_published(reader) != published)
+				failures += failed("%ld samples published, %ld seen", published, live_samples_published(reader));
+			for (n = 0; n <= published; n++) {
+				result = read_live_sample(reader, n, &sample);
+				if (n == published ? result != 0 : n < published - LIVE_RING_SLOTS ? result != -1 : result != 1)
+					failures += failed("sample %ld of %ld published: read gave %d", n, published, result);
+				else if (result == 1 && !live_sample_matches(&sample, n)) failures += failed("sample %ld was not read as written", n);
+				read_back += result == 1;
+				lost += result == -1;
+			}
+		}
+
+		writer.ring = ring;
+		writer.run = run;
+		writer.first = published;
+		writer.count = LIVE_TEST_RACING;
+		writer.done = 0;
+		if (pthread_create(&thread, NULL, live_writer_main, &writer) != 0) { printf("Could not start the writer in test_live.\n"); exit(1); }
+		while (!__atomic_load_n(&writer.done, __ATOMIC_ACQUIRE)) {
+			n = live_samples_published(reader) - 1 - uniform_int(rng, 0, LIVE_RING_SLOTS + 50);
+			if (n < 0) continue;
+			result = read_live_sample(reader, n, &sample);
+			if (result == 1 && !live_sample_matches(&sample, n)) failures += failed("sample %ld was read torn while being written", n);
+			racing_reads += result == 1;
+			racing_lost += result == -1;
+		}
+		pthread_join(thread, NULL);
+		close_live_ring(ring);
+		if (!live_ring_header(reader)->finished) failures += failed("the ring was closed but not marked finished");
+		detach_live_ring(reader);
+	}
+	mem_free(run->ladder.heat);
+	mem_free(run->ladder.log_gap);
+	mem_free(run->ladder.chain_on_rung);
+	mem_free(run->ladder.swaps_proposed);
+	mem_free(run->ladder.swaps_accepted);
+	mem_free(run->ladder.swap_rate);
+	mem_free(run->chains);
+	mem_free(run);
+	snprintf(detail, size, "%ld samples read back and %ld lost to wrapping, then %ld read of %d published by a thread (%ld lost)",
+		read_back, lost, racing_reads, LIVE_TEST_RACING, racing_lost);
+	return failures;
+}
+
+/*-------------------------------
+| running the tests				|
+-------------------------------*/
+
+static const struct self_test tests[] = {
+	{ "trace", test_trace },
+	{ "fft", test_fft },
+	{ "field", test_field },
+	{ "incidence", test_incidence },
+	{ "renewal", test_renewal },
+	{ "live", test_live },
+};
+
+//Runs every test (which = all) or the one named. Returns the number of tests that failed, or -1 if
+//there is no test of that name.
+int run_self_tests(const char *which, unsigned long seed)
+{
+	int num_tests = sizeof(tests) / sizeof(struct self_test), t, failures, num_failed = 0, num_run = 0;
+	struct mt_state rng;
+	struct timespec start, end;
+	char detail[200];
+
+	for (t = 0; t < num_tests; t++) {
+		if (strcmp(which, "all") != 0 && strcmp(which, tests[t].name) != 0) continue;
+		init_genrand_r(&rng, seed + t);
+		messages = 0;
+		detail[0] = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		failures = tests[t].run(&rng, detail, sizeof(detail));
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (failures > 0) printf("%-10s FAILED %d checks (%s)\n", tests[t].name, failures, detail);
+		else printf("%-10s ok (%s, %.2f s)\n", tests[t].name, detail, (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec));
+		num_failed += failures > 0;
+		num_run++;
+	}
+	if (num_run == 0) {
+		printf("There is no self-test called %s. Tests are all", which);
+		for (t = 0; t < num_tests; t++) printf(", %s", tests[t].name);
+		printf(".\n");
+		return -1;
+	}
+	printf("%d of %d self-tests passed.\n", num_run - num_failed, num_run);
+	return num_failed;
+}
@@ -0,0 +1,16 @@
+/********************************************************************************
+*	Self_Test.h																	*
+*	Contains:																	*
+*		- Checks of the fast paths against slow, direct versions of the same	*
+*			work on random inputs from the seed, run from the built program		*
+*			with -selftest (all of them, or one by name)						*
+*		- Functions defined in Self_Test.c										*
+********************************************************************************/
+
+#define SELF_TEST_MAX_MESSAGES 5		//Failures printed for each test (the rest are only counted)
+
+/****************************************
+* Functions defined in Self_Test.c		*
+****************************************/
+
+int run_self_tests(const char *which, unsigned long seed);
@@ -0,0 +1,301 @@
+/********************************************************************************
+*	Spatial_Kernel.c															*
+*	Subregions, the kernel between them and the pressure it spreads (see		*
+*		Spatial_Kernel.h).														*
+*	Subregions are numbered as the reports are read (assign_previous_dates),	*
+*		so cases carry a number and names are only compared here, once.			*
+*	Distances are worked out once, when the kernel is set up; a change of		*
+*		parameters only marks the kernel stale, and the next refresh takes one	*
+*		exp per pair kept. The pairs a sparse kernel keeps are fixed by the		*
+*		parameters it was set up with.											*
+*	Pressure is built in two steps: each subregion's own infectious load per	*
+*		day (from a running sum over the cases' infectious windows), then the	*
+*		kernel applied to every day's loads at once.							*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For strcmp and memset
+#include <math.h>						//For log, exp and sqrt
+#include "Date_And_Reading_Reports.h"	//For the case, report and parameter structures
+#include "Likelihood.h"					//For the infectious windows of a case
+#include "Spatial_Kernel.h"				//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+
+/*-------------------------------
+| subregions					|
+-------------------------------*/
+
+static unsigned long hash_name(const char *country, const char *subregion)
+{
+	unsigned long hash = 14695981039346656037UL;
+	const char *c;
+
+	for (c = country; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+	hash = (hash ^ ',') * 1099511628211UL;
+	for (c = subregion; *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+	return hash;
+}
+
+//Slot holding the subregion, or the empty slot where it would go
+static int *find_slot(struct location_table *table, const char *country, const char *subregion)
+{
+	unsigned long slot;
+	int *found;
+
+	for (slot = hash_name(country, subregion) & (table->num_slots - 1); *(found = &table->slot[slot]) >= 0;
+		slot = (slot + 1) & (table->num_slots - 1))
+		if (strcmp(table->subregion[*found], subregion) == 0 && strcmp(table->country[*found], country) == 0) break;
+	return found;
+}
+
+//Names the subregions by the numbers the reports were given (each report's location)
+void build_location_table(struct location_table *table, struct current_case_report *reports, int num_reports)
+{
+	int n, l;
+
+	table->num_locations = 0;
+	for (n = 0; n < num_reports; n++) if (reports[n].location >= table->num_locations) table->num_locations = reports[n].location + 1;
+	l = table->num_locations > 0 ? table->num_locations : 1;
+	table->country = (char(*)[50])mem_calloc(MEM_SPATIAL, l, sizeof(*table->country));
+	table->subregion = (char(*)[100])mem_calloc(MEM_SPATIAL, l, sizeof(*table->subregion));
+	table->x = (double*)mem_calloc(MEM_SPATIAL, l, sizeof(double));
+	table->y = (double*)mem_calloc(MEM_SPATIAL, l, sizeof(double));
+	table->has_coordinates = (char*)mem_calloc(MEM_SPATIAL, l, sizeof(char));
+	for (table->num_slots = 16; table->num_slots < 2UL * l; table->num_slots *= 2);
+	table->slot = (int*)mem_malloc(MEM_SPATIAL, table->num_slots * sizeof(int));
+	if (!table->country || !table->subregion || !table->x || !table->y || !table->has_coordinates || !table->slot) {
+		printf("Could not allocate the subregions in build_location_table.\n");
+		exit(1);
+	}
+	memset(table->slot, 0xff, table->num_slots * sizeof(int));
+	for (n = 0; n < num_reports; n++) {
+		l = reports[n].location;
+		if (l < 0 || table->country[l][0] || table->subregion[l][0]) continue;		//Named by an earlier report
+		memcpy(table->country[l], reports[n].country, sizeof(table->country[l]));
+		memcpy(table->subregion[l], reports[n].subregion, sizeof(table->subregion[l]));
+		*find_slot(table, table->country[l], table->subregion[l]) = l;
+	}
+}
+
+//Number of a subregion (NO_LOCATION if it is not among the reports)
+int find_location(struct location_table *table, const char *country, const char *subregion)
+{
+	int found = *find_slot(table, country, subregion);
+
+	return found >= 0 ? found : NO_LOCATION;
+}
+
+//Reads coordinates from a file with a heading and then rows of country,subregion,x,y. Rows for
+//subregions not among the reports are skipped. Returns the number of subregions given coordinates.
+int read_location_coordinates(struct location_table *table, const char *file_name)
+{
+	FILE *input = fopen(file_name, "r");
+	char line[400], *country, *subregion, *rest, *comma;
+	int l, matched = 0;
+	double x, y;
+
+	if (!input) { printf("Could not open %s to read the coordinates of the subregions.\n", file_name); exit(1); }
+	fgets(line, sizeof(line), input);		//Heading
+	while (fgets(line, sizeof(line), input)) {
+		country = line;
+		if (!(comma = strchr(country, ','))) continue;
+		*comma = 0;
+		subregion = comma + 1;
+		if (!(comma = strchr(subregion, ','))) continue;
+		*comma = 0;
+		rest = comma + 1;
+		if (sscanf(rest, "%lf,%lf", &x, &y) != 2) continue;
+		if ((l = find_location(table, country, subregion)) == NO_LOCATION) continue;
+		matched += !table->has_coordinates[l];
+		table->x[l] = x;
+		table->y[l] = y;
+		table->has_coordinates[l] = 1;
+	}
+	fclose(input);
+	return matched;
+}
+
+void free_location_table(struct location_table *table)
+{
+	mem_free(table->country);
+	mem_free(table->subregion);
+	mem_free(table->x);
+	mem_free(table->y);
+	mem_free(table->has_coordinates);
+	mem_free(table->slot);
+}
+
+/*-------------------------------
+| the kernel					|
+-------------------------------*/
+
+//log of the distance between two subregions (infinity if either has no coordinates)
+static float log_distance(struct location_table *table, int a, int b)
+{
+	double dx, dy;
+
+	if (a == b) return -INFINITY;
+	if (!table->has_coordinates[a] || !table->has_coordinates[b]) return INFINITY;
+	dx = table->x[a] - table->x[b];
+	dy = table->y[a] - table->y[b];
+	return dx == 0 && dy == 0 ? -INFINITY : (float)(0.5 * log(dx * dx + dy * dy));
+}
+
+void init_spatial_kernel(struct spatial_kernel *kernel, struct location_table *table, double scale, double exponent)
+{
+	int L = table->num_locations, to, from;
+	long e;
+	float log_radius, d;
+
+	memset(kernel, 0, sizeof(struct spatial_kernel));
+	kernel->num_locations = L;
+	kernel->sparse = L > SPATIAL_DENSE_LIMIT;
+	if (!kernel->sparse) {
+		kernel->num_entries = (long)L * L;
+		kernel->log_distance = (float*)mem_malloc(MEM_SPATIAL, (kernel->num_entries > 0 ? kernel->num_entries : 1) * sizeof(float));
+		if (!kernel->log_distance) { printf("Could not allocate the kernel in init_spatial_kernel.\n"); exit(1); }
+		for (to = 0, e = 0; to < L; to++) for (from = 0; from < L; from++) kernel->log_distance[e++] = log_distance(table, to, from);
+	}
+	else {
+		//Pairs out to where the kernel falls to SPATIAL_KERNEL_TAIL - counted first, then filled in
+		log_radius = (float)(log(scale) + log(1.0 / SPATIAL_KERNEL_TAIL - 1.0) / exponent);
+		kernel->row_start = (int*)mem_malloc(MEM_SPATIAL, (L + 1) * sizeof(int));
+		if (!kernel->row_start) { printf("Could not allocate the kernel in init_spatial_kernel.\n"); exit(1); }
+		kernel->row_start[0] = 0;
+		for (to = 0; to < L; to++) {
+			for (from = 0, e = 0; from < L; from++) e += log_distance(table, to, from) <= log_radius;
+			kernel->row_start[to + 1] = kernel->row_start[to] + (int)e;
+		}
+		kernel->num_entries = kernel->row_start[L];
+		kernel->column = (int*)mem_malloc(MEM_SPATIAL, (kernel->num_entries > 0 ? kernel->num_entries : 1) * sizeof(int));
+		kernel->log_distance = (float*)mem_malloc(MEM_SPATIAL, (kernel->num_entries > 0 ? kernel->num_entries : 1) * sizeof(float));
+		if (!kernel->column || !kernel->log_distance) { printf("Could not allocate the kernel in init_spatial_kernel.\n"); exit(1); }
+		for (to = 0, e = 0; to < L; to++)
+			for (from = 0; from < L; from++)
+				if ((d = log_distance(table, to, from)) <= log_radius) {
+					kernel->column[e] = from;
+					kernel->log_distance[e++] = d;
+				}
+	}
+	kernel->value = (double*)mem_malloc(MEM_SPATIAL, (kernel->num_entries > 0 ? kernel->num_entries : 1) * sizeof(double));
+	if (!kernel->value) { printf("Could not allocate the kernel in init_spatial_kernel.\n"); exit(1); }
+	kernel->scale = scale;
+	kernel->exponent = exponent;
+	kernel->stale = 1;
+	refresh_spatial_kernel(kernel);
+}
+
+//Only marks the kernel stale - it is worked out again when next used
+void set_kernel_parameters(struct spatial_kernel *kernel, double scale, double exponent)
+{
+	if (scale == kernel->scale && exponent == kernel->exponent) return;
+	kernel->scale = scale;
+	kernel->exponent = exponent;
+	kernel->stale = 1;
+}
+
+//1 / (1 + (d / scale)^exponent) for every pair kept, as 1 / (1 + exp(exponent * (log d - log scale)))
+void refresh_spatial_kernel(struct spatial_kernel *kernel)
+{
+	double log_scale = log(kernel->scale), exponent = kernel->exponent;
+	long e;
+
+	if (!kernel->stale) return;
+	for (e = 0; e < kernel->num_entries; e++)
+		kernel->value[e] = 1.0 / (1.0 + exp(exponent * (kernel->log_distance[e] - log_scale)));
+	kernel->stale = 0;
+	kernel->refreshes++;
+}
+
+double spatial_kernel_value(struct spatial_kernel *kernel, int to, int from)
+{
+	int lo, hi, e;
+
+	refresh_spatial_kernel(kernel);
+	if (!kernel->sparse) return kernel->value[(long)to * kernel->num_locations + from];
+	for (lo = kernel->row_start[to], hi = kernel->row_start[to + 1]; lo < hi; ) {		//Columns are in order
+		e = (lo + hi) / 2;
+		if (kernel->column[e] < from) lo = e + 1;
+		else hi = e;
+	}
+	return lo < kernel->row_start[to + 1] && kernel->column[lo] == from ? kernel->value[lo] : 0.0;
+}
+
+void free_spatial_kernel(struct spatial_kernel *kernel)
+{
+	mem_free(kernel->row_start);
+	mem_free(kernel->column);
+	mem_free(kernel->log_distance);
+	mem_free(kernel->value);
+}
+
+/*-------------------------------
+| pressure						|
+-------------------------------*/
+
+//load[location * NUMDAYS + day]: sum over the location's cases infectious that day of the rate of
+//each way they can transmit (beta[1] to beta[3]). Cases with no location add nothing.
+void location_load(p_patient first, struct parameter_list *p_params, int num_locations, double *load)
+{
+	p_patient current;
+	double *row;
+	int type, start, end, day;
+
+	memset(load, 0, (size_t)num_locations * NUMDAYS * sizeof(double));
+	for (current = first; current; current = current->next) {		//Changes of load, at the start and end of each window
+		if (current->location < 0 || current->location >= num_locations) continue;
+		row = &load[(long)current->location * NUMDAYS];
+		for (type = 1; type < NUM_TRANS_TYPES; type++) {
+			if (!infectious_window(current, type, &start, &end)) continue;
+			if (start < 0) start = 0;
+			if (start >= NUMDAYS) continue;
+			row[start] += p_params->beta[type];
+			if (end < NUMDAYS) row[end] -= p_params->beta[type];
+		}
+	}
+	for (row = load; row < load + (long)num_locations * NUMDAYS; row += NUMDAYS)	//Running sums give the load
+		for (day = 1; day < NUMDAYS; day++) row[day] += row[day - 1];
+}
+
+//pressure[to * NUMDAYS + day] = sum over from of kernel(to, from) * load[from * NUMDAYS + day]
+void spatial_pressure(struct spatial_kernel *kernel, const double *load, double *pressure)
+{
+	int to, from, day;
+	long e, end;
+	double k, *out;
+	const double *in;
+
+	refresh_spatial_kernel(kernel);
+	memset(pressure, 0, (size_t)kernel->num_locations * NUMDAYS * sizeof(double));
+	for (to = 0; to < kernel->num_locations; to++) {
+		out = &pressure[(long)to * NUMDAYS];
+		e = kernel->sparse ? kernel->row_start[to] : (long)to * kernel->num_locations;
+		end = kernel->sparse ? kernel->row_start[to + 1] : e + kernel->num_locations;
+		for (; e < end; e++) {
+			if ((k = kernel->value[e]) == 0.0) continue;
+			from = kernel->sparse ? kernel->column[e] : (int)(e - (long)to * kernel->num_locations);
+			in = &load[(long)from * NUMDAYS];
+			for (day = 0; day < NUMDAYS; day++) out[day] += k * in[day];
+		}
+	}
+}
+
+//Rows of subregion, day, its own load and the pressure on it, for days with either
+void write_spatial_pressure(const char *file_name, struct location_table *table, const double *load, const double *pressure)
+{
+	FILE *output = fopen(file_name, "w");
+	int l, day;
+	long cell;
+
+	if (!output) { printf("Could not open %s to write the spatial pressure.\n", file_name); exit(1); }
+	fprintf(output, "country,subregion,day,load,pressure\n");
+	for (l = 0; l < table->num_locations; l++)
+		for (day = 0; day < NUMDAYS; day++) {
+			cell = (long)l * NUMDAYS + day;
+			if (load[cell] > 1e-12 || pressure[cell] > 1e-12)
+				fprintf(output, "%s,%s,%d,%.6g,%.6g\n", table->country[l], table->subregion[l], day, load[cell], pressure[cell]);
+		}
+	fclose(output);
+}
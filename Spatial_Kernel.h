@@ -0,0 +1,74 @@
+/********************************************************************************
+*	Spatial_Kernel.h															*
+*	Contains:																	*
+*		- The subregions of the reports, numbered once as they are read			*
+*			(current_case_report.location, patient.location), with their		*
+*			coordinates where known												*
+*		- A kernel between every pair of subregions, worked out once per set	*
+*			of kernel parameters rather than per pair of cases: dense for few	*
+*			subregions, and sparse (pairs out to where the kernel falls below	*
+*			SPATIAL_KERNEL_TAIL) above SPATIAL_DENSE_LIMIT						*
+*		- Infectious pressure on each subregion per day, from the cases of		*
+*			every subregion through the kernel, so the cost goes with the		*
+*			number of subregions squared rather than of cases					*
+*		- Functions defined in Spatial_Kernel.c									*
+*	Needs Date_And_Reading_Reports.h first.										*
+********************************************************************************/
+
+//Default settings (each can be changed on the command line)
+#define DEFAULT_KERNEL_SCALE 10.0		//Distance at which the kernel has halved (in the units of the coordinates)
+#define DEFAULT_KERNEL_EXPONENT 2.0		//How fast it falls beyond: 1 / (1 + (distance / scale)^exponent)
+
+#define SPATIAL_DENSE_LIMIT 2048		//Kernels over more subregions are kept sparse
+#define SPATIAL_KERNEL_TAIL 1e-6		//Sparse kernels leave out pairs below this (the kernel is 1 at distance 0)
+
+/************************************************
+* Structures of the subregions and kernel		*
+************************************************/
+
+//Subregions by number, with a hash table to find them by name
+struct location_table
+{
+	int num_locations;
+	char (*country)[50];
+	char (*subregion)[100];
+	double *x;						//Coordinates, if has_coordinates
+	double *y;
+	char *has_coordinates;			//A subregion without them only reaches itself
+	int *slot;						//Open-addressed on country and subregion (-1 if empty)
+	unsigned long num_slots;
+};
+
+//kernel(to, from) for every pair kept. The log distances are kept, so new parameters only
+//take one exp per pair; pairs with no distance (no coordinates) have a log distance of infinity.
+struct spatial_kernel
+{
+	int num_locations;
+	int sparse;						//0: every pair, row by row; 1: rows of the pairs kept
+	long num_entries;
+	int *row_start;					//Sparse only: row to's pairs are row_start[to] to row_start[to + 1] - 1...
+	int *column;					//...from column[e]
+	float *log_distance;			//log_distance[e] (-infinity for a subregion with itself)
+	double *value;					//value[e]: the kernel (stale until refreshed)
+	double scale;					//Parameters the kernel is for
+	double exponent;
+	int stale;						//1 once the parameters change, until refresh_spatial_kernel
+	long refreshes;
+};
+
+/****************************************
+* Functions defined in Spatial_Kernel.c	*
+****************************************/
+
+void build_location_table(struct location_table *table, struct current_case_report *reports, int num_reports);
+int find_location(struct location_table *table, const char *country, const char *subregion);
+int read_location_coordinates(struct location_table *table, const char *file_name);
+void free_location_table(struct location_table *table);
+void init_spatial_kernel(struct spatial_kernel *kernel, struct location_table *table, double scale, double exponent);
+void set_kernel_parameters(struct spatial_kernel *kernel, double scale, double exponent);
+void refresh_spatial_kernel(struct spatial_kernel *kernel);
+double spatial_kernel_value(struct spatial_kernel *kernel, int to, int from);
+void free_spatial_kernel(struct spatial_kernel *kernel);
+void location_load(p_patient first, struct parameter_list *p_params, int num_locations, double *load);
+void spatial_pressure(struct spatial_kernel *kernel, const double *load, double *pressure);
+void write_spatial_pressure(const char *file_name, struct location_table *table, const double *load, const double *pressure);
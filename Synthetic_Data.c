@@ -0,0 +1,120 @@
+/********************************************************************************
+*	Synthetic_Data.c															*
+*	Writes synthetic case files of any size, for testing and benchmarking at	*
+*		the scale of the full dataset and beyond.								*
+*	Each subregion reports on evenly spaced days (from a random offset).		*
+*		With chance SYNTHETIC_OUTBREAK_CHANCE it has an outbreak with a			*
+*		normal curve, whose expected cases since the subregion's last report	*
+*		give a Poisson count. Rows are written a day at a time, in date order,	*
+*		so the file is streamed and any number of rows takes little memory.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <math.h>						//For erf (the outbreak curves)
+#include "MTrandom.h"					//For random number generation
+#include "Date_And_Reading_Reports.h"	//For the layout of the case file
+#include "Synthetic_Data.h"				//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+
+//How one subregion reports
+struct synthetic_location
+{
+	int num_reports;
+	int next_report;		//Reports made so far
+	double offset;			//Day of the first report
+	double interval;		//Days between reports
+	int last_day;			//Day of the last report (-1 before the first)
+	double size;			//Expected cases of the outbreak (0 for none)
+	double peak;
+	double width;
+};
+
+void default_synthetic_settings(struct synthetic_settings *settings)
+{
+	settings->num_rows = 1000;
+	settings->num_locations = DEFAULT_SYNTHETIC_LOCATIONS;
+	settings->num_days = DEFAULT_SYNTHETIC_DAYS;
+	settings->start_day = 1;
+	settings->start_month = 1;
+	settings->start_year = 2014;
+	settings->mean_cases = DEFAULT_SYNTHETIC_CASES;
+	settings->seed = 1;
+}
+
+static int days_in_month(int month, int year)
+{
+	static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if (month == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)) return 29;
+	return days[month - 1];
+}
+
+//Expected cases of an outbreak up to (and including) day
+static double cumulative_cases(struct synthetic_location *location, int day)
+{
+	if (location->size == 0) return 0;
+	return location->size * 0.5 * (1 + erf((day + 0.5 - location->peak) / (location->width * sqrt(2.0))));
+}
+
+//Writes the rows to file_name. Returns the number written (the settings' num_locations is raised
+//if the rows cannot otherwise fit).
+long write_synthetic_reports(const char *file_name, struct synthetic_settings *settings)
+{
+	FILE *output;
+	struct synthetic_location *locations, *location;
+	struct mt_state rng;
+	int l, day, d = settings->start_day, m = settings->start_month, y = settings->start_year;
+	long rows = 0, cases;
+	double expected;
+
+	if (settings->num_days < 1 || settings->num_rows < 1) { printf("Nothing to write in write_synthetic_reports.\n"); exit(1); }
+	if (settings->num_locations < 1) settings->num_locations = 1;
+	if (settings->num_rows > (long)settings->num_locations * settings->num_days)
+		settings->num_locations = (int)((settings->num_rows + settings->num_days - 1) / settings->num_days);
+	locations = (struct synthetic_location*)mem_malloc(MEM_OTHER, settings->num_locations * sizeof(struct synthetic_location));
+	if (!locations) { printf("Could not allocate locations in write_synthetic_reports.\n"); exit(1); }
+	output = fopen(file_name, "w");
+	if (!output) { printf("Could not open %s to write synthetic reports.\n", file_name); exit(1); }
+	setvbuf(output, NULL, _IOFBF, 1 << 20);
+
+	init_genrand_r(&rng, settings->seed);
+	for (l = 0; l < settings->num_locations; l++) {
+		location = &locations[l];
+		location->num_reports = (int)(settings->num_rows / settings->num_locations + (l < settings->num_rows % settings->num_locations));
+		location->next_report = 0;
+		location->interval = location->num_reports > 0 ? (double)settings->num_days / location->num_reports : 0;
+		location->offset = uniform_r(&rng) * location->interval;
+		location->last_day = -1;
+		location->size = uniform_r(&rng) < SYNTHETIC_OUTBREAK_CHANCE ? -settings->mean_cases * log(uniform_r(&rng)) : 0;
+		location->peak = uniform_r(&rng) * settings->num_days;
+		location->width = SYNTHETIC_MIN_WIDTH + uniform_r(&rng) * (SYNTHETIC_MAX_WIDTH - SYNTHETIC_MIN_WIDTH);
+	}
+
+	fprintf(output, "Country,Localite,Value,Date\n");
+	for (day = 0; day < settings->num_days; day++) {
+		for (l = 0; l < settings->num_locations; l++) {
+			location = &locations[l];
+			if (location->next_report == location->num_reports
+				|| (int)(location->offset + location->next_report * location->interval) != day) continue;
+			expected = cumulative_cases(location, day) - cumulative_cases(location, location->last_day)
+				+ SYNTHETIC_SPORADIC_RATE * (day - location->last_day);
+			cases = rpois_r(&rng, expected);
+			fprintf(output, "Country %d,Subregion %d,%ld,%d/%d/%d\n", l / SYNTHETIC_SUBREGIONS_PER_COUNTRY + 1, l + 1, cases, d, m, y);
+			location->last_day = day;
+			location->next_report++;
+			rows++;
+		}
+		if (++d > days_in_month(m, y)) {
+			d = 1;
+			if (++m > 12) {
+				m = 1;
+				y++;
+			}
+		}
+	}
+	fclose(output);
+	mem_free(locations);
+	return rows;
+}
@@ -0,0 +1,39 @@
+/********************************************************************************
+*	Synthetic_Data.h															*
+*	Contains:																	*
+*		- Settings of a synthetic case file: rows in the layout of the real	*
+*			data (country, subregion, cases, date) for many subregions over	*
+*			a long span, each subregion with its own epidemic curve				*
+*		- Functions defined in Synthetic_Data.c									*
+*	Needs Date_And_Reading_Reports.h first.										*
+********************************************************************************/
+
+//Default settings (each can be changed on the command line)
+#define DEFAULT_SYNTHETIC_LOCATIONS 200
+#define DEFAULT_SYNTHETIC_DAYS 1095			//Three years
+#define DEFAULT_SYNTHETIC_CASES 50.0		//Mean size of a subregion's outbreak
+
+#define SYNTHETIC_SUBREGIONS_PER_COUNTRY 50
+#define SYNTHETIC_OUTBREAK_CHANCE 0.4		//Chance that a subregion has an outbreak at all...
+#define SYNTHETIC_SPORADIC_RATE 0.002		//...and cases a day that it reports anyway
+#define SYNTHETIC_MIN_WIDTH 10.0			//Standard deviation of an outbreak's curve, in days,
+#define SYNTHETIC_MAX_WIDTH 60.0			//drawn uniformly from this range
+
+struct synthetic_settings
+{
+	long num_rows;
+	int num_locations;		//Raised if needed so that no subregion reports more than once a day
+	int num_days;
+	int start_day;			//Date of the first day
+	int start_month;
+	int start_year;
+	double mean_cases;		//Mean size of an outbreak (sizes are exponentially distributed)
+	unsigned long seed;
+};
+
+/****************************************
+* Functions defined in Synthetic_Data.c	*
+****************************************/
+
+void default_synthetic_settings(struct synthetic_settings *settings);
+long write_synthetic_reports(const char *file_name, struct synthetic_settings *settings);
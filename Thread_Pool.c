@@ -0,0 +1,154 @@
+/********************************************************************************
+*	Thread_Pool.c																*
+*	A fixed pool of worker threads. The thread calling run_pool_tasks works as	*
+*		thread 0, so a pool of n threads starts n - 1 workers. Tasks are		*
+*		claimed one at a time from a shared counter, so slow tasks (e.g. hot	*
+*		chains with more accepted moves) don't hold up the other threads.		*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>			//For standard input/output functions
+#include <stdlib.h>			//For memory allocation
+#include <unistd.h>			//For sysconf (number of cores)
+#include <pthread.h>		//For POSIX threads
+#include "Thread_Pool.h"	//For declarations of functions in this file
+#include "Memory.h"			//For memory accounting
+#include "Placement.h"		//For spreading workers over NUMA nodes
+
+struct thread_pool
+{
+	int num_threads;			//Including the calling thread
+	pthread_t *workers;			//num_threads - 1 worker threads
+	pthread_mutex_t lock;
+	pthread_cond_t start;		//Signalled when a new batch of tasks is ready
+	pthread_cond_t finished;	//Signalled when the last worker leaves a batch
+	long batch;					//Number of the current batch - workers wait for this to change
+	int shutdown;				//Set to make the workers exit
+	pool_task task;				//Current batch
+	void *arg;
+	int num_tasks;
+	int next_task;				//Next unclaimed task number
+	int busy_workers;			//Workers still working on the current batch
+};
+
+struct worker_start
+{
+	struct thread_pool *pool;
+	int thread;
+};
+
+int number_of_cores()
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (int)cores : 1;
+}
+
+//Claims and runs tasks of the current batch until there are none left
+static void work_on_batch(struct thread_pool *pool, int thread)
+{
+	int task;
+
+	for (;;) {
+		task = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED);
+		if (task >= pool->num_tasks) return;
+		pool->task(pool->arg, task, thread);
+	}
+}
+
+static void *worker_main(void *start)
+{
+	struct thread_pool *pool = ((struct worker_start*)start)->pool;
+	int thread = ((struct worker_start*)start)->thread;
+	long seen = 0;
+
+	mem_free(start);
+	if (numa_placement()) bind_thread_to_node(thread % num_nodes());	//Worker t on node t, round the nodes
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->batch == seen && !pool->shutdown)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->shutdown) break;
+		seen = pool->batch;
+		pthread_mutex_unlock(&pool->lock);
+
+		work_on_batch(pool, thread);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy_workers == 0) pthread_cond_signal(&pool->finished);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct thread_pool *create_thread_pool(int num_threads)
+{
+	int i;
+	struct thread_pool *pool;
+	struct worker_start *start;
+
+	if (num_threads < 1) num_threads = 1;
+	pool = (struct thread_pool*)mem_calloc(MEM_THREADS, 1, sizeof(struct thread_pool));
+	if (!pool) { printf("Could not allocate pool in create_thread_pool.\n"); exit(1); }
+	pool->num_threads = num_threads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+
+	pool->workers = (pthread_t*)mem_malloc(MEM_THREADS, num_threads * sizeof(pthread_t));
+	if (!pool->workers) { printf("Could not allocate workers in create_thread_pool.\n"); exit(1); }
+	for (i = 1; i < num_threads; i++) {
+		start = (struct worker_start*)mem_malloc(MEM_THREADS, sizeof(struct worker_start));
+		if (!start) { printf("Could not allocate start in create_thread_pool.\n"); exit(1); }
+		start->pool = pool;
+		start->thread = i;
+		if (pthread_create(&pool->workers[i], NULL, worker_main, start) != 0) {
+			printf("Could not start worker thread %d in create_thread_pool.\n", i);
+			exit(1);
+		}
+	}
+	return pool;
+}
+
+//Runs task(arg, t, thread) for t = 0 to num_tasks - 1 across the pool, and returns when all are done
+void run_pool_tasks(struct thread_pool *pool, pool_task task, void *arg, int num_tasks)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->num_tasks = num_tasks;
+	pool->next_task = 0;
+	pool->busy_workers = pool->num_threads - 1;
+	pool->batch++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	work_on_batch(pool, 0);		//The calling thread works too
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy_workers > 0)
+		pthread_cond_wait(&pool->finished, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_size(struct thread_pool *pool)
+{
+	return pool->num_threads;
+}
+
+void destroy_thread_pool(struct thread_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 1; i < pool->num_threads; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->finished);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	mem_free(pool->workers);
+	mem_free(pool);
+}
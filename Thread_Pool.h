@@ -0,0 +1,23 @@
+/********************************************************************************
+*	Thread_Pool.h																*
+*	Contains:																	*
+*		- A fixed pool of worker threads (POSIX threads) that run a batch of	*
+*			numbered tasks and then wait for the next batch						*
+*		- Functions defined in Thread_Pool.c									*
+********************************************************************************/
+
+//A task is called once for each task number in [0, num_tasks), on whichever thread claims it.
+//thread is the number of that thread in [0, num_threads) - use it to pick per-thread scratch space.
+typedef void (*pool_task)(void *arg, int task, int thread);
+
+struct thread_pool;		//Defined in Thread_Pool.c - only used through the functions below
+
+/****************************************
+* Functions defined in Thread_Pool.c	*
+****************************************/
+
+int number_of_cores();
+struct thread_pool *create_thread_pool(int num_threads);
+void run_pool_tasks(struct thread_pool *pool, pool_task task, void *arg, int num_tasks);
+int pool_size(struct thread_pool *pool);
+void destroy_thread_pool(struct thread_pool *pool);
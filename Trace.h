@@ -0,0 +1,123 @@
+/********************************************************************************
+*	Trace.h																		*
+*	Contains:																	*
+*		- The layout of a trace file: samples of the cold chain (parameters,	*
+*			likelihood and every observed case's dates and parent), stored		*
+*			by column in compressed chunks, with an index of chunks at the end	*
+*		- Functions defined in Trace_Writer.c and Trace_Reader.c				*
+*	Needs MTrandom.h, Date_And_Reading_Reports.h, Likelihood.h and				*
+*		Gibbs_Sampler.h first.													*
+********************************************************************************/
+
+#define TRACE_MAGIC "EBOLATRC"			//First 8 bytes of every trace file
+#define TRACE_INDEX_MAGIC "EBOLAIDX"	//Last 8 bytes of a trace file that was closed properly
+#define TRACE_CHUNK_MAGIC "CHNK"		//Start of every chunk (so a trace without an index can be scanned)
+#define TRACE_VERSION 2
+#define TRACE_MAX_CHUNK_SAMPLES 256		//Samples per chunk (fewer if they would take more than TRACE_CHUNK_BYTES)
+#define TRACE_CHUNK_BYTES (1 << 22)		//Rough size of a chunk before compression
+#define TRACE_QUEUE_CHUNKS 16			//Full chunks that may wait for the disk before samples are dropped
+#define DEFAULT_TRACE_INTERVAL 10		//Sweeps between samples (when a trace file is given)
+
+//Values recorded once per sample
+#define NUM_TRACE_VALUES 17
+#define TRACE_LOG_LIK 0
+#define TRACE_LOG_PRIOR 1
+#define TRACE_BETA 2					//beta[0..3]
+#define TRACE_DUR_MEAN 6				//dur_mean[0..3]
+#define TRACE_DUR_SIZE 10				//dur_size[0..3]
+#define TRACE_P_DIAG 14
+#define TRACE_P_SURVIVE 15
+#define TRACE_UNOBSERVED 16				//Number of unobserved cases (which are not recorded one by one)
+
+//Fields recorded for every observed case in every sample
+#define NUM_TRACE_CASE_FIELDS 7
+#define TRACE_DATES 0					//dates[0..3]
+#define TRACE_PARENT 4					//Position of the parent in the chain's block of cases (-1 if zoonotic, -2 if unobserved)
+#define TRACE_TYPE 5					//transmission_type
+#define TRACE_SURVIVE 6
+
+/************************************************
+* Structures of a trace file					*
+************************************************/
+
+struct trace_file_header
+{
+	char magic[8];
+	int version;
+	int num_cases;
+	int num_values;				//NUM_TRACE_VALUES
+	int num_case_fields;		//NUM_TRACE_CASE_FIELDS
+	int chunk_samples;			//Most samples in one chunk
+	int unused;
+	long interval;				//Sweeps between samples
+	char value_names[NUM_TRACE_VALUES][16];
+};
+
+//Each chunk holds the sweep numbers (less first_sweep), then each value, then each field of each
+//case, every column compressed on its own: a column of whole numbers is stored as differences from
+//the previous sample (zigzag varints, with runs of no change stored as a count), and a column of
+//doubles as the XOR with the previous sample, keeping only its non-zero bytes.
+struct trace_chunk_header
+{
+	char magic[4];
+	int num_samples;
+	long first_sweep;
+	long last_sweep;
+	long encoded_size;			//Bytes of compressed columns after this header
+};
+
+struct trace_index_entry
+{
+	long offset;				//Of the chunk header from the start of the file
+	long first_sample;			//Number of samples in the file before this chunk
+	long first_sweep;
+	long last_sweep;
+	long num_samples;
+};
+
+//Written after the index when the trace is closed
+struct trace_trailer
+{
+	long index_offset;
+	long num_chunks;
+	long num_samples;
+	char magic[8];
+};
+
+//One sample as handed back by the reader
+struct trace_sample
+{
+	long sweep;
+	double values[NUM_TRACE_VALUES];
+	int *case_values;			//case_values[case * NUM_TRACE_CASE_FIELDS + field]
+};
+
+struct trace_writer;	//Defined in Trace_Writer.c - only used through the functions below
+struct trace_reader;	//Defined in Trace_Reader.c - only used through the functions below
+
+/****************************************
+* Functions defined in Trace_Writer.c	*
+****************************************/
+
+struct trace_writer *open_trace_writer(const char *file_name, int num_cases, long interval);
+void record_trace_sample(struct trace_writer *writer, long sweep, struct chain_state *chain);
+void close_trace_writer(struct trace_writer *writer);
+size_t encode_counts(unsigned char *out, const int *column, int length);
+size_t encode_doubles(unsigned char *out, const double *column, int length);
+
+/****************************************
+* Functions defined in Trace_Reader.c	*
+****************************************/
+
+struct trace_reader *open_trace(const char *file_name);
+int trace_num_cases(struct trace_reader *reader);
+long trace_num_samples(struct trace_reader *reader);
+const char *trace_value_name(struct trace_reader *reader, int value);
+void allocate_trace_sample(struct trace_reader *reader, struct trace_sample *sample);
+int read_trace_sample(struct trace_reader *reader, long sample_number, struct trace_sample *sample);
+long find_trace_sweep(struct trace_reader *reader, long sweep);
+void trace_sample_parameters(struct trace_sample *sample, struct parameter_list *p_params);
+int read_trace_parameters(const char *file_name, long sample_number, struct parameter_list *p_params);
+void close_trace(struct trace_reader *reader);
+size_t decode_counts(const unsigned char *in, int *column, int length);
+size_t decode_doubles(const unsigned char *in, double *column, int length);
@@ -0,0 +1,340 @@
+/********************************************************************************
+*	Trace_Reader.c																*
+*	Reads samples back from a trace file (layout in Trace.h), by position or	*
+*		by sweep. Only the chunk holding the sample asked for is read and		*
+*		decompressed, and it is kept until a sample from another chunk is		*
+*		wanted, so reading samples in order decodes each chunk once.			*
+*	A trace whose run stopped before it was closed has no index - the chunks	*
+*		are then found by stepping through their headers.						*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcpy
+#include "MTrandom.h"					//Needed by Gibbs_Sampler.h
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//Needed by Gibbs_Sampler.h
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//Needed by Trace.h
+#include "Trace.h"						//For structures and declarations of functions needed in this file
+#include "Memory.h"						//For memory accounting
+#include "Log.h"						//For warnings
+
+struct trace_reader
+{
+	char file_name[200];
+	FILE *input;
+	struct trace_file_header header;
+	struct trace_index_entry *index;
+	long num_chunks;
+	long num_samples;
+	long cached_chunk;			//Chunk whose columns are decoded below (-1 for none)
+	unsigned char *encoded;
+	size_t encoded_size;
+	int *sweep;
+	double *values;				//values[value * chunk_samples + s]
+	int *case_values;			//case_values[(case * NUM_TRACE_CASE_FIELDS + field) * chunk_samples + s]
+};
+
+/*-------------------------------
+| decompression of columns		|
+-------------------------------*/
+
+static size_t get_varint(const unsigned char *in, unsigned long *value)
+{
+	size_t n = 0;
+	int shift = 0;
+
+	*value = 0;
+	do {
+		*value |= (unsigned long)(in[n] & 0x7f) << shift;
+		shift += 7;
+	} while (in[n++] & 0x80);
+	return n;
+}
+
+//Undoes encode_counts in Trace_Writer.c
+size_t decode_counts(const unsigned char *in, int *column, int length)
+{
+	size_t n = 0;
+	unsigned long zigzag, run;
+	long previous = 0;
+	int s;
+
+	for (s = 0; s < length; s++) {
+		n += get_varint(in + n, &zigzag);
+		previous += (long)(zigzag >> 1) ^ -(long)(zigzag & 1);
+		column[s] = (int)previous;
+		if (zigzag == 0) {
+			n += get_varint(in + n, &run);
+			while (run-- > 0 && s + 1 < length) column[++s] = (int)previous;
+		}
+	}
+	return n;
+}
+
+//Undoes encode_doubles in Trace_Writer.c
+size_t decode_doubles(const unsigned char *in, double *column, int length)
+{
+	size_t n = 0;
+	unsigned long long previous = 0, x;
+	unsigned long run;
+	int s, lead, trail, b, code;
+
+	for (s = 0; s < length; s++) {
+		code = in[n++];
+		if (code == 0) {
+			memcpy(&column[s], &previous, sizeof(double));
+			n += get_varint(in + n, &run);
+			while (run-- > 0 && s + 1 < length) memcpy(&column[++s], &previous, sizeof(double));
+			continue;
+		}
+		lead = (code - 1) / 8;
+		trail = (code - 1) % 8;
+		x = 0;
+		for (b = trail; b < 8 - lead; b++) x |= (unsigned long long)in[n++] << (8 * b);
+		previous ^= x;
+		memcpy(&column[s], &previous, sizeof(double));
+	}
+	return n;
+}
+
+/*-------------------------------
+| opening a trace				|
+-------------------------------*/
+
+static void add_index_entry(struct trace_reader *reader, long *index_size, long offset, struct trace_chunk_header *chunk)
+{
+	if (reader->num_chunks == *index_size) {
+		*index_size = *index_size ? 2 * *index_size : 256;
+		reader->index = (struct trace_index_entry*)mem_realloc(MEM_IO, reader->index, *index_size * sizeof(struct trace_index_entry));
+		if (!reader->index) { printf("Could not grow index in open_trace.\n"); exit(1); }
+	}
+	reader->index[reader->num_chunks].offset = offset;
+	reader->index[reader->num_chunks].first_sample = reader->num_samples;
+	reader->index[reader->num_chunks].first_sweep = chunk->first_sweep;
+	reader->index[reader->num_chunks].last_sweep = chunk->last_sweep;
+	reader->index[reader->num_chunks].num_samples = chunk->num_samples;
+	reader->num_chunks++;
+	reader->num_samples += chunk->num_samples;
+}
+
+//Rebuilds the index of a trace that was never closed, keeping every complete chunk
+static void scan_chunks(struct trace_reader *reader, long file_size)
+{
+	struct trace_chunk_header chunk;
+	long offset = sizeof(struct trace_file_header), index_size = 0;
+
+	while (offset + (long)sizeof(chunk) <= file_size) {
+		fseek(reader->input, offset, SEEK_SET);
+		if (fread(&chunk, sizeof(chunk), 1, reader->input) != 1 || memcmp(chunk.magic, TRACE_CHUNK_MAGIC, 4) != 0
+			|| chunk.num_samples < 1 || chunk.num_samples > reader->header.chunk_samples
+			|| offset + (long)sizeof(chunk) + chunk.encoded_size > file_size) break;
+		add_index_entry(reader, &index_size, offset, &chunk);
+		offset += sizeof(chunk) + chunk.encoded_size;
+	}
+	log_warn(LOG_MAIN, "Trace %s was not closed - found %ld complete chunks.", reader->file_name, reader->num_chunks);
+}
+
+struct trace_reader *open_trace(const char *file_name)
+{
+	struct trace_reader *reader;
+	struct trace_trailer trailer;
+	long file_size;
+	size_t columns;
+
+	reader = (struct trace_reader*)mem_calloc(MEM_IO, 1, sizeof(struct trace_reader));
+	if (!reader) { printf("Could not allocate reader in open_trace.\n"); exit(1); }
+	strncpy(reader->file_name, file_name, sizeof(reader->file_name) - 1);
+	reader->input = fopen(file_name, "rb");
+	if (reader->input == NULL) { printf("Trace file %s could not be opened.\n", file_name); exit(1); }
+	if (fread(&reader->header, sizeof(reader->header), 1, reader->input) != 1
+		|| memcmp(reader->header.magic, TRACE_MAGIC, 8) != 0) {
+		printf("%s is not a trace file.\n", file_name);
+		exit(1);
+	}
+	if (reader->header.version != TRACE_VERSION || reader->header.num_values != NUM_TRACE_VALUES
+		|| reader->header.num_case_fields != NUM_TRACE_CASE_FIELDS || reader->header.chunk_samples < 1) {
+		printf("Trace %s was written by a different version of the code.\n", file_name);
+		exit(1);
+	}
+
+	fseek(reader->input, 0, SEEK_END);
+	file_size = ftell(reader->input);
+	trailer.magic[0] = 0;
+	if (file_size >= (long)(sizeof(reader->header) + sizeof(trailer))) {
+		fseek(reader->input, file_size - sizeof(trailer), SEEK_SET);
+		if (fread(&trailer, sizeof(trailer), 1, reader->input) != 1) trailer.magic[0] = 0;
+	}
+	if (memcmp(trailer.magic, TRACE_INDEX_MAGIC, 8) == 0) {
+		reader->num_chunks = trailer.num_chunks;
+		reader->num_samples = trailer.num_samples;
+		reader->index = (struct trace_index_entry*)mem_malloc(MEM_IO, (trailer.num_chunks > 0 ? trailer.num_chunks : 1) * sizeof(struct trace_index_entry));
+		if (!reader->index) { printf("Could not allocate index in open_trace.\n"); exit(1); }
+		fseek(reader->input, trailer.index_offset, SEEK_SET);
+		if (fread(reader->index, sizeof(struct trace_index_entry), trailer.num_chunks, reader->input) != (size_t)trailer.num_chunks) {
+			printf("Could not read the index of trace %s.\n", file_name);
+			exit(1);
+		}
+	}
+	else scan_chunks(reader, file_size);
+
+	columns = (size_t)reader->header.num_cases * NUM_TRACE_CASE_FIELDS * reader->header.chunk_samples;
+	reader->sweep = (int*)mem_malloc(MEM_IO, reader->header.chunk_samples * sizeof(int));
+	reader->values = (double*)mem_malloc(MEM_IO, NUM_TRACE_VALUES * reader->header.chunk_samples * sizeof(double));
+	reader->case_values = (int*)mem_malloc(MEM_IO, (columns > 0 ? columns : 1) * sizeof(int));
+	if (!reader->sweep || !reader->values || !reader->case_values) { printf("Could not allocate columns in open_trace.\n"); exit(1); }
+	reader->cached_chunk = -1;
+	return reader;
+}
+
+int trace_num_cases(struct trace_reader *reader)
+{
+	return reader->header.num_cases;
+}
+
+long trace_num_samples(struct trace_reader *reader)
+{
+	return reader->num_samples;
+}
+
+const char *trace_value_name(struct trace_reader *reader, int value)
+{
+	return reader->header.value_names[value];
+}
+
+void allocate_trace_sample(struct trace_reader *reader, struct trace_sample *sample)
+{
+	sample->case_values = (int*)mem_malloc(MEM_IO, ((size_t)reader->header.num_cases * NUM_TRACE_CASE_FIELDS + 1) * sizeof(int));
+	if (!sample->case_values) { printf("Could not allocate sample in allocate_trace_sample.\n"); exit(1); }
+}
+
+/*-------------------------------
+| reading samples				|
+-------------------------------*/
+
+static void load_chunk(struct trace_reader *reader, long c)
+{
+	struct trace_chunk_header header;
+	size_t n = 0;
+	int k, length, stride = reader->header.chunk_samples;
+	int columns = reader->header.num_cases * NUM_TRACE_CASE_FIELDS;
+
+	fseek(reader->input, reader->index[c].offset, SEEK_SET);
+	if (fread(&header, sizeof(header), 1, reader->input) != 1 || memcmp(header.magic, TRACE_CHUNK_MAGIC, 4) != 0) {
+		printf("Trace %s is damaged at chunk %ld.\n", reader->file_name, c);
+		exit(1);
+	}
+	if ((size_t)header.encoded_size > reader->encoded_size) {
+		reader->encoded_size = header.encoded_size;
+		reader->encoded = (unsigned char*)mem_realloc(MEM_IO, reader->encoded, reader->encoded_size);
+		if (!reader->encoded) { printf("Could not allocate encoded in read_trace_sample.\n"); exit(1); }
+	}
+	if (fread(reader->encoded, 1, header.encoded_size, reader->input) != (size_t)header.encoded_size) {
+		printf("Trace %s ends in the middle of chunk %ld.\n", reader->file_name, c);
+		exit(1);
+	}
+
+	length = header.num_samples;
+	n += decode_counts(reader->encoded + n, reader->sweep, length);
+	for (k = 0; k < NUM_TRACE_VALUES; k++)
+		n += decode_doubles(reader->encoded + n, reader->values + k * stride, length);
+	for (k = 0; k < columns; k++)
+		n += decode_counts(reader->encoded + n, reader->case_values + (size_t)k * stride, length);
+	if (n != (size_t)header.encoded_size) {
+		printf("Trace %s is damaged at chunk %ld.\n", reader->file_name, c);
+		exit(1);
+	}
+	reader->cached_chunk = c;
+}
+
+//Chunk holding sample number sample_number (there are few chunks, so a binary search is plenty)
+static long chunk_of_sample(struct trace_reader *reader, long sample_number)
+{
+	long low = 0, high = reader->num_chunks - 1, middle;
+
+	while (low < high) {
+		middle = (low + high + 1) / 2;
+		if (reader->index[middle].first_sample <= sample_number) low = middle;
+		else high = middle - 1;
+	}
+	return low;
+}
+
+//Fills sample with sample number sample_number (counting from 0). Returns 0 if there is no such sample.
+int read_trace_sample(struct trace_reader *reader, long sample_number, struct trace_sample *sample)
+{
+	long c;
+	int s, k, stride = reader->header.chunk_samples;
+	int columns = reader->header.num_cases * NUM_TRACE_CASE_FIELDS;
+
+	if (sample_number < 0 || sample_number >= reader->num_samples) return 0;
+	c = chunk_of_sample(reader, sample_number);
+	if (c != reader->cached_chunk) load_chunk(reader, c);
+	s = (int)(sample_number - reader->index[c].first_sample);
+
+	sample->sweep = reader->index[c].first_sweep + reader->sweep[s];
+	for (k = 0; k < NUM_TRACE_VALUES; k++) sample->values[k] = reader->values[k * stride + s];
+	for (k = 0; k < columns; k++) sample->case_values[k] = reader->case_values[(size_t)k * stride + s];
+	return 1;
+}
+
+//Number of the first sample taken at or after sweep (trace_num_samples if there is none)
+long find_trace_sweep(struct trace_reader *reader, long sweep)
+{
+	long low = 0, high = reader->num_chunks, middle;
+	int s;
+
+	while (low < high) {		//First chunk that ends at or after sweep
+		middle = (low + high) / 2;
+		if (reader->index[middle].last_sweep < sweep) low = middle + 1;
+		else high = middle;
+	}
+	if (low == reader->num_chunks) return reader->num_samples;
+	if (low != reader->cached_chunk) load_chunk(reader, low);
+	for (s = 0; reader->index[low].first_sweep + reader->sweep[s] < sweep; s++);
+	return reader->index[low].first_sample + s;
+}
+
+//The parameters of a sample
+void trace_sample_parameters(struct trace_sample *sample, struct parameter_list *p_params)
+{
+	int k;
+
+	for (k = 0; k < NUM_TRANS_TYPES; k++) p_params->beta[k] = sample->values[TRACE_BETA + k];
+	for (k = 0; k < NUM_DURATIONS; k++) {
+		p_params->dur_mean[k] = sample->values[TRACE_DUR_MEAN + k];
+		p_params->dur_size[k] = sample->values[TRACE_DUR_SIZE + k];
+	}
+	p_params->p_diag = sample->values[TRACE_P_DIAG];
+	p_params->p_survive = sample->values[TRACE_P_SURVIVE];
+}
+
+//Sets the parameters to those of sample sample_number of the trace file_name (the last sample if
+//sample_number is negative). Returns 0, changing nothing, if there is no such sample.
+int read_trace_parameters(const char *file_name, long sample_number, struct parameter_list *p_params)
+{
+	struct trace_reader *reader = open_trace(file_name);
+	struct trace_sample sample;
+	int found;
+
+	allocate_trace_sample(reader, &sample);
+	if (sample_number < 0) sample_number = reader->num_samples - 1;
+	found = read_trace_sample(reader, sample_number, &sample);
+	if (found) trace_sample_parameters(&sample, p_params);
+	mem_free(sample.case_values);
+	close_trace(reader);
+	return found;
+}
+
+void close_trace(struct trace_reader *reader)
+{
+	fclose(reader->input);
+	mem_free(reader->index);
+	mem_free(reader->encoded);
+	mem_free(reader->sweep);
+	mem_free(reader->values);
+	mem_free(reader->case_values);
+	mem_free(reader);
+}
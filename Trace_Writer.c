@@ -0,0 +1,394 @@
+/********************************************************************************
+*	Trace_Writer.c																*
+*	Records samples of the cold chain to a trace file (layout in Trace.h)		*
+*		without ever making the sampler wait for the disk.						*
+*	The sampler copies each sample into the columns of the chunk it is			*
+*		filling. Full chunks go through a lock-free single-producer,			*
+*		single-consumer ring to a background thread, which compresses and		*
+*		writes them and hands the empty chunks back through a second ring.		*
+*	If the disk falls TRACE_QUEUE_CHUNKS chunks behind, samples are dropped		*
+*		(and counted) rather than stalling the sampler.							*
+********************************************************************************/
+
+//preprocessor directives
+#include <stdio.h>						//For standard input/output functions
+#include <stdlib.h>						//For memory allocation
+#include <string.h>						//For memcpy
+#include <unistd.h>						//For usleep
+#include <pthread.h>					//For the background writer thread
+#include <semaphore.h>					//To wake the writer thread without a lock
+#include "MTrandom.h"					//For the random number streams of the chains
+#include "Date_And_Reading_Reports.h"	//For the case and parameter structures
+#include "Likelihood.h"					//For the likelihood cache of the chains
+#include "Incidence.h"					//Needed by Gibbs_Sampler.h
+#include "Gibbs_Sampler.h"				//For the chains
+#include "Trace.h"						//For structures and declarations of functions needed in this file
+#include "Profile.h"						//For timing phases of the run
+#include "Memory.h"							//For memory accounting
+#include "Log.h"							//For progress
+
+//The columns of up to chunk_samples samples, as filled in by the sampler
+struct trace_chunk
+{
+	int num_samples;
+	long first_sweep;
+	long last_sweep;
+	int *sweep;					//sweep[s] - first_sweep
+	double *values;				//values[value * chunk_samples + s]
+	int *case_values;			//case_values[(case * NUM_TRACE_CASE_FIELDS + field) * chunk_samples + s]
+};
+
+//Single producer, single consumer: only the producer moves head and only the consumer moves tail
+struct chunk_ring
+{
+	struct trace_chunk *slot[TRACE_QUEUE_CHUNKS];
+	unsigned long head;
+	unsigned long tail;
+};
+
+struct trace_writer
+{
+	char file_name[200];
+	FILE *output;
+	int num_cases;
+	int chunk_samples;
+	pthread_t thread;
+	sem_t ready;				//Posted once for every chunk queued, and once on shutdown
+	int shutdown;
+	struct chunk_ring full;		//Sampler -> writer thread
+	struct chunk_ring empty;	//Writer thread -> sampler, so chunks are reused
+	struct trace_chunk *current;	//Being filled by the sampler
+	long dropped;				//Samples lost because the queue was full (sampler's count)
+
+	//Used by the writer thread alone
+	unsigned char *encoded;
+	struct trace_index_entry *index;
+	long num_chunks;
+	long index_size;
+	long num_samples;
+	long offset;
+};
+
+/*-------------------------------
+| compression of columns		|
+-------------------------------*/
+
+static size_t put_varint(unsigned char *out, unsigned long value)
+{
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		out[n++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	out[n++] = (unsigned char)value;
+	return n;
+}
+
+//Differences from the previous entry as zigzag varints. A difference of zero is followed by the
+//number of further zeros, so a date that does not move costs two bytes per chunk.
+size_t encode_counts(unsigned char *out, const int *column, int length)
+{
+	size_t n = 0;
+	long previous = 0, difference;
+	int s, run;
+
+	for (s = 0; s < length; s++) {
+		difference = (long)column[s] - previous;
+		previous = column[s];
+		n += put_varint(out + n, (unsigned long)((difference << 1) ^ (difference >> 63)));
+		if (difference == 0) {
+			for (run = 0; s + 1 < length && column[s + 1] == previous; run++) s++;
+			n += put_varint(out + n, run);
+		}
+	}
+	return n;
+}
+
+//XOR with the previous entry. Each entry is one byte holding how many of the 8 bytes are zero at
+//the top and at the bottom (0 for a run of unchanged entries, followed by its length), then the
+//bytes in between.
+size_t encode_doubles(unsigned char *out, const double *column, int length)
+{
+	size_t n = 0;
+	unsigned long long previous = 0, bits, x;
+	int s, run, lead, trail, b;
+
+	for (s = 0; s < length; s++) {
+		memcpy(&bits, &column[s], sizeof(bits));
+		x = bits ^ previous;
+		previous = bits;
+		if (x == 0) {
+			for (run = 0; s + 1 < length && memcmp(&column[s + 1], &column[s], sizeof(double)) == 0; run++) s++;
+			out[n++] = 0;
+			n += put_varint(out + n, run);
+			continue;
+		}
+		for (lead = 0; lead < 7 && !((x >> (8 * (7 - lead))) & 0xff); lead++);
+		for (trail = 0; trail < 7 - lead && !((x >> (8 * trail)) & 0xff); trail++);
+		out[n++] = (unsigned char)(1 + 8 * lead + trail);
+		for (b = trail; b < 8 - lead; b++) out[n++] = (unsigned char)(x >> (8 * b));
+	}
+	return n;
+}
+
+/*-------------------------------
+| the lock-free rings			|
+-------------------------------*/
+
+static int ring_push(struct chunk_ring *ring, struct trace_chunk *chunk)
+{
+	unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_QUEUE_CHUNKS) return 0;
+	ring->slot[head % TRACE_QUEUE_CHUNKS] = chunk;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static struct trace_chunk *ring_pop(struct chunk_ring *ring)
+{
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	struct trace_chunk *chunk;
+
+	if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) return NULL;
+	chunk = ring->slot[tail % TRACE_QUEUE_CHUNKS];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return chunk;
+}
+
+static struct trace_chunk *new_chunk(struct trace_writer *writer)
+{
+	struct trace_chunk *chunk;
+
+	chunk = (struct trace_chunk*)mem_calloc(MEM_IO, 1, sizeof(struct trace_chunk));
+	if (chunk) {
+		chunk->sweep = (int*)mem_malloc(MEM_IO, writer->chunk_samples * sizeof(int));
+		chunk->values = (double*)mem_malloc(MEM_IO, NUM_TRACE_VALUES * writer->chunk_samples * sizeof(double));
+		chunk->case_values = (int*)mem_malloc(MEM_IO, (size_t)writer->num_cases * NUM_TRACE_CASE_FIELDS * writer->chunk_samples * sizeof(int));
+	}
+	if (!chunk || !chunk->sweep || !chunk->values || !chunk->case_values) {
+		printf("Could not allocate chunk in record_trace_sample.\n");
+		exit(1);
+	}
+	return chunk;
+}
+
+static void free_chunk(struct trace_chunk *chunk)
+{
+	mem_free(chunk->sweep);
+	mem_free(chunk->values);
+	mem_free(chunk->case_values);
+	mem_free(chunk);
+}
+
+/*-------------------------------
+| the writer thread				|
+-------------------------------*/
+
+static void write_chunk(struct trace_writer *writer, struct trace_chunk *chunk)
+{
+	struct trace_chunk_header header;
+	size_t n = 0;
+	int k, length = chunk->num_samples, columns = writer->num_cases * NUM_TRACE_CASE_FIELDS;
+	unsigned long long ticks = profile_start();
+
+	n += encode_counts(writer->encoded + n, chunk->sweep, length);
+	for (k = 0; k < NUM_TRACE_VALUES; k++)
+		n += encode_doubles(writer->encoded + n, chunk->values + k * writer->chunk_samples, length);
+	for (k = 0; k < columns; k++)
+		n += encode_counts(writer->encoded + n, chunk->case_values + (size_t)k * writer->chunk_samples, length);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_CHUNK_MAGIC, 4);
+	header.num_samples = length;
+	header.first_sweep = chunk->first_sweep;
+	header.last_sweep = chunk->last_sweep;
+	header.encoded_size = n;
+	if (fwrite(&header, sizeof(header), 1, writer->output) != 1 || fwrite(writer->encoded, 1, n, writer->output) != n) {
+		printf("Could not write to trace %s.\n", writer->file_name);
+		exit(1);
+	}
+	profile_stop(PROF_TRACE_IO, ticks);
+	profile_count(PROF_BYTES_WRITTEN, (long)(sizeof(header) + n));
+
+	if (writer->num_chunks == writer->index_size) {
+		writer->index_size = writer->index_size ? 2 * writer->index_size : 256;
+		writer->index = (struct trace_index_entry*)mem_realloc(MEM_IO, writer->index, writer->index_size * sizeof(struct trace_index_entry));
+		if (!writer->index) { printf("Could not grow index in write_chunk.\n"); exit(1); }
+	}
+	writer->index[writer->num_chunks].offset = writer->offset;
+	writer->index[writer->num_chunks].first_sample = writer->num_samples;
+	writer->index[writer->num_chunks].first_sweep = chunk->first_sweep;
+	writer->index[writer->num_chunks].last_sweep = chunk->last_sweep;
+	writer->index[writer->num_chunks].num_samples = length;
+	writer->num_chunks++;
+	writer->num_samples += length;
+	writer->offset += sizeof(header) + n;
+}
+
+static void *writer_main(void *arg)
+{
+	struct trace_writer *writer = (struct trace_writer*)arg;
+	struct trace_chunk *chunk;
+
+	for (;;) {
+		while (sem_wait(&writer->ready) != 0);		//Retry if interrupted by a signal
+		chunk = ring_pop(&writer->full);
+		if (chunk == NULL) {
+			if (__atomic_load_n(&writer->shutdown, __ATOMIC_ACQUIRE)) break;
+			continue;
+		}
+		write_chunk(writer, chunk);
+		chunk->num_samples = 0;
+		if (!ring_push(&writer->empty, chunk)) free_chunk(chunk);
+	}
+	return NULL;
+}
+
+/*-------------------------------
+| used by the sampler			|
+-------------------------------*/
+
+struct trace_writer *open_trace_writer(const char *file_name, int num_cases, long interval)
+{
+	struct trace_writer *writer;
+	struct trace_file_header header;
+	const char *value_names[NUM_TRACE_VALUES] = { "log_lik", "log_prior", "beta0", "beta1", "beta2", "beta3",
+		"dur_mean0", "dur_mean1", "dur_mean2", "dur_mean3", "dur_size0", "dur_size1", "dur_size2", "dur_size3",
+		"p_diag", "p_survive", "unobserved" };
+	size_t sample_bytes, most_encoded;
+	int k;
+
+	writer = (struct trace_writer*)mem_calloc(MEM_IO, 1, sizeof(struct trace_writer));
+	if (!writer) { printf("Could not allocate writer in open_trace_writer.\n"); exit(1); }
+	strncpy(writer->file_name, file_name, sizeof(writer->file_name) - 1);
+	writer->num_cases = num_cases;
+	sample_bytes = sizeof(int) + NUM_TRACE_VALUES * sizeof(double) + (size_t)num_cases * NUM_TRACE_CASE_FIELDS * sizeof(int);
+	writer->chunk_samples = TRACE_CHUNK_BYTES / sample_bytes;
+	if (writer->chunk_samples > TRACE_MAX_CHUNK_SAMPLES) writer->chunk_samples = TRACE_MAX_CHUNK_SAMPLES;
+	if (writer->chunk_samples < 1) writer->chunk_samples = 1;
+
+	//At worst a varint takes 10 bytes, and a double 9 - plus a run length for a single entry
+	most_encoded = (size_t)writer->chunk_samples * (10 + 9 * NUM_TRACE_VALUES + 10 * num_cases * NUM_TRACE_CASE_FIELDS) + 16;
+	writer->encoded = (unsigned char*)mem_malloc(MEM_IO, most_encoded);
+	if (!writer->encoded) { printf("Could not allocate encoded in open_trace_writer.\n"); exit(1); }
+
+	writer->output = fopen(file_name, "wb");
+	if (writer->output == NULL) { printf("Trace file %s could not be opened.\n", file_name); exit(1); }
+	setvbuf(writer->output, NULL, _IOFBF, 1 << 20);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 8);
+	header.version = TRACE_VERSION;
+	header.num_cases = num_cases;
+	header.num_values = NUM_TRACE_VALUES;
+	header.num_case_fields = NUM_TRACE_CASE_FIELDS;
+	header.chunk_samples = writer->chunk_samples;
+	header.interval = interval;
+	for (k = 0; k < NUM_TRACE_VALUES; k++) strncpy(header.value_names[k], value_names[k], 15);
+	if (fwrite(&header, sizeof(header), 1, writer->output) != 1) { printf("Could not write to trace %s.\n", file_name); exit(1); }
+	writer->offset = sizeof(header);
+
+	sem_init(&writer->ready, 0, 0);
+	if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0) {
+		printf("Could not start the trace writer thread.\n");
+		exit(1);
+	}
+	return writer;
+}
+
+//Hands a full chunk to the writer thread, or drops it if the disk is too far behind
+static void queue_chunk(struct trace_writer *writer)
+{
+	if (ring_push(&writer->full, writer->current)) sem_post(&writer->ready);
+	else {
+		writer->dropped += writer->current->num_samples;
+		writer->current->num_samples = 0;
+		return;						//Keep the chunk and fill it again
+	}
+	writer->current = NULL;
+}
+
+//Copies the state of chain into the chunk being filled. Called from the sampler's thread only.
+void record_trace_sample(struct trace_writer *writer, long sweep, struct chain_state *chain)
+{
+	struct trace_chunk *chunk;
+	struct parameter_list *p = &chain->params;
+	p_patient current;
+	int i, k, s, stride;
+	int *column;
+
+	if (writer->current == NULL) {
+		writer->current = ring_pop(&writer->empty);
+		if (writer->current == NULL) writer->current = new_chunk(writer);
+	}
+	chunk = writer->current;
+	s = chunk->num_samples;
+	stride = writer->chunk_samples;
+	if (s == 0) chunk->first_sweep = sweep;
+	chunk->last_sweep = sweep;
+	chunk->sweep[s] = (int)(sweep - chunk->first_sweep);
+
+	chunk->values[TRACE_LOG_LIK * stride + s] = chain->log_lik;
+	chunk->values[TRACE_LOG_PRIOR * stride + s] = chain->log_prior;
+	for (k = 0; k < 4; k++) {
+		chunk->values[(TRACE_BETA + k) * stride + s] = p->beta[k];
+		chunk->values[(TRACE_DUR_MEAN + k) * stride + s] = p->dur_mean[k];
+		chunk->values[(TRACE_DUR_SIZE + k) * stride + s] = p->dur_size[k];
+	}
+	chunk->values[TRACE_P_DIAG * stride + s] = p->p_diag;
+	chunk->values[TRACE_P_SURVIVE * stride + s] = p->p_survive;
+	chunk->values[TRACE_UNOBSERVED * stride + s] = chain->num_cases - chain->num_observed;
+
+	for (i = 0; i < writer->num_cases; i++) {
+		current = &chain->cases[i];
+		column = chunk->case_values + (size_t)i * NUM_TRACE_CASE_FIELDS * stride + s;
+		for (k = 0; k < 4; k++) column[(TRACE_DATES + k) * stride] = current->dates[k];
+		if (current->parent_case == NULL) column[TRACE_PARENT * stride] = -1;
+		else if (current->parent_case->index >= chain->num_observed) column[TRACE_PARENT * stride] = -2;
+		else column[TRACE_PARENT * stride] = current->parent_case->index;
+		column[TRACE_TYPE * stride] = current->transmission_type;
+		column[TRACE_SURVIVE * stride] = current->survive;
+	}
+
+	chunk->num_samples++;
+	if (chunk->num_samples == writer->chunk_samples) queue_chunk(writer);
+}
+
+//Queues the last chunk, waits for everything to be written, then adds the index and closes the file
+void close_trace_writer(struct trace_writer *writer)
+{
+	struct trace_trailer trailer;
+	struct trace_chunk *chunk;
+
+	if (writer->current && writer->current->num_samples > 0) {
+		while (!ring_push(&writer->full, writer->current)) usleep(1000);	//The sampler has finished, so waiting is fine
+		sem_post(&writer->ready);
+		writer->current = NULL;
+	}
+	__atomic_store_n(&writer->shutdown, 1, __ATOMIC_RELEASE);
+	sem_post(&writer->ready);
+	pthread_join(writer->thread, NULL);
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.index_offset = writer->offset;
+	trailer.num_chunks = writer->num_chunks;
+	trailer.num_samples = writer->num_samples;
+	memcpy(trailer.magic, TRACE_INDEX_MAGIC, 8);
+	if ((writer->num_chunks > 0 && fwrite(writer->index, sizeof(struct trace_index_entry), writer->num_chunks, writer->output) != (size_t)writer->num_chunks)
+		|| fwrite(&trailer, sizeof(trailer), 1, writer->output) != 1 || fclose(writer->output) != 0) {
+		printf("Could not finish trace %s.\n", writer->file_name);
+		exit(1);
+	}
+	log_info(LOG_SAMPLER, "Wrote %ld samples to %s (%.1f kB, %ld dropped while the disk was busy).", writer->num_samples,
+		writer->file_name, (writer->offset + writer->num_chunks * sizeof(struct trace_index_entry) + sizeof(trailer)) / 1024.0,
+		writer->dropped);
+
+	if (writer->current) free_chunk(writer->current);
+	while ((chunk = ring_pop(&writer->empty)) != NULL) free_chunk(chunk);
+	sem_destroy(&writer->ready);
+	mem_free(writer->encoded);
+	mem_free(writer->index);
+	mem_free(writer);
+}
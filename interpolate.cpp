@@ -1,6 +1,9 @@
 #include<stdio.h>
 #include<math.h>
 #include<stdlib.h>
+#include "Memory.h"
+
+#define POLY_SCRATCH 16  //Points the scratch arrays below hold on the stack - lfunc2 uses DEG+1 = 3, a million times
 
 void polint(double *xa, double *ya, int n, double x, double *y, double *dy)
 //Given arrays xa[1..n] and ya[1..n], and given a value x, this routine returns a value y, and
@@ -10,12 +13,18 @@ void polint(double *xa, double *ya, int n, double x, double *y, double *dy)
   int i,m,ns=1;
   double den,dif,dift,ho,hp,w;
   double *c,*d;
+  double c_stack[POLY_SCRATCH],d_stack[POLY_SCRATCH];
 
   dif=fabs(x-xa[1]);
-  c=(double*)malloc(n*sizeof(double))-1;
-  if(!c){printf("Could not allocate c in polint.\n");exit(1);}
-  d=(double*)malloc(n*sizeof(double))-1;
-  if(!d){printf("Could not allocate d in polint.\n");exit(1);}
+  if(n<=POLY_SCRATCH){
+    c=c_stack-1;
+    d=d_stack-1;
+  }else{
+    c=(double*)mem_malloc(MEM_LFUNC, n*sizeof(double))-1;
+    if(!c){printf("Could not allocate c in polint.\n");exit(1);}
+    d=(double*)mem_malloc(MEM_LFUNC, n*sizeof(double))-1;
+    if(!d){printf("Could not allocate d in polint.\n");exit(1);}
+  }
   for (i=1;i<=n;i++) { //Here we find the index ns of the closest table entry,
     if ( (dift=fabs(x-xa[i])) < dif) {
       ns=i;
@@ -44,8 +53,10 @@ void polint(double *xa, double *ya, int n, double x, double *y, double *dy)
 //where we are. This route keeps the partial approximations centered (insofar as possible)
 //on the target x. The last dy added is thus the error indication.
   }
-  free(d+1);
-  free(c+1);
+  if(n>POLY_SCRATCH){
+    mem_free(d+1);
+    mem_free(c+1);
+  }
 }
 
 
@@ -56,11 +67,17 @@ void polcof(double *xa, double *ya, int n, double *cof)
   void polint(double *xa, double *ya, int n, double x, double *y, double *dy);
   int k,j,i;
   double xmin,dy,*x,*y;
+  double x_stack[POLY_SCRATCH],y_stack[POLY_SCRATCH];
 
-  x=(double*)malloc((n+1)*sizeof(double));
-  if(!x){printf("Could not allocate x in polcof.\n");exit(1);}
-  y=(double*)malloc((n+1)*sizeof(double));
-  if(!y){printf("Could not allocate y in polcof.\n");exit(1);}
+  if(n+1<=POLY_SCRATCH){
+    x=x_stack;
+    y=y_stack;
+  }else{
+    x=(double*)mem_malloc(MEM_LFUNC, (n+1)*sizeof(double));
+    if(!x){printf("Could not allocate x in polcof.\n");exit(1);}
+    y=(double*)mem_malloc(MEM_LFUNC, (n+1)*sizeof(double));
+    if(!y){printf("Could not allocate y in polcof.\n");exit(1);}
+  }
 
   for (j=0;j<=n;j++) {
     x[j]=xa[j];
@@ -84,6 +101,8 @@ void polcof(double *xa, double *ya, int n, double *cof)
       x[i-1]=x[i];
     }
   }
-  free(y);
-  free(x);
+  if(n+1>POLY_SCRATCH){
+    mem_free(y);
+    mem_free(x);
+  }
 }
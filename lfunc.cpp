@@ -1,12 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include "Profile.h"
+#include "Memory.h"
 
 
 #define NUMPANELS 1000000
 #define DEG 2
 
 double **cof;
+static pthread_mutex_t cof_lock = PTHREAD_MUTEX_INITIALIZER;
+static int cof_users;  //Model contexts sharing the table - it is built for the first and freed after the last
 void polint(double *xa, double *ya, int n, double x, double *y, double *dy);
 void polcof(double *xa, double *ya, int n, double *cof);
 
@@ -25,14 +30,19 @@ void initlfunc2()
   int i,j;
   double xa[DEG+1],ya[DEG+1];
   double a,b;
+  unsigned long long ticks;
 
-  //Initialise coeff for lfunc2
-  cof=(double**)malloc((NUMPANELS+1)*sizeof(double*));
+  pthread_mutex_lock(&cof_lock);
+  if(cof_users++>0){pthread_mutex_unlock(&cof_lock);return;}
+  ticks = profile_start();
+
+  //Initialise coeff for lfunc2 - the rows share one block, rather than a million of their own
+  cof=(double**)mem_malloc(MEM_LFUNC, (NUMPANELS+1)*sizeof(double*));
   if(!cof){printf("Could not allocate cof in main.\n");exit(1);}
-  for(j=0;j<=NUMPANELS;j++){
-    cof[j]=(double*)malloc((DEG+1)*sizeof(double));
-    if(!cof[j]){printf("Could not allocate cof in main.\n");exit(1);}
-  }
+  cof[0]=(double*)mem_malloc(MEM_LFUNC, (NUMPANELS+1)*(DEG+1)*sizeof(double));
+  if(!cof[0]){printf("Could not allocate cof in main.\n");exit(1);}
+  for(j=1;j<=NUMPANELS;j++)
+    cof[j]=cof[0]+j*(DEG+1);
 
   for(j=0;j<NUMPANELS;j++){
     a=1.0*j/NUMPANELS;
@@ -49,6 +59,8 @@ void initlfunc2()
   cof[NUMPANELS][0]=log(2.0);
   for(i=1;i<=DEG;i++)
     cof[NUMPANELS][i]=0.0;
+  profile_stop(PROF_LFUNC_TABLE, ticks);
+  pthread_mutex_unlock(&cof_lock);
 }
 
 
@@ -70,11 +82,13 @@ double lfunc2(double x)
 
 void cleanuplfunc2()
 {
-  int j;
-
-  for(j=0;j<=NUMPANELS;j++)
-    free(cof[j]);
-  free(cof);
+  pthread_mutex_lock(&cof_lock);
+  if(--cof_users==0){
+    mem_free(cof[0]);
+    mem_free(cof);
+    cof=NULL;
+  }
+  pthread_mutex_unlock(&cof_lock);
 }
 
 